@@ -115,6 +115,10 @@ ${MOCK} -v --root=$build_target --resultdir=$results \
     --shell "nosetests -v /matahari-tests/test_resource_api.py"
 check_result $? ${results} "Linux" "Resources API tests"
 
+${MOCK} -v --root=$build_target --resultdir=$results \
+    --shell "nosetests -v /matahari-tests/test_resource_systemd_api.py"
+check_result $? ${results} "Linux" "Resources systemd backend tests"
+
 ${MOCK} -v --root=$build_target --resultdir=$results \
     --shell "nosetests -v /matahari-tests/test_service_api_minimal.py"
 check_result $? ${results} "Linux" "Services API tests"
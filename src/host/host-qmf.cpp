@@ -47,9 +47,8 @@ public:
     /**
      * Send a heartbeat and reset the timer.
      *
-     * This function should be called a single time after the HostAgent
-     * is created.  From then on it will automatically reschedule itself
-     * to be called.
+     * This function is called a single time, at the end of setup().
+     * From then on it will automatically reschedule itself to be called.
      *
      * \param[in] data a pointer to the HostAgent
      *
@@ -97,8 +96,7 @@ main(int argc, char **argv)
     HostAgent *agent = new HostAgent();
     int rc = agent->init(argc, argv, "host");
     if (rc == 0) {
-        HostAgent::heartbeat_timer(agent);
-        agent->run();
+        rc = agent->run();
     }
 
     return rc;
@@ -221,6 +219,9 @@ HostAgent::setup(qmf::AgentSession session)
     _instance.setProperty("cpu_flags", mh_host_get_cpu_flags());
 
     session.addData(_instance, HOST_NAME);
+
+    /* The broker has answered, there is something to report now */
+    heartbeat_timer(this);
     return 0;
 }
 
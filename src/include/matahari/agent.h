@@ -57,10 +57,21 @@ using namespace std;
 
 namespace _qtype = ::qpid::types;
 
+struct qmf_notifier_s;
+
+/* Batch sizes are counted in buckets of 1, 2-3, 4-7, ... events */
+#define MAINLOOP_QMF_BATCH_BUCKETS 8
+
 typedef struct mainloop_qmf_s {
         GSource source;
         qmf::AgentSession session;
         qmf::AgentEvent event;
+        /* Thread waiting for events on our behalf, NULL when polling */
+        struct qmf_notifier_s *notifier;
+        /* Events handled per dispatch, see mainloop_qmf_set_batch() */
+        guint batch_max;
+        guint batch_budget_ms;
+        guint64 batches[MAINLOOP_QMF_BATCH_BUCKETS];
         guint id;
         void *user_data;
         GDestroyNotify dnotify;
@@ -88,10 +99,37 @@ qpid::types::Variant::Map
 mh_parse_options(const char *proc_name, int argc, char **argv,
                  qpid::types::Variant::Map &options);
 
+/**
+ * Connect to a broker, waiting until one answers.
+ *
+ * This runs the main loop until mh_connect_async() is done, so it is only
+ * meant for the consoles; agents don't block, see MatahariAgent::init().
+ */
 qpid::messaging::Connection
 mh_connect(qpid::types::Variant::Map mh_options,
            qpid::types::Variant::Map amqp_options, int retry);
 
+/**
+ * Connect to a broker without blocking the main loop.
+ *
+ * The candidate brokers (from DNS SRV, --broker or localhost) are raced
+ * a little apart from each other and the first to answer is kept.  When
+ * none answers, another round is made after a randomized, growing delay.
+ *
+ * \param[in] mh_options   matahari options, as from mh_parse_options()
+ * \param[in] amqp_options connection options, as from mh_parse_options()
+ * \param[in] retry        keep trying until a broker answers
+ * \param[in] callback     called from the main loop with the connection,
+ *                         or NULL if retry is not set and no broker answered
+ * \param[in] user_data    passed to the callback
+ */
+void
+mh_connect_async(qpid::types::Variant::Map mh_options,
+                 qpid::types::Variant::Map amqp_options, int retry,
+                 void (*callback)(qpid::messaging::Connection *connection,
+                                  gpointer user_data),
+                 gpointer user_data);
+
 mainloop_qmf_t *
 mainloop_add_qmf(int priority, qmf::AgentSession session,
                  gboolean (*dispatch)(qmf::AgentSession session,
@@ -102,6 +140,21 @@ mainloop_add_qmf(int priority, qmf::AgentSession session,
 gboolean
 mainloop_destroy_qmf(mainloop_qmf_t *source);
 
+/**
+ * Limit how many QMF events are handled in one main loop pass.
+ *
+ * Events already waiting are handled together rather than one per pass,
+ * until either limit is reached.  How many were handled each time is
+ * counted in source->batches.
+ *
+ * \param[in] source    the QMF source
+ * \param[in] max       events handled at most, 1 for one per pass
+ * \param[in] budget_ms time after which the rest are left for the next
+ *                      pass, so that other sources get their turn
+ */
+void
+mainloop_qmf_set_batch(mainloop_qmf_t *source, guint max, guint budget_ms);
+
 struct MatahariAgentImpl;
 
 class MatahariAgent
@@ -113,12 +166,61 @@ public:
     virtual int setup(qmf::AgentSession session) { return 0; };
     virtual gboolean invoke(qmf::AgentSession session, qmf::AgentEvent event,
                             gpointer user_data) { return FALSE; };
+
+    /**
+     * Handle a method marked with setOffloadable().
+     *
+     * This usually runs in a worker thread, so it must not touch anything
+     * the main loop uses.  Return arguments are added to the event, the
+     * reply is sent from the main loop once this returns.
+     *
+     * \param[in] event the method call
+     *
+     * \retval MH_RES_SUCCESS the method succeeded
+     * \retval other          the error to raise as an exception
+     */
+    virtual enum mh_result offload(qmf::AgentEvent event) {
+        return MH_RES_NOT_IMPLEMENTED;
+    };
+
+    /**
+     * Parse the options and start looking for a broker.
+     *
+     * This does not wait for the broker: the QMF session is opened and
+     * setup() called from the main loop once one answers.
+     *
+     * \param[in] argc      argument count, as passed to main()
+     * \param[in] argv      arguments, as passed to main()
+     * \param[in] proc_name name of the agent
+     *
+     * \retval 0 always, failures are reported by run()
+     */
     int init(int argc, char **argv, const char* proc_name);
-    void run();
+
+    /**
+     * Run the main loop.
+     *
+     * \retval  0 the main loop was stopped
+     * \retval -1 no broker could be used, or setup() failed
+     */
+    int run();
 
 protected:
     qmf::AgentSession& getSession(void);
 
+    /**
+     * Run a method through offload() in a worker thread.
+     *
+     * For methods that may block for a while, so that they don't hold up
+     * everything else the agent does.  The --offload option overrides
+     * the limit.
+     *
+     * \param[in] method name of the method
+     * \param[in] limit  calls of it that may run at once, 0 to run it in
+     *                   the main loop after all
+     */
+    void setOffloadable(const std::string &method, unsigned int limit = 1);
+
 private:
     // Disallow default copy constructor/assignment
     MatahariAgent(const MatahariAgent&);
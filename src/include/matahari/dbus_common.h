@@ -79,6 +79,13 @@ gboolean
 matahari_set(Matahari *matahari, const char *interface, const char *name,
              GValue *value, DBusGMethodInvocation *context);
 
+/**
+ * Report the time spent dispatching each main loop source, once authorized
+ * for PolicyKit action org.matahariproject.Mainloop.DispatchStats
+ */
+gboolean
+matahari_dispatch_stats(Matahari *matahari, DBusGMethodInvocation *context);
+
 /**
  * This method is used for getting value of DBus property.
  * It must be implemented in each module.
@@ -32,9 +32,30 @@
 
 struct mh_dnssrv_record;
 
+/**
+ * Counters of the SRV answer cache, see mh_dnssrv_cache_get_stats()
+ */
+struct mh_dnssrv_cache_stats {
+    /** Lookups answered from a live cache entry */
+    uint64_t hits;
+    /** Lookups answered from an expired entry while it was refreshed */
+    uint64_t stale_hits;
+    /** Lookups that had to wait for the resolver */
+    uint64_t misses;
+    /** Background refreshes of expired entries */
+    uint64_t refreshes;
+    /** Resolver queries, in the foreground or not, that found nothing */
+    uint64_t failures;
+};
+
 /**
  * Perform a DNS SRV lookup.
  *
+ * Answers are cached for as long as their TTL says, in memory and in
+ * the file set with mh_dnssrv_cache_set_file().  Once expired, an answer
+ * is still returned while a fresh one is looked up from the main loop,
+ * so that restarts and reconnects don't have to wait on the resolver.
+ *
  * \param[in] query srv record query i.e. "_matahari._tcp.matahariproject.org
  *
  * \return a sorted list of records (mh_dnssrv_record).  This list must be freed
@@ -43,6 +64,24 @@ struct mh_dnssrv_record;
 GList *
 mh_dnssrv_lookup(const char *query) G_GNUC_WARN_UNUSED_RESULT;
 
+/**
+ * Perform a DNS SRV lookup without blocking.
+ *
+ * Same as mh_dnssrv_lookup(), except that a lookup the cache can't answer
+ * is sent to the nameservers from the main loop, which must be running.
+ * Nameservers are tried in turn, several times, as resolv.conf says.
+ *
+ * \param[in] query     srv record query i.e. "_matahari._tcp.matahariproject.org
+ * \param[in] callback  called from the main loop, always after this returns,
+ *                      with a sorted list of records, or NULL if there are
+ *                      none.  The list must be freed as for mh_dnssrv_lookup().
+ * \param[in] user_data passed to the callback
+ */
+void
+mh_dnssrv_lookup_async(const char *query,
+                       void (*callback)(GList *records, gpointer user_data),
+                       gpointer user_data);
+
 /**
  * Do a DNS SRV lookup and get a single result.
  *
@@ -60,6 +99,26 @@ mh_dnssrv_lookup(const char *query) G_GNUC_WARN_UNUSED_RESULT;
 int
 mh_dnssrv_lookup_single(const char *query, char *host, size_t host_len, uint16_t *port);
 
+/**
+ * Set the file SRV answers are kept in across restarts.
+ *
+ * Answers found in the file are used straight away, and refreshed if
+ * they have expired.  It defaults to
+ * /var/lib/matahari/dnssrv.cache on Linux, and to none on Windows.
+ *
+ * \param[in] path the cache file, or NULL to only cache in memory
+ */
+void
+mh_dnssrv_cache_set_file(const char *path);
+
+/**
+ * Get the counters of the SRV answer cache.
+ *
+ * \param[out] stats the counters since the process started
+ */
+void
+mh_dnssrv_cache_get_stats(struct mh_dnssrv_cache_stats *stats);
+
 /**
  * Get the hostname in an SRV record
  *
@@ -57,4 +57,34 @@ mh_dnssrv_add_record(GList *records, const char *host, uint16_t port,
 GList *
 mh_dnssrv_records_sort(GList *records) G_GNUC_WARN_UNUSED_RESULT;
 
+/**
+ * Send asynchronous SRV queries to these nameservers, not resolv.conf's.
+ *
+ * \param[in] servers comma separated IPv4 addresses, with an optional
+ *                    :port each, or NULL to go back to resolv.conf
+ *
+ * \retval 0 success
+ * \retval -1 an address could not be parsed, or this isn't supported
+ */
+int
+mh_dnssrv_set_nameservers(const char *servers);
+
+/**
+ * Put an answer in the SRV cache, as if the resolver had returned it.
+ *
+ * \param[in] query   the query answered
+ * \param[in] records the answer, which the cache takes ownership of
+ * \param[in] ttl     time to live of the answer, in seconds
+ */
+void
+mh_dnssrv_cache_add(const char *query, GList *records, uint32_t ttl);
+
+/**
+ * Forget the SRV answers cached in memory.
+ *
+ * The cache file is left alone, and read again on the next lookup.
+ */
+void
+mh_dnssrv_cache_flush(void);
+
 #endif /* __MH_DNSSRV_INTERNAL_H__ */
@@ -40,6 +40,7 @@
 #endif
 
 #include <stdio.h>
+#include <inttypes.h>
 #include <glib.h>
 #include "matahari/utilities.h"
 
@@ -56,6 +57,85 @@ mh_log_init(const char *ident, int level, gboolean to_stderr);
 void
 mh_enable_stderr(gboolean to_stderr);
 
+/**
+ * What to do with a message when the asynchronous log buffer is full
+ */
+enum mh_log_overflow {
+    /** Drop it, the number of messages dropped is logged later on */
+    MH_LOG_OVERFLOW_DROP,
+    /** Wait for the background thread to make room */
+    MH_LOG_OVERFLOW_BLOCK,
+};
+
+struct mh_log_stats {
+    /** Messages written out */
+    uint64_t written;
+    /** Messages dropped because the buffer was full */
+    uint64_t dropped;
+    /** Messages dropped by rate limiting */
+    uint64_t suppressed;
+};
+
+/**
+ * Write log messages out from a background thread
+ *
+ * From then on, messages are formatted on the caller's thread into a
+ * buffer, and a background thread writes them to syslog (or stderr) in
+ * batches, so that a slow syslog doesn't hold the caller up.  Processes
+ * forked afterwards go back to writing their messages out themselves.
+ *
+ * This is also enabled by mh_log_init() when MATAHARI_LOG_ASYNC is set to
+ * "drop" or "block".
+ *
+ * \note Linux only.
+ *
+ * \param[in] overflow what to do when the buffer is full
+ *
+ * \retval TRUE  messages are written asynchronously
+ * \retval FALSE they are still written synchronously
+ */
+gboolean
+mh_log_async_start(enum mh_log_overflow overflow);
+
+/**
+ * Write whatever is still buffered out and go back to synchronous logging
+ */
+void
+mh_log_async_stop(void);
+
+/**
+ * Wait until everything logged so far has been written out
+ *
+ * Gives up after a couple of seconds if the background thread is stuck.
+ */
+void
+mh_log_flush(void);
+
+/**
+ * Limit how many messages each call site logs
+ *
+ * A call site (a given format string, really) logging more than burst
+ * messages within interval_s seconds has the rest dropped, and their
+ * number logged once it logs again after the interval.  Critical messages
+ * are never dropped.
+ *
+ * This is also enabled by mh_log_init() when MATAHARI_LOG_RATE is set to
+ * "BURST/INTERVAL".
+ *
+ * \param[in] burst      messages allowed per interval, 0 for no limit
+ * \param[in] interval_s length of the interval, in seconds
+ */
+void
+mh_log_ratelimit(unsigned int burst, unsigned int interval_s);
+
+/**
+ * Get counts of messages written and dropped since the process started
+ *
+ * \param[out] stats the counters
+ */
+void
+mh_log_get_stats(struct mh_log_stats *stats);
+
 #if SUPPORT_TRACING
 
 /* Linux with trace logging */
@@ -27,6 +27,10 @@
 
 #include <glib.h>
 #include <sys/types.h>
+#ifdef __linux__
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
 
 gboolean
 mainloop_signal(int sig, void (*dispatch)(int sig));
@@ -81,7 +85,7 @@ typedef struct mainloop_child_s mainloop_child_t;
 struct mainloop_child_s {
     pid_t     pid;
     char     *desc;
-    unsigned  timerid;
+    unsigned  timerid;  /* unused, kept for binary compatibility */
     gboolean  timeout;
     void     *privatedata;
 
@@ -89,6 +93,18 @@ struct mainloop_child_s {
     void (*callback)(mainloop_child_t* p, int status, int signo, int exitcode);
 };
 
+/**
+ * Start reaping tracked children from the mainloop
+ *
+ * Where the kernel supports it, each child is watched with its own pidfd so
+ * that completion is noticed as soon as the process exits.  SIGCHLD is used
+ * as well, to reap children that were not added with mainloop_add_child().
+ *
+ * Children added before this is called are watched at G_PRIORITY_LOW, the
+ * priority of the output pipes of actions, until then.
+ *
+ * \param[in] priority priority of the child watch source
+ */
 void
 mainloop_track_children(int priority);
 
@@ -101,4 +117,85 @@ mainloop_add_child(pid_t pid, int timeout, const char *desc, void *privatedata,
                    void (*callback)(mainloop_child_t* p, int status, int signo,
                                     int exitcode));
 
+#ifdef __linux__
+/**
+ * Resources used by a tracked child
+ *
+ * \param[in] p the child, as passed to its callback
+ *
+ * \return what the process consumed, valid once it has been reaped
+ */
+const struct rusage *
+mainloop_child_rusage(mainloop_child_t *p);
+#endif
+
+/**
+ * Time spent dispatching one source
+ */
+typedef struct mainloop_dispatch_stats_s {
+    guint64 calls;      /**< times the source was dispatched */
+    guint64 total_us;   /**< time spent in all of them */
+    guint64 max_us;     /**< time spent in the longest */
+} mainloop_dispatch_stats_t;
+
+/**
+ * Start accounting for the time spent dispatching each source
+ *
+ * Sources created through mainloop_add_*() are timed from then on, and
+ * those that take too long are logged along with their name (as set with
+ * g_source_set_name(), glib 2.26 or later, otherwise their id).  A summary
+ * is logged on SIGUSR1.
+ *
+ * \param[in] slow_ms warn about dispatches taking at least this long,
+ *                    0 to only keep count
+ */
+void
+mainloop_dispatch_accounting(guint slow_ms);
+
+/**
+ * Note the time before dispatching a source
+ *
+ * For sources implemented outside of this API, paired with
+ * mainloop_dispatch_end().
+ *
+ * \return a start time, or 0 if accounting is off
+ */
+gint64
+mainloop_dispatch_begin(void);
+
+/**
+ * Account for a dispatch started with mainloop_dispatch_begin()
+ *
+ * \param[in] source  the source that was dispatched
+ * \param[in] started as returned by mainloop_dispatch_begin()
+ */
+void
+mainloop_dispatch_end(GSource *source, gint64 started);
+
+/**
+ * Drop what was accounted for a source, as it is finalized
+ *
+ * \param[in] source the source going away
+ */
+void
+mainloop_dispatch_forget(GSource *source);
+
+/**
+ * Go through the sources dispatched so far, most time consuming first
+ *
+ * \param[in] fn        called with the name and stats of each source
+ * \param[in] user_data passed to fn
+ */
+void
+mainloop_dispatch_foreach(void (*fn)(const char *name,
+                                     const mainloop_dispatch_stats_t *stats,
+                                     gpointer user_data),
+                          gpointer user_data);
+
+/**
+ * Log the time spent dispatching each source
+ */
+void
+mainloop_dispatch_dump(void);
+
 #endif
@@ -102,6 +102,20 @@ enum op_status {
     LRM_OP_ERROR
 };
 
+/** Resources consumed by an action */
+typedef struct svc_action_usage_s {
+    /** CPU time spent in user and kernel mode, in microseconds */
+    guint64 user_us;
+    guint64 system_us;
+    /** Peak resident set size, in kilobytes */
+    guint64 max_rss_kb;
+    /** Blocks read and written */
+    guint64 block_in;
+    guint64 block_out;
+    /** Time from request to completion, in milliseconds */
+    guint64 wall_ms;
+} svc_action_usage_t;
+
 typedef struct svc_action_private_s svc_action_private_t;
 typedef struct svc_action_s
 {
@@ -191,6 +205,75 @@ resources_list_agents(const char *standard, const char *provider);
 GList *
 resources_list_standards(void);
 
+/**
+ * Check whether a resource standard is supported
+ *
+ * Cheaper than searching the result of resources_list_standards().
+ *
+ * \param[in] standard the standard to check for (case insensitive)
+ *
+ * \retval TRUE  the standard is supported
+ * \retval FALSE unknown standard
+ */
+gboolean
+resources_standard_is_valid(const char *standard);
+
+/**
+ * Check whether a resource agent is installed
+ *
+ * Agent lists are cached and kept up to date with inotify where available,
+ * so this is normally a hash lookup rather than a directory scan.
+ *
+ * \param[in] standard the standard of the agent (such as "ocf")
+ * \param[in] provider the provider of the agent, only used for "ocf"
+ * \param[in] agent    the name of the agent
+ *
+ * \retval TRUE  the agent is installed
+ * \retval FALSE the agent (or its standard) is not known
+ */
+gboolean
+resources_agent_exists(const char *standard, const char *provider,
+                       const char *agent);
+
+/**
+ * Obtain the XML description of a resource agent
+ *
+ * OCF agents are asked with their meta-data action, LSB descriptions are
+ * built from the init script's INIT INFO header.  Results are cached in
+ * memory and on disk until the agent file changes, so \p callback may be
+ * called before this function returns.
+ *
+ * \param[in] standard  the standard of the agent ("ocf" or "lsb")
+ * \param[in] provider  the provider of the agent, only used for "ocf"
+ * \param[in] agent     the name of the agent
+ * \param[in] callback  called with the XML, or NULL if it could not be
+ *                      obtained
+ * \param[in] user_data passed to \p callback
+ *
+ * \retval TRUE  \p callback has been or will be called
+ * \retval FALSE unknown agent or standard, \p callback will not be called
+ */
+gboolean
+resources_agent_describe(const char *standard, const char *provider,
+                         const char *agent,
+                         void (*callback)(const char *xml, gpointer user_data),
+                         gpointer user_data);
+
+/**
+ * Fill the description cache in the background
+ *
+ * Every agent of the standard (and provider, for "ocf") is described with
+ * a few requests running at a time.  Without a provider, all OCF
+ * providers are included.
+ *
+ * \param[in] standard the standard of the agents
+ * \param[in] provider the provider of the agents, may be NULL
+ *
+ * \return the number of agents queued
+ */
+int
+resources_describe_all(const char *standard, const char *provider);
+
 svc_action_t *
 services_action_create(const char *name, const char *action,
                        int interval /* ms */, int timeout /* ms */);
@@ -229,12 +312,31 @@ mh_services_action_create_generic(const char *exec, const char *args[]);
 void
 services_action_free(svc_action_t *op);
 
+/**
+ * Get what running an action cost
+ *
+ * This is filled in on completion.  Only the wall clock time is known for
+ * actions that shared another action's result or were not run as a child
+ * process (systemd, Windows).
+ *
+ * \param[in] op the action
+ *
+ * \return the usage, owned by \p op
+ */
+const svc_action_usage_t *
+services_action_usage(svc_action_t *op);
+
 gboolean
 services_action_sync(svc_action_t *op);
 
 /**
  * Run an action asynchronously.
  *
+ * Non-mutating actions (status, monitor and meta-data) that are identical
+ * to one already in flight are not run again.  They join the running
+ * action and complete with its result.  See also
+ * services_action_set_reuse_window().
+ *
  * \param[in] op services action data
  * \param[in] action_callback callback for when the action completes
  *
@@ -244,9 +346,279 @@ services_action_sync(svc_action_t *op);
 gboolean
 services_action_async(svc_action_t *op, void (*action_callback)(svc_action_t *));
 
+/**
+ * Cancel a recurring action
+ *
+ * An action waiting for its next run is freed straight away, a running
+ * one once it completes (its callback is called one last time).
+ *
+ * \param[in] name     the resource name of the action
+ * \param[in] action   the action
+ * \param[in] interval the interval of the action, in milliseconds
+ *
+ * \retval TRUE  the action has been cancelled
+ * \retval FALSE no such recurring action
+ */
 gboolean
 services_action_cancel(const char *name, const char *action, int interval);
 
+/**
+ * Cancel a group of recurring actions
+ *
+ * At least one of rsc and agent must be given; every recurring action on
+ * the node is too much to cancel by mistake.
+ *
+ * \param[in] rsc   only cancel actions of this resource, may be NULL
+ * \param[in] agent only cancel actions of this agent, as
+ *                  "standard:provider:agent" or "standard:agent",
+ *                  may be NULL
+ *
+ * \return the number of actions cancelled, -1 if neither rsc nor agent
+ *         was given
+ */
+int
+services_action_cancel_all(const char *rsc, const char *agent);
+
+/**
+ * Get the recurring actions
+ *
+ * \param[in] rsc   only include actions of this resource, may be NULL
+ * \param[in] agent only include actions of this agent, see
+ *                  services_action_cancel_all(), may be NULL
+ *
+ * \return a list of svc_action_t *, which remain owned by the library.
+ *         This list _must_ be destroyed using g_list_free(list).
+ */
+GList *
+services_recurring_list(const char *rsc, const char *agent);
+
+typedef struct svc_batch_s svc_batch_t;
+
+/** The outcome of one action of a batch */
+typedef struct svc_batch_result_s {
+    int     rc;
+    /** See enum op_status, LRM_OP_PENDING if running at the deadline */
+    int     status;
+    int     sequence;
+    /** Time from request to completion, in milliseconds */
+    guint64 duration;
+} svc_batch_result_t;
+
+/**
+ * Create a batch of actions
+ *
+ * \param[in] parallel    how many actions may run at once, 0 for the default
+ * \param[in] deadline_ms report after this long even if actions are still
+ *                        running, 0 for no deadline
+ *
+ * \return a new batch, see services_batch_run()
+ */
+svc_batch_t *
+services_batch_new(int parallel, int deadline_ms);
+
+/**
+ * Add an action to a batch
+ *
+ * Recurring actions are run once.  The action's cb_data is used by the
+ * batch.
+ *
+ * \param[in] batch the batch
+ * \param[in] op    the action, owned by the batch from now on
+ *
+ * \return the index of the action's result, see services_batch_result()
+ */
+guint
+services_batch_add(svc_batch_t *batch, svc_action_t *op);
+
+/**
+ * Run a batch of actions
+ *
+ * Actions are started in the order they were added.  Once all of them
+ * have completed, or the deadline has passed, \p callback is called.
+ * Actions not started by the deadline are reported as cancelled.  The
+ * batch is freed after \p callback returns.
+ *
+ * \param[in] batch     the batch
+ * \param[in] callback  called with the results
+ * \param[in] user_data passed to \p callback
+ */
+void
+services_batch_run(svc_batch_t *batch,
+                   void (*callback)(svc_batch_t *batch, gpointer user_data),
+                   gpointer user_data);
+
+/**
+ * Get the number of actions in a batch
+ */
+guint
+services_batch_size(svc_batch_t *batch);
+
+/**
+ * Get the result of one action of a batch
+ *
+ * \param[in] batch the batch
+ * \param[in] index as returned by services_batch_add()
+ *
+ * \return the result, or NULL if \p index is out of range
+ */
+const svc_batch_result_t *
+services_batch_result(svc_batch_t *batch, guint index);
+
+/**
+ * Hand the output of an action to a callback as it arrives
+ *
+ * Each complete line of output (without its newline) is passed to
+ * \p callback while the action runs, overly long lines in pieces, and a
+ * final unterminated line once it exits.  Only the last few kilobytes of
+ * output are then kept in stdout_data and stderr_data.
+ *
+ * Not supported on Windows, and systemd units driven over D-Bus have no
+ * output to stream.  Call this before the action is started.
+ *
+ * \param[in] op       the action
+ * \param[in] callback called for every line, NULL to stop streaming
+ */
+void
+services_action_set_output_callback(svc_action_t *op,
+        void (*callback)(svc_action_t *op, gboolean is_stderr,
+                         const char *line));
+
+/**
+ * Reuse recent results of non-mutating actions.
+ *
+ * A one-off status, monitor or meta-data action that is identical to one
+ * which completed less than \p ms milliseconds ago gets that result
+ * instead of being run again.
+ *
+ * \param[in] ms how long a result stays fresh, 0 (the default) disables reuse
+ */
+void
+services_action_set_reuse_window(int ms);
+
+/**
+ * Whether the action helper has been asked for.
+ *
+ * The helper is off unless MATAHARI_ACTION_HELPER is set to "yes" in the
+ * environment, see the sysconfig file.
+ *
+ * \retval TRUE  services_zygote_start() should be called
+ * \retval FALSE actions should be forked directly
+ */
+gboolean
+services_zygote_wanted(void);
+
+/**
+ * Start the action helper process.
+ *
+ * The helper is a small process that forks resource agents on behalf of
+ * the caller, so that spawning an action does not get slower as the
+ * calling process grows.  Call this early, before large libraries are
+ * initialized and before any threads are created.  Asynchronous actions
+ * use the helper while it is running and are forked directly otherwise.
+ *
+ * \retval TRUE  the helper is running
+ * \retval FALSE the helper could not be started (or is not supported)
+ */
+gboolean
+services_zygote_start(void);
+
+/**
+ * Stop the action helper process.
+ *
+ * Actions still waiting on the helper complete with OCF_UNKNOWN_ERROR.
+ */
+void
+services_zygote_stop(void);
+
+/** A completed resource operation, see services_op_history() */
+typedef struct svc_history_entry_s {
+    /** The action, owned by the library */
+    const char *action;
+    /** When the operation was started */
+    GTimeVal    started;
+    /** How long it took, in milliseconds */
+    guint       duration;
+    int         rc;
+    /** See enum op_status */
+    int         status;
+    gboolean    timed_out;
+} svc_history_entry_t;
+
+/** Resource operation statistics, see services_op_stats() */
+typedef struct svc_op_stats_s {
+    /** Operations completed */
+    guint64 count;
+    /** Operations that did not complete with their expected rc */
+    guint64 failed;
+    /** Operations that timed out */
+    guint64 timed_out;
+
+    /** Shortest and longest duration ever seen, in milliseconds */
+    guint min;
+    guint max;
+
+    /**
+     * Mean and percentiles of recent durations, in milliseconds.
+     * Percentiles are accurate to within 12.5%.
+     */
+    guint mean;
+    guint p50;
+    guint p90;
+    guint p99;
+} svc_op_stats_t;
+
+/**
+ * Get the most recent operations on a resource
+ *
+ * A small number of operations is remembered per resource, whether they
+ * were started with services_action_async() or services_action_sync().
+ *
+ * \param[in] rsc    the name of the resource
+ * \param[in] action only return this action, NULL for all actions
+ *
+ * \return a list of svc_history_entry_t *, most recent first.  This list
+ *         _must_ be destroyed using g_list_free_full(list, free).
+ */
+GList *
+services_op_history(const char *rsc, const char *action);
+
+/**
+ * Get duration statistics of resource operations
+ *
+ * \param[in]  rsc    the name of the resource, NULL for all resources
+ * \param[in]  action only include this action, NULL for all actions.
+ *                    Ignored if \p rsc is NULL.
+ * \param[out] stats  the statistics, zeroed if nothing is known
+ *
+ * \retval TRUE  \p stats has been filled in
+ * \retval FALSE no operations are known for \p rsc and \p action
+ */
+gboolean
+services_op_stats(const char *rsc, const char *action, svc_op_stats_t *stats);
+
+/** Resources consumed by one action of one agent, see services_agent_usage() */
+typedef struct svc_agent_usage_s {
+    /** "standard:provider:agent", or "standard:agent", owned by the library */
+    const char *agent;
+    /** The action, owned by the library */
+    const char *action;
+    /** Number of times the action was run */
+    guint64     count;
+    /** Sum over all runs, except max_rss_kb which is the largest seen */
+    svc_action_usage_t total;
+} svc_agent_usage_t;
+
+/**
+ * Get the resources consumed by each agent and action
+ *
+ * Only actions that were run as child processes are accounted for.
+ *
+ * \return a list of svc_agent_usage_t *.  This list _must_ be destroyed
+ *         using g_list_free_full(list, free).
+ */
+GList *
+services_agent_usage(void);
+
 static inline enum ocf_exitcode
 services_get_ocf_exitcode(char *action, int lsb_exitcode)
 {
@@ -82,6 +82,39 @@ void
 g_list_free_full(GList *list, GDestroyNotify free_func);
 #endif
 
+#ifndef HAVE_G_GET_MONOTONIC_TIME
+/**
+ * Custom implementation of g_get_monotonic_time()
+ *
+ * This version of g_get_monotonic_time() is only used when the build system
+ * doesn't find g_get_monotonic_time() on the system.
+ */
+gint64
+g_get_monotonic_time(void);
+#endif
+
+#ifndef HAVE_G_SOURCE_SET_NAME
+/**
+ * Stand-in for g_source_set_name()
+ *
+ * Only used when the build system doesn't find g_source_set_name() on the
+ * system.  GSources have no name there, so this does nothing.
+ */
+void
+g_source_set_name(GSource *source, const char *name);
+
+/**
+ * Stand-in for g_source_get_name()
+ *
+ * Only used when the build system doesn't find g_source_set_name() on the
+ * system.
+ *
+ * \retval NULL always, sources have no name
+ */
+const char *
+g_source_get_name(GSource *source);
+#endif
+
 #define DIMOF(a)    ((int) (sizeof(a) / sizeof(0[a])))
 
 #ifndef __GNUC__
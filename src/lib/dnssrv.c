@@ -19,19 +19,39 @@
 #include "config.h"
 
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <glib.h>
 
+#include "matahari/logging.h"
 #include "matahari/utilities.h"
 #include "matahari/dnssrv.h"
+#include "matahari/dnssrv_internal.h"
 #include "dnssrv_private.h"
 
+/* Bounds on what we make of the TTL of an answer */
+#define DNSSRV_CACHE_MIN_TTL 5
+#define DNSSRV_CACHE_MAX_TTL (24 * 60 * 60)
+/* How long a failed lookup is remembered, or not retried in the background */
+#define DNSSRV_CACHE_NEGATIVE_TTL 30
+/* Expired answers older than this are not used anymore */
+#define DNSSRV_CACHE_MAX_STALE (7 * 24 * 60 * 60)
+/* A refresh not done by then (no main loop?) is done in the foreground */
+#define DNSSRV_CACHE_REFRESH_GRACE 30
+
+#ifdef WIN32
+#  define DNSSRV_CACHE_FILE NULL
+#else
+#  define DNSSRV_CACHE_FILE LOCAL_STATE_DIR "/lib/matahari/dnssrv.cache"
+#endif
+
 
 struct mh_dnssrv_record {
     uint16_t port;
     uint16_t priority;
     uint16_t weight;
-    /** Used in the weight sorting algorithm */
-    uint32_t weight_running_sum;
     char host[1];
 };
 
@@ -60,113 +80,511 @@ mh_dnssrv_record_get_weight(const struct mh_dnssrv_record *record)
     return record->weight;
 }
 
-static gint
-dnssrv_record_priority_cmp(gconstpointer _a, gconstpointer _b)
+static int
+dnssrv_record_cmp(const void *_a, const void *_b)
 {
-    const struct mh_dnssrv_record *a = _a;
-    const struct mh_dnssrv_record *b = _b;
+    const struct mh_dnssrv_record *a = *(struct mh_dnssrv_record * const *) _a;
+    const struct mh_dnssrv_record *b = *(struct mh_dnssrv_record * const *) _b;
 
-    return (gint) (a->priority - b->priority);
+    if (a->priority != b->priority) {
+        return a->priority < b->priority ? -1 : 1;
+    }
+
+    /*
+     * Records with a weight of 0 must be at the beginning of their
+     * priority, the rest don't matter.
+     */
+    return (a->weight != 0) - (b->weight != 0);
 }
 
+/*
+ * Weights of the records still to be picked, as a Fenwick tree: node i
+ * (1-based) holds the sum of the weights of the records (i - lowbit(i), i].
+ */
+
 static void
-add_weight(gpointer data, gpointer user_data)
+weight_tree_add(uint64_t *tree, guint n, guint index, int64_t weight)
+{
+    for (index++; index <= n; index += index & -index) {
+        tree[index] += weight;
+    }
+}
+
+/* First record whose running sum of weights is >= magic, magic > 0 */
+static guint
+weight_tree_find(const uint64_t *tree, guint n, uint64_t magic)
 {
-    struct mh_dnssrv_record *record = data;
-    uint32_t *sum_weights = user_data;
+    guint index = 0, step;
+
+    for (step = 1; step * 2 <= n; step *= 2);
 
-    *sum_weights += record->weight;
+    for (; step; step /= 2) {
+        if (index + step <= n && tree[index + step] < magic) {
+            index += step;
+            magic -= tree[index];
+        }
+    }
 
-    record->weight_running_sum = *sum_weights;
+    return index;
 }
 
-static GList *
-apply_weight_sort(GList *records)
+/*
+ * Order records of the same priority as RFC 2782 says ("The format of
+ * the SRV RR" -> Weight): repeatedly pick a random number between 0 and
+ * the sum of the weights left, and take the first record whose running
+ * sum reaches it.
+ */
+static void
+weight_sort(struct mh_dnssrv_record **group, guint n,
+            struct mh_dnssrv_record **out, uint64_t *tree)
 {
-    GList *processed_records = NULL;
+    guint lpc, first = 0;
+    uint64_t sum_weights = 0;
 
-    while (records) {
-        uint32_t sum_weights = 0;
-        uint32_t magic;
-        GList *cur;
+    memset(tree, 0, (n + 1) * sizeof(*tree));
+    for (lpc = 0; lpc < n; lpc++) {
+        weight_tree_add(tree, n, lpc, group[lpc]->weight);
+        sum_weights += group[lpc]->weight;
+    }
 
-        g_list_foreach(records, add_weight, &sum_weights);
+    for (lpc = 0; lpc < n; lpc++) {
+        uint64_t magic = (uint64_t) (g_random_double() * (sum_weights + 1));
+        guint pick;
 
-        magic = g_random_int_range(0, sum_weights + 1);
+        if (magic == 0) {
+            /* Whatever is first, weight 0 ones included */
+            while (group[first] == NULL) {
+                first++;
+            }
+            pick = first;
+        } else {
+            pick = weight_tree_find(tree, n, MIN(magic, sum_weights));
+        }
 
-        for (cur = records; cur; cur = cur->next) {
-            struct mh_dnssrv_record *cur_record = cur->data;
+        out[lpc] = group[pick];
+        group[pick] = NULL;
+        weight_tree_add(tree, n, pick, -(int64_t) out[lpc]->weight);
+        sum_weights -= out[lpc]->weight;
+    }
+}
 
-            if (cur_record->weight_running_sum >= magic) {
-                processed_records = g_list_append(processed_records, cur_record);
-                records = g_list_delete_link(records, cur);
-                break;
-            }
+/* In place, records are only moved around */
+static void
+dnssrv_records_sort_array(struct mh_dnssrv_record **records, guint n)
+{
+    struct mh_dnssrv_record **group;
+    uint64_t *tree;
+    guint start, end;
+
+    if (n < 2) {
+        return;
+    }
+
+    qsort(records, n, sizeof(*records), dnssrv_record_cmp);
+
+    group = malloc(n * sizeof(*group));
+    tree = malloc((n + 1) * sizeof(*tree));
+
+    for (start = 0; start < n; start = end) {
+        for (end = start + 1;
+             end < n && records[end]->priority == records[start]->priority;
+             end++);
+
+        if (end - start > 1) {
+            memcpy(group, records + start, (end - start) * sizeof(*group));
+            weight_sort(group, end - start, records + start, tree);
         }
     }
 
-    return processed_records;
+    free(tree);
+    free(group);
 }
 
 GList *
 mh_dnssrv_records_sort(GList *records)
 {
-    GList *processed_records = NULL;
+    struct mh_dnssrv_record **array;
+    GList *cur, *sorted = NULL;
+    guint lpc, n = g_list_length(records);
 
-    /*
-     * At this point we have a list of records sorted by priority.
-     * There is also a weight field.  Oh, so the weight is just a
-     * secondary sort key?  No.  That would be too simple.
-     *
-     * For each priority, we have to sort by weight using the algorithm
-     * described in RFC 2782.  Specifically, see the section:
-     *     "The format of the SRV RR" -> Weight
-     */
+    array = malloc(MAX(n, 1) * sizeof(*array));
+    for (lpc = 0, cur = records; cur; cur = cur->next) {
+        array[lpc++] = cur->data;
+    }
+    g_list_free(records);
 
-    while (records) {
-        GList *tmp_list = NULL;
-        uint16_t cur_priority;
+    dnssrv_records_sort_array(array, n);
 
-        /*
-         * Move all records at this priority into a temporary list.
-         * We will then sort them based on weights before moving them
-         * into the list of processed records.
-         */
+    for (lpc = n; lpc > 0; lpc--) {
+        sorted = g_list_prepend(sorted, array[lpc - 1]);
+    }
+    free(array);
 
-        cur_priority = ((struct mh_dnssrv_record *) g_list_nth_data(records, 0))->priority;
-        do {
-            struct mh_dnssrv_record *record = g_list_nth_data(records, 0);
+    return sorted;
+}
 
-            if (record->priority != cur_priority) {
-                break;
-            }
+/*
+ * The answer cache.  Entries keep the records as the resolver returned
+ * them, in no particular order; every lookup gets its own copy sorted
+ * with fresh weights.  Like the main loop, it is not thread safe.
+ */
+
+typedef struct dnssrv_cache_entry_s {
+    GList    *records;     /* NULL for a failed lookup */
+    time_t    expires;
+    time_t    refresh;     /* refresh started at, or not to retry before */
+    gboolean  refreshing;
+} dnssrv_cache_entry_t;
+
+static GHashTable *dnssrv_cache = NULL;
+static char *dnssrv_cache_file = NULL;
+static gboolean dnssrv_cache_file_set = FALSE;
+static struct mh_dnssrv_cache_stats dnssrv_stats;
+
+static GList *
+records_copy(GList *records)
+{
+    GList *copy = NULL;
+
+    for (; records; records = records->next) {
+        struct mh_dnssrv_record *record = records->data;
+
+        copy = mh_dnssrv_add_record(copy, record->host, record->port,
+                                    record->priority, record->weight);
+    }
+
+    return copy;
+}
 
-            records = g_list_remove(records, record);
+static void
+cache_entry_free(gpointer data)
+{
+    dnssrv_cache_entry_t *entry = data;
+
+    g_list_free_full(entry->records, mh_dnssrv_record_free);
+    free(entry);
+}
 
-            /*
-             * Records with a weight of 0 must be at the beginning of the list.
-             * The rest don't matter.
-             */
+static const char *
+cache_file(void)
+{
+    if (!dnssrv_cache_file_set) {
+        return DNSSRV_CACHE_FILE;
+    }
+    return dnssrv_cache_file;
+}
 
-            if (record->weight == 0) {
-                tmp_list = g_list_prepend(tmp_list, record);
-            } else {
-                tmp_list = g_list_append(tmp_list, record);
+static void
+cache_load(void)
+{
+    GKeyFile *keys = g_key_file_new();
+    GError *error = NULL;
+    gchar **queries;
+    gsize lpc, n_queries = 0;
+
+    if (!cache_file()
+        || !g_key_file_load_from_file(keys, cache_file(), G_KEY_FILE_NONE,
+                                      &error)) {
+        if (error) {
+            mh_debug("No SRV answers loaded from %s: %s", cache_file(),
+                     error->message);
+            g_error_free(error);
+        }
+        g_key_file_free(keys);
+        return;
+    }
+
+    queries = g_key_file_get_groups(keys, &n_queries);
+    for (lpc = 0; lpc < n_queries; lpc++) {
+        dnssrv_cache_entry_t *entry;
+        gchar *expires;
+        gchar **records;
+        gsize rec, n_records = 0;
+
+        expires = g_key_file_get_string(keys, queries[lpc], "expires", NULL);
+        records = g_key_file_get_string_list(keys, queries[lpc], "records",
+                                             &n_records, NULL);
+        if (expires == NULL || records == NULL) {
+            g_free(expires);
+            g_strfreev(records);
+            continue;
+        }
+
+        entry = calloc(1, sizeof(dnssrv_cache_entry_t));
+        entry->expires = (time_t) g_ascii_strtoll(expires, NULL, 10);
+        for (rec = 0; rec < n_records; rec++) {
+            char host[1025];
+            unsigned int port, priority, weight;
+
+            if (sscanf(records[rec], "%1024[^ ] %u %u %u", host, &port,
+                       &priority, &weight) == 4) {
+                entry->records = mh_dnssrv_add_record(entry->records, host,
+                                                      port, priority, weight);
             }
-        } while (records);
+        }
+        g_hash_table_replace(dnssrv_cache, g_strdup(queries[lpc]), entry);
 
-        tmp_list = apply_weight_sort(tmp_list);
+        g_free(expires);
+        g_strfreev(records);
+    }
+
+    mh_debug("Loaded %" G_GSIZE_FORMAT " SRV answers from %s", n_queries,
+             cache_file());
+    g_strfreev(queries);
+    g_key_file_free(keys);
+}
 
-        processed_records = g_list_concat(processed_records, tmp_list);
+static void
+cache_save(void)
+{
+    GKeyFile *keys;
+    GHashTableIter iter;
+    gpointer key, value;
+    GError *error = NULL;
+    gchar *data;
+    gsize len;
+
+    if (!cache_file()) {
+        return;
     }
 
-    return processed_records;
+    keys = g_key_file_new();
+    g_hash_table_iter_init(&iter, dnssrv_cache);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        dnssrv_cache_entry_t *entry = value;
+        gchar *expires;
+        gchar **records;
+        GList *cur;
+        guint rec = 0;
+
+        if (entry->records == NULL) {
+            /* Failures are not worth remembering across restarts */
+            continue;
+        }
+
+        records = g_new0(gchar *, g_list_length(entry->records) + 1);
+        for (cur = entry->records; cur; cur = cur->next) {
+            struct mh_dnssrv_record *record = cur->data;
+
+            records[rec++] = g_strdup_printf("%s %u %u %u", record->host,
+                                             record->port, record->priority,
+                                             record->weight);
+        }
+
+        expires = g_strdup_printf("%" G_GINT64_FORMAT, (gint64) entry->expires);
+        g_key_file_set_string(keys, key, "expires", expires);
+        g_key_file_set_string_list(keys, key, "records",
+                                   (const gchar * const *) records, rec);
+        g_free(expires);
+        g_strfreev(records);
+    }
+
+    data = g_key_file_to_data(keys, &len, NULL);
+    if (!g_file_set_contents(cache_file(), data, len, &error)) {
+        /* Not being able to is expected when not running as root */
+        mh_debug("Could not save SRV answers to %s: %s", cache_file(),
+                 error->message);
+        g_error_free(error);
+    }
+    g_free(data);
+    g_key_file_free(keys);
+}
+
+static void
+cache_init(void)
+{
+    if (dnssrv_cache == NULL) {
+        dnssrv_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                             cache_entry_free);
+        cache_load();
+    }
+}
+
+/* Takes ownership of records */
+static dnssrv_cache_entry_t *
+cache_store(const char *query, GList *records, uint32_t ttl)
+{
+    dnssrv_cache_entry_t *entry = calloc(1, sizeof(dnssrv_cache_entry_t));
+
+    if (records) {
+        ttl = CLAMP(ttl, DNSSRV_CACHE_MIN_TTL, DNSSRV_CACHE_MAX_TTL);
+    } else {
+        ttl = DNSSRV_CACHE_NEGATIVE_TTL;
+    }
+
+    entry->records = records;
+    entry->expires = time(NULL) + ttl;
+    g_hash_table_replace(dnssrv_cache, g_strdup(query), entry);
+
+    if (records) {
+        cache_save();
+    }
+    return entry;
+}
+
+/* Takes ownership of records, NULL if the resolver found nothing */
+static dnssrv_cache_entry_t *
+cache_answer(const char *query, GList *records, uint32_t ttl)
+{
+    dnssrv_cache_entry_t *entry = g_hash_table_lookup(dnssrv_cache, query);
+
+    if (records == NULL) {
+        dnssrv_stats.failures++;
+    }
+
+    if (records == NULL && entry && entry->records) {
+        /* Keep what we had, and don't try again right away */
+        mh_debug("No answer to SRV query %s, keeping the old one", query);
+        entry->refreshing = FALSE;
+        entry->refresh = time(NULL) + DNSSRV_CACHE_NEGATIVE_TTL;
+        return entry;
+    }
+
+    return cache_store(query, records, ttl);
+}
+
+static void
+cache_refreshed(GList *records, uint32_t ttl, gpointer user_data)
+{
+    char *query = user_data;
+
+    mh_trace("Refreshed SRV answer for %s: %s", query,
+             records ? "found" : "not found");
+    cache_answer(query, records, ttl);
+    free(query);
+}
+
+/*
+ * Find the answer to a query in the cache, starting a refresh if it has
+ * expired.  NULL if the resolver has to be waited for.
+ */
+static dnssrv_cache_entry_t *
+cache_lookup(const char *query)
+{
+    dnssrv_cache_entry_t *entry;
+    time_t now = time(NULL);
+
+    cache_init();
+    entry = g_hash_table_lookup(dnssrv_cache, query);
+
+    if (entry && now < entry->expires) {
+        dnssrv_stats.hits++;
+        return entry;
+    }
+
+    if (entry && entry->records && now < entry->expires + DNSSRV_CACHE_MAX_STALE
+        && (!entry->refreshing
+            || now < entry->refresh + DNSSRV_CACHE_REFRESH_GRACE)) {
+        dnssrv_stats.stale_hits++;
+        if (!entry->refreshing && now >= entry->refresh) {
+            entry->refreshing = TRUE;
+            entry->refresh = now;
+            dnssrv_stats.refreshes++;
+            mh_os_dnssrv_lookup_async(query, cache_refreshed, strdup(query));
+        }
+        return entry;
+    }
+
+    dnssrv_stats.misses++;
+    return NULL;
 }
 
 GList *
 mh_dnssrv_lookup(const char *query)
 {
-    return mh_dnssrv_records_sort(mh_os_dnssrv_lookup(query));
+    dnssrv_cache_entry_t *entry = cache_lookup(query);
+
+    if (entry == NULL) {
+        GList *records;
+        uint32_t ttl;
+
+        records = mh_os_dnssrv_lookup(query, &ttl);
+        entry = cache_answer(query, records, ttl);
+    }
+
+    return mh_dnssrv_records_sort(records_copy(entry->records));
+}
+
+typedef struct dnssrv_async_s {
+    char *query;
+    GList *records;             /* when answered from the cache */
+    void (*callback)(GList *records, gpointer user_data);
+    gpointer user_data;
+} dnssrv_async_t;
+
+static gboolean
+lookup_cached_cb(gpointer user_data)
+{
+    dnssrv_async_t *lookup = user_data;
+
+    lookup->callback(mh_dnssrv_records_sort(lookup->records),
+                     lookup->user_data);
+    free(lookup->query);
+    free(lookup);
+    return FALSE;
+}
+
+static void
+lookup_resolved(GList *records, uint32_t ttl, gpointer user_data)
+{
+    dnssrv_async_t *lookup = user_data;
+    dnssrv_cache_entry_t *entry;
+
+    entry = cache_answer(lookup->query, records, ttl);
+    lookup->records = records_copy(entry->records);
+    lookup_cached_cb(lookup);
+}
+
+void
+mh_dnssrv_lookup_async(const char *query,
+                       void (*callback)(GList *records, gpointer user_data),
+                       gpointer user_data)
+{
+    dnssrv_async_t *lookup = calloc(1, sizeof(dnssrv_async_t));
+    dnssrv_cache_entry_t *entry = cache_lookup(query);
+
+    lookup->query = strdup(query);
+    lookup->callback = callback;
+    lookup->user_data = user_data;
+
+    if (entry) {
+        /* Callers expect the callback after we return */
+        lookup->records = records_copy(entry->records);
+        g_idle_add(lookup_cached_cb, lookup);
+        return;
+    }
+
+    mh_os_dnssrv_lookup_async(query, lookup_resolved, lookup);
+}
+
+void
+mh_dnssrv_cache_set_file(const char *path)
+{
+    free(dnssrv_cache_file);
+    dnssrv_cache_file = path ? strdup(path) : NULL;
+    dnssrv_cache_file_set = TRUE;
+}
+
+void
+mh_dnssrv_cache_get_stats(struct mh_dnssrv_cache_stats *stats)
+{
+    *stats = dnssrv_stats;
+}
+
+void
+mh_dnssrv_cache_add(const char *query, GList *records, uint32_t ttl)
+{
+    cache_init();
+    cache_store(query, records, ttl);
+}
+
+void
+mh_dnssrv_cache_flush(void)
+{
+    if (dnssrv_cache) {
+        g_hash_table_destroy(dnssrv_cache);
+        dnssrv_cache = NULL;
+    }
 }
 
 int
@@ -212,7 +630,8 @@ mh_dnssrv_add_record(GList *records, const char *host, uint16_t port,
     memcpy(record->host, host, host_len);
     record->host[host_len] = '\0';
 
-    return g_list_insert_sorted(records, record, dnssrv_record_priority_cmp);
+    /* Ordering is left to mh_dnssrv_records_sort() */
+    return g_list_prepend(records, record);
 }
 
 
@@ -23,36 +23,42 @@
 #include <errno.h>
 #include <glib.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <arpa/nameser.h>
 #include <resolv.h>
 #include <limits.h>
 
 #include "dnssrv_private.h"
+#include "matahari/logging.h"
+#include "matahari/mainloop.h"
 #include "matahari/utilities.h"
 #include "matahari/dnssrv.h"
 #include "matahari/dnssrv_internal.h"
 
-GList *
-mh_os_dnssrv_lookup(const char *query)
+/* Wait at least this long for a server before asking the next one */
+#define DNSSRV_MIN_SERVER_TIMEOUT_MS 1000
+
+/* Set by mh_dnssrv_set_nameservers(), resolv.conf is used if none */
+static struct sockaddr_in nameservers[MAXNS];
+static int n_nameservers = 0;
+
+static GList *
+parse_answer(const unsigned char *buf, int size, uint32_t *ttl)
 {
-    union {
-        HEADER hdr;
-        unsigned char buf[NS_PACKETSZ];
-    } answer;
     ns_msg nsh = { NULL, };
     ns_rr rr;
-    int size, rrnum;
+    int rrnum;
     GList *records = NULL;
 
-    size = res_query(query, C_IN, T_SRV, (u_char *) &answer, sizeof(answer));
+    *ttl = UINT32_MAX;
 
-    if (size > 0) {
-        if (ns_initparse(answer.buf, size, &nsh) < 0) {
-            return NULL;
-        }
+    if (ns_initparse(buf, size, &nsh) < 0) {
+        return NULL;
     }
 
     for (rrnum = 0; rrnum < ns_msg_count(nsh, ns_s_an); rrnum++) {
@@ -68,6 +74,8 @@ mh_os_dnssrv_lookup(const char *query)
             continue;
         }
 
+        *ttl = MIN(*ttl, ns_rr_ttl(rr));
+
         data = (uint16_t *) ns_rr_rdata(rr);
         priority = ntohs(data[0]);
         weight = ntohs(data[1]);
@@ -86,3 +94,365 @@ error_cleanup:
 
     return NULL;
 }
+
+GList *
+mh_os_dnssrv_lookup(const char *query, uint32_t *ttl)
+{
+    union {
+        HEADER hdr;
+        unsigned char buf[NS_PACKETSZ];
+    } answer;
+    int size;
+
+    *ttl = UINT32_MAX;
+    size = res_query(query, C_IN, T_SRV, (u_char *) &answer, sizeof(answer));
+
+    if (size <= 0) {
+        return NULL;
+    }
+    return parse_answer(answer.buf, size, ttl);
+}
+
+/*
+ * Asynchronous lookups send the query over UDP themselves, one server at
+ * a time, moving on to the next when one doesn't answer in time or fails
+ * to.  Answers from a server already given up on are still taken.  Like
+ * res_query(), resolv.conf's timeout and attempts options are honored.
+ */
+
+typedef struct dnssrv_query_s {
+    char *query;
+    unsigned char packet[NS_PACKETSZ];
+    int packet_len;
+    uint16_t id;
+
+    struct sockaddr_in servers[MAXNS];
+    int n_servers;
+    int next;                   /* server the next send goes to */
+    int sent;
+    int sends;                  /* left, over all rounds */
+    guint server_timeout_ms;
+
+    int fd;
+    mainloop_fd_t *source;
+    guint timer;
+    gboolean done;
+
+    void (*callback)(GList *records, uint32_t ttl, gpointer user_data);
+    gpointer user_data;
+} dnssrv_query_t;
+
+static void
+query_free(gpointer data)
+{
+    dnssrv_query_t *q = data;
+
+    if (q->timer) {
+        g_source_remove(q->timer);
+    }
+    if (q->fd >= 0) {
+        close(q->fd);
+    }
+    free(q->query);
+    free(q);
+}
+
+static void
+query_complete(dnssrv_query_t *q, GList *records, uint32_t ttl)
+{
+    q->done = TRUE;
+    if (q->timer) {
+        g_source_remove(q->timer);
+        q->timer = 0;
+    }
+    q->callback(records, ttl, q->user_data);
+}
+
+static gboolean query_send(dnssrv_query_t *q);
+
+static gboolean
+query_timeout_cb(gpointer user_data)
+{
+    dnssrv_query_t *q = user_data;
+
+    q->timer = 0;
+    if (query_send(q) == FALSE) {
+        mh_debug("No answer to SRV query %s", q->query);
+        query_complete(q, NULL, 0);
+        mainloop_destroy_fd(q->source);
+    }
+    return FALSE;
+}
+
+/* Send the query to the next server, FALSE when there are no sends left */
+static gboolean
+query_send(dnssrv_query_t *q)
+{
+    struct sockaddr_in *server;
+    guint timeout_ms;
+    int round;
+
+    if (q->sends == 0) {
+        return FALSE;
+    }
+
+    round = q->sent / q->n_servers;
+    server = &q->servers[q->next];
+    q->next = (q->next + 1) % q->n_servers;
+    q->sent++;
+    q->sends--;
+
+    if (sendto(q->fd, q->packet, q->packet_len, 0,
+               (struct sockaddr *) server, sizeof(*server)) < 0) {
+        mh_perror(LOG_DEBUG, "Could not send SRV query %s", q->query);
+    }
+
+    /* Like res_send(), each round waits twice as long */
+    timeout_ms = q->server_timeout_ms << MIN(round, 4);
+    q->timer = g_timeout_add(timeout_ms, query_timeout_cb, q);
+    return TRUE;
+}
+
+static gboolean
+query_known_server(dnssrv_query_t *q, const struct sockaddr_in *from)
+{
+    int lpc;
+
+    for (lpc = 0; lpc < q->n_servers; lpc++) {
+        if (q->servers[lpc].sin_addr.s_addr == from->sin_addr.s_addr
+            && q->servers[lpc].sin_port == from->sin_port) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Domain names compare case-insensitively, with or without the root dot */
+static gboolean
+query_same_name(const char *a, const char *b)
+{
+    size_t a_len = strlen(a), b_len = strlen(b);
+
+    if (a_len && a[a_len - 1] == '.') {
+        a_len--;
+    }
+    if (b_len && b[b_len - 1] == '.') {
+        b_len--;
+    }
+    return a_len == b_len && strncasecmp(a, b, a_len) == 0;
+}
+
+/* Whether the answer is for our question, like res_send()'s queriesmatch */
+static gboolean
+query_same_question(dnssrv_query_t *q, const unsigned char *buf, int size)
+{
+    ns_msg nsh;
+    ns_rr rr;
+
+    if (ns_initparse(buf, size, &nsh) < 0
+        || ns_msg_count(nsh, ns_s_qd) != 1
+        || ns_parserr(&nsh, ns_s_qd, 0, &rr) < 0) {
+        return FALSE;
+    }
+
+    return ns_rr_type(rr) == ns_t_srv && ns_rr_class(rr) == ns_c_in
+           && query_same_name(ns_rr_name(rr), q->query);
+}
+
+static gboolean
+query_dispatch(int fd, gpointer user_data)
+{
+    dnssrv_query_t *q = user_data;
+    union {
+        HEADER hdr;
+        unsigned char buf[NS_PACKETSZ];
+    } answer;
+    struct sockaddr_in from;
+    socklen_t from_len;
+    GList *records;
+    uint32_t ttl = 0;
+    ssize_t size;
+
+    while (!q->done) {
+        from_len = sizeof(from);
+        size = recvfrom(fd, answer.buf, sizeof(answer.buf), 0,
+                        (struct sockaddr *) &from, &from_len);
+        if (size < 0) {
+            return TRUE;
+        }
+
+        if (size < (ssize_t) sizeof(HEADER) || !answer.hdr.qr
+            || ntohs(answer.hdr.id) != q->id || !query_known_server(q, &from)) {
+            /* Not the answer to our question, or not from who we asked */
+            continue;
+
+        } else if (!query_same_question(q, answer.buf, size)) {
+            mh_debug("Answer from %s is for another question than %s",
+                     inet_ntoa(from.sin_addr), q->query);
+            continue;
+        }
+
+        if (answer.hdr.rcode == SERVFAIL || answer.hdr.rcode == NOTIMP
+            || answer.hdr.rcode == REFUSED) {
+            mh_debug("%s could not answer SRV query %s (%d)",
+                     inet_ntoa(from.sin_addr), q->query, answer.hdr.rcode);
+            if (q->timer) {
+                g_source_remove(q->timer);
+                q->timer = 0;
+            }
+            if (query_send(q)) {
+                continue;
+            }
+            query_complete(q, NULL, 0);
+            break;
+        }
+
+        if (answer.hdr.tc) {
+            /* No TCP fallback, use what fits */
+            mh_debug("Truncated answer to SRV query %s", q->query);
+        }
+
+        records = answer.hdr.rcode == NOERROR
+                  ? parse_answer(answer.buf, size, &ttl) : NULL;
+        query_complete(q, records, ttl);
+    }
+
+    return FALSE;
+}
+
+static int
+query_servers(dnssrv_query_t *q, int *timeout_s, int *attempts)
+{
+    struct __res_state res;
+    int lpc;
+
+    memset(&res, 0, sizeof(res));
+    if (res_ninit(&res) < 0) {
+        return -1;
+    }
+
+    *timeout_s = res.retrans > 0 ? res.retrans : RES_TIMEOUT;
+    *attempts = res.retry > 0 ? res.retry : 1;
+
+    if (n_nameservers) {
+        memcpy(q->servers, nameservers, sizeof(nameservers));
+        q->n_servers = n_nameservers;
+    } else {
+        for (lpc = 0; lpc < res.nscount && lpc < MAXNS; lpc++) {
+            /* IPv6 servers are kept elsewhere, and skipped for now */
+            if (res.nsaddr_list[lpc].sin_family == AF_INET) {
+                q->servers[q->n_servers++] = res.nsaddr_list[lpc];
+            }
+        }
+    }
+
+    q->packet_len = res_nmkquery(&res, QUERY, q->query, C_IN, T_SRV, NULL, 0,
+                                 NULL, q->packet, sizeof(q->packet));
+    res_nclose(&res);
+
+    if (q->n_servers == 0) {
+        /* What the resolver does when there is no resolv.conf */
+        q->servers[0].sin_family = AF_INET;
+        q->servers[0].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        q->servers[0].sin_port = htons(NS_DEFAULTPORT);
+        q->n_servers = 1;
+    }
+
+    return q->packet_len > 0 ? 0 : -1;
+}
+
+static gboolean
+query_failed_cb(gpointer user_data)
+{
+    dnssrv_query_t *q = user_data;
+
+    q->callback(NULL, 0, q->user_data);
+    query_free(q);
+    return FALSE;
+}
+
+void
+mh_os_dnssrv_lookup_async(const char *query,
+                          void (*callback)(GList *records, uint32_t ttl,
+                                           gpointer user_data),
+                          gpointer user_data)
+{
+    dnssrv_query_t *q = calloc(1, sizeof(dnssrv_query_t));
+    HEADER *hdr = (HEADER *) q->packet;
+    int timeout_s, attempts;
+
+    q->query = strdup(query);
+    q->callback = callback;
+    q->user_data = user_data;
+    q->fd = -1;
+
+    if (query_servers(q, &timeout_s, &attempts) < 0) {
+        mh_err("Could not build SRV query for %s", query);
+        g_idle_add(query_failed_cb, q);
+        return;
+    }
+
+    /* res_nmkquery() ids are predictable, ours needn't be */
+    q->id = (uint16_t) g_random_int_range(0, 0x10000);
+    hdr->id = htons(q->id);
+
+    q->sends = q->n_servers * attempts;
+    q->server_timeout_ms = MAX(DNSSRV_MIN_SERVER_TIMEOUT_MS,
+                               timeout_s * 1000 / q->n_servers);
+
+    q->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (q->fd < 0) {
+        mh_perror(LOG_ERR, "Could not open a socket for SRV query %s", query);
+        g_idle_add(query_failed_cb, q);
+        return;
+    }
+
+    q->source = mainloop_add_fd(G_PRIORITY_DEFAULT, q->fd, query_dispatch,
+                                query_free, q);
+    g_source_set_name((GSource *) q->source, "SRV query");
+    mh_trace("SRV query %s: %d servers, %d attempts, %ums", query,
+             q->n_servers, attempts, q->server_timeout_ms);
+    query_send(q);
+}
+
+int
+mh_dnssrv_set_nameservers(const char *servers)
+{
+    gchar **list;
+    int lpc, count = 0;
+
+    if (servers == NULL) {
+        n_nameservers = 0;
+        return 0;
+    }
+
+    list = g_strsplit_set(servers, ", ", -1);
+    for (lpc = 0; list[lpc] && count < MAXNS; lpc++) {
+        struct sockaddr_in *server = &nameservers[count];
+        char *port;
+
+        if (*list[lpc] == '\0') {
+            continue;
+        }
+
+        memset(server, 0, sizeof(*server));
+        server->sin_family = AF_INET;
+        server->sin_port = htons(NS_DEFAULTPORT);
+
+        port = strchr(list[lpc], ':');
+        if (port) {
+            *port++ = '\0';
+            server->sin_port = htons(atoi(port));
+        }
+        if (inet_pton(AF_INET, list[lpc], &server->sin_addr) != 1) {
+            mh_err("Not a nameserver address: %s", list[lpc]);
+            g_strfreev(list);
+            return -1;
+        }
+        count++;
+    }
+    g_strfreev(list);
+
+    n_nameservers = count;
+    return 0;
+}
@@ -34,11 +34,27 @@
 /**
  * Perform a DNS SRV lookup.
  *
- * \param[in] query DNS SRV lookup, such as _matahari._tcp.matahariproject.org
+ * \param[in]  query DNS SRV lookup, such as _matahari._tcp.matahariproject.org
+ * \param[out] ttl   lowest time to live of the records, in seconds
  *
  * \return head of DNS SRV records list
  */
 GList *
-mh_os_dnssrv_lookup(const char *query);
+mh_os_dnssrv_lookup(const char *query, uint32_t *ttl);
+
+/**
+ * Perform a DNS SRV lookup from the main loop.
+ *
+ * \param[in] query     DNS SRV lookup, such as _matahari._tcp.matahariproject.org
+ * \param[in] callback  called from the main loop with the records (which it
+ *                      takes ownership of) and their lowest time to live,
+ *                      records is NULL if the lookup failed
+ * \param[in] user_data passed to the callback
+ */
+void
+mh_os_dnssrv_lookup_async(const char *query,
+                          void (*callback)(GList *records, uint32_t ttl,
+                                           gpointer user_data),
+                          gpointer user_data);
 
 #endif /* __MH_DNSSRV_PRIVATE_H__ */
@@ -19,8 +19,11 @@
 
 #include "config.h"
 
+#include <stdlib.h>
+
 #include "matahari/dnssrv.h"
 #include "matahari/dnssrv_internal.h"
+#include "dnssrv_private.h"
 
 #include <windows.h>
 #include <winsock.h>
@@ -33,13 +36,14 @@
 #endif
 
 GList *
-mh_os_dnssrv_lookup(const char *query)
+mh_os_dnssrv_lookup(const char *query, uint32_t *ttl)
 {
     PDNS_RECORD rr, record;
     int len = strlen(query) + 1;
     WCHAR query_wstr[len];
     GList *records = NULL;
 
+    *ttl = UINT32_MAX;
     MultiByteToWideChar(CP_UTF8, 0, query, len, query_wstr, len);
     if (DnsQuery(query_wstr, DNS_TYPE_SRV,
                 DNS_QUERY_STANDARD, NULL,
@@ -57,6 +61,8 @@ mh_os_dnssrv_lookup(const char *query)
             continue;
         }
 
+        *ttl = MIN(*ttl, (uint32_t) record->dwTtl);
+
         /* record->Data.Srv.wPort */
         len = 1 + wcslen(record->Data.Srv.pNameTarget);
         WideCharToMultiByte(CP_UTF8, 0, record->Data.Srv.pNameTarget, len, host, sizeof(host), NULL, NULL);
@@ -72,3 +78,41 @@ mh_os_dnssrv_lookup(const char *query)
 
     return records;
 }
+
+typedef struct dnssrv_query_s {
+    GList *records;
+    uint32_t ttl;
+    void (*callback)(GList *records, uint32_t ttl, gpointer user_data);
+    gpointer user_data;
+} dnssrv_query_t;
+
+static gboolean
+query_complete_cb(gpointer user_data)
+{
+    dnssrv_query_t *q = user_data;
+
+    q->callback(q->records, q->ttl, q->user_data);
+    free(q);
+    return FALSE;
+}
+
+void
+mh_os_dnssrv_lookup_async(const char *query,
+                          void (*callback)(GList *records, uint32_t ttl,
+                                           gpointer user_data),
+                          gpointer user_data)
+{
+    dnssrv_query_t *q = calloc(1, sizeof(dnssrv_query_t));
+
+    /* DnsQuery() has no asynchronous form we can use, so it blocks */
+    q->records = mh_os_dnssrv_lookup(query, &q->ttl);
+    q->callback = callback;
+    q->user_data = user_data;
+    g_idle_add(query_complete_cb, q);
+}
+
+int
+mh_dnssrv_set_nameservers(const char *servers)
+{
+    return servers ? -1 : 0;
+}
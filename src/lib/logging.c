@@ -0,0 +1,536 @@
+/*
+ * Copyright (C) 2011, Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/**
+ * \file
+ * \brief Log output
+ *
+ * mh_log_fn() writes messages out on the caller's thread, unless
+ * mh_log_async_start() was called.  Messages are then formatted into a
+ * ring of fixed size slots and a background thread writes them out in
+ * batches.
+ *
+ * The ring is a bounded multi-producer queue after Dmitry Vyukov's: each
+ * slot carries a sequence number saying whether it is free for the
+ * producer at a given position or ready for the consumer, so producers
+ * only ever contend on the head counter.  The background thread sleeps on
+ * a condition variable when the ring is empty, and producers only take
+ * the mutex to wake it up.
+ */
+
+#include "config.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "matahari/logging.h"
+
+/* Slots in the ring, a power of two */
+#define LOG_RING_SLOTS 1024
+
+/* Longer messages are truncated */
+#define LOG_LINE_MAX 512
+
+/* Messages taken out of the ring at once */
+#define LOG_BATCH_MAX 64
+
+/* How long mh_log_flush() waits for the background thread */
+#define LOG_FLUSH_TIMEOUT_S 2
+
+/* How long a producer waits for room, with MH_LOG_OVERFLOW_BLOCK */
+#define LOG_BLOCK_WAIT_US 1000
+
+/* Call sites tracked for rate limiting, a power of two */
+#define RATELIMIT_SITES 256
+
+gboolean mh_stderr_enabled = FALSE;
+
+static struct mh_log_stats log_stats;
+
+typedef struct ratelimit_site_s {
+    volatile int lock;
+    const char *fmt;
+    gint64 window_end;  /**< us, monotonic */
+    unsigned int count;
+    unsigned int suppressed;
+} ratelimit_site_t;
+
+static ratelimit_site_t ratelimit_sites[RATELIMIT_SITES];
+static unsigned int ratelimit_burst = 0;
+static gint64 ratelimit_interval_us = 0;
+
+static void
+log_write_line(int priority, const char *line)
+{
+    if (mh_stderr_enabled) {
+#ifdef __linux__
+        fprintf(stderr, "%s\n", line);
+#else
+        fprintf(stderr, "%s\n\r", line);
+#endif
+
+#ifdef __linux__
+    } else {
+        syslog(priority, "%s", line);
+#endif
+    }
+
+    __sync_fetch_and_add(&log_stats.written, 1);
+}
+
+static void
+log_vwrite(int priority, const char *fmt, va_list ap)
+{
+    if (mh_stderr_enabled) {
+        vfprintf(stderr, fmt, ap);
+#ifdef __linux__
+        fprintf(stderr, "\n");
+#else
+        fprintf(stderr, "\n\r");
+#endif
+
+#ifdef __linux__
+    } else {
+        vsyslog(priority, fmt, ap);
+#endif
+    }
+
+    __sync_fetch_and_add(&log_stats.written, 1);
+}
+
+#ifdef __linux__
+typedef struct log_slot_s {
+    volatile gsize seq;
+    int priority;
+    char text[LOG_LINE_MAX];
+} log_slot_t;
+
+typedef struct log_line_s {
+    int priority;
+    char text[LOG_LINE_MAX];
+} log_line_t;
+
+static log_slot_t *log_ring = NULL;
+static volatile gsize log_head = 0;     /**< next position to fill */
+static gsize log_tail = 0;              /**< next position to write out */
+static volatile gsize log_written = 0;  /**< log_tail, once written out */
+
+static volatile gboolean log_async = FALSE;
+static volatile int log_sleeping = 0;
+static enum mh_log_overflow log_overflow = MH_LOG_OVERFLOW_DROP;
+
+static pthread_t log_thread;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t log_flushed = PTHREAD_COND_INITIALIZER;
+
+static void
+log_wake(void)
+{
+    pthread_mutex_lock(&log_lock);
+    pthread_cond_signal(&log_wakeup);
+    pthread_mutex_unlock(&log_lock);
+}
+
+/*
+ * Queue a message for the background thread
+ *
+ * Returns FALSE, without touching ap, if the message should be written
+ * out synchronously instead.
+ */
+static gboolean
+log_ring_push(int priority, const char *fmt, va_list ap)
+{
+    gsize pos = log_head;
+    log_slot_t *slot = NULL;
+
+    if (!log_async || pthread_equal(pthread_self(), log_thread)) {
+        return FALSE;
+    }
+
+    while (TRUE) {
+        gssize diff;
+
+        slot = &log_ring[pos & (LOG_RING_SLOTS - 1)];
+        __sync_synchronize();
+        diff = (gssize) (slot->seq - pos);
+
+        if (diff == 0) {
+            if (__sync_bool_compare_and_swap(&log_head, pos, pos + 1)) {
+                break;
+            }
+
+        } else if (diff < 0) {
+            /* Full */
+            if (log_overflow == MH_LOG_OVERFLOW_DROP) {
+                __sync_fetch_and_add(&log_stats.dropped, 1);
+                return TRUE;
+            }
+            if (!log_async) {
+                /* Stopped while we waited */
+                return FALSE;
+            }
+            log_wake();
+            usleep(LOG_BLOCK_WAIT_US);
+        }
+        pos = log_head;
+    }
+
+    slot->priority = priority;
+    vsnprintf(slot->text, sizeof(slot->text), fmt, ap);
+
+    /* Hand it over, then see whether the consumer needs waking up */
+    __sync_synchronize();
+    slot->seq = pos + 1;
+    __sync_synchronize();
+    if (log_sleeping) {
+        log_wake();
+    }
+    return TRUE;
+}
+
+/* Only from the background thread */
+static unsigned int
+log_ring_take(log_line_t *lines, unsigned int max)
+{
+    unsigned int n = 0;
+
+    while (n < max) {
+        log_slot_t *slot = &log_ring[log_tail & (LOG_RING_SLOTS - 1)];
+
+        __sync_synchronize();
+        if ((gssize) (slot->seq - (log_tail + 1)) < 0) {
+            break;
+        }
+        __sync_synchronize();
+
+        lines[n].priority = slot->priority;
+        memcpy(lines[n].text, slot->text, strlen(slot->text) + 1);
+        n++;
+
+        /* Free for the producer one lap ahead */
+        __sync_synchronize();
+        slot->seq = log_tail + LOG_RING_SLOTS;
+        log_tail++;
+    }
+    return n;
+}
+
+static void
+log_write_batch(log_line_t *lines, unsigned int n)
+{
+    static char buffer[LOG_BATCH_MAX * (LOG_LINE_MAX + 1)];
+    size_t len = 0;
+    unsigned int lpc;
+
+    if (!mh_stderr_enabled) {
+        for (lpc = 0; lpc < n; lpc++) {
+            log_write_line(lines[lpc].priority, lines[lpc].text);
+        }
+        return;
+    }
+
+    /* In one write, stderr isn't buffered */
+    for (lpc = 0; lpc < n; lpc++) {
+        size_t line_len = strlen(lines[lpc].text);
+
+        memcpy(buffer + len, lines[lpc].text, line_len);
+        len += line_len;
+        buffer[len++] = '\n';
+    }
+    fwrite(buffer, 1, len, stderr);
+    __sync_fetch_and_add(&log_stats.written, n);
+}
+
+static void *
+log_thread_main(void *user_data)
+{
+    static log_line_t lines[LOG_BATCH_MAX];
+    uint64_t dropped_reported = log_stats.dropped;
+
+    while (TRUE) {
+        unsigned int n = log_ring_take(lines, LOG_BATCH_MAX);
+        uint64_t dropped = log_stats.dropped;
+
+        if (n > 0) {
+            log_write_batch(lines, n);
+
+            pthread_mutex_lock(&log_lock);
+            log_written = log_tail;
+            pthread_cond_broadcast(&log_flushed);
+            pthread_mutex_unlock(&log_lock);
+            continue;
+        }
+
+        if (dropped != dropped_reported) {
+            char line[128];
+
+            snprintf(line, sizeof(line), "%" PRIu64 " log messages were"
+                     " dropped, the log buffer was full",
+                     dropped - dropped_reported);
+            log_write_line(LOG_WARNING, line);
+            dropped_reported = dropped;
+        }
+
+        if (!log_async) {
+            break;
+        }
+
+        pthread_mutex_lock(&log_lock);
+        log_sleeping = 1;
+        __sync_synchronize();
+        if ((gssize) (log_ring[log_tail & (LOG_RING_SLOTS - 1)].seq
+                      - (log_tail + 1)) < 0 && log_async) {
+            struct timespec deadline;
+
+            /* Producers wake us up, this is only a safety net */
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec++;
+            pthread_cond_timedwait(&log_wakeup, &log_lock, &deadline);
+        }
+        log_sleeping = 0;
+        pthread_mutex_unlock(&log_lock);
+    }
+
+    return NULL;
+}
+
+/* The thread is gone in a forked child, and the locks may be held */
+static void
+log_atfork_child(void)
+{
+    log_async = FALSE;
+    log_sleeping = 0;
+    pthread_mutex_init(&log_lock, NULL);
+    pthread_cond_init(&log_wakeup, NULL);
+    pthread_cond_init(&log_flushed, NULL);
+}
+#endif
+
+gboolean
+mh_log_async_start(enum mh_log_overflow overflow)
+{
+#ifdef __linux__
+    static gboolean registered = FALSE;
+    gsize lpc;
+    int rc;
+
+    log_overflow = overflow;
+    if (log_async) {
+        return TRUE;
+    }
+
+    if (log_ring == NULL) {
+        log_ring = calloc(LOG_RING_SLOTS, sizeof(log_slot_t));
+        if (log_ring == NULL) {
+            return FALSE;
+        }
+    }
+
+    /* Anything left over from before a fork is somebody else's */
+    log_head = log_tail = log_written = 0;
+    for (lpc = 0; lpc < LOG_RING_SLOTS; lpc++) {
+        log_ring[lpc].seq = lpc;
+    }
+
+    log_async = TRUE;
+    __sync_synchronize();
+    rc = pthread_create(&log_thread, NULL, log_thread_main, NULL);
+    if (rc != 0) {
+        log_async = FALSE;
+        errno = rc;
+        mh_perror(LOG_ERR, "Could not start the logging thread");
+        return FALSE;
+    }
+
+    if (!registered) {
+        pthread_atfork(NULL, NULL, log_atfork_child);
+        atexit(mh_log_async_stop);
+        registered = TRUE;
+    }
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+void
+mh_log_async_stop(void)
+{
+#ifdef __linux__
+    if (!log_async || pthread_equal(pthread_self(), log_thread)) {
+        return;
+    }
+
+    /* The thread writes out what is left before going away */
+    log_async = FALSE;
+    log_wake();
+    pthread_join(log_thread, NULL);
+#endif
+}
+
+void
+mh_log_flush(void)
+{
+#ifdef __linux__
+    struct timespec deadline;
+    gsize target;
+
+    if (!log_async || pthread_equal(pthread_self(), log_thread)) {
+        return;
+    }
+
+    target = log_head;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += LOG_FLUSH_TIMEOUT_S;
+
+    pthread_mutex_lock(&log_lock);
+    pthread_cond_signal(&log_wakeup);
+    while ((gssize) (log_written - target) < 0) {
+        if (pthread_cond_timedwait(&log_flushed, &log_lock,
+                                   &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&log_lock);
+#endif
+}
+
+void
+mh_log_ratelimit(unsigned int burst, unsigned int interval_s)
+{
+    ratelimit_interval_us = (gint64) interval_s * G_USEC_PER_SEC;
+    ratelimit_burst = interval_s ? burst : 0;
+}
+
+void
+mh_log_get_stats(struct mh_log_stats *stats)
+{
+    stats->written = log_stats.written;
+    stats->dropped = log_stats.dropped;
+    stats->suppressed = log_stats.suppressed;
+}
+
+/*
+ * Whether a message from the call site using fmt may go through
+ *
+ * Sites sharing a slot take it over from each other, which only resets
+ * their count early.
+ */
+static gboolean
+ratelimit_pass(const char *fmt, unsigned int *suppressed)
+{
+    gsize hash = (gsize) fmt;
+    ratelimit_site_t *site = NULL;
+    gint64 now = g_get_monotonic_time();
+    gboolean pass;
+
+    hash ^= hash >> 12;
+    site = &ratelimit_sites[(hash >> 3) & (RATELIMIT_SITES - 1)];
+
+    while (__sync_lock_test_and_set(&site->lock, 1)) {
+        /* Only held for a few instructions */
+    }
+
+    if (site->fmt != fmt || now >= site->window_end) {
+        if (site->fmt == fmt) {
+            *suppressed = site->suppressed;
+        }
+        site->fmt = fmt;
+        site->window_end = now + ratelimit_interval_us;
+        site->count = 0;
+        site->suppressed = 0;
+    }
+
+    pass = (++site->count <= ratelimit_burst);
+    if (!pass) {
+        site->suppressed++;
+    }
+    __sync_lock_release(&site->lock);
+
+    if (!pass) {
+        __sync_fetch_and_add(&log_stats.suppressed, 1);
+    }
+    return pass;
+}
+
+static void
+log_line(int priority, const char *fmt, ...) G_GNUC_PRINTF(2, 3);
+
+static void
+log_line(int priority, const char *fmt, ...)
+{
+    va_list ap;
+
+#ifdef __linux__
+    va_start(ap, fmt);
+    if (log_ring_push(priority, fmt, ap)) {
+        va_end(ap);
+        return;
+    }
+    va_end(ap);
+#endif
+
+    va_start(ap, fmt);
+    log_vwrite(priority, fmt, ap);
+    va_end(ap);
+}
+
+void
+mh_enable_stderr(gboolean to_stderr)
+{
+    mh_stderr_enabled = to_stderr;
+}
+
+void
+mh_log_fn(int priority, const char * fmt, ...)
+{
+    va_list ap;
+    unsigned int suppressed = 0;
+
+    if (ratelimit_burst && priority > LOG_CRIT
+        && !ratelimit_pass(fmt, &suppressed)) {
+        return;
+    }
+
+    if (suppressed) {
+        log_line(LOG_WARNING, "%u messages like \"%s\" were suppressed",
+                 suppressed, fmt);
+    }
+
+#ifdef __linux__
+    va_start(ap, fmt);
+    if (log_ring_push(priority, fmt, ap)) {
+        va_end(ap);
+        return;
+    }
+    va_end(ap);
+#endif
+
+    va_start(ap, fmt);
+    log_vwrite(priority, fmt, ap);
+    va_end(ap);
+}
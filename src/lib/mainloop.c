@@ -18,15 +18,23 @@
 
 #include "config.h"
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <errno.h>
-#include <signal.h>
 #include <time.h>
+#include <unistd.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#endif
 
 #if __linux__
 #include <sys/wait.h>
 #include <sys/times.h>
+#include <sys/syscall.h>
+#include <sys/signalfd.h>
 #endif
 
 #include "matahari/mainloop.h"
@@ -34,6 +42,161 @@
 
 static GHashTable *mainloop_process_table = NULL;
 
+/*
+ * Dispatch accounting
+ *
+ * Off until mainloop_dispatch_accounting() is called, after which each
+ * dispatch of a source created here is timed.  Entries go away with their
+ * source, so what is reported is about the sources still around.
+ */
+typedef struct dispatch_entry_s {
+    mainloop_dispatch_stats_t stats;
+    char *name;
+} dispatch_entry_t;
+
+static GHashTable *dispatch_table = NULL; /* GSource * -> dispatch_entry_t */
+static gint64 dispatch_slow_us = 0;
+
+static void
+dispatch_entry_free(gpointer data)
+{
+    dispatch_entry_t *entry = data;
+
+    g_free(entry->name);
+    g_free(entry);
+}
+
+#ifndef WIN32
+static void
+dispatch_dump_signal(int sig)
+{
+    mainloop_dispatch_dump();
+}
+#endif
+
+void
+mainloop_dispatch_accounting(guint slow_ms)
+{
+    dispatch_slow_us = (gint64) slow_ms * 1000;
+    if (dispatch_table != NULL) {
+        return;
+    }
+
+    dispatch_table = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                           NULL, dispatch_entry_free);
+#ifndef WIN32
+    mainloop_add_signal(SIGUSR1, dispatch_dump_signal);
+#endif
+    mh_info("Accounting for main loop dispatches, slow ones take %ums",
+            slow_ms);
+}
+
+gint64
+mainloop_dispatch_begin(void)
+{
+    return dispatch_table ? g_get_monotonic_time() : 0;
+}
+
+void
+mainloop_dispatch_end(GSource *source, gint64 started)
+{
+    dispatch_entry_t *entry = NULL;
+    gint64 elapsed;
+
+    if (started == 0 || dispatch_table == NULL) {
+        return;
+    }
+
+    elapsed = g_get_monotonic_time() - started;
+    entry = g_hash_table_lookup(dispatch_table, source);
+    if (entry == NULL) {
+        const char *name = g_source_get_name(source);
+
+        entry = g_new0(dispatch_entry_t, 1);
+        if (name) {
+            entry->name = g_strdup(name);
+        } else {
+            entry->name = g_strdup_printf("source %u", g_source_get_id(source));
+        }
+        g_hash_table_insert(dispatch_table, source, entry);
+    }
+
+    entry->stats.calls++;
+    entry->stats.total_us += elapsed;
+    if (elapsed > entry->stats.max_us) {
+        entry->stats.max_us = elapsed;
+    }
+
+    if (dispatch_slow_us > 0 && elapsed >= dispatch_slow_us) {
+        mh_warn("Dispatching %s took %" G_GINT64_FORMAT "ms", entry->name,
+                elapsed / 1000);
+    }
+}
+
+void
+mainloop_dispatch_forget(GSource *source)
+{
+    if (dispatch_table) {
+        g_hash_table_remove(dispatch_table, source);
+    }
+}
+
+static gint
+dispatch_entry_cmp(gconstpointer a, gconstpointer b)
+{
+    const dispatch_entry_t *ea = a;
+    const dispatch_entry_t *eb = b;
+
+    if (ea->stats.total_us != eb->stats.total_us) {
+        return ea->stats.total_us > eb->stats.total_us ? -1 : 1;
+    }
+    return strcmp(ea->name, eb->name);
+}
+
+void
+mainloop_dispatch_foreach(void (*fn)(const char *name,
+                                     const mainloop_dispatch_stats_t *stats,
+                                     gpointer user_data),
+                          gpointer user_data)
+{
+    GList *entries = NULL, *gIter = NULL;
+
+    if (dispatch_table == NULL) {
+        return;
+    }
+
+    entries = g_list_sort(g_hash_table_get_values(dispatch_table),
+                          dispatch_entry_cmp);
+    for (gIter = entries; gIter != NULL; gIter = gIter->next) {
+        dispatch_entry_t *entry = gIter->data;
+
+        fn(entry->name, &entry->stats, user_data);
+    }
+    g_list_free(entries);
+}
+
+static void
+dispatch_dump_one(const char *name, const mainloop_dispatch_stats_t *stats,
+                  gpointer user_data)
+{
+    mh_notice("  %s: %" G_GUINT64_FORMAT " calls, %" G_GUINT64_FORMAT
+              "us in all, %" G_GUINT64_FORMAT "us at most", name,
+              stats->calls, stats->total_us, stats->max_us);
+}
+
+void
+mainloop_dispatch_dump(void)
+{
+    if (dispatch_table == NULL) {
+        mh_notice("Main loop dispatches are not accounted for");
+        return;
+    }
+
+    mh_notice("Time spent dispatching %u sources:",
+              g_hash_table_size(dispatch_table));
+    mainloop_dispatch_foreach(dispatch_dump_one, NULL);
+}
+
 static gboolean
 mainloop_trigger_prepare(GSource *source, gint *timeout)
 {
@@ -53,19 +216,29 @@ mainloop_trigger_dispatch(GSource *source, GSourceFunc callback,
                           gpointer userdata)
 {
     mainloop_trigger_t *trig = (mainloop_trigger_t *) source;
+    gint64 started = mainloop_dispatch_begin();
+    gboolean rc = TRUE;
+
     trig->trigger = FALSE;
 
     if (callback) {
-        return callback(trig->user_data);
+        rc = callback(trig->user_data);
     }
-    return TRUE;
+    mainloop_dispatch_end(source, started);
+    return rc;
+}
+
+static void
+mainloop_trigger_finalize(GSource *source)
+{
+    mainloop_dispatch_forget(source);
 }
 
 static GSourceFuncs mainloop_trigger_funcs = {
     mainloop_trigger_prepare,
     mainloop_trigger_check,
     mainloop_trigger_dispatch,
-    NULL
+    mainloop_trigger_finalize
 };
 
 static mainloop_trigger_t *
@@ -121,26 +294,46 @@ mainloop_destroy_trigger(mainloop_trigger_t *source)
     return TRUE;
 }
 
-typedef struct signal_s {
-        mainloop_trigger_t trigger; /**< must be first */
-        void (*handler)(int sig);
-        int signal;
-} mainloop_signal_t;
+/*
+ * Signals are turned into something the main loop can poll, so that
+ * their handlers run as soon as they arrive rather than whenever some
+ * other source wakes the loop up.
+ *
+ * On Linux, signals we handle are blocked and read from a signalfd.
+ * Threads started before a signal was added still have it unblocked
+ * though, and the kernel delivers it to one of those if there are any.
+ * For them, as everywhere else, a handler writes the signal number down
+ * a pipe.
+ */
+typedef struct signal_source_s {
+    GSource source;         /**< must be first */
+    GPollFD pipe;           /**< read end of the self-pipe */
+#if __linux__
+    GPollFD sigfd;
+    sigset_t mask;          /**< what sigfd is for */
+#endif
+    gboolean installed[NSIG];
+    gboolean pending[NSIG];
+    void (*handlers[NSIG])(int sig);
+} signal_source_t;
+
+static signal_source_t *mainloop_signals = NULL;
+static int mainloop_signal_pipe[2] = { -1, -1 };
 
-static mainloop_signal_t *mainloop_signals[NSIG];
+#ifdef WIN32
+/*
+ * There is no pipe to poll here, so each signal sets a trigger instead,
+ * and its handler runs from the main loop like everywhere else.
+ */
+static mainloop_trigger_t *mainloop_signal_triggers[NSIG];
 
 static gboolean
-mainloop_signal_dispatch(GSource *source, GSourceFunc callback,
-                         gpointer userdata)
+mainloop_signal_trigger_dispatch(gpointer user_data)
 {
-    mainloop_signal_t *sig = (mainloop_signal_t *) source;
-#if __linux__
-    mh_info("Invoking handler for signal %d: %s",
-            sig->signal, strsignal(sig->signal));
-#endif
-    sig->trigger.trigger = FALSE;
-    if (sig->handler) {
-        sig->handler(sig->signal);
+    int sig = GPOINTER_TO_INT(user_data);
+
+    if (mainloop_signals->handlers[sig]) {
+        mainloop_signals->handlers[sig](sig);
     }
     return TRUE;
 }
@@ -148,18 +341,216 @@ mainloop_signal_dispatch(GSource *source, GSourceFunc callback,
 static void
 mainloop_signal_handler(int sig)
 {
-    if (sig > 0 && sig < NSIG && mainloop_signals[sig] != NULL) {
-        mainloop_set_trigger((mainloop_trigger_t *) mainloop_signals[sig]);
+    if (sig > 0 && sig < NSIG && mainloop_signal_triggers[sig] != NULL) {
+        mainloop_set_trigger(mainloop_signal_triggers[sig]);
     }
 }
 
+static gboolean
+mainloop_signal_setup(void)
+{
+    if (mainloop_signals == NULL) {
+        mainloop_signals = g_new0(signal_source_t, 1);
+    }
+    return TRUE;
+}
+#endif
+
+#ifndef WIN32
+static gboolean
+mainloop_signal_prepare(GSource *source, gint *timeout)
+{
+    return FALSE;
+}
+
+static gboolean
+mainloop_signal_check(GSource *source)
+{
+    signal_source_t *signals = (signal_source_t *) source;
+
+#if __linux__
+    if (signals->sigfd.revents) {
+        return TRUE;
+    }
+#endif
+    return signals->pipe.revents != 0;
+}
+
+static void
+mainloop_signal_invoke(signal_source_t *signals, int sig)
+{
+    signals->pending[sig] = FALSE;
+    if (!signals->installed[sig]) {
+        /* Removed after it arrived */
+        return;
+    }
+
+#if __linux__
+    mh_info("Invoking handler for signal %d: %s", sig, strsignal(sig));
+#endif
+    if (signals->handlers[sig]) {
+        signals->handlers[sig](sig);
+    }
+}
+
+static gboolean
+mainloop_signal_dispatch(GSource *source, GSourceFunc callback,
+                         gpointer userdata)
+{
+    signal_source_t *signals = (signal_source_t *) source;
+    gint64 started = mainloop_dispatch_begin();
+    unsigned char sigs[64];
+    ssize_t len, lpc;
+    int sig;
+
+    /* Collect everything that arrived before running any handler */
+#if __linux__
+    if (signals->sigfd.revents) {
+        struct signalfd_siginfo info[16];
+
+        signals->sigfd.revents = 0;
+        while ((len = read(signals->sigfd.fd, info, sizeof(info))) > 0) {
+            for (lpc = 0; lpc < len / (ssize_t) sizeof(info[0]); lpc++) {
+                if (info[lpc].ssi_signo < NSIG) {
+                    signals->pending[info[lpc].ssi_signo] = TRUE;
+                }
+            }
+        }
+    }
+#endif
+
+    if (signals->pipe.revents) {
+        signals->pipe.revents = 0;
+        while ((len = read(signals->pipe.fd, sigs, sizeof(sigs))) > 0) {
+            for (lpc = 0; lpc < len; lpc++) {
+                if (sigs[lpc] < NSIG) {
+                    signals->pending[sigs[lpc]] = TRUE;
+                }
+            }
+        }
+    }
+
+    /* TERM is handled before anything else */
+    if (signals->pending[SIGTERM]) {
+        mainloop_signal_invoke(signals, SIGTERM);
+    }
+    for (sig = 1; sig < NSIG; sig++) {
+        if (signals->pending[sig]) {
+            mainloop_signal_invoke(signals, sig);
+        }
+    }
+
+    mainloop_dispatch_end(source, started);
+    return TRUE;
+}
+
 static GSourceFuncs mainloop_signal_funcs = {
-    mainloop_trigger_prepare,
-    mainloop_trigger_check,
+    mainloop_signal_prepare,
+    mainloop_signal_check,
     mainloop_signal_dispatch,
     NULL
 };
 
+static void
+mainloop_signal_handler(int sig)
+{
+    int saved_errno = errno;
+    unsigned char byte = sig;
+
+    /* If the pipe is full, the loop has a wakeup coming anyway */
+    if (write(mainloop_signal_pipe[1], &byte, 1) < 0) {
+        /* Nothing we can safely do about it here */
+    }
+    errno = saved_errno;
+}
+
+static gboolean
+mainloop_signal_setup(void)
+{
+    GSource *source = NULL;
+    int lpc;
+
+    if (mainloop_signals != NULL) {
+        return TRUE;
+    }
+
+    if (pipe(mainloop_signal_pipe) < 0) {
+        mh_perror(LOG_ERR, "Could not create the signal pipe");
+        return FALSE;
+    }
+    for (lpc = 0; lpc < 2; lpc++) {
+        fcntl(mainloop_signal_pipe[lpc], F_SETFL,
+              fcntl(mainloop_signal_pipe[lpc], F_GETFL) | O_NONBLOCK);
+        fcntl(mainloop_signal_pipe[lpc], F_SETFD, FD_CLOEXEC);
+    }
+
+    MH_ASSERT(sizeof(signal_source_t) > sizeof(GSource));
+    source = g_source_new(&mainloop_signal_funcs, sizeof(signal_source_t));
+    mainloop_signals = (signal_source_t *) source;
+    memset(mainloop_signals->installed, 0, sizeof(mainloop_signals->installed));
+    memset(mainloop_signals->pending, 0, sizeof(mainloop_signals->pending));
+    memset(mainloop_signals->handlers, 0, sizeof(mainloop_signals->handlers));
+
+    mainloop_signals->pipe.fd = mainloop_signal_pipe[0];
+    mainloop_signals->pipe.events = G_IO_IN;
+    mainloop_signals->pipe.revents = 0;
+    g_source_add_poll(source, &mainloop_signals->pipe);
+
+#if __linux__
+    sigemptyset(&mainloop_signals->mask);
+    mainloop_signals->sigfd.fd = signalfd(-1, &mainloop_signals->mask,
+                                          SFD_NONBLOCK | SFD_CLOEXEC);
+    mainloop_signals->sigfd.events = G_IO_IN;
+    mainloop_signals->sigfd.revents = 0;
+    if (mainloop_signals->sigfd.fd < 0) {
+        mh_perror(LOG_WARNING, "signalfd() failed, signals will go through"
+                  " a pipe only");
+    } else {
+        g_source_add_poll(source, &mainloop_signals->sigfd);
+    }
+#endif
+
+    /*
+     * Signals are higher priority than other ipc.
+     * Yes, minus: smaller is "higher"
+     */
+    g_source_set_name(source, "signals");
+    g_source_set_priority(source, G_PRIORITY_HIGH - 2);
+    g_source_set_can_recurse(source, FALSE);
+    g_source_attach(source, NULL);
+    return TRUE;
+}
+
+#if __linux__
+/* Move sig between the signalfd and the handler */
+static void
+mainloop_signal_route(int sig, gboolean to_fd)
+{
+    sigset_t one;
+
+    if (mainloop_signals->sigfd.fd < 0) {
+        return;
+    }
+
+    if (to_fd) {
+        sigaddset(&mainloop_signals->mask, sig);
+    } else {
+        sigdelset(&mainloop_signals->mask, sig);
+    }
+    if (signalfd(mainloop_signals->sigfd.fd, &mainloop_signals->mask, 0) < 0) {
+        mh_perror(LOG_ERR, "Could not update the signalfd for signal %d", sig);
+    }
+
+    sigemptyset(&one);
+    sigaddset(&one, sig);
+    if (sigprocmask(to_fd ? SIG_BLOCK : SIG_UNBLOCK, &one, NULL) < 0) {
+        mh_perror(LOG_ERR, "Could not %s signal %d",
+                  to_fd ? "block" : "unblock", sig);
+    }
+}
+#endif
+#endif
+
 gboolean
 mainloop_signal(int sig, void (*dispatch)(int sig))
 {
@@ -194,54 +585,49 @@ mainloop_signal(int sig, void (*dispatch)(int sig))
 gboolean
 mainloop_add_signal(int sig, void (*dispatch)(int sig))
 {
-    GSource *source = NULL;
-    int priority = G_PRIORITY_HIGH - 1;
-    if (sig == SIGTERM) {
-        /* TERM is higher priority than other signals,
-         *   signals are higher priority than other ipc.
-         * Yes, minus: smaller is "higher"
-         */
-        priority--;
-    }
-
-    if (sig >= NSIG || sig < 0) {
+    if (sig >= NSIG || sig <= 0) {
         mh_err("Signal %d is out of range", sig);
         return FALSE;
 
-    } else if (mainloop_signals[sig] != NULL) {
+    } else if (mainloop_signals != NULL && mainloop_signals->installed[sig]) {
         mh_err("Signal handler for %d is already installed", sig);
         return FALSE;
     }
 
-    MH_ASSERT(sizeof(mainloop_signal_t) > sizeof(GSource));
-    source = g_source_new(&mainloop_signal_funcs, sizeof(mainloop_signal_t));
-
-    mainloop_signals[sig] = (mainloop_signal_t *) mainloop_setup_trigger(
-            source, priority, NULL, NULL);
-    if (mainloop_signals[sig] == NULL) {
+    if (mainloop_signal_setup() == FALSE) {
         return FALSE;
     }
 
-    mainloop_signals[sig]->handler = dispatch;
-    mainloop_signals[sig]->signal = sig;
+    mainloop_signals->handlers[sig] = dispatch;
+    mainloop_signals->installed[sig] = TRUE;
 
-    if (mainloop_signal(sig, mainloop_signal_handler) == FALSE) {
-        mainloop_signal_t *tmp = mainloop_signals[sig];
-        mainloop_signals[sig] = NULL;
+#ifdef WIN32
+    /* TERM is higher priority than other signals, as on the signal source */
+    mainloop_signal_triggers[sig] = mainloop_add_trigger(
+        sig == SIGTERM ? G_PRIORITY_HIGH - 2 : G_PRIORITY_HIGH - 1,
+        mainloop_signal_trigger_dispatch, GINT_TO_POINTER(sig));
+#endif
 
-        mainloop_destroy_trigger((mainloop_trigger_t *) tmp);
+    if (mainloop_signal(sig, mainloop_signal_handler) == FALSE) {
+#ifdef WIN32
+        mainloop_destroy_trigger(mainloop_signal_triggers[sig]);
+        mainloop_signal_triggers[sig] = NULL;
+#endif
+        mainloop_signals->installed[sig] = FALSE;
+        mainloop_signals->handlers[sig] = NULL;
         return FALSE;
     }
 
+#if __linux__
+    mainloop_signal_route(sig, TRUE);
+#endif
     return TRUE;
 }
 
 gboolean
 mainloop_destroy_signal(int sig)
 {
-    mainloop_signal_t *tmp = NULL;
-
-    if (sig >= NSIG || sig < 0) {
+    if (sig >= NSIG || sig <= 0) {
         mh_err("Signal %d is out of range", sig);
         return FALSE;
 
@@ -250,13 +636,20 @@ mainloop_destroy_signal(int sig)
                   sig);
         return FALSE;
 
-    } else if (mainloop_signals[sig] == NULL) {
+    } else if (mainloop_signals == NULL || !mainloop_signals->installed[sig]) {
         return TRUE;
     }
 
-    tmp = mainloop_signals[sig];
-    mainloop_signals[sig] = NULL;
-    mainloop_destroy_trigger((mainloop_trigger_t *) tmp);
+#if __linux__
+    mainloop_signal_route(sig, FALSE);
+#endif
+#ifdef WIN32
+    mainloop_destroy_trigger(mainloop_signal_triggers[sig]);
+    mainloop_signal_triggers[sig] = NULL;
+#endif
+    mainloop_signals->installed[sig] = FALSE;
+    mainloop_signals->handlers[sig] = NULL;
+    mainloop_signals->pending[sig] = FALSE;
     return TRUE;
 }
 
@@ -280,6 +673,9 @@ static gboolean
 mainloop_fd_dispatch(GSource *source, GSourceFunc callback, gpointer userdata)
 {
     mainloop_fd_t *trig = (mainloop_fd_t *) source;
+    gint64 started = mainloop_dispatch_begin();
+    gboolean rc = TRUE;
+
     mh_trace("%p", source);
     /*
      * Is output now unblocked?
@@ -291,13 +687,16 @@ mainloop_fd_dispatch(GSource *source, GSourceFunc callback, gpointer userdata)
         trig->gpoll.events &= ~G_IO_OUT;
     }
 
-    if (trig->dispatch != NULL
-        && trig->dispatch(trig->gpoll.fd, trig->user_data) == FALSE) {
+    if (trig->dispatch != NULL) {
+        rc = trig->dispatch(trig->gpoll.fd, trig->user_data);
+    }
+    mainloop_dispatch_end(source, started);
+
+    if (rc == FALSE) {
         g_source_remove_poll(source, &trig->gpoll);
         g_source_unref(source); /* Really? */
-        return FALSE;
     }
-    return TRUE;
+    return rc;
 }
 
 static void
@@ -306,6 +705,7 @@ mainloop_fd_destroy(GSource *source)
     mainloop_fd_t *trig = (mainloop_fd_t *) source;
     mh_trace("%p", source);
 
+    mainloop_dispatch_forget(source);
     if (trig->dnotify) {
         trig->dnotify(trig->user_data);
     }
@@ -325,6 +725,8 @@ mainloop_add_fd(int priority, int fd,
 {
     GSource *source = NULL;
     mainloop_fd_t *fd_source = NULL;
+    char name[32];
+
     MH_ASSERT(sizeof(mainloop_fd_t) > sizeof(GSource));
     source = g_source_new(&mainloop_fd_funcs, sizeof(mainloop_fd_t));
     MH_ASSERT(source != NULL);
@@ -344,6 +746,10 @@ mainloop_add_fd(int priority, int fd,
     fd_source->dispatch = dispatch;
     fd_source->user_data = userdata;
 
+    /* Callers can give it a better name */
+    snprintf(name, sizeof(name), "fd %d", fd);
+    g_source_set_name(source, name);
+
     g_source_set_priority(source, priority);
     g_source_set_can_recurse(source, FALSE);
     g_source_add_poll(source, &fd_source->gpoll);
@@ -363,48 +769,353 @@ mainloop_destroy_fd(mainloop_fd_t *source)
     return TRUE;
 }
 
-static gboolean
-child_timeout_callback(gpointer p)
+/* How long to wait for a child to go away after we sent it SIGKILL */
+#define CHILD_KILL_GRACE_MS 5000
+
+typedef struct child_watch_s {
+    mainloop_child_t child; /**< must be first */
+    GPollFD gpoll;          /**< pidfd, gpoll.fd is -1 if there is none */
+    long long deadline;     /**< ms, 0 if the child has no timeout */
+    GSequenceIter *deadline_iter;
+#if __linux__
+    struct rusage rusage;   /**< see mainloop_child_rusage() */
+#endif
+} child_watch_t;
+
+typedef struct child_source_s {
+    GSource source;         /**< must be first */
+    GSequence *deadlines;   /**< child_watch_t, soonest deadline first */
+    gboolean have_pidfd;
+    unsigned long reaped;
+    unsigned long unmanaged;
+} child_source_t;
+
+static child_source_t *mainloop_children = NULL;
+/* Not above the output pipes until told otherwise, see services_linux.c */
+static int mainloop_children_priority = G_PRIORITY_LOW;
+
+static long long
+mainloop_now_ms(void)
 {
-    pid_t pid = (pid_t) GPOINTER_TO_INT(p);
-    mainloop_child_t *pinfo = (mainloop_child_t *) g_hash_table_lookup(
-            mainloop_process_table, p);
+#if __linux__
+    struct timespec ts;
 
-    if (pinfo == NULL) {
-        return FALSE;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((long long) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+#else
+    GTimeVal tv;
+
+    g_get_current_time(&tv);
+    return ((long long) tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+#endif
+}
+
+static int
+child_pidfd_open(pid_t pid)
+{
+#if __linux__ && defined(SYS_pidfd_open)
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static gint
+child_deadline_cmp(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    const child_watch_t *wa = a;
+    const child_watch_t *wb = b;
+
+    if (wa->deadline != wb->deadline) {
+        return wa->deadline < wb->deadline ? -1 : 1;
+    }
+    return wa->child.pid - wb->child.pid;
+}
+
+static void
+child_set_deadline(child_watch_t *watch, long long deadline)
+{
+    if (watch->deadline_iter) {
+        g_sequence_remove(watch->deadline_iter);
+        watch->deadline_iter = NULL;
     }
 
-    pinfo->timerid = 0;
+    watch->deadline = deadline;
+    if (deadline > 0) {
+        watch->deadline_iter = g_sequence_insert_sorted(
+            mainloop_children->deadlines, watch, child_deadline_cmp, NULL);
+    }
+}
+
+static void
+mainloop_child_destroy(gpointer data)
+{
+    child_watch_t *watch = data;
+
+    child_set_deadline(watch, 0);
+
+    if (watch->gpoll.fd >= 0) {
+        g_source_remove_poll((GSource *) mainloop_children, &watch->gpoll);
+        close(watch->gpoll.fd);
+        watch->gpoll.fd = -1;
+    }
+
+    free(watch->child.desc);
+    g_free(watch);
+}
+
+static void
+child_timed_out(child_watch_t *watch)
+{
+    mainloop_child_t *pinfo = &watch->child;
+
+    child_set_deadline(watch, 0);
+
     if (pinfo->timeout) {
-        mh_crit("%s process (PID %d) will not die!", pinfo->desc, (int)pid);
-        return FALSE;
+        mh_crit("%s process (PID %d) will not die!", pinfo->desc,
+                (int) pinfo->pid);
+        return;
     }
 
     pinfo->timeout = TRUE;
-    mh_warn("%s process (PID %d) timed out", pinfo->desc, (int)pid);
+    mh_warn("%s process (PID %d) timed out", pinfo->desc, (int) pinfo->pid);
 
 #if __linux__
     if (kill(pinfo->pid, SIGKILL) < 0) {
         if (errno == ESRCH) {
             /* Nothing left to do */
-            return FALSE;
+            return;
         }
-        mh_perror(LOG_ERR, "kill(%d, KILL) failed", pid);
+        mh_perror(LOG_ERR, "kill(%d, KILL) failed", (int) pinfo->pid);
     }
 
-    pinfo->timerid = g_timeout_add(5000, child_timeout_callback, p);
+    child_set_deadline(watch, mainloop_now_ms() + CHILD_KILL_GRACE_MS);
 #endif
+}
+
+#if __linux__
+const struct rusage *
+mainloop_child_rusage(mainloop_child_t *p)
+{
+    return &((child_watch_t *) p)->rusage;
+}
+
+/*
+ * Report the death of a tracked child and stop tracking it
+ */
+static void
+child_finished(child_watch_t *watch, int status, struct rusage *rusage)
+{
+    mainloop_child_t *p = &watch->child;
+    pid_t pid = abs(p->pid);
+    int signo = 0, exitcode = 0;
+
+    if (WIFEXITED(status)) {
+        exitcode = WEXITSTATUS(status);
+        mh_trace("Managed process %d (%s) exited with rc=%d", pid,
+                 p->desc, exitcode);
+
+    } else if (WIFSIGNALED(status)) {
+        signo = WTERMSIG(status);
+        mh_trace("Managed process %d (%s) exited with signal=%d", pid,
+                 p->desc, signo);
+    }
+#ifdef WCOREDUMP
+    if (WCOREDUMP(status)) {
+        mh_err("Managed process %d (%s) dumped core", pid, p->desc);
+    }
+#endif
+
+    watch->rusage = *rusage;
+    mainloop_children->reaped++;
+
+    child_set_deadline(watch, 0);
+    p->callback(p, status, signo, exitcode);
+    g_hash_table_remove(mainloop_process_table, GINT_TO_POINTER(pid));
+    mh_trace("Removed process entry for %d", pid);
+}
+
+/*
+ * Reap every child whose pidfd has fired
+ *
+ * Children are collected first and reported afterwards so that callbacks
+ * are free to add (or remove) children of their own.
+ */
+static void
+child_reap_ready(void)
+{
+    GHashTableIter iter;
+    gpointer value = NULL;
+    GList *batch = NULL, *gIter = NULL;
+
+    g_hash_table_iter_init(&iter, mainloop_process_table);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        child_watch_t *watch = value;
+
+        if (watch->gpoll.fd >= 0 && watch->gpoll.revents) {
+            watch->gpoll.revents = 0;
+            batch = g_list_prepend(batch,
+                                   GINT_TO_POINTER(abs(watch->child.pid)));
+        }
+    }
+
+    for (gIter = batch; gIter != NULL; gIter = gIter->next) {
+        child_watch_t *watch = g_hash_table_lookup(mainloop_process_table,
+                                                   gIter->data);
+        struct rusage rusage;
+        int status = 0;
+        pid_t rc;
+
+        if (watch == NULL) {
+            /* Already reaped by an earlier callback in this batch */
+            continue;
+        }
+
+        memset(&rusage, 0, sizeof(rusage));
+        do {
+            rc = wait4(GPOINTER_TO_INT(gIter->data), &status, WNOHANG,
+                       &rusage);
+        } while (rc < 0 && errno == EINTR);
+
+        if (rc > 0) {
+            child_finished(watch, status, &rusage);
+
+        } else if (rc < 0 && errno != ECHILD) {
+            mh_perror(LOG_ERR, "wait4(%d) failed", (int) watch->child.pid);
+        }
+    }
+
+    if (batch) {
+        mh_trace("Reaped %u children in one pass", g_list_length(batch));
+    }
+    g_list_free(batch);
+}
+#endif
+
+static gboolean
+mainloop_child_prepare(GSource *source, gint *timeout)
+{
+    child_source_t *children = (child_source_t *) source;
+    GSequenceIter *first = g_sequence_get_begin_iter(children->deadlines);
+    long long remaining;
+
+    if (g_sequence_iter_is_end(first)) {
+        *timeout = -1;
+        return FALSE;
+    }
+
+    remaining = ((child_watch_t *) g_sequence_get(first))->deadline
+                - mainloop_now_ms();
+    if (remaining <= 0) {
+        *timeout = 0;
+        return TRUE;
+    }
+
+    *timeout = remaining > G_MAXINT ? G_MAXINT : (gint) remaining;
     return FALSE;
 }
 
+static gboolean
+mainloop_child_check(GSource *source)
+{
+    child_source_t *children = (child_source_t *) source;
+    GSequenceIter *first = g_sequence_get_begin_iter(children->deadlines);
+    GHashTableIter iter;
+    gpointer value = NULL;
+
+    if (!g_sequence_iter_is_end(first)
+        && ((child_watch_t *) g_sequence_get(first))->deadline
+           <= mainloop_now_ms()) {
+        return TRUE;
+    }
+
+    g_hash_table_iter_init(&iter, mainloop_process_table);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        if (((child_watch_t *) value)->gpoll.revents) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static gboolean
+mainloop_child_dispatch(GSource *source, GSourceFunc callback,
+                        gpointer userdata)
+{
+    child_source_t *children = (child_source_t *) source;
+    gint64 started = mainloop_dispatch_begin();
+    long long now;
+
+#if __linux__
+    child_reap_ready();
+#endif
+
+    now = mainloop_now_ms();
+    while (TRUE) {
+        GSequenceIter *first = g_sequence_get_begin_iter(children->deadlines);
+        child_watch_t *watch;
+
+        if (g_sequence_iter_is_end(first)) {
+            break;
+        }
+
+        watch = g_sequence_get(first);
+        if (watch->deadline > now) {
+            break;
+        }
+        child_timed_out(watch);
+    }
+
+    mainloop_dispatch_end(source, started);
+    return TRUE;
+}
+
+static GSourceFuncs mainloop_child_funcs = {
+    mainloop_child_prepare,
+    mainloop_child_check,
+    mainloop_child_dispatch,
+    NULL
+};
+
 static void
-mainloop_child_destroy(gpointer data)
+mainloop_setup_children(void)
 {
-    mainloop_child_t *p = data;
+    GSource *source = NULL;
+    int fd;
+
+    if (mainloop_process_table == NULL) {
+        mainloop_process_table = g_hash_table_new_full(
+            g_direct_hash, g_direct_equal, NULL, mainloop_child_destroy);
+    }
 
-    free(p->desc);
+    if (mainloop_children != NULL) {
+        return;
+    }
+
+    MH_ASSERT(sizeof(child_source_t) > sizeof(GSource));
+    source = g_source_new(&mainloop_child_funcs, sizeof(child_source_t));
+    MH_ASSERT(source != NULL);
 
-    g_free(p);
+    mainloop_children = (child_source_t *) source;
+    mainloop_children->deadlines = g_sequence_new(NULL);
+    mainloop_children->reaped = 0;
+    mainloop_children->unmanaged = 0;
+
+    /* Find out once whether the kernel knows about pidfds */
+    fd = child_pidfd_open(getpid());
+    mainloop_children->have_pidfd = (fd >= 0);
+    if (fd >= 0) {
+        close(fd);
+    } else {
+        mh_info("pidfd_open() not available (%s), children will be reaped"
+                " on SIGCHLD only", strerror(errno));
+    }
+
+    g_source_set_name(source, "children");
+    g_source_set_priority(source, mainloop_children_priority);
+    g_source_set_can_recurse(source, FALSE);
+    g_source_attach(source, NULL);
 }
 
 /* Create/Log a new tracked process
@@ -415,78 +1126,89 @@ mainloop_add_child(pid_t pid, int timeout, const char *desc, void * privatedata,
                    void (*callback)(mainloop_child_t *p, int status, int signo,
                                     int exitcode))
 {
-    mainloop_child_t *p = g_new(mainloop_child_t, 1);
+    child_watch_t *watch = g_new0(child_watch_t, 1);
+    mainloop_child_t *p = &watch->child;
 
-    if (mainloop_process_table == NULL) {
-        mainloop_process_table = g_hash_table_new_full(
-            g_direct_hash, g_direct_equal, NULL, mainloop_child_destroy);
-    }
+    mainloop_setup_children();
 
     p->pid = pid;
-    p->timerid = 0;
     p->timeout = FALSE;
     p->desc = strdup(desc);
     p->privatedata = privatedata;
     p->callback = callback;
 
+    watch->gpoll.fd = -1;
+    watch->deadline_iter = NULL;
+
+    if (mainloop_children->have_pidfd) {
+        watch->gpoll.fd = child_pidfd_open(abs(pid));
+        if (watch->gpoll.fd >= 0) {
+            watch->gpoll.events = G_IO_IN;
+            watch->gpoll.revents = 0;
+            g_source_add_poll((GSource *) mainloop_children, &watch->gpoll);
+
+        } else {
+            mh_perror(LOG_WARNING, "pidfd_open(%d) failed", (int) abs(pid));
+        }
+    }
+
     if (timeout) {
-        p->timerid = g_timeout_add(
-            timeout, child_timeout_callback, GINT_TO_POINTER(pid));
+        child_set_deadline(watch, mainloop_now_ms() + timeout);
     }
 
-    g_hash_table_insert(mainloop_process_table, GINT_TO_POINTER(abs(pid)), p);
+    g_hash_table_insert(mainloop_process_table, GINT_TO_POINTER(abs(pid)),
+                        watch);
 }
 
 #if __linux__
+/*
+ * Reap everything that has exited
+ *
+ * Children we don't know about are reaped as well (and counted) so that
+ * they don't linger as zombies.
+ */
 static void
 child_death_dispatch(int sig)
 {
-    int status = 0;
+    unsigned int batch = 0;
+
     while (TRUE) {
-        pid_t pid = wait3(&status, WNOHANG, NULL);
-        if (pid > 0) {
-            int signo = 0, exitcode = 0;
-
-            mainloop_child_t *p = g_hash_table_lookup(mainloop_process_table,
-                                                      GINT_TO_POINTER(pid));
-            mh_trace("Managed process %d exited: %p", pid, p);
-            if (p == NULL) {
-                continue;
-            }
+        struct rusage rusage;
+        int status = 0;
+        pid_t pid;
+        child_watch_t *watch;
 
-            if (WIFEXITED(status)) {
-                exitcode = WEXITSTATUS(status);
-                mh_trace("Managed process %d (%s) exited with rc=%d", pid,
-                         p->desc, exitcode);
+        memset(&rusage, 0, sizeof(rusage));
+        pid = wait4(-1, &status, WNOHANG, &rusage);
 
-            } else if (WIFSIGNALED(status)) {
-                signo = WTERMSIG(status);
-                mh_trace("Managed process %d (%s) exited with signal=%d", pid,
-                         p->desc, signo);
-            }
-#ifdef WCOREDUMP
-            if (WCOREDUMP(status)) {
-                mh_err("Managed process %d (%s) dumped core", pid, p->desc);
-            }
-#endif
-            if (p->timerid != 0) {
-                mh_trace("Removing timer %d", p->timerid);
-                g_source_remove(p->timerid);
-                p->timerid = 0;
-            }
-            p->callback(p, status, signo, exitcode);
-            g_hash_table_remove(mainloop_process_table, GINT_TO_POINTER(pid));
-            mh_trace("Removed process entry for %d", pid);
-            return;
+        if (pid == 0) {
+            break;
 
-        } else {
-            if (errno == EAGAIN) {
+        } else if (pid < 0) {
+            if (errno == EINTR) {
                 continue;
             } else if (errno != ECHILD) {
-                mh_perror(LOG_ERR, "wait3() failed");
+                mh_perror(LOG_ERR, "wait4() failed");
             }
             break;
         }
+
+        watch = g_hash_table_lookup(mainloop_process_table,
+                                    GINT_TO_POINTER(pid));
+        mh_trace("Managed process %d exited: %p", pid, watch);
+        if (watch == NULL) {
+            mainloop_children->unmanaged++;
+            mh_debug("Reaped unmanaged process %d (%lu so far)", pid,
+                     mainloop_children->unmanaged);
+            continue;
+        }
+
+        batch++;
+        child_finished(watch, status, &rusage);
+    }
+
+    if (batch > 1) {
+        mh_trace("Reaped %u children in one pass", batch);
     }
 }
 #endif
@@ -494,10 +1216,12 @@ child_death_dispatch(int sig)
 void
 mainloop_track_children(int priority)
 {
-    if (mainloop_process_table == NULL) {
-        mainloop_process_table = g_hash_table_new_full(
-            g_direct_hash, g_direct_equal, NULL, NULL/*TODO: Add destructor */);
+    mainloop_children_priority = priority;
+    if (mainloop_children != NULL) {
+        /* Created early by mainloop_add_child() */
+        g_source_set_priority((GSource *) mainloop_children, priority);
     }
+    mainloop_setup_children();
 
 #if __linux__
     mainloop_add_signal(SIGCHLD, child_death_dispatch);
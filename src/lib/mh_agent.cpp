@@ -28,6 +28,8 @@
 #include <sstream>
 #include <errno.h>
 #include <vector>
+#include <deque>
+#include <map>
 #include <exception>
 
 #include <signal.h>
@@ -49,7 +51,10 @@ extern "C" {
 #include "matahari/utilities.h"
 #ifndef WIN32
 #include <sys/socket.h>
+#include <sys/eventfd.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <unistd.h>
 #ifdef MH_SSL
 #include <secmod.h>
 #endif
@@ -62,6 +67,34 @@ using namespace std;
 
 typedef qpid::types::Variant::Map OptionsMap;
 
+/* QMF events handled per main loop pass, unless --qmf-batch says otherwise */
+#define QMF_BATCH_DEFAULT 32
+/* Time spent on them at most, unless --qmf-budget says otherwise */
+#define QMF_BUDGET_DEFAULT_MS 10
+/* How often the Agent object's event_batches are brought up to date,
+ * unless --qmf-report says otherwise */
+#define QMF_BATCH_REPORT_S 10
+/* Same for dns_cache */
+#define DNS_CACHE_REPORT_S 60
+
+/* Worker threads started at most, unless --workers says otherwise */
+#define OFFLOAD_DEFAULT_WORKERS 4
+
+typedef struct offload_job_s {
+    struct MatahariAgentImpl *impl;
+    qmf::AgentSession session;
+    qmf::AgentEvent event;
+    enum mh_result res;
+} offload_job_t;
+
+/* See MatahariAgent::setOffloadable(), only used from the main loop */
+typedef struct offload_method_s {
+    unsigned int limit;
+    unsigned int running;
+    std::deque<offload_job_t *> waiting;
+} offload_method_t;
+
+struct offload_pool_s;
 
 struct MatahariAgentImpl {
     GMainLoop *_mainloop;
@@ -70,10 +103,32 @@ struct MatahariAgentImpl {
     qmf::AgentSession _agent_session;
     qpid::messaging::Connection _amqp_connection;
 
+    MatahariAgent *_agent;
+    std::map<std::string, offload_method_t> _offload;
+    struct offload_pool_s *_pool;
+
     qmf::Data _agent_instance;
+    guint64 _batches_reported;
     void registerAgent(void);
+
+    /* Needed once the broker answers, see agent_connected() */
+    std::string _proc_name;
+    std::string _servername;
+    int _status;
 };
 
+static guint qmf_batch = QMF_BATCH_DEFAULT;
+static guint qmf_budget_ms = QMF_BUDGET_DEFAULT_MS;
+static guint qmf_report_s = QMF_BATCH_REPORT_S;
+
+static unsigned int offload_workers = OFFLOAD_DEFAULT_WORKERS;
+/* Limits given on the command line, they override the agent's own */
+static std::map<std::string, unsigned int> offload_limits;
+
+static bool
+offload_event(MatahariAgentImpl *impl, qmf::AgentSession session,
+              qmf::AgentEvent event);
+
 
 int print_help(int code, const char *name, const char *arg, void *userdata);
 
@@ -123,18 +178,58 @@ RegistryRead(
 }
 #endif
 
+static void
+dispatch_stats_add(const char *name, const mainloop_dispatch_stats_t *stats,
+                   gpointer user_data)
+{
+    qpid::types::Variant::List *sources = (qpid::types::Variant::List *) user_data;
+    qpid::types::Variant::Map source;
+
+    source["name"] = name;
+    source["calls"] = stats->calls;
+    source["total_us"] = stats->total_us;
+    source["max_us"] = stats->max_us;
+    sources->push_back(source);
+}
+
+/* Methods of the Agent object itself, rather than of the agent's schema */
+static gboolean
+invoke_agent(qmf::AgentSession session, qmf::AgentEvent event)
+{
+    if (event.getMethodName() == "dispatch_stats") {
+        qpid::types::Variant::List sources;
+
+        mainloop_dispatch_foreach(dispatch_stats_add, &sources);
+        event.addReturnArgument("sources", sources);
+        session.methodSuccess(event);
+
+    } else {
+        session.raiseException(event, mh_result_to_str(MH_RES_NOT_IMPLEMENTED));
+    }
+    return TRUE;
+}
+
 static gboolean
 mh_qpid_callback(qmf::AgentSession session, qmf::AgentEvent event,
                  gpointer user_data)
 {
-    MatahariAgent *agent = (MatahariAgent*) user_data;
+    MatahariAgentImpl *impl = (MatahariAgentImpl *) user_data;
     mh_trace("Qpid message recieved");
     if (event.hasDataAddr()) {
         mh_trace("Message is for %s (type: %s)",
                  event.getDataAddr().getName().c_str(),
                  event.getDataAddr().getAgentName().c_str());
     }
-    return agent->invoke(session, event, user_data);
+
+    if (event.getType() == qmf::AGENT_METHOD && event.hasDataAddr()
+        && event.getDataAddr() == impl->_agent_instance.getAddr()) {
+        return invoke_agent(session, event);
+    }
+
+    if (offload_event(impl, session, event)) {
+        return TRUE;
+    }
+    return impl->_agent->invoke(session, event, impl->_agent);
 }
 
 static void
@@ -234,13 +329,9 @@ int print_help(int code, const char *name, const char *arg, void *userdata)
     return 0;
 }
 
-qpid::messaging::Connection
-mh_connect(OptionsMap mh_options, OptionsMap amqp_options, int retry)
+static void
+krb5_renew(OptionsMap &mh_options, OptionsMap &amqp_options)
 {
-    int retries = 0;
-    int backoff = 0;
-    GList *srv_records = NULL, *cur_srv_record = NULL;
-    struct mh_dnssrv_record *record;
     GError *error = NULL;
     int status;
 
@@ -286,6 +377,13 @@ mh_connect(OptionsMap mh_options, OptionsMap amqp_options, int retry)
             }
         }
     }
+}
+
+/* The SRV query for brokers, or "" if --broker was given without --dns-srv */
+static std::string
+connect_srv_query(OptionsMap &mh_options)
+{
+    std::stringstream query;
 
     if (!mh_options.count("servername") || mh_options.count("dns-srv")) {
         /*
@@ -294,8 +392,6 @@ mh_connect(OptionsMap mh_options, OptionsMap amqp_options, int retry)
          * used specifically requesting an SRV lookup.
          */
 
-        std::stringstream query;
-
         query << "_matahari.";
         query << ((mh_options["protocol"]) == "ssl" ? "_tls" : "_tcp") << ".";
         if (mh_options.count("servername")) {
@@ -303,65 +399,74 @@ mh_connect(OptionsMap mh_options, OptionsMap amqp_options, int retry)
         } else {
             query << mh_dnsdomainname();
         }
-
-        if ((cur_srv_record = srv_records = mh_dnssrv_lookup(query.str().c_str()))) {
-            mh_info("SRV query successful: %s", query.str().c_str());
-        } else {
-            mh_info("SRV query not successful: %s", query.str().c_str());
-        }
     }
 
-    while (true) {
-        std::stringstream url;
+    return query.str();
+}
 
-        if (srv_records) {
-            /* Use the result of a DNS SRV lookup. */
+/* Brokers to try, in order of preference */
+static std::vector<std::string>
+connect_candidates(OptionsMap &mh_options, GList *srv_records)
+{
+    std::vector<std::string> urls;
+    GList *cur_srv_record = NULL;
+
+    for (cur_srv_record = srv_records; cur_srv_record;
+         cur_srv_record = cur_srv_record->next) {
+        /* Use the result of a DNS SRV lookup. */
+        struct mh_dnssrv_record *record =
+            (struct mh_dnssrv_record *) cur_srv_record->data;
+        std::stringstream url;
 
-            record = (struct mh_dnssrv_record *) cur_srv_record->data;
+        url << "amqp:" << mh_options["protocol"];
+        url << ":" << mh_dnssrv_record_get_host(record);
+        url << ":" << mh_dnssrv_record_get_port(record);
+        urls.push_back(url.str());
+    }
 
-            url << "amqp:" << mh_options["protocol"];
-            url << ":" << mh_dnssrv_record_get_host(record);
-            url << ":" << mh_dnssrv_record_get_port(record);
+    if (urls.empty()) {
+        std::stringstream url;
 
-            cur_srv_record = cur_srv_record->next;
-            if (!cur_srv_record) {
-                cur_srv_record = srv_records;
-            }
-        } else if (mh_options.count("servername")) {
+        if (mh_options.count("servername")) {
             /* Use the explicitly specified broker hostname or IP address. */
             url << "amqp:" << mh_options["protocol"] << ":" << mh_options["servername"] << ":" << mh_options["serverport"] ;
         } else {
             /* If nothing else, try localhost */
             url << "amqp:" << mh_options["protocol"] << ":localhost:" << mh_options["serverport"] ;
         }
+        urls.push_back(url.str());
+    }
 
-        retries++;
-        qpid::messaging::Connection amqp = qpid::messaging::Connection(url.str(), amqp_options);
-        if(retries < 5) {
-            mh_info("Trying: %s", url.str().c_str());
-        } else if(retries == 5) {
-            mh_warn("Cannot find a QMF broker - will keep retrying silently");
-        } else {
-            backoff = retries % 300;
-        }
+    return urls;
+}
 
-        try {
-            amqp.open();
-            g_list_free_full(srv_records, mh_dnssrv_record_free);
-            return amqp;
+struct connect_sync_s {
+    GMainLoop *loop;
+    qpid::messaging::Connection connection;
+};
 
-        } catch (const std::exception& err) {
-            if(!retry) {
-                goto bail;
+static void
+connected_sync(qpid::messaging::Connection *connection, gpointer user_data)
+{
+    struct connect_sync_s *sync = (struct connect_sync_s *) user_data;
 
-            } else if(backoff) {
-                g_usleep(backoff * G_USEC_PER_SEC);
-            }
-        }
+    if (connection) {
+        sync->connection = *connection;
     }
-  bail:
-    g_list_free_full(srv_records, mh_dnssrv_record_free);
-    return NULL;
+    g_main_loop_quit(sync->loop);
+}
+
+qpid::messaging::Connection
+mh_connect(OptionsMap mh_options, OptionsMap amqp_options, int retry)
+{
+    struct connect_sync_s sync;
+
+    sync.loop = g_main_loop_new(NULL, FALSE);
+    mh_connect_async(mh_options, amqp_options, retry, connected_sync, &sync);
+    g_main_loop_run(sync.loop);
+    g_main_loop_unref(sync.loop);
+
+    return sync.connection;
 }
 
 #ifndef WIN32
@@ -380,6 +485,11 @@ read_environment(OptionsMap& options)
         options["serverport"] = data;
     }
 
+    data = getenv("MATAHARI_SLOW_DISPATCH");
+    if (!mh_strlen_zero(data)) {
+        mainloop_dispatch_accounting(atoi(data));
+    }
+
     data = getenv("KRB5_KEYTAB");
     if (!mh_strlen_zero(data)) {
         options["krb5_keytab"] = data;
@@ -605,9 +715,53 @@ mh_should_daemonize(int code, const char *name, const char *arg, void *userdata)
     return 0;
 }
 
-MatahariAgent::MatahariAgent(): _impl(new MatahariAgentImpl())
+static int
+qmf_batch_option(int code, const char *name, const char *arg, void *userdata)
+{
+    if (strcmp(name, "qmf-batch") == 0) {
+        qmf_batch = atoi(arg);
+    } else if (strcmp(name, "qmf-report") == 0) {
+        qmf_report_s = MAX(atoi(arg), 1);
+    } else {
+        qmf_budget_ms = atoi(arg);
+    }
+    return 0;
+}
+
+static int
+slow_dispatch_option(int code, const char *name, const char *arg,
+                     void *userdata)
+{
+    mainloop_dispatch_accounting(atoi(arg));
+    return 0;
+}
+
+static int
+offload_option(int code, const char *name, const char *arg, void *userdata)
 {
+    if (strcmp(name, "workers") == 0) {
+        offload_workers = atoi(arg);
+
+    } else {
+        const char *equals = strchr(arg, '=');
 
+        if (equals == NULL || equals == arg) {
+            fprintf(stderr, "Expected METHOD=N for --%s, not '%s'\n", name, arg);
+            return 1;
+        }
+        offload_limits[std::string(arg, equals - arg)] = atoi(equals + 1);
+    }
+    return 0;
+}
+
+MatahariAgent::MatahariAgent(): _impl(new MatahariAgentImpl())
+{
+    _impl->_agent = this;
+    _impl->_pool = NULL;
+    _impl->_batches_reported = 0;
+    _impl->_mainloop = NULL;
+    _impl->_qpid_source = NULL;
+    _impl->_status = 0;
 }
 
 MatahariAgent::~MatahariAgent()
@@ -620,6 +774,19 @@ qmf::AgentSession& MatahariAgent::getSession(void)
     return _impl->_agent_session;
 }
 
+void
+MatahariAgent::setOffloadable(const std::string &method, unsigned int limit)
+{
+    std::map<std::string, unsigned int>::iterator override =
+        offload_limits.find(method);
+
+    if (override != offload_limits.end()) {
+        limit = override->second;
+    }
+    _impl->_offload[method].limit = limit;
+    mh_debug("%s: %u calls at a time in worker threads", method.c_str(), limit);
+}
+
 void
 MatahariAgentImpl::registerAgent(void)
 {
@@ -639,6 +806,29 @@ MatahariAgentImpl::registerAgent(void)
         prop.setDesc("Filesystem Host UUID");
         data_Agent.addProperty(prop);
     }
+    {
+        qmf::SchemaProperty prop("event_batches", qmf::SCHEMA_DATA_MAP);
+        prop.setAccess(qmf::ACCESS_READ_ONLY);
+        prop.setDesc("Main loop passes that handled 1, 2-3, 4-7, ... QMF events");
+        data_Agent.addProperty(prop);
+    }
+    {
+        qmf::SchemaProperty prop("dns_cache", qmf::SCHEMA_DATA_MAP);
+        prop.setAccess(qmf::ACCESS_READ_ONLY);
+        prop.setDesc("DNS SRV cache hits, stale hits, misses, refreshes and failures");
+        data_Agent.addProperty(prop);
+    }
+    {
+        qmf::SchemaMethod method("dispatch_stats");
+        qmf::SchemaProperty arg("sources", qmf::SCHEMA_DATA_LIST);
+
+        method.setDesc("Time spent dispatching each main loop source, "
+                       "if accounted for (see --slow-dispatch)");
+        arg.setDirection(qmf::DIR_OUT);
+        arg.setDesc("name, calls, total_us and max_us of each source");
+        method.addArgument(arg);
+        data_Agent.addMethod(method);
+    }
 
     _agent_session.registerSchema(data_Agent);
 
@@ -648,6 +838,54 @@ MatahariAgentImpl::registerAgent(void)
     _agent_session.addData(_agent_instance);
 }
 
+static gboolean
+report_batches(gpointer user_data)
+{
+    MatahariAgentImpl *impl = (MatahariAgentImpl *) user_data;
+    qpid::types::Variant::Map batches;
+    guint64 total = 0;
+    int lpc;
+
+    for (lpc = 0; lpc < MAINLOOP_QMF_BATCH_BUCKETS; lpc++) {
+        total += impl->_qpid_source->batches[lpc];
+    }
+    if (total == impl->_batches_reported) {
+        return TRUE;
+    }
+    impl->_batches_reported = total;
+
+    for (lpc = 0; lpc < MAINLOOP_QMF_BATCH_BUCKETS; lpc++) {
+        std::stringstream bucket;
+
+        bucket << (1 << lpc);
+        if (lpc == MAINLOOP_QMF_BATCH_BUCKETS - 1) {
+            bucket << "+";
+        } else if (lpc > 0) {
+            bucket << "-" << (2 << lpc) - 1;
+        }
+        batches[bucket.str()] = impl->_qpid_source->batches[lpc];
+    }
+    impl->_agent_instance.setProperty("event_batches", batches);
+    return TRUE;
+}
+
+static gboolean
+report_dns_cache(gpointer user_data)
+{
+    MatahariAgentImpl *impl = (MatahariAgentImpl *) user_data;
+    struct mh_dnssrv_cache_stats stats;
+    qpid::types::Variant::Map counters;
+
+    mh_dnssrv_cache_get_stats(&stats);
+    counters["hits"] = stats.hits;
+    counters["stale_hits"] = stats.stale_hits;
+    counters["misses"] = stats.misses;
+    counters["refreshes"] = stats.refreshes;
+    counters["failures"] = stats.failures;
+    impl->_agent_instance.setProperty("dns_cache", counters);
+    return TRUE;
+}
+
 static bool
 mh_hastty(void)
 {
@@ -658,17 +896,67 @@ mh_hastty(void)
 #endif
 }
 
+static void
+agent_connected(qpid::messaging::Connection *connection, gpointer user_data)
+{
+    MatahariAgentImpl *impl = (MatahariAgentImpl *) user_data;
+
+    if (connection == NULL) {
+        mh_err("Could not connect to a broker for %s", impl->_proc_name.c_str());
+        impl->_status = -1;
+        g_main_loop_quit(impl->_mainloop);
+        return;
+    }
+    impl->_amqp_connection = *connection;
+
+    impl->_agent_session = qmf::AgentSession(impl->_amqp_connection);
+    impl->_agent_session.setVendor("matahariproject.org");
+    impl->_agent_session.setProduct(impl->_proc_name);
+    impl->_agent_session.setAttribute("uuid", mh_uuid());
+    impl->_agent_session.setAttribute("hostname", mh_hostname());
+
+    impl->_agent_session.open();
+
+    /* Do any setup required by our agent */
+    if (impl->_agent->setup(impl->_agent_session) < 0) {
+        mh_err("Failed to set up broker connection to %s for %s\n",
+               impl->_servername.c_str(), impl->_proc_name.c_str());
+        impl->_status = -1;
+        g_main_loop_quit(impl->_mainloop);
+        return;
+    }
+
+    impl->registerAgent();
+
+    /*
+     * Events are handled in batches, so there is no need to hold up
+     * timers and the like until the broker has nothing more for us
+     */
+    impl->_qpid_source = mainloop_add_qmf(G_PRIORITY_DEFAULT, impl->_agent_session,
+                                          mh_qpid_callback, mh_qpid_disconnect,
+                                          impl);
+    mainloop_qmf_set_batch(impl->_qpid_source, qmf_batch, qmf_budget_ms);
+    g_timeout_add_seconds(qmf_report_s, report_batches, impl);
+    report_dns_cache(impl);
+    g_timeout_add_seconds(DNS_CACHE_REPORT_S, report_dns_cache, impl);
+}
+
 int
 MatahariAgent::init(int argc, char **argv, const char* proc_name)
 {
     OptionsMap options;
-    int res = 0;
     std::stringstream logname;
     logname << "matahari-" << proc_name;
 
     /* Set up basic logging */
     mh_log_init(proc_name, mh_log_level, mh_hastty());
     mh_add_option('d', no_argument, "daemon", "run as a daemon", NULL, mh_should_daemonize);
+    mh_add_option('w', required_argument, "workers", "worker threads for slow methods", NULL, offload_option);
+    mh_add_option('q', required_argument, "qmf-batch", "QMF events handled at most per main loop pass", NULL, qmf_batch_option);
+    mh_add_option('Q', required_argument, "qmf-budget", "time, in milliseconds, spent on QMF events at most per main loop pass", NULL, qmf_batch_option);
+    mh_add_option('R', required_argument, "qmf-report", "how often, in seconds, the Agent object's event_batches are brought up to date", NULL, qmf_batch_option);
+    mh_add_option('O', required_argument, "offload", "METHOD=N: run at most N calls of a slow method at once, 0 to run it in the main loop", NULL, offload_option);
+    mh_add_option('S', required_argument, "slow-dispatch", "account for main loop dispatches, warning about those taking this many milliseconds or more (0 for none)", NULL, slow_dispatch_option);
 
     OptionsMap amqp_options = mh_parse_options(proc_name, argc, argv, options);
 
@@ -679,46 +967,179 @@ MatahariAgent::init(int argc, char **argv, const char* proc_name)
     // Set up the cleanup handler for sigint
     signal(SIGINT, shutdown);
 
-    _impl->_amqp_connection = mh_connect(options, amqp_options, TRUE);
-
-    _impl->_agent_session = qmf::AgentSession(_impl->_amqp_connection);
-    _impl->_agent_session.setVendor("matahariproject.org");
-    _impl->_agent_session.setProduct(proc_name);
-    _impl->_agent_session.setAttribute("uuid", mh_uuid());
-    _impl->_agent_session.setAttribute("hostname", mh_hostname());
-
-    _impl->_agent_session.open();
-
-    /* Do any setup required by our agent */
-    if (this->setup(_impl->_agent_session) < 0) {
-        mh_err("Failed to set up broker connection to %s for %s\n",
-               options["servername"].asString().c_str(), proc_name);
-        res = -1;
-        goto return_cleanup;
+    _impl->_proc_name = proc_name;
+    if (options.count("servername")) {
+        _impl->_servername = options["servername"].asString();
     }
 
-    _impl->registerAgent();
-
+    /*
+     * The session is opened and setup() called from agent_connected(),
+     * once a broker answers; until then the main loop runs as usual
+     */
     _impl->_mainloop = g_main_new(FALSE);
-    _impl->_qpid_source = mainloop_add_qmf(G_PRIORITY_HIGH, _impl->_agent_session,
-                                           mh_qpid_callback, mh_qpid_disconnect,
-                                           this);
+    mh_connect_async(options, amqp_options, TRUE, agent_connected, _impl);
 
-return_cleanup:
-    return res;
+    return 0;
 }
 
-void
+int
 MatahariAgent::run()
 {
     mh_trace("Starting agent mainloop");
     g_main_run(_impl->_mainloop);
+    return _impl->_status;
 }
 
+/*
+ * The QMF session has no descriptor we could poll, so rather than asking
+ * it for events every millisecond a thread blocks in nextEvent() and
+ * hands them over, waking the main loop up through an eventfd.  Where
+ * that isn't available (Windows) the source falls back to polling.
+ */
+
+#ifndef WIN32
+/* Events the notifier fetches ahead of the main loop */
+#define QMF_NOTIFIER_BACKLOG 64
+/* How often the notifier checks whether its source is still there */
+#define QMF_NOTIFIER_CHECK_MS 5000
+
+struct qmf_notifier_s {
+    qmf::AgentSession session;
+    GPollFD wakeup;
+
+    pthread_mutex_t lock;
+    pthread_cond_t space;
+    std::deque<qmf::AgentEvent> pending;
+    bool stopping;
+};
+
+static void *
+qmf_notifier_thread(void *data)
+{
+    struct qmf_notifier_s *notifier = (struct qmf_notifier_s *) data;
+    qpid::messaging::Duration wait(QMF_NOTIFIER_CHECK_MS);
+    bool stopping = false;
+
+    while (!stopping) {
+        qmf::AgentEvent event;
+        bool wake = false;
+
+        if (!notifier->session.nextEvent(event, wait)) {
+            pthread_mutex_lock(&notifier->lock);
+            stopping = notifier->stopping;
+            pthread_mutex_unlock(&notifier->lock);
+            continue;
+        }
+
+        pthread_mutex_lock(&notifier->lock);
+        while (notifier->pending.size() >= QMF_NOTIFIER_BACKLOG
+               && !notifier->stopping) {
+            pthread_cond_wait(&notifier->space, &notifier->lock);
+        }
+        stopping = notifier->stopping;
+        if (!stopping) {
+            notifier->pending.push_back(event);
+            /* Otherwise the main loop hasn't caught up with the last one */
+            wake = (notifier->pending.size() == 1);
+        }
+        pthread_mutex_unlock(&notifier->lock);
+
+        if (wake) {
+            uint64_t one = 1;
+
+            if (write(notifier->wakeup.fd, &one, sizeof(one)) < 0) {
+                mh_perror(LOG_ERR, "Could not wake up the main loop");
+            }
+        }
+    }
+
+    /* The source is gone, everything left is ours */
+    close(notifier->wakeup.fd);
+    pthread_cond_destroy(&notifier->space);
+    pthread_mutex_destroy(&notifier->lock);
+    delete notifier;
+    return NULL;
+}
+
+static struct qmf_notifier_s *
+qmf_notifier_start(GSource *source, qmf::AgentSession session)
+{
+    struct qmf_notifier_s *notifier = NULL;
+    pthread_t thread;
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (fd < 0) {
+        mh_perror(LOG_WARNING, "Could not create an eventfd, polling instead");
+        return NULL;
+    }
+
+    notifier = new qmf_notifier_s;
+    notifier->session = session;
+    notifier->wakeup.fd = fd;
+    notifier->wakeup.events = G_IO_IN;
+    notifier->wakeup.revents = 0;
+    notifier->stopping = false;
+    pthread_mutex_init(&notifier->lock, NULL);
+    pthread_cond_init(&notifier->space, NULL);
+
+    if (pthread_create(&thread, NULL, qmf_notifier_thread, notifier) != 0) {
+        mh_perror(LOG_WARNING, "Could not start the QMF notifier, polling instead");
+        close(fd);
+        pthread_cond_destroy(&notifier->space);
+        pthread_mutex_destroy(&notifier->lock);
+        delete notifier;
+        return NULL;
+    }
+    pthread_detach(thread);
+
+    g_source_add_poll(source, &notifier->wakeup);
+    return notifier;
+}
+
+static void
+qmf_notifier_stop(GSource *source, struct qmf_notifier_s *notifier)
+{
+    g_source_remove_poll(source, &notifier->wakeup);
+
+    /* The thread notices within QMF_NOTIFIER_CHECK_MS and cleans up */
+    pthread_mutex_lock(&notifier->lock);
+    notifier->stopping = true;
+    pthread_cond_signal(&notifier->space);
+    pthread_mutex_unlock(&notifier->lock);
+}
+
+static void
+qmf_notifier_take(mainloop_qmf_t *qmf)
+{
+    struct qmf_notifier_s *notifier = qmf->notifier;
+
+    if (qmf->event) {
+        return;
+    }
+
+    pthread_mutex_lock(&notifier->lock);
+    if (!notifier->pending.empty()) {
+        qmf->event = notifier->pending.front();
+        notifier->pending.pop_front();
+        pthread_cond_signal(&notifier->space);
+    }
+    pthread_mutex_unlock(&notifier->lock);
+}
+#endif
+
 static gboolean
 mainloop_qmf_prepare(GSource* source, gint *timeout)
 {
     mainloop_qmf_t *qmf = (mainloop_qmf_t *) source;
+
+#ifndef WIN32
+    if (qmf->notifier) {
+        qmf_notifier_take(qmf);
+        /* Otherwise sleep until the notifier has something for us */
+        return qmf->event ? TRUE : FALSE;
+    }
+#endif
+
     if (qmf->event) {
         return TRUE;
     }
@@ -731,6 +1152,22 @@ static gboolean
 mainloop_qmf_check(GSource* source)
 {
     mainloop_qmf_t *qmf = (mainloop_qmf_t *) source;
+
+#ifndef WIN32
+    if (qmf->notifier) {
+        if (qmf->notifier->wakeup.revents & G_IO_IN) {
+            uint64_t count;
+
+            if (read(qmf->notifier->wakeup.fd, &count, sizeof(count)) < 0
+                && errno != EAGAIN) {
+                mh_perror(LOG_ERR, "Could not clear the QMF wakeup");
+            }
+        }
+        qmf_notifier_take(qmf);
+        return qmf->event ? TRUE : FALSE;
+    }
+#endif
+
     if (qmf->event) {
         return TRUE;
 
@@ -745,17 +1182,42 @@ static gboolean
 mainloop_qmf_dispatch(GSource *source, GSourceFunc callback, gpointer userdata)
 {
     mainloop_qmf_t *qmf = (mainloop_qmf_t *) source;
+    gint64 started = mainloop_dispatch_begin();
+    gint64 deadline = g_get_monotonic_time() + qmf->batch_budget_ms * 1000;
+    guint handled = 0;
+
     mh_trace("%p", source);
-    if (qmf->dispatch != NULL) {
+    if (qmf->dispatch == NULL) {
+        return TRUE;
+    }
+
+    while (qmf->event) {
         qmf::AgentEvent event = qmf->event;
         qmf->event = NULL;
+        handled++;
 
         if (qmf->dispatch(qmf->session, event, qmf->user_data) == FALSE) {
+            mainloop_dispatch_end(source, started);
             g_source_unref(source); /* Really? */
             return FALSE;
         }
+
+        if (handled >= qmf->batch_max || g_get_monotonic_time() >= deadline) {
+            break;
+        }
+
+        /* Save a trip through poll() for whatever is already waiting */
+#ifndef WIN32
+        if (qmf->notifier) {
+            qmf_notifier_take(qmf);
+            continue;
+        }
+#endif
+        qmf->session.nextEvent(qmf->event, qpid::messaging::Duration::IMMEDIATE);
     }
 
+    qmf->batches[MIN(g_bit_storage(handled), MAINLOOP_QMF_BATCH_BUCKETS) - 1]++;
+    mainloop_dispatch_end(source, started);
     return TRUE;
 }
 
@@ -765,6 +1227,14 @@ mainloop_qmf_destroy(GSource *source)
     mainloop_qmf_t *qmf = (mainloop_qmf_t *) source;
     mh_trace("%p", source);
 
+    mainloop_dispatch_forget(source);
+#ifndef WIN32
+    if (qmf->notifier) {
+        qmf_notifier_stop(source, qmf->notifier);
+        qmf->notifier = NULL;
+    }
+#endif
+
     if (qmf->dnotify) {
         qmf->dnotify(qmf->user_data);
     }
@@ -793,6 +1263,13 @@ mainloop_add_qmf(int priority, qmf::AgentSession session,
     qmf_source->id = 0;
     qmf_source->event = NULL;
     qmf_source->session = session;
+    qmf_source->notifier = NULL;
+    qmf_source->batch_max = 1;
+    qmf_source->batch_budget_ms = 0;
+    memset(qmf_source->batches, 0, sizeof(qmf_source->batches));
+#ifndef WIN32
+    qmf_source->notifier = qmf_notifier_start(source, session);
+#endif
 
     /*
      * Normally we'd use g_source_set_callback() to specify the dispatch
@@ -803,6 +1280,7 @@ mainloop_add_qmf(int priority, qmf::AgentSession session,
     qmf_source->dispatch = dispatch;
     qmf_source->user_data = userdata;
 
+    g_source_set_name(source, "QMF events");
     g_source_set_priority(source, priority);
     g_source_set_can_recurse(source, FALSE);
 
@@ -811,6 +1289,13 @@ mainloop_add_qmf(int priority, qmf::AgentSession session,
     return qmf_source;
 }
 
+void
+mainloop_qmf_set_batch(mainloop_qmf_t *source, guint max, guint budget_ms)
+{
+    source->batch_max = MAX(max, 1);
+    source->batch_budget_ms = budget_ms;
+}
+
 gboolean
 mainloop_destroy_qmf(mainloop_qmf_t *source)
 {
@@ -820,3 +1305,680 @@ mainloop_destroy_qmf(mainloop_qmf_t *source)
 
     return TRUE;
 }
+
+/*
+ * Worker threads hand their results to the main loop through a mailbox:
+ * a lock-free stack of callbacks, plus an eventfd to wake the main loop
+ * up when the stack stops being empty.
+ */
+
+#ifndef WIN32
+typedef struct mailbox_msg_s {
+    void (*fn)(gpointer data);
+    gpointer data;
+    struct mailbox_msg_s *next;
+} mailbox_msg_t;
+
+typedef struct mailbox_s {
+    GSource source;
+    GPollFD wakeup;
+    /* Newest first */
+    mailbox_msg_t * volatile head;
+} mailbox_t;
+
+static mailbox_t *mailbox = NULL;
+
+static gboolean
+mailbox_prepare(GSource *source, gint *timeout)
+{
+    return ((mailbox_t *) source)->head != NULL;
+}
+
+static gboolean
+mailbox_check(GSource *source)
+{
+    mailbox_t *box = (mailbox_t *) source;
+
+    if (box->wakeup.revents & G_IO_IN) {
+        uint64_t count;
+
+        if (read(box->wakeup.fd, &count, sizeof(count)) < 0
+            && errno != EAGAIN) {
+            mh_perror(LOG_ERR, "Could not clear the mailbox wakeup");
+        }
+    }
+    return box->head != NULL;
+}
+
+static gboolean
+mailbox_dispatch(GSource *source, GSourceFunc callback, gpointer userdata)
+{
+    mailbox_t *box = (mailbox_t *) source;
+    gint64 started = mainloop_dispatch_begin();
+    mailbox_msg_t *head = __sync_lock_test_and_set(&box->head, NULL);
+    mailbox_msg_t *msg = NULL;
+
+    /* Oldest first */
+    while (head) {
+        mailbox_msg_t *next = head->next;
+
+        head->next = msg;
+        msg = head;
+        head = next;
+    }
+
+    while (msg) {
+        mailbox_msg_t *next = msg->next;
+
+        msg->fn(msg->data);
+        delete msg;
+        msg = next;
+    }
+
+    mainloop_dispatch_end(source, started);
+    return TRUE;
+}
+
+static GSourceFuncs mailbox_funcs = {
+    mailbox_prepare,
+    mailbox_check,
+    mailbox_dispatch,
+    NULL,
+};
+
+/* Only from the main loop, before starting threads that will post */
+static bool
+mailbox_open(void)
+{
+    int fd;
+
+    if (mailbox) {
+        return true;
+    }
+
+    fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+        mh_perror(LOG_WARNING, "Could not create an eventfd");
+        return false;
+    }
+
+    mailbox = (mailbox_t *) g_source_new(&mailbox_funcs, sizeof(mailbox_t));
+    mailbox->wakeup.fd = fd;
+    mailbox->wakeup.events = G_IO_IN;
+    mailbox->wakeup.revents = 0;
+    mailbox->head = NULL;
+    g_source_add_poll((GSource *) mailbox, &mailbox->wakeup);
+    g_source_set_name((GSource *) mailbox, "worker results");
+    g_source_set_priority((GSource *) mailbox, G_PRIORITY_HIGH);
+    g_source_set_can_recurse((GSource *) mailbox, FALSE);
+    g_source_attach((GSource *) mailbox, NULL);
+
+    return true;
+}
+
+/* From any thread: have fn(data) called from the main loop */
+static void
+mailbox_post(void (*fn)(gpointer data), gpointer data)
+{
+    mailbox_msg_t *msg = new mailbox_msg_t;
+    mailbox_msg_t *head;
+
+    msg->fn = fn;
+    msg->data = data;
+
+    do {
+        head = mailbox->head;
+        msg->next = head;
+    } while (!__sync_bool_compare_and_swap(&mailbox->head, head, msg));
+
+    if (head == NULL) {
+        /* Otherwise the main loop is already due to look */
+        uint64_t one = 1;
+
+        if (write(mailbox->wakeup.fd, &one, sizeof(one)) < 0) {
+            mh_perror(LOG_ERR, "Could not wake up the main loop");
+        }
+    }
+}
+#endif
+
+/*
+ * Methods an agent marked offloadable run in a small pool of worker
+ * threads, the main loop sends the replies once they are done.  Without
+ * threads (Windows) they run in the main loop like any other method.
+ */
+
+static void
+offload_reply(qmf::AgentSession session, qmf::AgentEvent event,
+              enum mh_result res)
+{
+    if (res == MH_RES_SUCCESS) {
+        session.methodSuccess(event);
+    } else {
+        session.raiseException(event, mh_result_to_str(res));
+    }
+}
+
+static enum mh_result
+offload_run(MatahariAgent *agent, qmf::AgentEvent event)
+{
+    try {
+        return agent->offload(event);
+
+    } catch (const std::exception &e) {
+        mh_err("%s failed: %s", event.getMethodName().c_str(), e.what());
+        return MH_RES_OTHER_ERROR;
+    }
+}
+
+#ifndef WIN32
+struct offload_pool_s {
+    MatahariAgentImpl *impl;
+
+    /* Protected by lock */
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    std::deque<offload_job_t *> queue;
+    unsigned int threads;
+    unsigned int idle;
+};
+
+static void offload_complete(gpointer data);
+
+static void *
+offload_worker(void *data)
+{
+    struct offload_pool_s *pool = (struct offload_pool_s *) data;
+
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        offload_job_t *job;
+
+        while (pool->queue.empty()) {
+            pool->idle++;
+            pthread_cond_wait(&pool->work, &pool->lock);
+            pool->idle--;
+        }
+        job = pool->queue.front();
+        pool->queue.pop_front();
+        pthread_mutex_unlock(&pool->lock);
+
+        job->res = offload_run(pool->impl->_agent, job->event);
+        mailbox_post(offload_complete, job);
+
+        pthread_mutex_lock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+static void
+offload_queue(struct offload_pool_s *pool, offload_job_t *job)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->queue.push_back(job);
+
+    if (pool->idle == 0 && pool->threads < offload_workers) {
+        pthread_t thread;
+
+        if (pthread_create(&thread, NULL, offload_worker, pool) == 0) {
+            pthread_detach(thread);
+            pool->threads++;
+            mh_debug("Started worker thread %u", pool->threads);
+
+        } else if (pool->threads == 0) {
+            /* Nobody would ever pick it up */
+            mh_perror(LOG_ERR, "Could not start a worker thread");
+            pool->queue.pop_back();
+            pthread_mutex_unlock(&pool->lock);
+            job->res = offload_run(pool->impl->_agent, job->event);
+            mailbox_post(offload_complete, job);
+            return;
+        }
+    }
+
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void
+offload_complete(gpointer data)
+{
+    offload_job_t *job = (offload_job_t *) data;
+    struct offload_pool_s *pool = job->impl->_pool;
+    offload_method_t &method = job->impl->_offload[job->event.getMethodName()];
+
+    offload_reply(job->session, job->event, job->res);
+    delete job;
+
+    method.running--;
+    if (!method.waiting.empty() && method.running < method.limit) {
+        method.running++;
+        offload_queue(pool, method.waiting.front());
+        method.waiting.pop_front();
+    }
+}
+
+static struct offload_pool_s *
+offload_pool_new(MatahariAgentImpl *impl)
+{
+    struct offload_pool_s *pool;
+
+    if (!mailbox_open()) {
+        mh_warn("Running slow methods in the main loop");
+        return NULL;
+    }
+
+    pool = new offload_pool_s;
+    pool->impl = impl;
+    pool->threads = 0;
+    pool->idle = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+
+    return pool;
+}
+#endif
+
+static bool
+offload_event(MatahariAgentImpl *impl, qmf::AgentSession session,
+              qmf::AgentEvent event)
+{
+    std::map<std::string, offload_method_t>::iterator iter;
+
+    if (event.getType() != qmf::AGENT_METHOD) {
+        return false;
+    }
+
+    iter = impl->_offload.find(event.getMethodName());
+    if (iter == impl->_offload.end()) {
+        return false;
+    }
+
+#ifndef WIN32
+    if (impl->_pool == NULL && offload_workers > 0) {
+        impl->_pool = offload_pool_new(impl);
+    }
+#endif
+    if (impl->_pool == NULL || iter->second.limit == 0) {
+        offload_reply(session, event, offload_run(impl->_agent, event));
+        return true;
+    }
+
+#ifndef WIN32
+    offload_job_t *job = new offload_job_t;
+    job->impl = impl;
+    job->session = session;
+    job->event = event;
+    job->res = MH_RES_OTHER_ERROR;
+
+    if (iter->second.running < iter->second.limit) {
+        iter->second.running++;
+        offload_queue(impl->_pool, job);
+    } else {
+        mh_trace("%s: %u calls running, queueing this one",
+                 iter->first.c_str(), iter->second.running);
+        iter->second.waiting.push_back(job);
+    }
+#endif
+    return true;
+}
+
+/*
+ * Connecting to a broker happens in the background.  Every round, all
+ * candidate brokers are tried a little apart from each other, the first
+ * to answer wins and the others are dropped.  When a whole round fails
+ * the next one starts after an exponential backoff with jitter, so that
+ * agents that lost the same broker don't all come back at once.
+ */
+
+/* Head start given to each candidate before the next one is tried */
+#define CONNECT_STAGGER_MS 250
+/* A round is given up on when no candidate answered in this time */
+#define CONNECT_ROUND_TIMEOUT_MS 30000
+/* Backoff between failed rounds */
+#define CONNECT_BACKOFF_BASE_MS 1000
+#define CONNECT_BACKOFF_MAX_MS (300 * 1000)
+/* Rounds reported before going quiet */
+#define CONNECT_ROUNDS_LOGGED 5
+
+typedef struct mh_connector_s mh_connector_t;
+
+typedef struct connect_round_s {
+    mh_connector_t *connector;  /* NULL once nobody cares about the result */
+    std::string query;          /* SRV query for brokers, if any */
+    std::vector<std::string> urls;
+    guint started;
+    guint finished;
+    guint refs;
+} connect_round_t;
+
+typedef struct connect_attempt_s {
+    connect_round_t *round;
+    std::string url;
+    OptionsMap options;
+    qpid::messaging::Connection connection;
+    bool connected;
+    std::string error;
+} connect_attempt_t;
+
+struct mh_connector_s {
+    OptionsMap mh_options;
+    OptionsMap amqp_options;
+    bool retry;
+    guint failures;
+
+    connect_round_t *round;
+    guint stagger_timer;
+    guint round_timer;
+    guint backoff_timer;
+
+    void (*callback)(qpid::messaging::Connection *connection,
+                     gpointer user_data);
+    gpointer user_data;
+};
+
+static void connect_round_start(mh_connector_t *connector);
+
+static void
+connect_round_unref(connect_round_t *round)
+{
+    if (--round->refs == 0) {
+        delete round;
+    }
+}
+
+static void
+connect_round_stop(mh_connector_t *connector)
+{
+    if (connector->stagger_timer) {
+        g_source_remove(connector->stagger_timer);
+        connector->stagger_timer = 0;
+    }
+    if (connector->round_timer) {
+        g_source_remove(connector->round_timer);
+        connector->round_timer = 0;
+    }
+    if (connector->round) {
+        /* Stragglers are closed as they come back */
+        connector->round->connector = NULL;
+        connect_round_unref(connector->round);
+        connector->round = NULL;
+    }
+}
+
+static void
+connector_finish(mh_connector_t *connector,
+                 qpid::messaging::Connection *connection)
+{
+    connect_round_stop(connector);
+    connector->callback(connection, connector->user_data);
+    delete connector;
+}
+
+static gboolean
+connect_backoff_cb(gpointer user_data)
+{
+    mh_connector_t *connector = (mh_connector_t *) user_data;
+
+    connector->backoff_timer = 0;
+    connect_round_start(connector);
+    return FALSE;
+}
+
+static void
+connect_round_failed(mh_connector_t *connector)
+{
+    guint cap, delay;
+
+    connect_round_stop(connector);
+    connector->failures++;
+
+    if (!connector->retry) {
+        connector_finish(connector, NULL);
+        return;
+    }
+
+    /* Full jitter: anywhere up to the backoff, to spread agents out best */
+    cap = CONNECT_BACKOFF_BASE_MS << MIN(connector->failures - 1, 16);
+    cap = MIN(cap, CONNECT_BACKOFF_MAX_MS);
+    delay = g_random_int_range(0, cap + 1);
+
+    if (connector->failures < CONNECT_ROUNDS_LOGGED) {
+        mh_info("No QMF broker could be reached, trying again in %ums", delay);
+    } else if (connector->failures == CONNECT_ROUNDS_LOGGED) {
+        mh_warn("Cannot find a QMF broker - will keep retrying silently");
+    }
+
+    connector->backoff_timer = g_timeout_add(delay, connect_backoff_cb,
+                                             connector);
+}
+
+static void
+connect_attempt_run(connect_attempt_t *attempt)
+{
+    try {
+        attempt->connection = qpid::messaging::Connection(attempt->url,
+                                                          attempt->options);
+        attempt->connection.open();
+        attempt->connected = true;
+
+    } catch (const std::exception &err) {
+        attempt->error = err.what();
+    }
+}
+
+static void connect_stagger_next(mh_connector_t *connector);
+
+static void
+connect_attempt_done(gpointer data)
+{
+    connect_attempt_t *attempt = (connect_attempt_t *) data;
+    connect_round_t *round = attempt->round;
+    mh_connector_t *connector = round->connector;
+
+    round->finished++;
+
+    if (connector == NULL) {
+        /* Another candidate won, or the round was given up on */
+        if (attempt->connected) {
+            attempt->connection.close();
+        }
+
+    } else if (attempt->connected) {
+        mh_info("Connected to %s", attempt->url.c_str());
+
+        /* Now that we have one, let qpid keep it up */
+        attempt->connection.setOption("reconnect",
+                                      connector->amqp_options["reconnect"]);
+        if (!connector->amqp_options.count("reconnect_interval_min")) {
+            /* Keep the agents that lose this broker together apart */
+            attempt->connection.setOption("reconnect_interval_min",
+                                          g_random_int_range(1, 6));
+        }
+        if (!connector->amqp_options.count("reconnect_interval_max")) {
+            attempt->connection.setOption("reconnect_interval_max",
+                                          CONNECT_BACKOFF_MAX_MS / 1000);
+        }
+        connector_finish(connector, &attempt->connection);
+
+    } else {
+        if (connector->failures < CONNECT_ROUNDS_LOGGED) {
+            mh_info("Could not connect to %s: %s", attempt->url.c_str(),
+                    attempt->error.c_str());
+        }
+
+        if (round->started < round->urls.size()) {
+            /* Don't wait for the stagger timer to try the next one */
+            connect_stagger_next(connector);
+        } else if (round->finished == round->urls.size()) {
+            connect_round_failed(connector);
+        }
+    }
+
+    connect_round_unref(round);
+    delete attempt;
+}
+
+static gboolean
+connect_attempt_idle(gpointer data)
+{
+    connect_attempt_done(data);
+    return FALSE;
+}
+
+#ifndef WIN32
+static void *
+connect_attempt_thread(void *data)
+{
+    connect_attempt_run((connect_attempt_t *) data);
+    mailbox_post(connect_attempt_done, data);
+    return NULL;
+}
+#endif
+
+static void
+connect_attempt_start(mh_connector_t *connector)
+{
+    connect_round_t *round = connector->round;
+    connect_attempt_t *attempt = new connect_attempt_t;
+
+    attempt->round = round;
+    attempt->url = round->urls[round->started++];
+    attempt->options = connector->amqp_options;
+    /* One try only, we do the retrying */
+    attempt->options["reconnect"] = false;
+    attempt->connected = false;
+    round->refs++;
+
+    if (connector->failures < CONNECT_ROUNDS_LOGGED) {
+        mh_info("Trying: %s", attempt->url.c_str());
+    }
+
+#ifndef WIN32
+    pthread_t thread;
+
+    if (mailbox_open()
+        && pthread_create(&thread, NULL, connect_attempt_thread, attempt) == 0) {
+        pthread_detach(thread);
+        return;
+    }
+#endif
+
+    /* Blocks the main loop, but it's all we can do */
+    connect_attempt_run(attempt);
+    g_idle_add(connect_attempt_idle, attempt);
+}
+
+static gboolean
+connect_stagger_cb(gpointer user_data)
+{
+    mh_connector_t *connector = (mh_connector_t *) user_data;
+
+    connector->stagger_timer = 0;
+    connect_stagger_next(connector);
+    return FALSE;
+}
+
+static void
+connect_stagger_next(mh_connector_t *connector)
+{
+    if (connector->stagger_timer) {
+        g_source_remove(connector->stagger_timer);
+        connector->stagger_timer = 0;
+    }
+
+    connect_attempt_start(connector);
+
+    if (connector->round->started < connector->round->urls.size()) {
+        connector->stagger_timer = g_timeout_add(CONNECT_STAGGER_MS,
+                                                 connect_stagger_cb,
+                                                 connector);
+    }
+}
+
+static gboolean
+connect_round_timeout_cb(gpointer user_data)
+{
+    mh_connector_t *connector = (mh_connector_t *) user_data;
+
+    connector->round_timer = 0;
+    mh_debug("No broker answered within %dms", CONNECT_ROUND_TIMEOUT_MS);
+    connect_round_failed(connector);
+    return FALSE;
+}
+
+static void
+connect_round_resolved(GList *srv_records, gpointer user_data)
+{
+    connect_round_t *round = (connect_round_t *) user_data;
+    mh_connector_t *connector = round->connector;
+
+    if (connector) {
+        if (srv_records) {
+            mh_info("SRV query successful: %s", round->query.c_str());
+        } else {
+            mh_info("SRV query not successful: %s", round->query.c_str());
+        }
+
+        round->urls = connect_candidates(connector->mh_options, srv_records);
+        connect_stagger_next(connector);
+    }
+
+    g_list_free_full(srv_records, mh_dnssrv_record_free);
+    connect_round_unref(round);
+}
+
+static void
+connect_round_start(mh_connector_t *connector)
+{
+    connect_round_t *round = new connect_round_t;
+
+    round->connector = connector;
+    round->query = connect_srv_query(connector->mh_options);
+    round->started = 0;
+    round->finished = 0;
+    round->refs = 1;
+    connector->round = round;
+
+    connector->round_timer = g_timeout_add(CONNECT_ROUND_TIMEOUT_MS,
+                                           connect_round_timeout_cb,
+                                           connector);
+
+    if (round->query.empty()) {
+        round->urls = connect_candidates(connector->mh_options, NULL);
+        connect_stagger_next(connector);
+    } else {
+        /* The resolver may take a while, keep the main loop going */
+        round->refs++;
+        mh_dnssrv_lookup_async(round->query.c_str(), connect_round_resolved,
+                               round);
+    }
+}
+
+void
+mh_connect_async(OptionsMap mh_options, OptionsMap amqp_options, int retry,
+                 void (*callback)(qpid::messaging::Connection *connection,
+                                  gpointer user_data),
+                 gpointer user_data)
+{
+    mh_connector_t *connector = new mh_connector_t;
+
+    krb5_renew(mh_options, amqp_options);
+
+    connector->mh_options = mh_options;
+    connector->amqp_options = amqp_options;
+    if (!connector->amqp_options.count("reconnect")) {
+        connector->amqp_options["reconnect"] = true;
+    }
+    connector->retry = retry;
+    connector->failures = 0;
+    connector->round = NULL;
+    connector->stagger_timer = 0;
+    connector->round_timer = 0;
+    connector->backoff_timer = 0;
+    connector->callback = callback;
+    connector->user_data = user_data;
+
+    connect_round_start(connector);
+}
@@ -22,6 +22,8 @@
 
 #include "config.h"
 
+#include <stdlib.h>
+
 #include "matahari/dbus_common.h"
 #include "matahari/logging.h"
 #include "matahari/mainloop.h"
@@ -210,6 +212,9 @@ run_dbus_server(char *bus_name, char *object_path)
     }
 
     mainloop_track_children(G_PRIORITY_DEFAULT);
+    if (getenv("MATAHARI_SLOW_DISPATCH")) {
+        mainloop_dispatch_accounting(atoi(getenv("MATAHARI_SLOW_DISPATCH")));
+    }
     g_main_loop_run(loop);
     g_main_loop_unref(loop);
     g_object_unref(obj);
@@ -268,6 +273,40 @@ matahari_set(Matahari *matahari, const char *interface, const char *name,
     return TRUE;
 }
 
+static void
+dispatch_stats_add(const char *name, const mainloop_dispatch_stats_t *stats,
+                   gpointer user_data)
+{
+    GPtrArray *sources = user_data;
+
+    g_ptr_array_add(sources, g_strdup_printf(
+        "%s: %" G_GUINT64_FORMAT " calls, %" G_GUINT64_FORMAT "us in all, %"
+        G_GUINT64_FORMAT "us at most", name, stats->calls, stats->total_us,
+        stats->max_us));
+}
+
+gboolean
+matahari_dispatch_stats(Matahari *matahari, DBusGMethodInvocation *context)
+{
+    GError *error = NULL;
+    GPtrArray *sources = NULL;
+
+    if (!check_authorization("org.matahariproject.Mainloop.DispatchStats",
+                             &error, context)) {
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    sources = g_ptr_array_new();
+    mainloop_dispatch_foreach(dispatch_stats_add, sources);
+    g_ptr_array_add(sources, NULL);
+
+    dbus_g_method_return(context, sources->pdata);
+    g_strfreev((gchar **) g_ptr_array_free(sources, FALSE));
+    return TRUE;
+}
+
 /* Class init */
 static void
 matahari_class_init(MatahariClass *matahari_class)
@@ -36,7 +36,9 @@ MH_TRACE_INIT_DATA(mh_services);
 /* TODO: Develop a rollover strategy */
 
 static int operations = 0;
-GHashTable *recurring_actions = NULL;
+
+static void coalesce_complete(svc_action_t *op);
+static void recurring_unregister(svc_action_t *op);
 
 svc_action_t *
 services_action_create(const char *name, const char *action, int interval,
@@ -85,42 +87,35 @@ svc_action_t *resources_action_create(
      * Sanity checks passed, proceed!
      */
 
-    op = calloc(1, sizeof(svc_action_t));
-    op->opaque = calloc(1, sizeof(svc_action_private_t));
-    op->rsc = strdup(name);
-    op->action = strdup(action);
+    op = services_action_alloc();
+    op->rsc = services_intern(name);
+    op->action = services_intern(action);
     op->interval = interval;
     op->timeout = timeout;
-    op->standard = strdup(standard);
-    op->agent = strdup(agent);
+    op->standard = services_intern(standard);
+    op->agent = services_intern(agent);
     op->sequence = ++operations;
     if (asprintf(&op->id, "%s_%s_%d", name, action, interval) == -1) {
         goto return_error;
     }
 
     if(strcasecmp(standard, "ocf") == 0) {
-        op->provider = strdup(provider);
+        op->provider = services_intern(provider);
         op->params = params;
 
-        if (asprintf(&op->opaque->exec, "%s/resource.d/%s/%s",
-                     OCF_ROOT, provider, agent) == -1) {
-            goto return_error;
-        }
-        op->opaque->args[0] = strdup(op->opaque->exec);
-        op->opaque->args[1] = strdup(action);
+        op->opaque->exec = services_intern_printf("%s/resource.d/%s/%s",
+                                                  OCF_ROOT, provider, agent);
+        op->opaque->args[0] = services_intern(op->opaque->exec);
+        op->opaque->args[1] = services_intern(action);
 
     } else if(strcasecmp(standard, "lsb") == 0 || strcasecmp(standard, "windows") == 0) {
         services_os_set_exec(op);
 
     } else if(strcasecmp(standard, "systemd") == 0) {
-        char *service;
-        op->opaque->exec = strdup(SYSTEMCTL);
-        op->opaque->args[0] = strdup(SYSTEMCTL);
-        op->opaque->args[1] = strdup(action);
-        if (asprintf(&service, "%s.service", agent) == -1) {
-            goto return_error;
-        }
-        op->opaque->args[2] = service;
+        op->opaque->exec = services_intern(SYSTEMCTL);
+        op->opaque->args[0] = services_intern(SYSTEMCTL);
+        op->opaque->args[1] = services_intern(action);
+        op->opaque->args[2] = services_intern_printf("%s.service", agent);
     } else {
         mh_err("Unknown resource standard: %s", standard);
         services_action_free(op);
@@ -141,14 +136,13 @@ mh_services_action_create_generic(const char *exec, const char *args[])
     svc_action_t *op;
     unsigned int cur_arg;
 
-    op = calloc(1, sizeof(*op));
-    op->opaque = calloc(1, sizeof(svc_action_private_t));
+    op = services_action_alloc();
 
-    op->opaque->exec = strdup(exec);
-    op->opaque->args[0] = strdup(exec);
+    op->opaque->exec = services_intern(exec);
+    op->opaque->args[0] = services_intern(exec);
 
     for (cur_arg = 1; args && args[cur_arg - 1]; cur_arg++) {
-        op->opaque->args[cur_arg] = strdup(args[cur_arg - 1]);
+        op->opaque->args[cur_arg] = services_intern(args[cur_arg - 1]);
 
         if (cur_arg == DIMOF(op->opaque->args) - 1) {
             mh_err("svc_action_t args list not long enough for '%s' execution request.", exec);
@@ -178,19 +172,54 @@ services_action_free(svc_action_t *op)
         op->opaque->stdout_gsource = NULL;
     }
 
+#ifdef HAVE_SYSTEMD_DBUS
+    systemd_unit_forget(op);
+#endif
+#ifndef WIN32
+    services_zygote_forget(op);
+#endif
+
+    if (op->opaque->repeat_timer) {
+        g_source_remove(op->opaque->repeat_timer);
+        op->opaque->repeat_timer = 0;
+    }
+
+    if (op->opaque->registered) {
+        recurring_unregister(op);
+    }
+
+    if (op->opaque->leader) {
+        /* Freed while following, the leader must not finalize us */
+        op->opaque->leader->opaque->followers =
+            g_list_remove(op->opaque->leader->opaque->followers, op);
+        op->opaque->leader = NULL;
+    }
+
+    if (op->opaque->reuse_source) {
+        g_source_remove(op->opaque->reuse_source);
+        op->opaque->reuse_source = 0;
+    }
+
+    if (op->opaque->coalesce_key) {
+        /* Freed while still running, don't leave followers waiting */
+        op->status = LRM_OP_CANCELLED;
+        op->rc = OCF_CANCELLED;
+        coalesce_complete(op);
+    }
+
     free(op->id);
-    free(op->opaque->exec);
+    services_intern_release(op->opaque->exec);
 
     for (i = 0; i < DIMOF(op->opaque->args); i++) {
-        free(op->opaque->args[i]);
+        services_intern_release(op->opaque->args[i]);
     }
 
-    free(op->rsc);
-    free(op->action);
+    services_intern_release(op->rsc);
+    services_intern_release(op->action);
 
-    free(op->standard);
-    free(op->agent);
-    free(op->provider);
+    services_intern_release(op->standard);
+    services_intern_release(op->agent);
+    services_intern_release(op->provider);
 
     free(op->stdout_data);
     free(op->stderr_data);
@@ -200,53 +229,564 @@ services_action_free(svc_action_t *op)
         op->params = NULL;
     }
 
-    free(op);
+    services_action_release(op);
+}
+
+const svc_action_usage_t *
+services_action_usage(svc_action_t *op)
+{
+    return &op->opaque->usage;
+}
+
+char *
+services_agent_label(svc_action_t *op)
+{
+    if (op->provider) {
+        return g_strdup_printf("%s:%s:%s", op->standard, op->provider,
+                               op->agent);
+    }
+    return g_strdup_printf("%s:%s", op->standard, op->agent);
+}
+
+/*
+ * Recurring actions are indexed by (resource, action, interval) for
+ * cancelling one of them, and by resource and by agent for finding or
+ * cancelling a group of them.  Each action keeps its links into the
+ * group queues, so it leaves every index in constant time.
+ */
+
+/* recurring_key_t -> svc_action_t */
+static GHashTable *recurring_by_key = NULL;
+
+/* Resource name -> GQueue of svc_action_t */
+static GHashTable *recurring_by_rsc = NULL;
+
+/* Agent label, see services_agent_label() -> GQueue of svc_action_t */
+static GHashTable *recurring_by_agent = NULL;
+
+static guint
+recurring_key_hash(gconstpointer key)
+{
+    const recurring_key_t *k = key;
+
+    return (g_str_hash(k->rsc) * 31 + g_str_hash(k->action)) ^ k->interval;
+}
+
+static gboolean
+recurring_key_equal(gconstpointer a, gconstpointer b)
+{
+    const recurring_key_t *ka = a;
+    const recurring_key_t *kb = b;
+
+    return ka->interval == kb->interval && strcmp(ka->rsc, kb->rsc) == 0
+           && strcmp(ka->action, kb->action) == 0;
+}
+
+static void
+recurring_queue_free(gpointer data)
+{
+    g_queue_free(data);
+}
+
+static GList *
+recurring_index_add(GHashTable *index, const char *name, svc_action_t *op)
+{
+    GQueue *queue = g_hash_table_lookup(index, name);
+
+    if (queue == NULL) {
+        queue = g_queue_new();
+        g_hash_table_insert(index, g_strdup(name), queue);
+    }
+
+    g_queue_push_tail(queue, op);
+    return g_queue_peek_tail_link(queue);
+}
+
+static void
+recurring_index_remove(GHashTable *index, const char *name, GList *link)
+{
+    GQueue *queue = g_hash_table_lookup(index, name);
+
+    g_queue_delete_link(queue, link);
+    if (g_queue_is_empty(queue)) {
+        g_hash_table_remove(index, name);
+    }
+}
+
+static void recurring_cancel(svc_action_t *op);
+
+static void
+recurring_register(svc_action_t *op)
+{
+    svc_action_t *old;
+
+    if (recurring_by_key == NULL) {
+        recurring_by_key = g_hash_table_new(recurring_key_hash,
+                                            recurring_key_equal);
+        recurring_by_rsc = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                 g_free, recurring_queue_free);
+        recurring_by_agent = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                   g_free,
+                                                   recurring_queue_free);
+    }
+
+    op->opaque->key.rsc = op->rsc;
+    op->opaque->key.action = op->action;
+    op->opaque->key.interval = op->interval;
+
+    old = g_hash_table_lookup(recurring_by_key, &op->opaque->key);
+    if (old) {
+        mh_debug("%s replaces an identical recurring action", op->id);
+        recurring_cancel(old);
+    }
+
+    op->opaque->agent_label = services_agent_label(op);
+    g_hash_table_insert(recurring_by_key, &op->opaque->key, op);
+    op->opaque->rsc_link = recurring_index_add(recurring_by_rsc, op->rsc, op);
+    op->opaque->agent_link = recurring_index_add(recurring_by_agent,
+                                                 op->opaque->agent_label, op);
+    op->opaque->registered = TRUE;
+}
+
+static void
+recurring_unregister(svc_action_t *op)
+{
+    g_hash_table_remove(recurring_by_key, &op->opaque->key);
+    recurring_index_remove(recurring_by_rsc, op->rsc, op->opaque->rsc_link);
+    recurring_index_remove(recurring_by_agent, op->opaque->agent_label,
+                           op->opaque->agent_link);
+
+    g_free(op->opaque->agent_label);
+    op->opaque->agent_label = NULL;
+    op->opaque->rsc_link = op->opaque->agent_link = NULL;
+    op->opaque->registered = FALSE;
+}
+
+static void
+recurring_cancel(svc_action_t *op)
+{
+    mh_debug("Removing %s", op->id);
+    recurring_unregister(op);
+
+    if (op->opaque->repeat_timer) {
+        /* Waiting for its next run */
+        services_action_free(op);
+
+    } else {
+        /* Running, it is released once it completes */
+        op->interval = 0;
+    }
 }
 
 gboolean
 services_action_cancel(const char *name, const char *action, int interval)
 {
-    svc_action_t* op = NULL;
-    char id[512];
+    recurring_key_t key = { name, action, interval };
+    svc_action_t *op;
+
+    if (recurring_by_key == NULL || name == NULL || action == NULL
+        || (op = g_hash_table_lookup(recurring_by_key, &key)) == NULL) {
+        return FALSE;
+    }
+
+    recurring_cancel(op);
+    return TRUE;
+}
+
+GList *
+services_recurring_list(const char *rsc, const char *agent)
+{
+    GQueue *queue = NULL;
+    GList *list = NULL, *gIter;
+
+    if (recurring_by_key == NULL) {
+        return NULL;
+    }
+
+    if (!mh_strlen_zero(rsc)) {
+        queue = g_hash_table_lookup(recurring_by_rsc, rsc);
+    } else if (!mh_strlen_zero(agent)) {
+        queue = g_hash_table_lookup(recurring_by_agent, agent);
+    } else {
+        return g_hash_table_get_values(recurring_by_key);
+    }
+
+    for (gIter = queue ? queue->head : NULL; gIter; gIter = gIter->next) {
+        svc_action_t *op = gIter->data;
+
+        /* With both, the resource index is used and the agent checked */
+        if (mh_strlen_zero(agent)
+            || strcmp(op->opaque->agent_label, agent) == 0) {
+            list = g_list_prepend(list, op);
+        }
+    }
+
+    return g_list_reverse(list);
+}
+
+int
+services_action_cancel_all(const char *rsc, const char *agent)
+{
+    GList *ops, *gIter;
+    int count = 0;
+
+    if (mh_strlen_zero(rsc) && mh_strlen_zero(agent)) {
+        mh_err("Refusing to cancel every recurring action");
+        return -1;
+    }
+
+    ops = services_recurring_list(rsc, agent);
+    for (gIter = ops; gIter; gIter = gIter->next) {
+        recurring_cancel(gIter->data);
+        count++;
+    }
+    g_list_free(ops);
+
+    mh_debug("Cancelled %d recurring actions", count);
+    return count;
+}
+
+/*
+ * Identical non-mutating actions requested while one is already running
+ * are attached to the running one (the "leader") and complete with its
+ * result.  Optionally, a result is also handed out again for a while
+ * after it was produced.
+ */
+
+static const char *coalesce_actions[] = { "status", "monitor", "meta-data" };
+
+/* Coalescing key -> leader currently running for it */
+static GHashTable *inflight_actions = NULL;
+
+/* Coalescing key -> action_result_t, only kept with a reuse window */
+static GHashTable *recent_results = NULL;
+static int reuse_window_ms = 0;
+
+typedef struct action_result_s {
+    gint64 completed;   /* monotonic, in microseconds */
+    int rc;
+    int status;
+    char *stdout_data;
+    char *stderr_data;
+} action_result_t;
+
+static void
+action_result_free(gpointer data)
+{
+    action_result_t *result = data;
+
+    free(result->stdout_data);
+    free(result->stderr_data);
+    free(result);
+}
 
-    snprintf(id, sizeof(id), "%s_%s_%d", name, action, interval);
+static gboolean
+action_is_coalescable(svc_action_t *op)
+{
+    int lpc;
 
-    if (!(op = g_hash_table_lookup(recurring_actions, id))) {
+    if (op->standard == NULL || op->action == NULL) {
+        /* Arbitrary commands, see mh_services_action_create_generic() */
         return FALSE;
     }
 
-    mh_debug("Removing %s", op->id);
-    if (op->opaque->repeat_timer) {
-        g_source_remove(op->opaque->repeat_timer);
+    for (lpc = 0; lpc < DIMOF(coalesce_actions); lpc++) {
+        if (strcasecmp(op->action, coalesce_actions[lpc]) == 0) {
+            return TRUE;
+        }
     }
-    services_action_free(op);
+    return FALSE;
+}
+
+static char *
+action_coalesce_key(svc_action_t *op)
+{
+    GString *key = g_string_new(NULL);
+    GList *params, *gIter;
+
+    g_string_append_printf(key, "%s:%s:%s:%s", op->standard,
+                           op->provider ? op->provider : "", op->agent,
+                           op->action);
+
+    /* OCF agents also see the resource name and its parameters */
+    if (strcasecmp(op->standard, "ocf") == 0) {
+        g_string_append_printf(key, ":%s", op->rsc);
+
+        if (op->params) {
+            params = g_list_sort(g_hash_table_get_keys(op->params),
+                                 (GCompareFunc) strcmp);
+            for (gIter = params; gIter; gIter = gIter->next) {
+                g_string_append_printf(key, ":%s=%s", (char *) gIter->data,
+                        (char *) g_hash_table_lookup(op->params, gIter->data));
+            }
+            g_list_free(params);
+        }
+    }
+
+    return g_string_free(key, FALSE);
+}
 
+static void
+action_copy_result(svc_action_t *op, int rc, int status,
+                   const char *stdout_data, const char *stderr_data)
+{
+    op->rc = rc;
+    op->status = status;
+
+    free(op->stdout_data);
+    op->stdout_data = stdout_data ? strdup(stdout_data) : NULL;
+
+    free(op->stderr_data);
+    op->stderr_data = stderr_data ? strdup(stderr_data) : NULL;
+}
+
+static gboolean
+reused_result_cb(gpointer user_data)
+{
+    svc_action_t *op = user_data;
+
+    op->opaque->reuse_source = 0;
+    operation_finalize(op);
+    return FALSE;
+}
+
+static gboolean
+action_reuse_result(svc_action_t *op, const char *key)
+{
+    action_result_t *result;
+    long age;
+
+    if (op->interval > 0 || reuse_window_ms == 0 || recent_results == NULL
+        || (result = g_hash_table_lookup(recent_results, key)) == NULL) {
+        return FALSE;
+    }
+
+    age = (g_get_monotonic_time() - result->completed) / 1000;
+    if (age > reuse_window_ms) {
+        g_hash_table_remove(recent_results, key);
+        return FALSE;
+    }
+
+    mh_debug("Reusing the %ldms old result for %s", age, op->id);
+    action_copy_result(op, result->rc, result->status, result->stdout_data,
+                       result->stderr_data);
+
+    /* Callers expect the callback after we return, as for a real run */
+    op->opaque->reuse_source = g_idle_add(reused_result_cb, op);
+    return TRUE;
+}
+
+static gboolean
+action_join_inflight(svc_action_t *op, const char *key)
+{
+    svc_action_t *leader;
+
+    /* Recurring actions need their own timer, so they never follow */
+    if (op->interval > 0 || inflight_actions == NULL
+        || (leader = g_hash_table_lookup(inflight_actions, key)) == NULL) {
+        return FALSE;
+    }
+
+    mh_debug("Coalescing %s with in-flight %s", op->id, leader->id);
+    op->status = LRM_OP_PENDING;
+    op->opaque->leader = leader;
+    leader->opaque->followers = g_list_append(leader->opaque->followers, op);
     return TRUE;
 }
 
+/* Hand the leader's result to everyone who joined it */
+static void
+coalesce_complete(svc_action_t *op)
+{
+    char *key = op->opaque->coalesce_key;
+    GList *followers, *gIter;
+
+    if (key == NULL) {
+        return;
+    }
+
+    if (g_hash_table_lookup(inflight_actions, key) == op) {
+        g_hash_table_remove(inflight_actions, key);
+    }
+
+    if (reuse_window_ms > 0 && op->status == LRM_OP_DONE) {
+        action_result_t *result = calloc(1, sizeof(action_result_t));
+
+        result->completed = g_get_monotonic_time();
+        result->rc = op->rc;
+        result->status = op->status;
+        result->stdout_data = op->stdout_data ? strdup(op->stdout_data) : NULL;
+        result->stderr_data = op->stderr_data ? strdup(op->stderr_data) : NULL;
+
+        if (recent_results == NULL) {
+            recent_results = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                   g_free, action_result_free);
+        }
+        g_hash_table_replace(recent_results, g_strdup(key), result);
+    }
+
+    followers = op->opaque->followers;
+    op->opaque->followers = NULL;
+    op->opaque->coalesce_key = NULL;
+    g_free(key);
+
+    for (gIter = followers; gIter; gIter = gIter->next) {
+        svc_action_t *follower = gIter->data;
+
+        mh_trace("%s shares the result of %s", follower->id, op->id);
+        follower->opaque->leader = NULL;
+        action_copy_result(follower, op->rc, op->status, op->stdout_data,
+                           op->stderr_data);
+        operation_finalize(follower);
+    }
+    g_list_free(followers);
+}
+
+void
+services_action_set_reuse_window(int ms)
+{
+    reuse_window_ms = ms > 0 ? ms : 0;
+
+    if (reuse_window_ms == 0 && recent_results) {
+        g_hash_table_remove_all(recent_results);
+    }
+}
+
+void
+services_action_set_output_callback(svc_action_t *op,
+        void (*callback)(svc_action_t *op, gboolean is_stderr,
+                         const char *line))
+{
+    op->opaque->output_callback = callback;
+}
+
+static gboolean
+recurring_action_timer(gpointer data)
+{
+    svc_action_t *op = data;
+    mh_debug("Scheduling another invokation of %s", op->id);
+
+    op->opaque->repeat_timer = 0;
+
+    /* Clean out the old result */
+    free(op->stdout_data); op->stdout_data = NULL;
+    free(op->stderr_data); op->stderr_data = NULL;
+    op->opaque->stdout_streamed = op->opaque->stderr_streamed = 0;
+    memset(&op->opaque->usage, 0, sizeof(op->opaque->usage));
+    op->opaque->usage_valid = FALSE;
+
+    if (services_action_async(op, NULL) == FALSE) {
+        mh_err("Could not run %s, trying again in %dms", op->id,
+               op->interval);
+        op->opaque->repeat_timer = g_timeout_add(op->interval,
+                                                 recurring_action_timer,
+                                                 (void *) op);
+    }
+    return FALSE;
+}
+
+/* Account for the completion of an action */
+static void
+action_completed(svc_action_t *op)
+{
+    if (op->opaque->started) {
+        op->opaque->usage.wall_ms = (g_get_monotonic_time() - op->opaque->started)
+                            / 1000;
+        op->opaque->started = 0;
+    }
+
+    if (op->opaque->usage_valid) {
+        services_usage_record(op);
+    }
+    services_history_record(op);
+}
+
+/* Reschedule recurring actions, report the result and release the action */
+void
+operation_finalize(svc_action_t *op)
+{
+    int recurring = 0;
+
+    coalesce_complete(op);
+    action_completed(op);
+
+    if (op->interval) {
+        recurring = 1;
+        op->opaque->repeat_timer = g_timeout_add(op->interval,
+                                                 recurring_action_timer,
+                                                 (void *) op);
+    }
+
+    op->pid = 0;
+
+    if (op->opaque->callback) {
+        op->opaque->callback(op);
+    }
+
+    if (!recurring) {
+        /*
+         * If this is a recurring action, do not free explicitly.
+         * It will get freed whenever the action gets cancelled.
+         */
+        services_action_free(op);
+    }
+}
+
 gboolean
 services_action_async(svc_action_t* op, void (*action_callback)(svc_action_t *))
 {
+    char *key = NULL;
+
+    op->opaque->started = g_get_monotonic_time();
+
     if (action_callback) {
         op->opaque->callback = action_callback;
     }
 
-    if (recurring_actions == NULL) {
-        recurring_actions = g_hash_table_new_full(g_str_hash, g_str_equal,
-                                                  NULL, NULL);
+    if (op->interval > 0 && op->rsc && op->opaque->registered == FALSE) {
+        recurring_register(op);
     }
 
-    if (op->interval > 0) {
-        g_hash_table_replace(recurring_actions, op->id, op);
+    if (action_is_coalescable(op)) {
+        key = action_coalesce_key(op);
+        if (action_reuse_result(op, key) || action_join_inflight(op, key)) {
+            g_free(key);
+            return TRUE;
+        }
     }
 
-    return services_os_action_execute(op, FALSE);
+    op->status = LRM_OP_PENDING;
+    if (services_os_action_execute(op, FALSE) == FALSE) {
+        g_free(key);
+        return FALSE;
+    }
+
+    if (key && op->status == LRM_OP_PENDING) {
+        /* Still running, let identical requests join it */
+        if (inflight_actions == NULL) {
+            inflight_actions = g_hash_table_new(g_str_hash, g_str_equal);
+        }
+        op->opaque->coalesce_key = key;
+        g_hash_table_replace(inflight_actions, key, op);
+
+    } else {
+        g_free(key);
+    }
+
+    return TRUE;
 }
 
 gboolean
 services_action_sync(svc_action_t* op)
 {
-    gboolean rc = services_os_action_execute(op, TRUE);
+    gboolean rc;
+
+    op->opaque->started = g_get_monotonic_time();
+    rc = services_os_action_execute(op, TRUE);
+    if (rc) {
+        action_completed(op);
+    }
+
     mh_trace(" > %s_%s_%d: %s = %d", op->rsc, op->action, op->interval,
              op->opaque->exec, op->rc);
     if (op->stdout_data) {
@@ -258,6 +798,14 @@ services_action_sync(svc_action_t* op)
     return rc;
 }
 
+gboolean
+services_zygote_wanted(void)
+{
+    const char *value = getenv("MATAHARI_ACTION_HELPER");
+
+    return value && strcasecmp(value, "yes") == 0;
+}
+
 GList *
 get_directory_list(const char *root, gboolean files)
 {
@@ -270,10 +818,22 @@ services_list(void)
     return resources_list_agents("lsb", NULL);
 }
 
-GList *
-resources_list_standards(void)
+/*
+ * The set of standards can't change while we're running, so work it out
+ * once and answer validity checks with a hash lookup.
+ */
+static GList *standards = NULL;
+static GHashTable *standards_index = NULL;
+
+static void
+init_standards(void)
 {
-    GList *standards = NULL;
+    GList *gIter;
+
+    if (standards_index) {
+        return;
+    }
+
 #ifdef __linux__
     standards = g_list_append(standards, strdup("ocf"));
     standards = g_list_append(standards, strdup("lsb"));
@@ -283,7 +843,68 @@ resources_list_standards(void)
 #ifdef WIN32
     standards = g_list_append(standards, strdup("windows"));
 #endif
-    return standards;
+
+    standards_index = g_hash_table_new(g_str_hash, g_str_equal);
+    for (gIter = standards; gIter != NULL; gIter = gIter->next) {
+        g_hash_table_insert(standards_index, gIter->data, gIter->data);
+    }
+}
+
+GList *
+resources_list_standards(void)
+{
+    GList *list = NULL;
+    GList *gIter;
+
+    init_standards();
+    for (gIter = standards; gIter != NULL; gIter = gIter->next) {
+        list = g_list_append(list, strdup(gIter->data));
+    }
+    return list;
+}
+
+gboolean
+resources_standard_is_valid(const char *standard)
+{
+    char *lower;
+    gboolean valid;
+
+    if (mh_strlen_zero(standard)) {
+        return FALSE;
+    }
+
+    init_standards();
+
+    /* Standards are matched case insensitively */
+    lower = g_ascii_strdown(standard, -1);
+    valid = g_hash_table_lookup(standards_index, lower) != NULL;
+    g_free(lower);
+
+    return valid;
+}
+
+gboolean
+resources_agent_exists(const char *standard, const char *provider,
+                       const char *agent)
+{
+    if (!resources_standard_is_valid(standard) || mh_strlen_zero(agent)) {
+        return FALSE;
+    }
+
+    if (strcasecmp(standard, "ocf") == 0) {
+        return resources_os_ocf_agent_exists(provider, agent);
+
+    } else if (strcasecmp(standard, "lsb") == 0
+            || strcasecmp(standard, "windows") == 0) {
+        return services_os_exists(agent);
+
+#ifdef __linux__
+    } else if (strcasecmp(standard, "systemd") == 0) {
+        return resources_os_systemd_service_exists(agent);
+#endif
+    }
+
+    return FALSE;
 }
 
 GList *
@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2011, Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/**
+ * \file
+ * \brief Batches of actions
+ *
+ * A batch runs its actions through services_action_async(), at most a
+ * given number at a time, and reports once all of them have completed or
+ * its deadline has passed.  Actions still running at the deadline are
+ * left to finish (or time out) on their own, their results are dropped.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "matahari/logging.h"
+#include "matahari/services.h"
+
+#include "services_private.h"
+
+/* Actions run at once when the caller doesn't say */
+#define BATCH_DEFAULT_PARALLEL 8
+
+typedef struct batch_entry_s {
+    svc_batch_t        *batch;
+    svc_action_t       *op;     /* until it is started */
+    svc_batch_result_t  result;
+} batch_entry_t;
+
+struct svc_batch_s {
+    GPtrArray *entries;
+    guint      next;            /* first entry not started yet */
+    int        running;
+    int        parallel;
+    int        deadline_ms;
+    guint      deadline_timer;
+    gboolean   filling;
+    gboolean   done;
+
+    void     (*callback)(svc_batch_t *batch, gpointer user_data);
+    gpointer   user_data;
+};
+
+static void
+batch_free(svc_batch_t *batch)
+{
+    guint lpc;
+
+    for (lpc = 0; lpc < batch->entries->len; lpc++) {
+        batch_entry_t *entry = g_ptr_array_index(batch->entries, lpc);
+
+        if (entry->op) {
+            services_action_free(entry->op);
+        }
+        free(entry);
+    }
+    g_ptr_array_free(batch->entries, TRUE);
+    free(batch);
+}
+
+static void
+batch_complete(svc_batch_t *batch)
+{
+    batch->done = TRUE;
+
+    if (batch->deadline_timer) {
+        g_source_remove(batch->deadline_timer);
+        batch->deadline_timer = 0;
+    }
+
+    mh_trace("Batch of %u actions complete, %d still running",
+             batch->entries->len, batch->running);
+    batch->callback(batch, batch->user_data);
+
+    if (batch->running == 0) {
+        batch_free(batch);
+    }
+}
+
+static void batch_fill(svc_batch_t *batch);
+
+static void
+batch_op_done(svc_action_t *op)
+{
+    batch_entry_t *entry = op->cb_data;
+    svc_batch_t *batch = entry->batch;
+
+    batch->running--;
+
+    if (batch->done) {
+        /* Reported as pending at the deadline, nobody wants this anymore */
+        mh_debug("%s completed after its batch was reported", op->id);
+        if (batch->running == 0) {
+            batch_free(batch);
+        }
+        return;
+    }
+
+    entry->result.rc = op->rc;
+    entry->result.status = op->status;
+    entry->result.duration = op->opaque->usage.wall_ms;
+
+    batch_fill(batch);
+}
+
+static void
+batch_fill(svc_batch_t *batch)
+{
+    if (batch->filling) {
+        /* An action completed while we were starting it */
+        return;
+    }
+
+    batch->filling = TRUE;
+    while (batch->done == FALSE && batch->running < batch->parallel
+           && batch->next < batch->entries->len) {
+        batch_entry_t *entry = g_ptr_array_index(batch->entries,
+                                                 batch->next++);
+        svc_action_t *op = entry->op;
+
+        entry->op = NULL;
+        batch->running++;
+
+        if (services_action_async(op, batch_op_done) == FALSE) {
+            mh_err("Could not start %s", op->id);
+            batch->running--;
+            entry->result.rc = OCF_UNKNOWN_ERROR;
+            entry->result.status = LRM_OP_ERROR;
+            services_action_free(op);
+        }
+    }
+    batch->filling = FALSE;
+
+    if (batch->done == FALSE && batch->running == 0
+        && batch->next == batch->entries->len) {
+        batch_complete(batch);
+    }
+}
+
+static gboolean
+batch_deadline(gpointer user_data)
+{
+    svc_batch_t *batch = user_data;
+
+    mh_warn("Batch deadline of %dms passed with %d actions running "
+            "and %u not started", batch->deadline_ms, batch->running,
+            batch->entries->len - batch->next);
+
+    /* Those not started are cancelled, running ones stay pending */
+    for (; batch->next < batch->entries->len; batch->next++) {
+        batch_entry_t *entry = g_ptr_array_index(batch->entries,
+                                                 batch->next);
+
+        entry->result.rc = OCF_CANCELLED;
+        entry->result.status = LRM_OP_CANCELLED;
+        services_action_free(entry->op);
+        entry->op = NULL;
+    }
+
+    batch->deadline_timer = 0;
+    batch_complete(batch);
+    return FALSE;
+}
+
+static gboolean
+batch_empty_cb(gpointer user_data)
+{
+    batch_complete(user_data);
+    return FALSE;
+}
+
+svc_batch_t *
+services_batch_new(int parallel, int deadline_ms)
+{
+    svc_batch_t *batch = calloc(1, sizeof(svc_batch_t));
+
+    batch->entries = g_ptr_array_new();
+    batch->parallel = parallel > 0 ? parallel : BATCH_DEFAULT_PARALLEL;
+    batch->deadline_ms = deadline_ms;
+
+    return batch;
+}
+
+guint
+services_batch_add(svc_batch_t *batch, svc_action_t *op)
+{
+    batch_entry_t *entry = calloc(1, sizeof(batch_entry_t));
+
+    if (op->interval) {
+        mh_warn("%s: recurring actions can't be batched, running it once",
+                op->id);
+        op->interval = 0;
+    }
+
+    entry->batch = batch;
+    entry->op = op;
+    entry->result.rc = OCF_PENDING;
+    entry->result.status = LRM_OP_PENDING;
+    entry->result.sequence = op->sequence;
+
+    op->cb_data = entry;
+    g_ptr_array_add(batch->entries, entry);
+
+    return batch->entries->len - 1;
+}
+
+void
+services_batch_run(svc_batch_t *batch,
+                   void (*callback)(svc_batch_t *batch, gpointer user_data),
+                   gpointer user_data)
+{
+    batch->callback = callback;
+    batch->user_data = user_data;
+
+    if (batch->entries->len == 0) {
+        /* Callers expect the callback after we return */
+        g_idle_add(batch_empty_cb, batch);
+        return;
+    }
+
+    if (batch->deadline_ms > 0) {
+        batch->deadline_timer = g_timeout_add(batch->deadline_ms,
+                                              batch_deadline, batch);
+    }
+
+    mh_debug("Running a batch of %u actions, %d at a time",
+             batch->entries->len, batch->parallel);
+    batch_fill(batch);
+}
+
+guint
+services_batch_size(svc_batch_t *batch)
+{
+    return batch->entries->len;
+}
+
+const svc_batch_result_t *
+services_batch_result(svc_batch_t *batch, guint index)
+{
+    batch_entry_t *entry;
+
+    if (index >= batch->entries->len) {
+        return NULL;
+    }
+
+    entry = g_ptr_array_index(batch->entries, index);
+    return &entry->result;
+}
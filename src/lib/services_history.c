@@ -0,0 +1,502 @@
+/*
+ * Copyright (C) 2011, Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/**
+ * \file
+ * \brief Resource operation history and accounting
+ *
+ * The last few operations of every resource are kept in a small ring,
+ * and the durations of each (resource, action) pair go into a log-scale
+ * histogram from which percentiles are read.  Histograms are halved once
+ * they fill up, so their percentiles follow recent behaviour rather than
+ * everything since the agent started.
+ *
+ * Separately, the resources consumed by every action that was run are
+ * added up per agent and action.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "matahari/logging.h"
+#include "matahari/utilities.h"
+#include "matahari/services.h"
+
+#include "services_private.h"
+
+/* Operations remembered per resource */
+#define OP_HISTORY_LEN 32
+
+/* Resources remembered, the least recently active one is dropped first */
+#define OP_HISTORY_MAX_RESOURCES 1024
+
+/*
+ * Durations below 8ms get a bucket each, above that every power of two
+ * is split into four, which bounds the error of a percentile to 12.5%.
+ */
+#define HISTOGRAM_LINEAR  8
+#define HISTOGRAM_BUCKETS (HISTOGRAM_LINEAR + (32 - 3) * 4)
+
+/* Samples after which a histogram is halved */
+#define HISTOGRAM_DECAY 1024
+
+typedef struct op_record_s {
+    const char *action;     /* interned */
+    gint64      started;    /* ms since the epoch */
+    guint32     duration;   /* ms */
+    gint16      rc;
+    gint8       status;
+    guint8      timed_out;
+} op_record_t;
+
+typedef struct op_histogram_s {
+    guint64 count;
+    guint64 failed;
+    guint64 timed_out;
+    guint32 min;
+    guint32 max;
+
+    /* Decayed, see histogram_add() */
+    guint32 samples;
+    guint64 sum;
+    guint32 buckets[HISTOGRAM_BUCKETS];
+} op_histogram_t;
+
+typedef struct rsc_history_s {
+    op_record_t ring[OP_HISTORY_LEN];
+    guint       head;       /* next slot to write */
+    guint       length;
+    gint64      last;       /* monotonic time of the last record */
+
+    /* Interned action -> op_histogram_t */
+    GHashTable *stats;
+} rsc_history_t;
+
+/* Resource name -> rsc_history_t */
+static GHashTable *histories = NULL;
+
+/* Every operation of every resource */
+static op_histogram_t summary;
+
+/* "agent action" -> svc_agent_usage_t */
+static GHashTable *agent_usage = NULL;
+
+static int
+histogram_bucket(guint32 ms)
+{
+    int msb;
+
+    if (ms < HISTOGRAM_LINEAR) {
+        return ms;
+    }
+
+    msb = g_bit_storage(ms) - 1;
+    return HISTOGRAM_LINEAR + (msb - 3) * 4 + ((ms >> (msb - 2)) & 3);
+}
+
+/* Midpoint of the durations that fall into a bucket */
+static guint32
+histogram_bucket_value(int bucket)
+{
+    int msb, sub;
+
+    if (bucket < HISTOGRAM_LINEAR) {
+        return bucket;
+    }
+
+    msb = 3 + (bucket - HISTOGRAM_LINEAR) / 4;
+    sub = (bucket - HISTOGRAM_LINEAR) % 4;
+    return ((1U << msb) | (sub << (msb - 2))) + (1U << (msb - 3));
+}
+
+static void
+histogram_add(op_histogram_t *hist, guint32 duration, gboolean failed,
+              gboolean timed_out)
+{
+    int lpc;
+
+    if (hist->count == 0 || duration < hist->min) {
+        hist->min = duration;
+    }
+    if (duration > hist->max) {
+        hist->max = duration;
+    }
+
+    hist->count++;
+    hist->failed += failed ? 1 : 0;
+    hist->timed_out += timed_out ? 1 : 0;
+
+    if (hist->samples >= HISTOGRAM_DECAY) {
+        hist->samples = 0;
+        for (lpc = 0; lpc < HISTOGRAM_BUCKETS; lpc++) {
+            hist->buckets[lpc] /= 2;
+            hist->samples += hist->buckets[lpc];
+        }
+        hist->sum /= 2;
+    }
+
+    hist->buckets[histogram_bucket(duration)]++;
+    hist->samples++;
+    hist->sum += duration;
+}
+
+static void
+histogram_merge(op_histogram_t *into, const op_histogram_t *from)
+{
+    int lpc;
+
+    if (from->count == 0) {
+        return;
+    }
+
+    if (into->count == 0 || from->min < into->min) {
+        into->min = from->min;
+    }
+    if (from->max > into->max) {
+        into->max = from->max;
+    }
+
+    into->count += from->count;
+    into->failed += from->failed;
+    into->timed_out += from->timed_out;
+    into->samples += from->samples;
+    into->sum += from->sum;
+
+    for (lpc = 0; lpc < HISTOGRAM_BUCKETS; lpc++) {
+        into->buckets[lpc] += from->buckets[lpc];
+    }
+}
+
+static guint32
+histogram_percentile(const op_histogram_t *hist, int percent)
+{
+    guint64 rank, seen = 0;
+    guint32 value;
+    int lpc;
+
+    if (hist->samples == 0) {
+        return 0;
+    }
+
+    rank = ((guint64) hist->samples * percent + 99) / 100;
+    for (lpc = 0; lpc < HISTOGRAM_BUCKETS; lpc++) {
+        seen += hist->buckets[lpc];
+        if (seen >= rank) {
+            break;
+        }
+    }
+
+    value = histogram_bucket_value(lpc);
+    return CLAMP(value, hist->min, hist->max);
+}
+
+static void
+histogram_report(const op_histogram_t *hist, svc_op_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    stats->count = hist->count;
+    stats->failed = hist->failed;
+    stats->timed_out = hist->timed_out;
+    stats->min = hist->min;
+    stats->max = hist->max;
+
+    if (hist->samples) {
+        stats->mean = hist->sum / hist->samples;
+        stats->p50 = histogram_percentile(hist, 50);
+        stats->p90 = histogram_percentile(hist, 90);
+        stats->p99 = histogram_percentile(hist, 99);
+    }
+}
+
+static void
+rsc_history_free(gpointer data)
+{
+    rsc_history_t *history = data;
+
+    g_hash_table_destroy(history->stats);
+    free(history);
+}
+
+static void
+history_evict_oldest(void)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    const char *oldest = NULL;
+    gint64 oldest_last = G_MAXINT64;
+
+    g_hash_table_iter_init(&iter, histories);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        rsc_history_t *history = value;
+
+        if (history->last < oldest_last) {
+            oldest_last = history->last;
+            oldest = key;
+        }
+    }
+
+    if (oldest) {
+        mh_debug("Forgetting the operation history of %s", oldest);
+        g_hash_table_remove(histories, oldest);
+    }
+}
+
+static rsc_history_t *
+history_lookup(const char *rsc, gboolean create)
+{
+    rsc_history_t *history;
+
+    if (histories == NULL) {
+        if (!create) {
+            return NULL;
+        }
+        histories = g_hash_table_new_full(g_str_hash, g_str_equal, free,
+                                          rsc_history_free);
+    }
+
+    history = g_hash_table_lookup(histories, rsc);
+    if (history == NULL && create) {
+        if (g_hash_table_size(histories) >= OP_HISTORY_MAX_RESOURCES) {
+            history_evict_oldest();
+        }
+
+        history = calloc(1, sizeof(rsc_history_t));
+        history->stats = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                               NULL, free);
+        g_hash_table_insert(histories, strdup(rsc), history);
+    }
+
+    return history;
+}
+
+void
+services_history_record(svc_action_t *op)
+{
+    rsc_history_t *history;
+    op_histogram_t *hist;
+    op_record_t *record;
+    GTimeVal now;
+    gint64 elapsed = op->opaque->usage.wall_ms;
+    gboolean failed, timed_out;
+
+    /* Arbitrary commands and agent descriptions aren't resource operations */
+    if (op->rsc == NULL || strcasecmp(op->action, "meta-data") == 0) {
+        return;
+    }
+
+    g_get_current_time(&now);
+
+    timed_out = op->status == LRM_OP_TIMEOUT;
+    failed = op->status != LRM_OP_DONE || op->rc != op->expected_rc;
+
+    history = history_lookup(op->rsc, TRUE);
+    history->last = g_get_monotonic_time();
+
+    record = &history->ring[history->head];
+    record->action = g_intern_string(op->action);
+    record->started = (gint64) now.tv_sec * 1000 + now.tv_usec / 1000
+                      - elapsed;
+    record->duration = (guint32) MIN(elapsed, G_MAXUINT32);
+    record->rc = op->rc;
+    record->status = op->status;
+    record->timed_out = timed_out;
+
+    history->head = (history->head + 1) % OP_HISTORY_LEN;
+    if (history->length < OP_HISTORY_LEN) {
+        history->length++;
+    }
+
+    hist = g_hash_table_lookup(history->stats, record->action);
+    if (hist == NULL) {
+        hist = calloc(1, sizeof(op_histogram_t));
+        g_hash_table_insert(history->stats, (gpointer) record->action, hist);
+    }
+
+    histogram_add(hist, record->duration, failed, timed_out);
+    histogram_add(&summary, record->duration, failed, timed_out);
+
+    mh_trace("%s took %ums (rc=%d, status=%d)", op->id, record->duration,
+             op->rc, op->status);
+}
+
+/*
+ * The interned copy of an action name, or NULL if it was never recorded.
+ * Names come from consoles here, so nothing new may be interned.
+ */
+static const char *
+history_action_lookup(const char *action)
+{
+    GQuark quark = g_quark_try_string(action);
+
+    return quark ? g_quark_to_string(quark) : NULL;
+}
+
+GList *
+services_op_history(const char *rsc, const char *action)
+{
+    rsc_history_t *history;
+    const char *interned = NULL;
+    GList *list = NULL;
+    guint lpc;
+
+    if (mh_strlen_zero(rsc) || (history = history_lookup(rsc, FALSE)) == NULL) {
+        return NULL;
+    }
+
+    if (!mh_strlen_zero(action)) {
+        interned = history_action_lookup(action);
+        if (interned == NULL) {
+            return NULL;
+        }
+    }
+
+    /* Oldest first, prepending leaves the newest at the head */
+    for (lpc = 0; lpc < history->length; lpc++) {
+        guint slot = (history->head + OP_HISTORY_LEN - history->length + lpc)
+                     % OP_HISTORY_LEN;
+        op_record_t *record = &history->ring[slot];
+        svc_history_entry_t *entry;
+
+        if (interned && record->action != interned) {
+            continue;
+        }
+
+        entry = calloc(1, sizeof(svc_history_entry_t));
+        entry->action = record->action;
+        entry->started.tv_sec = record->started / 1000;
+        entry->started.tv_usec = (record->started % 1000) * 1000;
+        entry->duration = record->duration;
+        entry->rc = record->rc;
+        entry->status = record->status;
+        entry->timed_out = record->timed_out;
+
+        list = g_list_prepend(list, entry);
+    }
+
+    return list;
+}
+
+gboolean
+services_op_stats(const char *rsc, const char *action, svc_op_stats_t *stats)
+{
+    rsc_history_t *history;
+    op_histogram_t *merged;
+    GHashTableIter iter;
+    gpointer key, value;
+
+    if (mh_strlen_zero(rsc)) {
+        histogram_report(&summary, stats);
+        return TRUE;
+    }
+
+    if ((history = history_lookup(rsc, FALSE)) == NULL) {
+        memset(stats, 0, sizeof(*stats));
+        return FALSE;
+    }
+
+    if (!mh_strlen_zero(action)) {
+        const char *interned = history_action_lookup(action);
+        op_histogram_t *hist = NULL;
+
+        if (interned) {
+            hist = g_hash_table_lookup(history->stats, interned);
+        }
+        if (hist == NULL) {
+            memset(stats, 0, sizeof(*stats));
+            return FALSE;
+        }
+
+        histogram_report(hist, stats);
+        return TRUE;
+    }
+
+    merged = calloc(1, sizeof(op_histogram_t));
+    g_hash_table_iter_init(&iter, history->stats);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        histogram_merge(merged, value);
+    }
+    histogram_report(merged, stats);
+    free(merged);
+
+    return TRUE;
+}
+
+void
+services_usage_record(svc_action_t *op)
+{
+    svc_agent_usage_t *usage;
+    char *agent, *key;
+
+    if (op->standard == NULL || op->agent == NULL) {
+        /* Arbitrary commands, see mh_services_action_create_generic() */
+        return;
+    }
+
+    agent = services_agent_label(op);
+    key = g_strdup_printf("%s %s", agent, op->action);
+
+    if (agent_usage == NULL) {
+        agent_usage = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                            free);
+    }
+
+    usage = g_hash_table_lookup(agent_usage, key);
+    if (usage == NULL) {
+        usage = calloc(1, sizeof(svc_agent_usage_t));
+        usage->agent = g_intern_string(agent);
+        usage->action = g_intern_string(op->action);
+        g_hash_table_insert(agent_usage, key, usage);
+    } else {
+        g_free(key);
+    }
+    g_free(agent);
+
+    usage->count++;
+    usage->total.user_us += op->opaque->usage.user_us;
+    usage->total.system_us += op->opaque->usage.system_us;
+    usage->total.max_rss_kb = MAX(usage->total.max_rss_kb,
+                                  op->opaque->usage.max_rss_kb);
+    usage->total.block_in += op->opaque->usage.block_in;
+    usage->total.block_out += op->opaque->usage.block_out;
+    usage->total.wall_ms += op->opaque->usage.wall_ms;
+}
+
+GList *
+services_agent_usage(void)
+{
+    GHashTableIter iter;
+    gpointer value;
+    GList *list = NULL;
+
+    if (agent_usage == NULL) {
+        return NULL;
+    }
+
+    g_hash_table_iter_init(&iter, agent_usage);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        svc_agent_usage_t *usage = malloc(sizeof(svc_agent_usage_t));
+
+        memcpy(usage, value, sizeof(svc_agent_usage_t));
+        list = g_list_prepend(list, usage);
+    }
+
+    return list;
+}
@@ -20,8 +20,17 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sys/signalfd.h>
+#include <sys/inotify.h>
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <fcntl.h>
@@ -47,6 +56,76 @@ set_fd_opts(int fd, int opts)
     }
 }
 
+/* Longest partial line held back while streaming output */
+#define STREAM_LINE_MAX 4096
+
+/* Output already streamed that is kept for stdout_data/stderr_data */
+#define STREAM_KEEP_MAX 4096
+
+/*
+ * Hand the complete lines that arrived since last time to the output
+ * callback, and all that's left as well once the action has finished.
+ */
+static void
+stream_output(svc_action_t *op, gboolean is_err, char *data, int *len,
+              gboolean eof)
+{
+    size_t *streamed = is_err ? &op->opaque->stderr_streamed
+                              : &op->opaque->stdout_streamed;
+    char *start = data + *streamed;
+
+    for (;;) {
+        size_t avail = (data + *len) - start;
+        char *end = memchr(start, '\n', avail);
+        char *next, saved;
+
+        if (end) {
+            next = end + 1;
+        } else if (avail >= STREAM_LINE_MAX) {
+            end = next = start + STREAM_LINE_MAX;
+        } else if (eof && avail > 0) {
+            end = next = start + avail;
+        } else {
+            break;
+        }
+
+        saved = *end;
+        *end = 0;
+        op->opaque->output_callback(op, is_err, start);
+        *end = saved;
+        start = next;
+    }
+    *streamed = start - data;
+
+    if (*streamed > STREAM_KEEP_MAX) {
+        size_t drop = *streamed - STREAM_KEEP_MAX;
+
+        memmove(data, data + drop, *len - drop + 1);
+        *len -= drop;
+        *streamed -= drop;
+    }
+}
+
+/* Stream whatever is left once the action has finished */
+static void
+stream_output_finish(svc_action_t *op)
+{
+    int len;
+
+    if (op->opaque->output_callback == NULL) {
+        return;
+    }
+
+    if (op->stdout_data) {
+        len = strlen(op->stdout_data);
+        stream_output(op, FALSE, op->stdout_data, &len, TRUE);
+    }
+    if (op->stderr_data) {
+        len = strlen(op->stderr_data);
+        stream_output(op, TRUE, op->stderr_data, &len, TRUE);
+    }
+}
+
 static gboolean
 read_output(int fd, gpointer user_data)
 {
@@ -78,8 +157,20 @@ read_output(int fd, gpointer user_data)
             sprintf(data + len, "%s", buf);
             len += rc;
 
+        } else if (rc == 0) {
+            /* EOF
+             * Cleanup happens in pipe_done()
+             */
+            rc = FALSE;
+            break;
+
+        } else if (errno == EAGAIN) {
+            /* Drained for now, more may follow */
+            rc = TRUE;
+            break;
+
         } else if (errno != EINTR) {
-            /* error or EOF
+            /* error
              * Cleanup happens in pipe_done()
              */
             rc = FALSE;
@@ -88,6 +179,10 @@ read_output(int fd, gpointer user_data)
 
     } while (rc == buf_read_len || rc < 0);
 
+    if (data != NULL && op->opaque->output_callback) {
+        stream_output(op, is_err, data, &len, FALSE);
+    }
+
     if (data != NULL && is_err) {
         op->stderr_data = data;
     } else if (data != NULL) {
@@ -123,78 +218,112 @@ pipe_err_done(gpointer user_data)
 }
 
 static void
-set_ocf_env(gpointer key, gpointer value, gpointer user_data)
+add_ocf_env(GPtrArray *env, const char *key, const char *value)
 {
-    if (setenv(key, value, 1) != 0) {
-        mh_err("setenv failed in raexecocf.");
-    }
+    g_ptr_array_add(env, g_strdup_printf("%s=%s", key, value));
 }
 
 static void
-set_ocf_env_with_prefix(gpointer key, gpointer value, gpointer user_data)
+add_ocf_env_with_prefix(gpointer key, gpointer value, gpointer user_data)
 {
-    /* TODO: Add OCF_RESKEY_ prefix to 'key' */
     char buffer[500];
     snprintf(buffer, sizeof(buffer), "OCF_RESKEY_%s", (char *) key);
-    set_ocf_env(buffer, value, user_data);
+    add_ocf_env(user_data, buffer, value);
 }
 
-static void
-add_OCF_env_vars(svc_action_t *op)
+GPtrArray *
+ocf_env_vars(svc_action_t *op)
 {
+    GPtrArray *env = g_ptr_array_new();
+
     if (!op->standard || strcasecmp("ocf", op->standard) != 0) {
-        return;
+        return env;
     }
 
     if (op->params) {
-        g_hash_table_foreach(op->params, set_ocf_env_with_prefix, NULL);
+        g_hash_table_foreach(op->params, add_ocf_env_with_prefix, env);
     }
 
-    set_ocf_env("OCF_RA_VERSION_MAJOR", "1", NULL);
-    set_ocf_env("OCF_RA_VERSION_MINOR", "0", NULL);
-    set_ocf_env("OCF_ROOT", OCF_ROOT, NULL);
+    add_ocf_env(env, "OCF_RA_VERSION_MAJOR", "1");
+    add_ocf_env(env, "OCF_RA_VERSION_MINOR", "0");
+    add_ocf_env(env, "OCF_ROOT", OCF_ROOT);
 
     if (op->rsc) {
-        set_ocf_env("OCF_RESOURCE_INSTANCE", op->rsc, NULL);
+        add_ocf_env(env, "OCF_RESOURCE_INSTANCE", op->rsc);
     }
 
     if (op->agent != NULL) {
-        set_ocf_env("OCF_RESOURCE_TYPE", op->agent, NULL);
+        add_ocf_env(env, "OCF_RESOURCE_TYPE", op->agent);
     }
 
     /* Notes: this is not added to specification yet. Sept 10,2004 */
     if (op->provider != NULL) {
-        set_ocf_env("OCF_RESOURCE_PROVIDER", op->provider, NULL);
+        add_ocf_env(env, "OCF_RESOURCE_PROVIDER", op->provider);
     }
+
+    return env;
 }
 
-static gboolean recurring_action_timer(gpointer data)
+static void
+add_OCF_env_vars(svc_action_t *op)
 {
-    svc_action_t *op = data;
-    mh_debug("Scheduling another invokation of %s", op->id);
+    GPtrArray *env = ocf_env_vars(op);
+    guint lpc;
 
-    /* Clean out the old result */
-    free(op->stdout_data); op->stdout_data = NULL;
-    free(op->stderr_data); op->stderr_data = NULL;
+    /* Only called in the child, the strings must outlive the exec */
+    for (lpc = 0; lpc < env->len; lpc++) {
+        if (putenv(env->pdata[lpc]) != 0) {
+            mh_err("setenv failed in raexecocf.");
+        }
+    }
+    g_ptr_array_free(env, FALSE);
+}
 
-    services_action_async(op, NULL);
-    return FALSE;
+void
+services_usage_from_rusage(svc_action_t *op, const struct rusage *ru)
+{
+    op->opaque->usage.user_us = (guint64) ru->ru_utime.tv_sec * 1000000
+                        + ru->ru_utime.tv_usec;
+    op->opaque->usage.system_us = (guint64) ru->ru_stime.tv_sec * 1000000
+                          + ru->ru_stime.tv_usec;
+    op->opaque->usage.max_rss_kb = ru->ru_maxrss;
+    op->opaque->usage.block_in = ru->ru_inblock;
+    op->opaque->usage.block_out = ru->ru_oublock;
+    op->opaque->usage_valid = TRUE;
 }
 
 static void
 operation_finished(mainloop_child_t *p, int status, int signo, int exitcode)
 {
-    char *next = NULL;
-    char *offset = NULL;
     svc_action_t *op = p->privatedata;
-    int recurring = 0;
 
     p->privatedata = NULL;
-    op->status = LRM_OP_DONE;
     MH_ASSERT(op->pid == p->pid);
 
+    services_usage_from_rusage(op, mainloop_child_rusage(p));
+    operation_child_exited(op, p->timeout, signo, exitcode);
+}
+
+void
+operation_child_exited(svc_action_t *op, gboolean timed_out, int signo,
+                       int exitcode)
+{
+    char *next = NULL;
+    char *offset = NULL;
+
+    /* The exit may be noticed before the last of the output was read */
+    if (op->opaque->stdout_fd > STDERR_FILENO) {
+        read_output(op->opaque->stdout_fd, op);
+    }
+    if (op->opaque->stderr_fd > STDERR_FILENO) {
+        read_output(op->opaque->stderr_fd, op);
+    }
+    stream_output_finish(op);
+
+    op->status = LRM_OP_DONE;
+
     if (signo) {
-        if (p->timeout) {
+        if (timed_out) {
             mh_warn("%s:%d - timed out after %dms", op->id, op->pid,
                     op->timeout);
             op->status = LRM_OP_TIMEOUT;
@@ -240,34 +369,249 @@ operation_finished(mainloop_child_t *p, int status, int signo, int exitcode)
         }
     }
 
-    if (op->interval) {
-        recurring = 1;
-        op->opaque->repeat_timer = g_timeout_add(op->interval,
-                                                 recurring_action_timer,
-                                                 (void *) op);
+    operation_finalize(op);
+}
+
+/* Used when the action doesn't specify a timeout of its own */
+#define SYNC_DEFAULT_TIMEOUT_MS 1000
+
+static long long
+sync_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((long long) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/*
+ * Get a descriptor that becomes readable when the child exits.
+ *
+ * A pidfd is preferred.  On kernels without pidfd_open() we fall back to a
+ * signalfd for SIGCHLD, which requires SIGCHLD to be blocked while we wait.
+ * Other threads may still take the signal, so the caller polls as well.
+ * *sigfd_used is set when the fallback was taken so that the caller can
+ * restore the signal mask.
+ */
+static int
+sync_child_fd(pid_t pid, sigset_t *old_mask, gboolean *sigfd_used)
+{
+    int fd = -1;
+    sigset_t mask;
+
+    *sigfd_used = FALSE;
+
+#ifdef SYS_pidfd_open
+    fd = syscall(SYS_pidfd_open, pid, 0);
+    if (fd >= 0) {
+        return fd;
+    }
+    mh_trace("pidfd_open(%d) failed: %s", pid, strerror(errno));
+#endif
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    /* Only blocked for this thread, the others may still take SIGCHLD */
+    errno = pthread_sigmask(SIG_BLOCK, &mask, old_mask);
+    if (errno != 0) {
+        mh_perror(LOG_ERR, "pthread_sigmask() failed");
+        return -1;
+    }
+
+    fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0) {
+        mh_perror(LOG_ERR, "signalfd() failed");
+        pthread_sigmask(SIG_SETMASK, old_mask, NULL);
+        return -1;
+    }
+
+    *sigfd_used = TRUE;
+    return fd;
+}
+
+/*
+ * Wait for a synchronous action to complete
+ *
+ * Output is collected while we wait so that a chatty child can't fill its
+ * pipes and block forever.
+ *
+ * \retval TRUE  the child exited and has been reaped, see status and ru
+ * \retval FALSE the action timed out, the child is still running
+ */
+static gboolean
+sync_wait_child(svc_action_t *op, int *status, struct rusage *ru)
+{
+    struct pollfd fds[3];
+    gboolean sigfd_used = FALSE;
+    gboolean done = FALSE;
+    gboolean consumed_sigchld = FALSE;
+    sigset_t old_mask;
+    long long deadline;
+    int child_fd;
+
+    deadline = sync_now_ms() +
+        (op->timeout > 0 ? op->timeout : SYNC_DEFAULT_TIMEOUT_MS);
+
+    child_fd = sync_child_fd(op->pid, &old_mask, &sigfd_used);
+
+    fds[0].fd = child_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = op->opaque->stdout_fd;
+    fds[1].events = POLLIN;
+    fds[2].fd = op->opaque->stderr_fd;
+    fds[2].events = POLLIN;
+
+    while (done == FALSE) {
+        long long remaining;
+        int poll_ms;
+        int lpc;
+
+        /* Covers exits that happened before the signalfd was created */
+        if (child_fd < 0 || sigfd_used) {
+            pid_t rc = wait4(op->pid, status, WNOHANG, ru);
+            if (rc == op->pid) {
+                done = TRUE;
+                break;
+            } else if (rc < 0 && errno != EINTR) {
+                mh_perror(LOG_ERR, "wait4(%d) failed", op->pid);
+                done = TRUE;
+                break;
+            }
+        }
+
+        remaining = deadline - sync_now_ms();
+        if (remaining <= 0) {
+            break;
+        }
+
+        poll_ms = (int) remaining;
+        if ((child_fd < 0 || sigfd_used) && poll_ms > 50) {
+            /*
+             * No exit notification, or one that another thread may take
+             * the signal for, check back regularly
+             */
+            poll_ms = 50;
+        }
+
+        if (poll(fds, DIMOF(fds), poll_ms) < 0) {
+            if (errno != EINTR) {
+                mh_perror(LOG_ERR, "poll() failed");
+                break;
+            }
+            continue;
+        }
+
+        for (lpc = 1; lpc < DIMOF(fds); lpc++) {
+            if (fds[lpc].revents & POLLIN) {
+                read_output(fds[lpc].fd, op);
+
+            } else if (fds[lpc].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+                /* EOF, stop watching it */
+                fds[lpc].fd = -1;
+            }
+        }
+
+        if (child_fd >= 0 && (fds[0].revents & POLLIN)) {
+            if (sigfd_used) {
+                struct signalfd_siginfo info[8];
+                while (read(child_fd, info, sizeof(info)) > 0) {
+                    consumed_sigchld = TRUE;
+                }
+
+            } else if (wait4(op->pid, status, 0, ru) == op->pid) {
+                done = TRUE;
+            }
+        }
+    }
+
+    if (child_fd >= 0) {
+        close(child_fd);
     }
 
-    op->pid = 0;
+    if (sigfd_used) {
+        pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+        if (consumed_sigchld) {
+            /*
+             * We may have swallowed notifications meant for children that
+             * are tracked by the mainloop, make sure they get reaped.
+             */
+            raise(SIGCHLD);
+        }
+    }
 
-    if (op->opaque->callback) {
-        op->opaque->callback(op);
+    return done;
+}
+
+int
+exec_failure_rc(int errnum)
+{
+    switch (errnum) { /* see execve(2) */
+    case ENOENT:  /* No such file or directory */
+    case EISDIR:   /* Is a directory */
+        return OCF_NOT_INSTALLED;
+    case EACCES:   /* permission denied (various errors) */
+        return OCF_INSUFFICIENT_PRIV;
+    default:
+        return OCF_UNKNOWN_ERROR;
+    }
+}
+
+static void
+action_child_exec(svc_action_t *op, int stdout_fd[2], int stderr_fd[2])
+{
+    sigset_t mask;
+    int lpc;
+
+    /* Man: The call setpgrp() is equivalent to setpgid(0,0)
+     * _and_ compiles on BSD variants too
+     * need to investigate if it works the same too.
+     */
+    setpgid(0, 0);
+    close(stdout_fd[0]);
+    close(stderr_fd[0]);
+    if (STDOUT_FILENO != stdout_fd[1]) {
+        if (dup2(stdout_fd[1], STDOUT_FILENO) != STDOUT_FILENO) {
+            mh_perror(LOG_ERR, "dup2() failed (stdout)");
+        }
+        close(stdout_fd[1]);
+    }
+    if (STDERR_FILENO != stderr_fd[1]) {
+        if (dup2(stderr_fd[1], STDERR_FILENO) != STDERR_FILENO) {
+            mh_perror(LOG_ERR, "dup2() failed (stderr)");
+        }
+        close(stderr_fd[1]);
     }
 
-    if (!recurring) {
-        /*
-         * If this is a recurring action, do not free explicitly.
-         * It will get freed whenever the action gets cancelled.
-         */
-        services_action_free(op);
+    /* close all descriptors except stdin/out/err and channels to logd */
+    for (lpc = getdtablesize() - 1; lpc > STDERR_FILENO; lpc--) {
+        close(lpc);
     }
+
+    /* The agent may have blocked signals to read them from its main loop */
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+
+    /* Setup environment correctly */
+    add_OCF_env_vars(op);
+
+    /* execute the RA */
+    execvp(op->opaque->exec, op->opaque->args);
+
+    _exit(exec_failure_rc(errno));
 }
 
 gboolean
 services_os_action_execute(svc_action_t* op, gboolean synchronous)
 {
-    int rc, lpc;
     int stdout_fd[2];
     int stderr_fd[2];
+    gboolean helper = FALSE;
+
+#ifdef HAVE_SYSTEMD_DBUS
+    if (systemd_unit_handles(op, synchronous)) {
+        return systemd_unit_exec(op);
+    }
+#endif
 
     if (pipe(stdout_fd) < 0) {
         mh_perror(LOG_ERR, "pipe() failed");
@@ -277,61 +621,23 @@ services_os_action_execute(svc_action_t* op, gboolean synchronous)
         mh_perror(LOG_ERR, "pipe() failed");
     }
 
-    op->pid = fork();
-    switch (op->pid) {
-    case -1:
-        mh_perror(LOG_ERR, "fork() failed");
-        close(stdout_fd[0]);
-        close(stdout_fd[1]);
-        close(stderr_fd[0]);
-        close(stderr_fd[1]);
-        return FALSE;
+    if (!synchronous && services_zygote_exec(op, stdout_fd[1], stderr_fd[1])) {
+        /* The action helper forks on our behalf, see services_zygote.c */
+        helper = TRUE;
 
-    case 0:                /* Child */
-        /* Man: The call setpgrp() is equivalent to setpgid(0,0)
-         * _and_ compiles on BSD variants too
-         * need to investigate if it works the same too.
-         */
-        setpgid(0, 0);
-        close(stdout_fd[0]);
-        close(stderr_fd[0]);
-        if (STDOUT_FILENO != stdout_fd[1]) {
-            if (dup2(stdout_fd[1], STDOUT_FILENO) != STDOUT_FILENO) {
-                mh_perror(LOG_ERR, "dup2() failed (stdout)");
-            }
+    } else {
+        op->pid = fork();
+        if (op->pid < 0) {
+            mh_perror(LOG_ERR, "fork() failed");
+            close(stdout_fd[0]);
             close(stdout_fd[1]);
-        }
-        if (STDERR_FILENO != stderr_fd[1]) {
-            if (dup2(stderr_fd[1], STDERR_FILENO) != STDERR_FILENO) {
-                mh_perror(LOG_ERR, "dup2() failed (stderr)");
-            }
+            close(stderr_fd[0]);
             close(stderr_fd[1]);
-        }
+            return FALSE;
 
-        /* close all descriptors except stdin/out/err and channels to logd */
-        for (lpc = getdtablesize() - 1; lpc > STDERR_FILENO; lpc--) {
-            close(lpc);
+        } else if (op->pid == 0) {
+            action_child_exec(op, stdout_fd, stderr_fd);
         }
-
-        /* Setup environment correctly */
-        add_OCF_env_vars(op);
-
-        /* execute the RA */
-        execvp(op->opaque->exec, op->opaque->args);
-
-        switch (errno) { /* see execve(2) */
-        case ENOENT:  /* No such file or directory */
-        case EISDIR:   /* Is a directory */
-            rc = OCF_NOT_INSTALLED;
-            break;
-        case EACCES:   /* permission denied (various errors) */
-            rc = OCF_INSUFFICIENT_PRIV;
-            break;
-        default:
-            rc = OCF_UNKNOWN_ERROR;
-            break;
-        }
-        _exit(rc);
     }
 
     /* Only the parent reaches here */
@@ -345,19 +651,16 @@ services_os_action_execute(svc_action_t* op, gboolean synchronous)
     set_fd_opts(op->opaque->stderr_fd, O_NONBLOCK);
 
     if (synchronous) {
+        struct rusage ru;
         int status = 0;
-        int timeout = 1 + op->timeout / 1000;
-        mh_trace("Waiting for %d", op->pid);
-        while (timeout > 0 && waitpid(op->pid, &status, WNOHANG) <= 0) {
-            sleep(1);
-            timeout--;
-        }
 
-        mh_trace("Child done: %d", op->pid);
-        if (timeout == 0) {
+        memset(&ru, 0, sizeof(ru));
+        mh_trace("Waiting for %d", op->pid);
+        if (sync_wait_child(op, &status, &ru) == FALSE) {
             int killrc = sigar_proc_kill(op->pid, 9 /*SIGKILL*/);
 
             op->status = LRM_OP_TIMEOUT;
+            op->rc = OCF_TIMEOUT;
             mh_warn("%s:%d - timed out after %dms", op->id, op->pid,
                     op->timeout);
 
@@ -365,11 +668,14 @@ services_os_action_execute(svc_action_t* op, gboolean synchronous)
                 mh_err("kill(%d, KILL) failed: %d", op->pid, killrc);
             }
 
+            /* Don't leave a zombie behind */
+            while (wait4(op->pid, &status, 0, &ru) < 0 && errno == EINTR);
+
         } else if (WIFEXITED(status)) {
             op->status = LRM_OP_DONE;
             op->rc = WEXITSTATUS(status);
-            mh_err("Managed %s process %d exited with rc=%d", op->id, op->pid,
-                   op->rc);
+            mh_debug("Managed %s process %d exited with rc=%d", op->id,
+                     op->pid, op->rc);
 
         } else if (WIFSIGNALED(status)) {
             int signo = WTERMSIG(status);
@@ -383,26 +689,47 @@ services_os_action_execute(svc_action_t* op, gboolean synchronous)
         }
 #endif
 
+        services_usage_from_rusage(op, &ru);
+        mh_trace("Child done: %d", op->pid);
         read_output(op->opaque->stdout_fd, op);
         read_output(op->opaque->stderr_fd, op);
+        stream_output_finish(op);
+
+        close(op->opaque->stdout_fd);
+        op->opaque->stdout_fd = -1;
+        close(op->opaque->stderr_fd);
+        op->opaque->stderr_fd = -1;
 
     } else {
-        mh_trace("Async waiting for %d - %s", op->pid, op->opaque->exec);
-        mainloop_add_child(op->pid, op->timeout, op->id, op,
-                           operation_finished);
+        if (helper == FALSE) {
+            mh_trace("Async waiting for %d - %s", op->pid, op->opaque->exec);
+            mainloop_add_child(op->pid, op->timeout, op->id, op,
+                               operation_finished);
+        }
 
         op->opaque->stdout_gsource = mainloop_add_fd(G_PRIORITY_LOW,
                 op->opaque->stdout_fd, read_output, pipe_out_done, op);
 
         op->opaque->stderr_gsource = mainloop_add_fd(G_PRIORITY_LOW,
                 op->opaque->stderr_fd, read_output, pipe_err_done, op);
+
+        if (op->id) {
+            char *name = g_strdup_printf("%s stdout", op->id);
+
+            g_source_set_name((GSource *) op->opaque->stdout_gsource, name);
+            g_free(name);
+
+            name = g_strdup_printf("%s stderr", op->id);
+            g_source_set_name((GSource *) op->opaque->stderr_gsource, name);
+            g_free(name);
+        }
     }
 
     return TRUE;
 }
 
-GList *
-services_os_get_directory_list(const char *root, gboolean files)
+static GList *
+scan_directory(const char *root, gboolean files)
 {
     GList *list = NULL;
 #if __linux__
@@ -454,29 +781,279 @@ services_os_get_directory_list(const char *root, gboolean files)
     return list;
 }
 
+/*
+ * Agent catalogs
+ *
+ * Listing agents means walking a directory and stat()ing every entry (or
+ * asking systemctl), and consoles do that a lot.  Results are cached per
+ * directory and thrown away when inotify reports a change to that
+ * directory.  Pending inotify events are picked up whenever a catalog is
+ * consulted, so no mainloop is required.
+ *
+ * Without inotify every lookup rescans, as before.
+ */
+
+typedef struct services_catalog_s services_catalog_t;
+struct services_catalog_s {
+    /** Directory being listed, or a unique name for other catalogs */
+    char *key;
+    gboolean files;
+    /** Directories whose changes invalidate the catalog, NULL for key */
+    const char **watch;
+    /** Produces the entries, scan_directory() when NULL */
+    GList *(*scan)(services_catalog_t *catalog);
+
+    gboolean valid;
+    gboolean watched;
+    /** Sorted list of entries (char *) */
+    GList *entries;
+    /** Entry name -> entry, for membership tests */
+    GHashTable *index;
+};
+
+static int catalog_inotify_fd = -1;
+static GHashTable *catalogs = NULL;         /* key -> services_catalog_t */
+/* wd -> GList of services_catalog_t; "root" and "root/" share a wd */
+static GHashTable *catalog_watches = NULL;
+
+static void
+catalog_clear(services_catalog_t *catalog)
+{
+    if (catalog->index) {
+        g_hash_table_destroy(catalog->index);
+        catalog->index = NULL;
+    }
+    g_list_free_full(catalog->entries, free);
+    catalog->entries = NULL;
+    catalog->valid = FALSE;
+}
+
+static void
+catalog_free(gpointer data)
+{
+    services_catalog_t *catalog = data;
+
+    catalog_clear(catalog);
+    free(catalog->key);
+    free(catalog);
+}
+
+static gboolean
+catalog_invalidate_one(gpointer key, gpointer value, gpointer user_data)
+{
+    services_catalog_t *catalog = value;
+
+    catalog_clear(catalog);
+    return FALSE;
+}
+
+static void
+catalog_process_events(void)
+{
+    char buffer[4096]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    if (catalog_inotify_fd < 0) {
+        return;
+    }
+
+    while ((len = read(catalog_inotify_fd, buffer, sizeof(buffer))) > 0) {
+        char *ptr;
+
+        for (ptr = buffer; ptr < buffer + len;
+             ptr += sizeof(struct inotify_event)
+                    + ((struct inotify_event *) ptr)->len) {
+            struct inotify_event *event = (struct inotify_event *) ptr;
+            GList *watchers, *gIter;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                mh_debug("inotify queue overflowed, dropping all catalogs");
+                g_hash_table_foreach(catalogs,
+                                     (GHFunc) catalog_invalidate_one, NULL);
+                continue;
+            }
+
+            watchers = g_hash_table_lookup(catalog_watches,
+                                           GINT_TO_POINTER(event->wd));
+
+            for (gIter = watchers; gIter != NULL; gIter = gIter->next) {
+                services_catalog_t *catalog = gIter->data;
+
+                mh_trace("Catalog %s changed (mask 0x%x)", catalog->key,
+                         event->mask);
+                catalog_clear(catalog);
+
+                if (event->mask & IN_IGNORED) {
+                    /* The directory went away, watch it again on the next
+                     * scan */
+                    catalog->watched = FALSE;
+                }
+            }
+
+            if (watchers && (event->mask & IN_IGNORED)) {
+                g_hash_table_remove(catalog_watches,
+                                    GINT_TO_POINTER(event->wd));
+                g_list_free(watchers);
+            }
+        }
+    }
+}
+
+static void
+catalog_add_watches(services_catalog_t *catalog)
+{
+    const char *single[] = { catalog->key, NULL };
+    const char **dirs = catalog->watch ? catalog->watch : single;
+    int lpc;
+
+    if (catalog_inotify_fd < 0) {
+        return;
+    }
+
+    for (lpc = 0; dirs[lpc] != NULL; lpc++) {
+        GList *watchers;
+        int wd = inotify_add_watch(catalog_inotify_fd, dirs[lpc],
+                                   IN_CREATE | IN_DELETE | IN_MOVED_FROM
+                                   | IN_MOVED_TO | IN_ATTRIB | IN_CLOSE_WRITE
+                                   | IN_DELETE_SELF | IN_MOVE_SELF);
+        if (wd < 0) {
+            mh_trace("Could not watch %s: %s", dirs[lpc], strerror(errno));
+            continue;
+        }
+
+        /* An existing watch on the same directory gives back the same wd */
+        watchers = g_hash_table_lookup(catalog_watches, GINT_TO_POINTER(wd));
+        if (g_list_find(watchers, catalog) == NULL) {
+            g_hash_table_insert(catalog_watches, GINT_TO_POINTER(wd),
+                                g_list_prepend(watchers, catalog));
+        }
+        catalog->watched = TRUE;
+    }
+}
+
+static services_catalog_t *
+catalog_get(const char *key, gboolean files, const char **watch,
+            GList *(*scan)(services_catalog_t *catalog))
+{
+    services_catalog_t *catalog;
+    GList *gIter;
+
+    if (catalogs == NULL) {
+        catalogs = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                         catalog_free);
+        catalog_watches = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+        catalog_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (catalog_inotify_fd < 0) {
+            mh_perror(LOG_INFO, "inotify unavailable, agent lists won't be "
+                      "cached");
+        }
+    }
+
+    catalog = g_hash_table_lookup(catalogs, key);
+    if (catalog == NULL) {
+        catalog = calloc(1, sizeof(services_catalog_t));
+        catalog->key = strdup(key);
+        catalog->files = files;
+        catalog->watch = watch;
+        catalog->scan = scan;
+        g_hash_table_insert(catalogs, catalog->key, catalog);
+    }
+
+    catalog_process_events();
+
+    if (catalog->valid) {
+        return catalog;
+    }
+
+    catalog_clear(catalog);
+
+    /* Watch before scanning so that changes made meanwhile aren't missed */
+    if (catalog->watched == FALSE) {
+        catalog_add_watches(catalog);
+    }
+
+    if (catalog->scan) {
+        catalog->entries = catalog->scan(catalog);
+    } else {
+        catalog->entries = scan_directory(catalog->key, catalog->files);
+    }
+
+    catalog->index = g_hash_table_new(g_str_hash, g_str_equal);
+    for (gIter = catalog->entries; gIter != NULL; gIter = gIter->next) {
+        g_hash_table_insert(catalog->index, gIter->data, gIter->data);
+    }
+
+    /* Only trust the result if we'll hear about changes */
+    catalog->valid = catalog->watched;
+    return catalog;
+}
+
+static GList *
+catalog_copy_entries(services_catalog_t *catalog)
+{
+    GList *list = NULL;
+    GList *gIter;
+
+    for (gIter = catalog->entries; gIter != NULL; gIter = gIter->next) {
+        list = g_list_prepend(list, strdup(gIter->data));
+    }
+    return g_list_reverse(list);
+}
+
+static gboolean
+catalog_contains(services_catalog_t *catalog, const char *entry)
+{
+    return entry != NULL
+        && g_hash_table_lookup(catalog->index, entry) != NULL;
+}
+
+static services_catalog_t *
+ocf_agent_catalog(const char *provider)
+{
+    char buffer[PATH_MAX];
+
+    snprintf(buffer, sizeof(buffer), "%s/resource.d/%s", OCF_ROOT, provider);
+    return catalog_get(buffer, TRUE, NULL, NULL);
+}
+
+GList *
+services_os_get_directory_list(const char *root, gboolean files)
+{
+    services_catalog_t *catalog;
+    char *key;
+
+    /* The same directory may be listed both ways */
+    key = g_strdup_printf("%s%s", root, files ? "" : "/");
+    catalog = catalog_get(key, files, NULL, NULL);
+    g_free(key);
+
+    return catalog_copy_entries(catalog);
+}
+
 void
 services_os_set_exec(svc_action_t *op)
 {
     if (strcmp("enable", op->action) == 0) {
-        op->opaque->exec = strdup("/sbin/chkconfig");
-        op->opaque->args[0] = strdup(op->opaque->exec);
-        op->opaque->args[1] = strdup(op->agent);
-        op->opaque->args[2] = strdup("on");
+        op->opaque->exec = services_intern("/sbin/chkconfig");
+        op->opaque->args[0] = services_intern(op->opaque->exec);
+        op->opaque->args[1] = services_intern(op->agent);
+        op->opaque->args[2] = services_intern("on");
         op->opaque->args[3] = NULL;
 
     } else if (strcmp("disable", op->action) == 0) {
-        op->opaque->exec = strdup("/sbin/chkconfig");
-        op->opaque->args[0] = strdup(op->opaque->exec);
-        op->opaque->args[1] = strdup(op->agent);
-        op->opaque->args[2] = strdup("off");
+        op->opaque->exec = services_intern("/sbin/chkconfig");
+        op->opaque->args[0] = services_intern(op->opaque->exec);
+        op->opaque->args[1] = services_intern(op->agent);
+        op->opaque->args[2] = services_intern("off");
         op->opaque->args[3] = NULL;
 
     } else {
-        if (asprintf(&op->opaque->exec, "%s/%s", LSB_ROOT, op->agent) == -1) {
-            return;
-        }
-        op->opaque->args[0] = strdup(op->opaque->exec);
-        op->opaque->args[1] = strdup(op->action);
+        op->opaque->exec = services_intern_printf("%s/%s", LSB_ROOT,
+                                                  op->agent);
+        op->opaque->args[0] = services_intern(op->opaque->exec);
+        op->opaque->args[1] = services_intern(op->action);
         op->opaque->args[2] = NULL;
     }
 }
@@ -487,6 +1064,11 @@ services_os_list(void)
     return get_directory_list(LSB_ROOT, TRUE);
 }
 
+gboolean
+services_os_exists(const char *name)
+{
+    return catalog_contains(catalog_get(LSB_ROOT, TRUE, NULL, NULL), name);
+}
 
 GList *
 resources_os_list_ocf_providers(void)
@@ -498,16 +1080,22 @@ GList *
 resources_os_list_ocf_agents(const char *provider)
 {
     if (provider) {
-        char buffer[500];
-        snprintf(buffer, sizeof(buffer), "%s//resource.d/%s", OCF_ROOT,
-                 provider);
-        return get_directory_list(buffer, TRUE);
+        return catalog_copy_entries(ocf_agent_catalog(provider));
     }
     return NULL;
 }
 
-GList *
-resources_os_list_systemd_services(void)
+gboolean
+resources_os_ocf_agent_exists(const char *provider, const char *agent)
+{
+    if (mh_strlen_zero(provider) || strchr(provider, '/')) {
+        return FALSE;
+    }
+    return catalog_contains(ocf_agent_catalog(provider), agent);
+}
+
+static GList *
+systemd_scan_units(services_catalog_t *catalog)
 {
     GList *list = NULL;
     char *ptr, *service, *end;
@@ -516,10 +1104,16 @@ resources_os_list_systemd_services(void)
     const char *args[] = { "list-units", "--all", "--type=service", "--full",
                            "--no-pager", NULL };
 
+#ifdef HAVE_SYSTEMD_DBUS
+    if (systemd_unit_list(&list)) {
+        return list;
+    }
+#endif
+
     if (!(action = mh_services_action_create_generic(SYSTEMCTL, args))) {
         return NULL;
     }
-    if (!services_action_sync(action)) {
+    if (!services_action_sync(action) || action->stdout_data == NULL) {
         services_action_free(action);
         return NULL;
     }
@@ -539,8 +1133,34 @@ resources_os_list_systemd_services(void)
             break;
         }
         service = mh_string_copy(service, ptr, len + 1);
-        list = g_list_append(list, service);
+        list = g_list_prepend(list, service);
     }
     services_action_free(action);
-    return list;
+    return g_list_sort(list, (GCompareFunc) strcmp);
+}
+
+static services_catalog_t *
+systemd_catalog(void)
+{
+    static const char *unit_dirs[] = {
+        "/etc/systemd/system",
+        "/run/systemd/system",
+        "/lib/systemd/system",
+        "/usr/lib/systemd/system",
+        NULL
+    };
+
+    return catalog_get("systemd:", TRUE, unit_dirs, systemd_scan_units);
+}
+
+GList *
+resources_os_list_systemd_services(void)
+{
+    return catalog_copy_entries(systemd_catalog());
+}
+
+gboolean
+resources_os_systemd_service_exists(const char *name)
+{
+    return catalog_contains(systemd_catalog(), name);
 }
@@ -0,0 +1,511 @@
+/*
+ * Copyright (C) 2011, Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/**
+ * \file
+ * \brief Resource agent descriptions
+ *
+ * OCF agents describe themselves with their meta-data action, LSB init
+ * scripts through their INIT INFO header.  Descriptions are kept in
+ * memory and on disk, keyed by the agent's path and validated against
+ * its mtime and size, so an agent is only asked again once it changes.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "matahari/logging.h"
+#include "matahari/utilities.h"
+#include "matahari/services.h"
+
+#include "services_private.h"
+
+#define DESCRIBE_TIMEOUT_MS 30000
+
+/* How many agents resources_describe_all() asks at once */
+#define DESCRIBE_PREFETCH_PARALLEL 4
+
+#define METADATA_DIR LOCAL_STATE_DIR "/lib/matahari/metadata"
+
+typedef struct metadata_s {
+    time_t  mtime;
+    off_t   size;
+    char   *xml;
+} metadata_t;
+
+typedef struct describe_req_s {
+    char       *path;
+    struct stat sb;
+    void      (*callback)(const char *xml, gpointer user_data);
+    gpointer    user_data;
+} describe_req_t;
+
+typedef struct prefetch_s {
+    char *standard;
+    char *provider;
+    char *agent;
+} prefetch_t;
+
+/* Agent path -> metadata_t */
+static GHashTable *metadata_cache = NULL;
+
+static GQueue *prefetch_queue = NULL;
+static int prefetch_active = 0;
+
+static void
+metadata_free(gpointer data)
+{
+    metadata_t *md = data;
+
+    free(md->xml);
+    free(md);
+}
+
+static char *
+agent_path(const char *standard, const char *provider, const char *agent)
+{
+    if (mh_strlen_zero(agent) || strchr(agent, '/')
+        || (provider && strchr(provider, '/'))) {
+        return NULL;
+    }
+
+    if (strcasecmp(standard, "ocf") == 0 && !mh_strlen_zero(provider)) {
+        return g_strdup_printf("%s/resource.d/%s/%s", OCF_ROOT, provider,
+                               agent);
+
+    } else if (strcasecmp(standard, "lsb") == 0) {
+        return g_strdup_printf("%s/%s", LSB_ROOT, agent);
+    }
+
+    return NULL;
+}
+
+static char *
+metadata_file(const char *path)
+{
+    char *digest = g_compute_checksum_for_string(G_CHECKSUM_MD5, path, -1);
+    char *file = g_strdup_printf("%s/%s", METADATA_DIR, digest);
+
+    g_free(digest);
+    return file;
+}
+
+static const char *
+metadata_lookup(const char *path, struct stat *sb)
+{
+    metadata_t *md;
+
+    if (metadata_cache == NULL
+        || (md = g_hash_table_lookup(metadata_cache, path)) == NULL) {
+        return NULL;
+    }
+
+    if (md->mtime != sb->st_mtime || md->size != sb->st_size) {
+        g_hash_table_remove(metadata_cache, path);
+        return NULL;
+    }
+
+    return md->xml;
+}
+
+static const char *
+metadata_remember(const char *path, struct stat *sb, const char *xml)
+{
+    metadata_t *md = calloc(1, sizeof(metadata_t));
+
+    md->mtime = sb->st_mtime;
+    md->size = sb->st_size;
+    md->xml = strdup(xml);
+
+    if (metadata_cache == NULL) {
+        metadata_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                               g_free, metadata_free);
+    }
+    g_hash_table_replace(metadata_cache, g_strdup(path), md);
+
+    return md->xml;
+}
+
+/*
+ * The on-disk format is the agent path and "mtime size" on the first two
+ * lines, followed by the XML.
+ */
+static const char *
+metadata_load(const char *path, struct stat *sb)
+{
+    char *file = metadata_file(path);
+    char *contents = NULL, *line2, *xml;
+    const char *result = NULL;
+    long long mtime = 0, size = 0;
+
+    if (g_file_get_contents(file, &contents, NULL, NULL) == FALSE) {
+        g_free(file);
+        return NULL;
+    }
+
+    if ((line2 = strchr(contents, '\n')) != NULL) {
+        *line2++ = 0;
+        if ((xml = strchr(line2, '\n')) != NULL
+            && strcmp(contents, path) == 0
+            && sscanf(line2, "%lld %lld", &mtime, &size) == 2
+            && mtime == (long long) sb->st_mtime
+            && size == (long long) sb->st_size) {
+            result = metadata_remember(path, sb, xml + 1);
+        }
+    }
+
+    if (result == NULL) {
+        mh_debug("Discarding stale description of %s", path);
+        unlink(file);
+    }
+
+    g_free(contents);
+    g_free(file);
+    return result;
+}
+
+static void
+metadata_store(const char *path, struct stat *sb, const char *xml)
+{
+    char *file, *contents;
+    GError *error = NULL;
+
+    metadata_remember(path, sb, xml);
+
+    if (g_mkdir_with_parents(METADATA_DIR, 0700) < 0) {
+        mh_perror(LOG_DEBUG, "Cannot create %s", METADATA_DIR);
+        return;
+    }
+
+    file = metadata_file(path);
+    contents = g_strdup_printf("%s\n%lld %lld\n%s", path,
+                               (long long) sb->st_mtime,
+                               (long long) sb->st_size, xml);
+
+    /* Written to a temporary file and renamed into place */
+    if (g_file_set_contents(file, contents, -1, &error) == FALSE) {
+        mh_warn("Could not save the description of %s: %s", path,
+                error->message);
+        g_error_free(error);
+    }
+
+    g_free(contents);
+    g_free(file);
+}
+
+static const char *lsb_fields[] = {
+    "Provides", "Required-Start", "Required-Stop", "Should-Start",
+    "Should-Stop", "Default-Start", "Default-Stop", "Short-Description",
+    "Description",
+};
+
+static char *
+lsb_metadata(const char *agent, const char *path)
+{
+    char *contents = NULL, **lines, *value;
+    GHashTable *fields;
+    GString *xml;
+    const char *last = NULL;
+    gboolean in_header = FALSE;
+    int lpc, field;
+
+    if (g_file_get_contents(path, &contents, NULL, NULL) == FALSE) {
+        return NULL;
+    }
+
+    fields = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+    lines = g_strsplit(contents, "\n", 0);
+    g_free(contents);
+
+    for (lpc = 0; lines[lpc]; lpc++) {
+        char *line = lines[lpc];
+
+        if (strncmp(line, "### BEGIN INIT INFO", 19) == 0) {
+            in_header = TRUE;
+            continue;
+        } else if (strncmp(line, "### END INIT INFO", 17) == 0) {
+            break;
+        } else if (!in_header || line[0] != '#') {
+            continue;
+        }
+
+        if (last && (strncmp(line, "#\t", 2) == 0
+                     || strncmp(line, "#  ", 3) == 0)) {
+            /* Continuation of a multi-line field */
+            char *old = g_hash_table_lookup(fields, last);
+
+            value = g_strdup_printf("%s %s", old, g_strstrip(line + 1));
+            g_hash_table_replace(fields, (gpointer) last, value);
+            continue;
+        }
+
+        last = NULL;
+        for (field = 0; field < DIMOF(lsb_fields); field++) {
+            size_t len = strlen(lsb_fields[field]);
+
+            if (strncmp(line, "# ", 2) == 0
+                && strncmp(line + 2, lsb_fields[field], len) == 0
+                && line[2 + len] == ':') {
+                last = lsb_fields[field];
+                g_hash_table_replace(fields, (gpointer) last,
+                                     g_strdup(g_strstrip(line + 3 + len)));
+                break;
+            }
+        }
+    }
+    g_strfreev(lines);
+
+    xml = g_string_new(NULL);
+    g_string_append_printf(xml,
+        "<?xml version=\"1.0\"?>\n"
+        "<!DOCTYPE resource-agent SYSTEM \"ra-api-1.dtd\">\n"
+        "<resource-agent name=\"%s\" version=\"0.1\">\n"
+        "  <version>1.0</version>\n", agent);
+
+    value = g_markup_escape_text(g_hash_table_lookup(fields, "Description")
+                                 ? g_hash_table_lookup(fields, "Description")
+                                 : agent, -1);
+    g_string_append_printf(xml, "  <longdesc lang=\"en\">%s</longdesc>\n",
+                           value);
+    g_free(value);
+
+    value = g_markup_escape_text(
+                g_hash_table_lookup(fields, "Short-Description")
+                ? g_hash_table_lookup(fields, "Short-Description")
+                : agent, -1);
+    g_string_append_printf(xml, "  <shortdesc lang=\"en\">%s</shortdesc>\n",
+                           value);
+    g_free(value);
+
+    g_string_append(xml,
+        "  <parameters/>\n"
+        "  <actions>\n"
+        "    <action name=\"start\"     timeout=\"15\" />\n"
+        "    <action name=\"stop\"      timeout=\"15\" />\n"
+        "    <action name=\"status\"    timeout=\"15\" />\n"
+        "    <action name=\"restart\"   timeout=\"15\" />\n"
+        "    <action name=\"monitor\"   timeout=\"15\" interval=\"15\" />\n"
+        "    <action name=\"meta-data\" timeout=\"5\" />\n"
+        "  </actions>\n"
+        "  <special tag=\"LSB\">\n");
+
+    for (field = 0; field < DIMOF(lsb_fields); field++) {
+        const char *raw = g_hash_table_lookup(fields, lsb_fields[field]);
+
+        if (raw) {
+            value = g_markup_escape_text(raw, -1);
+            g_string_append_printf(xml, "    <%s>%s</%s>\n", lsb_fields[field],
+                                   value, lsb_fields[field]);
+            g_free(value);
+        }
+    }
+
+    g_string_append(xml, "  </special>\n</resource-agent>\n");
+    g_hash_table_destroy(fields);
+
+    return g_string_free(xml, FALSE);
+}
+
+static void
+describe_req_free(describe_req_t *req)
+{
+    g_free(req->path);
+    free(req);
+}
+
+static void
+describe_done(svc_action_t *op)
+{
+    describe_req_t *req = op->cb_data;
+
+    op->cb_data = NULL;
+
+    if (op->rc == OCF_OK && !mh_strlen_zero(op->stdout_data)) {
+        metadata_store(req->path, &req->sb, op->stdout_data);
+        req->callback(op->stdout_data, req->user_data);
+
+    } else {
+        mh_warn("Could not obtain the description of %s: rc=%d", req->path,
+                op->rc);
+        req->callback(NULL, req->user_data);
+    }
+
+    describe_req_free(req);
+}
+
+gboolean
+resources_agent_describe(const char *standard, const char *provider,
+                         const char *agent,
+                         void (*callback)(const char *xml, gpointer user_data),
+                         gpointer user_data)
+{
+    char *path;
+    const char *xml;
+    struct stat sb;
+    svc_action_t *op;
+    describe_req_t *req;
+
+    if (mh_strlen_zero(standard)
+        || (path = agent_path(standard, provider, agent)) == NULL) {
+        return FALSE;
+    }
+
+    if (stat(path, &sb) < 0) {
+        g_free(path);
+        return FALSE;
+    }
+
+    if ((xml = metadata_lookup(path, &sb)) || (xml = metadata_load(path, &sb))) {
+        mh_trace("Using the cached description of %s", path);
+        callback(xml, user_data);
+        g_free(path);
+        return TRUE;
+    }
+
+    if (strcasecmp(standard, "lsb") == 0) {
+        char *generated = lsb_metadata(agent, path);
+
+        if (generated) {
+            metadata_store(path, &sb, generated);
+        }
+        callback(generated, user_data);
+        g_free(generated);
+        g_free(path);
+        return TRUE;
+    }
+
+    op = resources_action_create(agent, standard, provider, agent,
+                                 "meta-data", 0, DESCRIBE_TIMEOUT_MS, NULL);
+    if (op == NULL) {
+        g_free(path);
+        return FALSE;
+    }
+
+    req = calloc(1, sizeof(describe_req_t));
+    req->path = path;
+    req->sb = sb;
+    req->callback = callback;
+    req->user_data = user_data;
+    op->cb_data = req;
+
+    /* Concurrent describes of the same agent share one meta-data run */
+    if (services_action_async(op, describe_done) == FALSE) {
+        op->cb_data = NULL;
+        describe_req_free(req);
+        services_action_free(op);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void prefetch_next(void);
+
+static void
+prefetch_done(const char *xml, gpointer user_data)
+{
+    prefetch_active--;
+    prefetch_next();
+}
+
+static void
+prefetch_next(void)
+{
+    static gboolean running = FALSE;
+    prefetch_t *item;
+
+    /* Cached descriptions complete immediately, don't recurse for them */
+    if (running) {
+        return;
+    }
+    running = TRUE;
+
+    while (prefetch_active < DESCRIBE_PREFETCH_PARALLEL
+           && (item = g_queue_pop_head(prefetch_queue))) {
+        prefetch_active++;
+        if (!resources_agent_describe(item->standard, item->provider,
+                                      item->agent, prefetch_done, NULL)) {
+            prefetch_active--;
+        }
+
+        free(item->standard);
+        free(item->provider);
+        free(item->agent);
+        free(item);
+    }
+
+    running = FALSE;
+}
+
+static int
+prefetch_queue_agents(const char *standard, const char *provider)
+{
+    GList *agents, *gIter;
+    int count = 0;
+
+    agents = resources_list_agents(standard, provider);
+    for (gIter = agents; gIter; gIter = gIter->next) {
+        prefetch_t *item = calloc(1, sizeof(prefetch_t));
+
+        item->standard = strdup(standard);
+        item->provider = provider ? strdup(provider) : NULL;
+        item->agent = strdup(gIter->data);
+        g_queue_push_tail(prefetch_queue, item);
+        count++;
+    }
+    g_list_free_full(agents, free);
+
+    return count;
+}
+
+int
+resources_describe_all(const char *standard, const char *provider)
+{
+    int count = 0;
+
+    if (mh_strlen_zero(standard)) {
+        return 0;
+    }
+
+    if (prefetch_queue == NULL) {
+        prefetch_queue = g_queue_new();
+    }
+
+    if (strcasecmp(standard, "ocf") == 0 && mh_strlen_zero(provider)) {
+        GList *providers = resources_list_providers(standard), *gIter;
+
+        for (gIter = providers; gIter; gIter = gIter->next) {
+            count += prefetch_queue_agents(standard, gIter->data);
+        }
+        g_list_free_full(providers, free);
+
+    } else {
+        count = prefetch_queue_agents(standard, provider);
+    }
+
+    mh_debug("Prefetching %d %s descriptions", count, standard);
+    prefetch_next();
+    return count;
+}
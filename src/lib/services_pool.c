@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2011, Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/**
+ * \file
+ * \brief Action allocation
+ *
+ * Recurring monitors keep their svc_action_t alive for as long as the
+ * agent runs, so thousands of them would otherwise leave a dozen small
+ * allocations each scattered over the heap.  Actions and their private
+ * part are carved out of slabs together instead, and the strings they
+ * hold (names, standards, agents, exec paths and arguments) are shared
+ * through a reference counted table, since most of them are the same
+ * handful of values over and over.
+ *
+ * Like the rest of the services library, this is only used from the
+ * main loop.
+ */
+
+#include "config.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "matahari/logging.h"
+#include "matahari/services.h"
+
+#include "services_private.h"
+
+/* Actions carved out of each slab */
+#define ACTION_SLAB_BLOCKS 64
+
+typedef struct action_slab_s action_slab_t;
+
+typedef struct action_block_s {
+    svc_action_t           op;   /* must come first */
+    svc_action_private_t   priv;
+    action_slab_t         *slab;
+    struct action_block_s *next_free;
+} action_block_t;
+
+struct action_slab_s {
+    GList           link;        /* in partial_slabs */
+    action_block_t *free_blocks;
+    guint           used;
+    action_block_t  blocks[ACTION_SLAB_BLOCKS];
+};
+
+typedef struct intern_s {
+    guint refs;
+    char  str[1];
+} intern_t;
+
+/* Slabs with at least one free block, most recently used first */
+static GQueue partial_slabs = G_QUEUE_INIT;
+
+static GHashTable *interned = NULL;
+
+static action_slab_t *
+slab_new(void)
+{
+    action_slab_t *slab = calloc(1, sizeof(action_slab_t));
+    int lpc;
+
+    slab->link.data = slab;
+    for (lpc = ACTION_SLAB_BLOCKS - 1; lpc >= 0; lpc--) {
+        slab->blocks[lpc].slab = slab;
+        slab->blocks[lpc].next_free = slab->free_blocks;
+        slab->free_blocks = &slab->blocks[lpc];
+    }
+
+    return slab;
+}
+
+svc_action_t *
+services_action_alloc(void)
+{
+    action_slab_t *slab;
+    action_block_t *block;
+
+    if (g_queue_is_empty(&partial_slabs)) {
+        g_queue_push_head_link(&partial_slabs, &slab_new()->link);
+    }
+
+    slab = partial_slabs.head->data;
+    block = slab->free_blocks;
+    slab->free_blocks = block->next_free;
+    slab->used++;
+
+    if (slab->free_blocks == NULL) {
+        g_queue_unlink(&partial_slabs, &slab->link);
+    }
+
+    memset(&block->op, 0, sizeof(block->op));
+    memset(&block->priv, 0, sizeof(block->priv));
+    block->op.opaque = &block->priv;
+
+    return &block->op;
+}
+
+void
+services_action_release(svc_action_t *op)
+{
+    action_block_t *block = (action_block_t *) op;
+    action_slab_t *slab = block->slab;
+
+    if (slab->free_blocks == NULL) {
+        /* It was full, it has room again */
+        g_queue_push_head_link(&partial_slabs, &slab->link);
+    }
+
+    block->next_free = slab->free_blocks;
+    slab->free_blocks = block;
+    slab->used--;
+
+    /* Keep one slab around so a lone action doesn't keep allocating one */
+    if (slab->used == 0 && partial_slabs.length > 1) {
+        g_queue_unlink(&partial_slabs, &slab->link);
+        free(slab);
+    }
+}
+
+char *
+services_intern(const char *str)
+{
+    intern_t *entry;
+    size_t len;
+
+    if (str == NULL) {
+        return NULL;
+    }
+
+    if (interned == NULL) {
+        interned = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free);
+    }
+
+    entry = g_hash_table_lookup(interned, str);
+    if (entry == NULL) {
+        len = strlen(str);
+        entry = malloc(sizeof(intern_t) + len);
+        entry->refs = 0;
+        memcpy(entry->str, str, len + 1);
+        g_hash_table_insert(interned, entry->str, entry);
+    }
+
+    entry->refs++;
+    return entry->str;
+}
+
+char *
+services_intern_printf(const char *format, ...)
+{
+    va_list ap;
+    char *str, *result;
+
+    va_start(ap, format);
+    str = g_strdup_vprintf(format, ap);
+    va_end(ap);
+
+    result = services_intern(str);
+    g_free(str);
+
+    return result;
+}
+
+void
+services_intern_release(const char *str)
+{
+    intern_t *entry;
+
+    if (str == NULL) {
+        return;
+    }
+
+    entry = interned ? g_hash_table_lookup(interned, str) : NULL;
+    if (entry == NULL || entry->str != str) {
+        /* Set by the caller rather than through services_intern() */
+        free((char *) str);
+        return;
+    }
+
+    if (--entry->refs == 0) {
+        g_hash_table_remove(interned, str);
+    }
+}
@@ -19,6 +19,13 @@
 #ifndef __MH_SERVICES_PRIVATE_H__
 #define __MH_SERVICES_PRIVATE_H__
 
+/* Identifies a recurring action, see services_action_cancel() */
+typedef struct recurring_key_s {
+    const char *rsc;
+    const char *action;
+    int         interval;
+} recurring_key_t;
+
 struct svc_action_private_s {
     char *exec;
     char *args[7];
@@ -31,8 +38,59 @@ struct svc_action_private_s {
 
     int            stdout_fd;
     mainloop_fd_t *stdout_gsource;
+
+    /* Monotonic time the action was requested, see services_history.c */
+    gint64 started;
+    /* Kept here rather than in svc_action_t to preserve its layout */
+    svc_action_usage_t usage;
+    /* usage holds what the child process consumed */
+    gboolean usage_valid;
+
+    /* Streaming output, see services_action_set_output_callback() */
+    void (*output_callback)(svc_action_t *op, gboolean is_stderr,
+                            const char *line);
+    size_t stdout_streamed;
+    size_t stderr_streamed;
+
+    /* Recurring action registry, see services.c */
+    gboolean        registered;
+    recurring_key_t key;
+    char           *agent_label;
+    GList          *rsc_link;
+    GList          *agent_link;
+
+    /* Single-flight coalescing, see services_action_async() */
+    char  *coalesce_key;
+    GList *followers;
+    /* Who we follow, or the idle source delivering a reused result */
+    svc_action_t *leader;
+    guint         reuse_source;
+
+    /* Native systemd backend, see services_systemd.c */
+    char  *systemd_job;
+    guint  systemd_timer;
+    void  *systemd_pending;
+
+    /* Request id while the action helper runs us, see services_zygote.c */
+    guint32 zygote_id;
 };
 
+svc_action_t *
+services_action_alloc(void);
+
+void
+services_action_release(svc_action_t *op);
+
+/* Shared, read-only copies of str; release with services_intern_release() */
+char *
+services_intern(const char *str);
+
+char *
+services_intern_printf(const char *format, ...) G_GNUC_PRINTF(1, 2);
+
+void
+services_intern_release(const char *str);
+
 GList *
 services_os_get_directory_list(const char *root, gboolean files);
 
@@ -45,13 +103,69 @@ services_os_set_exec(svc_action_t *op);
 GList *
 services_os_list(void);
 
+gboolean
+services_os_exists(const char *name);
+
 GList *
 resources_os_list_ocf_providers(void);
 
 GList *
 resources_os_list_ocf_agents(const char *provider);
 
+gboolean
+resources_os_ocf_agent_exists(const char *provider, const char *agent);
+
 GList *
 resources_os_list_systemd_services(void);
 
+gboolean
+resources_os_systemd_service_exists(const char *name);
+
+void
+operation_finalize(svc_action_t *op);
+
+char *
+services_agent_label(svc_action_t *op);
+
+void
+operation_child_exited(svc_action_t *op, gboolean timed_out, int signo,
+                       int exitcode);
+
+int
+exec_failure_rc(int errnum);
+
+GPtrArray *
+ocf_env_vars(svc_action_t *op);
+
+void
+services_history_record(svc_action_t *op);
+
+void
+services_usage_record(svc_action_t *op);
+
+struct rusage;
+
+void
+services_usage_from_rusage(svc_action_t *op, const struct rusage *ru);
+
+gboolean
+services_zygote_exec(svc_action_t *op, int stdout_fd, int stderr_fd);
+
+void
+services_zygote_forget(svc_action_t *op);
+
+#ifdef HAVE_SYSTEMD_DBUS
+gboolean
+systemd_unit_handles(svc_action_t *op, gboolean synchronous);
+
+gboolean
+systemd_unit_exec(svc_action_t *op);
+
+void
+systemd_unit_forget(svc_action_t *op);
+
+gboolean
+systemd_unit_list(GList **units);
+#endif
+
 #endif /* __MH_SERVICES_PRIVATE_H__ */
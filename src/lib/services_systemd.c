@@ -0,0 +1,599 @@
+/*
+ * Copyright (C) 2011, Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/**
+ * \file
+ * \brief Native systemd backend for the "systemd" resource standard
+ *
+ * Unit actions are sent straight to the systemd manager over D-Bus
+ * instead of forking systemctl.  Start/stop style actions complete when
+ * systemd reports the job as removed, status/monitor read the unit's
+ * ActiveState property.  Results are delivered through the normal
+ * svc_action_t callback.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+#include <dbus/dbus.h>
+#include <dbus/dbus-glib-lowlevel.h>
+
+#include "matahari/logging.h"
+#include "matahari/utilities.h"
+#include "matahari/services.h"
+
+#include "services_private.h"
+
+#define SYSTEMD_BUS_NAME     "org.freedesktop.systemd1"
+#define SYSTEMD_OBJ_PATH     "/org/freedesktop/systemd1"
+#define SYSTEMD_MGR_IFACE    "org.freedesktop.systemd1.Manager"
+#define SYSTEMD_UNIT_IFACE   "org.freedesktop.systemd1.Unit"
+#define DBUS_PROPS_IFACE     "org.freedesktop.DBus.Properties"
+
+/* How long to wait for blocking manager queries, such as ListUnits */
+#define SYSTEMD_QUERY_TIMEOUT_MS 5000
+
+/* After failing to connect, use systemctl for this long before retrying */
+#define SYSTEMD_RETRY_S 30
+
+/*
+ * Setting this in the environment connects to the given bus instead of
+ * the system bus, which allows the backend to be pointed at a mock
+ * systemd service for testing.
+ */
+#define SYSTEMD_BUS_ENV "MH_SYSTEMD_BUS_ADDRESS"
+
+static DBusConnection *systemd_bus = NULL;
+
+/* Monotonic time of the next connection attempt, 0 when connected */
+static time_t systemd_retry_at = 0;
+
+/* Job object path -> svc_action_t waiting for the job to be removed */
+static GHashTable *systemd_jobs = NULL;
+
+static const struct {
+    const char *action;
+    const char *method;
+} systemd_job_methods[] = {
+    { "start",   "StartUnit" },
+    { "stop",    "StopUnit" },
+    { "restart", "RestartUnit" },
+    { "reload",  "ReloadUnit" },
+};
+
+static const char *
+systemd_job_method(const char *action)
+{
+    int lpc;
+
+    for (lpc = 0; lpc < DIMOF(systemd_job_methods); lpc++) {
+        if (strcasecmp(action, systemd_job_methods[lpc].action) == 0) {
+            return systemd_job_methods[lpc].method;
+        }
+    }
+    return NULL;
+}
+
+static gboolean
+systemd_is_query(const char *action)
+{
+    return strcasecmp(action, "status") == 0
+           || strcasecmp(action, "monitor") == 0;
+}
+
+static void
+systemd_action_done(svc_action_t *op, enum op_status status, int rc)
+{
+    systemd_unit_forget(op);
+
+    op->status = status;
+    op->rc = rc;
+    mh_debug("%s - systemd reported rc=%d", op->id, rc);
+
+    operation_finalize(op);
+}
+
+static void
+systemd_fail_jobs(void)
+{
+    GList *ops, *gIter;
+
+    if (systemd_jobs == NULL) {
+        return;
+    }
+
+    ops = g_hash_table_get_values(systemd_jobs);
+    for (gIter = ops; gIter; gIter = gIter->next) {
+        svc_action_t *op = gIter->data;
+
+        mh_err("%s - lost connection to systemd", op->id);
+        systemd_action_done(op, LRM_OP_ERROR, OCF_UNKNOWN_ERROR);
+    }
+    g_list_free(ops);
+}
+
+static DBusHandlerResult
+systemd_filter(DBusConnection *conn, DBusMessage *msg, void *user_data)
+{
+    if (dbus_message_is_signal(msg, SYSTEMD_MGR_IFACE, "JobRemoved")) {
+        dbus_uint32_t id = 0;
+        const char *path = NULL, *unit = NULL, *result = NULL;
+        svc_action_t *op;
+
+        if (!dbus_message_get_args(msg, NULL,
+                                   DBUS_TYPE_UINT32, &id,
+                                   DBUS_TYPE_OBJECT_PATH, &path,
+                                   DBUS_TYPE_STRING, &unit,
+                                   DBUS_TYPE_STRING, &result,
+                                   DBUS_TYPE_INVALID)) {
+            return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+        }
+
+        if (systemd_jobs == NULL
+            || (op = g_hash_table_lookup(systemd_jobs, path)) == NULL) {
+            return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+        }
+
+        mh_trace("Job %u for %s finished: %s", id, unit, result);
+
+        if (strcmp(result, "done") == 0) {
+            systemd_action_done(op, LRM_OP_DONE, OCF_OK);
+
+        } else if (strcmp(result, "timeout") == 0) {
+            mh_warn("%s - systemd timed out the %s job", op->id, unit);
+            systemd_action_done(op, LRM_OP_TIMEOUT, OCF_TIMEOUT);
+
+        } else if (strcmp(result, "canceled") == 0) {
+            mh_warn("%s - systemd cancelled the %s job", op->id, unit);
+            systemd_action_done(op, LRM_OP_CANCELLED, OCF_CANCELLED);
+
+        } else {
+            mh_warn("%s - job for %s finished with result '%s'", op->id,
+                    unit, result);
+            systemd_action_done(op, LRM_OP_DONE, OCF_UNKNOWN_ERROR);
+        }
+
+    } else if (dbus_message_is_signal(msg, DBUS_INTERFACE_LOCAL,
+                                      "Disconnected")) {
+        /* The connection is replaced on the next request */
+        systemd_fail_jobs();
+    }
+
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static DBusMessage *
+systemd_manager_call(const char *method)
+{
+    return dbus_message_new_method_call(SYSTEMD_BUS_NAME, SYSTEMD_OBJ_PATH,
+                                        SYSTEMD_MGR_IFACE, method);
+}
+
+static time_t
+systemd_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static DBusConnection *
+systemd_connect(void)
+{
+    DBusError error;
+    DBusMessage *msg;
+    const char *address;
+
+    if (systemd_bus) {
+        if (dbus_connection_get_is_connected(systemd_bus)) {
+            return systemd_bus;
+        }
+        dbus_connection_close(systemd_bus);
+        dbus_connection_unref(systemd_bus);
+        systemd_bus = NULL;
+    }
+
+    if (systemd_retry_at && systemd_now() < systemd_retry_at) {
+        /* Failed recently, don't try (and complain) for every action */
+        return NULL;
+    }
+
+    dbus_error_init(&error);
+
+    /* Use a private connection so we never share filters or the
+     * exit-on-disconnect policy with a D-Bus agent in the same process */
+    if ((address = getenv(SYSTEMD_BUS_ENV))) {
+        systemd_bus = dbus_connection_open_private(address, &error);
+        if (systemd_bus && !dbus_bus_register(systemd_bus, &error)) {
+            dbus_connection_close(systemd_bus);
+            dbus_connection_unref(systemd_bus);
+            systemd_bus = NULL;
+        }
+    } else {
+        systemd_bus = dbus_bus_get_private(DBUS_BUS_SYSTEM, &error);
+    }
+
+    if (systemd_bus == NULL) {
+        if (systemd_retry_at == 0) {
+            mh_warn("Could not connect to systemd, using systemctl for now: %s",
+                    dbus_error_is_set(&error) ? error.message : "unknown error");
+        } else {
+            mh_debug("Still could not connect to systemd: %s",
+                     dbus_error_is_set(&error) ? error.message : "unknown error");
+        }
+        dbus_error_free(&error);
+        systemd_retry_at = systemd_now() + SYSTEMD_RETRY_S;
+        return NULL;
+    }
+    systemd_retry_at = 0;
+
+    dbus_connection_set_exit_on_disconnect(systemd_bus, FALSE);
+    dbus_connection_setup_with_g_main(systemd_bus, NULL);
+    dbus_connection_add_filter(systemd_bus, systemd_filter, NULL, NULL);
+    dbus_bus_add_match(systemd_bus,
+                       "type='signal',"
+                       "sender='" SYSTEMD_BUS_NAME "',"
+                       "path='" SYSTEMD_OBJ_PATH "',"
+                       "interface='" SYSTEMD_MGR_IFACE "',"
+                       "member='JobRemoved'", NULL);
+
+    /* systemd only emits job signals to subscribed clients */
+    if ((msg = systemd_manager_call("Subscribe"))) {
+        dbus_connection_send(systemd_bus, msg, NULL);
+        dbus_message_unref(msg);
+    }
+
+    if (systemd_jobs == NULL) {
+        systemd_jobs = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                             g_free, NULL);
+    }
+
+    return systemd_bus;
+}
+
+static void
+systemd_reply_error(svc_action_t *op, DBusError *error)
+{
+    if (dbus_error_has_name(error, DBUS_ERROR_NO_REPLY)
+        || dbus_error_has_name(error, DBUS_ERROR_TIMEOUT)) {
+        mh_warn("%s - no reply from systemd after %dms", op->id, op->timeout);
+        systemd_action_done(op, LRM_OP_TIMEOUT, OCF_TIMEOUT);
+
+    } else if (dbus_error_has_name(error, SYSTEMD_BUS_NAME ".NoSuchUnit")
+               || dbus_error_has_name(error, SYSTEMD_BUS_NAME ".LoadFailed")) {
+        mh_warn("%s - %s", op->id, error->message);
+        systemd_action_done(op, LRM_OP_DONE, OCF_NOT_INSTALLED);
+
+    } else {
+        mh_err("%s - systemd request failed: %s", op->id,
+               error->message ? error->message : "unknown error");
+        systemd_action_done(op, LRM_OP_ERROR, OCF_UNKNOWN_ERROR);
+    }
+}
+
+/*
+ * Collect the reply for op's outstanding request.  Returns NULL (and
+ * completes the action) if systemd reported an error.
+ */
+static DBusMessage *
+systemd_steal_reply(svc_action_t *op, DBusPendingCall *pending)
+{
+    DBusMessage *reply;
+    DBusError error;
+
+    reply = dbus_pending_call_steal_reply(pending);
+    dbus_pending_call_unref(pending);
+    op->opaque->systemd_pending = NULL;
+
+    dbus_error_init(&error);
+    if (reply == NULL) {
+        dbus_set_error_const(&error, DBUS_ERROR_NO_REPLY, "No reply");
+    } else if (!dbus_set_error_from_message(&error, reply)) {
+        return reply;
+    }
+
+    systemd_reply_error(op, &error);
+    dbus_error_free(&error);
+    if (reply) {
+        dbus_message_unref(reply);
+    }
+    return NULL;
+}
+
+static gboolean
+systemd_send(svc_action_t *op, DBusMessage *msg,
+             DBusPendingCallNotifyFunction notify)
+{
+    DBusPendingCall *pending = NULL;
+    int timeout = op->timeout > 0 ? op->timeout : -1;
+
+    if (msg == NULL) {
+        return FALSE;
+    }
+
+    if (!dbus_connection_send_with_reply(systemd_bus, msg, &pending, timeout)
+        || pending == NULL) {
+        mh_err("%s - could not send request to systemd", op->id);
+        dbus_message_unref(msg);
+        return FALSE;
+    }
+    dbus_message_unref(msg);
+
+    op->opaque->systemd_pending = pending;
+    dbus_pending_call_set_notify(pending, notify, op, NULL);
+    return TRUE;
+}
+
+static void
+systemd_job_queued(DBusPendingCall *pending, void *user_data)
+{
+    svc_action_t *op = user_data;
+    DBusMessage *reply;
+    const char *path = NULL;
+
+    if (!(reply = systemd_steal_reply(op, pending))) {
+        return;
+    }
+
+    if (!dbus_message_get_args(reply, NULL, DBUS_TYPE_OBJECT_PATH, &path,
+                               DBUS_TYPE_INVALID)) {
+        mh_err("%s - malformed job reply from systemd", op->id);
+        dbus_message_unref(reply);
+        systemd_action_done(op, LRM_OP_ERROR, OCF_UNKNOWN_ERROR);
+        return;
+    }
+
+    mh_trace("%s - queued as %s", op->id, path);
+    op->opaque->systemd_job = strdup(path);
+    g_hash_table_insert(systemd_jobs, g_strdup(path), op);
+    dbus_message_unref(reply);
+}
+
+static void
+systemd_unit_state(DBusPendingCall *pending, void *user_data)
+{
+    svc_action_t *op = user_data;
+    DBusMessage *reply;
+    DBusMessageIter iter, variant;
+    const char *state = NULL;
+    gboolean running;
+
+    if (!(reply = systemd_steal_reply(op, pending))) {
+        return;
+    }
+
+    if (dbus_message_iter_init(reply, &iter)
+        && dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_VARIANT) {
+        dbus_message_iter_recurse(&iter, &variant);
+        if (dbus_message_iter_get_arg_type(&variant) == DBUS_TYPE_STRING) {
+            dbus_message_iter_get_basic(&variant, &state);
+        }
+    }
+
+    if (state == NULL) {
+        mh_err("%s - malformed ActiveState reply from systemd", op->id);
+        dbus_message_unref(reply);
+        systemd_action_done(op, LRM_OP_ERROR, OCF_UNKNOWN_ERROR);
+        return;
+    }
+
+    mh_trace("%s - unit is %s", op->id, state);
+    running = strcmp(state, "active") == 0 || strcmp(state, "reloading") == 0;
+    dbus_message_unref(reply);
+
+    if (running) {
+        systemd_action_done(op, LRM_OP_DONE, OCF_OK);
+    } else if (strcasecmp(op->action, "status") == 0) {
+        systemd_action_done(op, LRM_OP_DONE, LSB_STATUS_NOT_RUNNING);
+    } else {
+        systemd_action_done(op, LRM_OP_DONE, OCF_NOT_RUNNING);
+    }
+}
+
+static void
+systemd_unit_loaded(DBusPendingCall *pending, void *user_data)
+{
+    svc_action_t *op = user_data;
+    DBusMessage *reply, *msg;
+    const char *path = NULL;
+    const char *iface = SYSTEMD_UNIT_IFACE;
+    const char *prop = "ActiveState";
+
+    if (!(reply = systemd_steal_reply(op, pending))) {
+        return;
+    }
+
+    if (!dbus_message_get_args(reply, NULL, DBUS_TYPE_OBJECT_PATH, &path,
+                               DBUS_TYPE_INVALID)) {
+        mh_err("%s - malformed LoadUnit reply from systemd", op->id);
+        dbus_message_unref(reply);
+        systemd_action_done(op, LRM_OP_ERROR, OCF_UNKNOWN_ERROR);
+        return;
+    }
+
+    msg = dbus_message_new_method_call(SYSTEMD_BUS_NAME, path,
+                                       DBUS_PROPS_IFACE, "Get");
+    dbus_message_unref(reply);
+
+    if (msg) {
+        dbus_message_append_args(msg, DBUS_TYPE_STRING, &iface,
+                                 DBUS_TYPE_STRING, &prop, DBUS_TYPE_INVALID);
+    }
+    if (systemd_send(op, msg, systemd_unit_state) == FALSE) {
+        systemd_action_done(op, LRM_OP_ERROR, OCF_UNKNOWN_ERROR);
+    }
+}
+
+static gboolean
+systemd_action_timeout(gpointer user_data)
+{
+    svc_action_t *op = user_data;
+
+    op->opaque->systemd_timer = 0;
+    mh_warn("%s - timed out after %dms", op->id, op->timeout);
+    systemd_action_done(op, LRM_OP_TIMEOUT, OCF_TIMEOUT);
+    return FALSE;
+}
+
+gboolean
+systemd_unit_handles(svc_action_t *op, gboolean synchronous)
+{
+    if (synchronous || op->standard == NULL || op->action == NULL
+        || strcasecmp(op->standard, "systemd") != 0) {
+        /* Synchronous callers keep using systemctl, which already blocks
+         * until the job has finished */
+        return FALSE;
+    }
+
+    if (systemd_job_method(op->action) == NULL && !systemd_is_query(op->action)) {
+        return FALSE;
+    }
+
+    return systemd_connect() != NULL;
+}
+
+gboolean
+systemd_unit_exec(svc_action_t *op)
+{
+    const char *unit = op->opaque->args[2];
+    const char *method = systemd_job_method(op->action);
+    const char *mode = "replace";
+    DBusMessage *msg;
+    gboolean rc;
+
+    if (unit == NULL || systemd_connect() == NULL) {
+        return FALSE;
+    }
+
+    op->status = LRM_OP_PENDING;
+
+    if (method) {
+        mh_trace("%s - %s(%s)", op->id, method, unit);
+        msg = systemd_manager_call(method);
+        if (msg) {
+            dbus_message_append_args(msg, DBUS_TYPE_STRING, &unit,
+                                     DBUS_TYPE_STRING, &mode,
+                                     DBUS_TYPE_INVALID);
+        }
+        rc = systemd_send(op, msg, systemd_job_queued);
+
+    } else {
+        mh_trace("%s - LoadUnit(%s)", op->id, unit);
+        msg = systemd_manager_call("LoadUnit");
+        if (msg) {
+            dbus_message_append_args(msg, DBUS_TYPE_STRING, &unit,
+                                     DBUS_TYPE_INVALID);
+        }
+        rc = systemd_send(op, msg, systemd_unit_loaded);
+    }
+
+    if (rc && op->timeout > 0) {
+        /* Covers both the request and waiting for the job to finish */
+        op->opaque->systemd_timer = g_timeout_add(op->timeout,
+                                                  systemd_action_timeout, op);
+    }
+
+    return rc;
+}
+
+void
+systemd_unit_forget(svc_action_t *op)
+{
+    if (op->opaque->systemd_timer) {
+        g_source_remove(op->opaque->systemd_timer);
+        op->opaque->systemd_timer = 0;
+    }
+
+    if (op->opaque->systemd_pending) {
+        dbus_pending_call_cancel(op->opaque->systemd_pending);
+        dbus_pending_call_unref(op->opaque->systemd_pending);
+        op->opaque->systemd_pending = NULL;
+    }
+
+    if (op->opaque->systemd_job) {
+        if (systemd_jobs) {
+            g_hash_table_remove(systemd_jobs, op->opaque->systemd_job);
+        }
+        free(op->opaque->systemd_job);
+        op->opaque->systemd_job = NULL;
+    }
+}
+
+gboolean
+systemd_unit_list(GList **units)
+{
+    DBusMessage *msg, *reply;
+    DBusMessageIter iter, array;
+    DBusError error;
+
+    *units = NULL;
+
+    if (systemd_connect() == NULL || !(msg = systemd_manager_call("ListUnits"))) {
+        return FALSE;
+    }
+
+    dbus_error_init(&error);
+    reply = dbus_connection_send_with_reply_and_block(systemd_bus, msg,
+                SYSTEMD_QUERY_TIMEOUT_MS, &error);
+    dbus_message_unref(msg);
+
+    if (reply == NULL) {
+        mh_warn("Could not list systemd units: %s", error.message);
+        dbus_error_free(&error);
+        return FALSE;
+    }
+
+    if (!dbus_message_iter_init(reply, &iter)
+        || dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY) {
+        mh_err("Malformed ListUnits reply from systemd");
+        dbus_message_unref(reply);
+        return FALSE;
+    }
+
+    /* a(ssssssouso) - the unit name is the first member of each struct */
+    dbus_message_iter_recurse(&iter, &array);
+    while (dbus_message_iter_get_arg_type(&array) == DBUS_TYPE_STRUCT) {
+        DBusMessageIter unit;
+        const char *name = NULL;
+        size_t len;
+
+        dbus_message_iter_recurse(&array, &unit);
+        if (dbus_message_iter_get_arg_type(&unit) == DBUS_TYPE_STRING) {
+            dbus_message_iter_get_basic(&unit, &name);
+        }
+
+        if (name && (len = strlen(name)) > strlen(".service")
+            && strcmp(name + len - strlen(".service"), ".service") == 0) {
+            *units = g_list_prepend(*units,
+                                    strndup(name, len - strlen(".service")));
+        }
+
+        dbus_message_iter_next(&array);
+    }
+
+    dbus_message_unref(reply);
+
+    /* Catalogs are kept sorted, see services_linux.c */
+    *units = g_list_sort(*units, (GCompareFunc) strcmp);
+    return TRUE;
+}
@@ -318,13 +318,13 @@ services_os_set_exec(svc_action_t *op)
 {
     char *p = getenv("WINDIR");
     if (strcmp("status", op->action) == 0) {
-        op->opaque->exec = g_strdup_printf("%s\\system32\\sc.exe query %s", p,
-                                           op->rsc);
+        op->opaque->exec = services_intern_printf("%s\\system32\\sc.exe query %s",
+                                                  p, op->rsc);
         /* op->opaque->exec = g_strdup_printf("sc query %s", op->rsc); */
 
     } else {
-        op->opaque->exec = g_strdup_printf("%s\\system32\\sc.exe %s %s", p,
-                                           op->action, op->rsc);
+        op->opaque->exec = services_intern_printf("%s\\system32\\sc.exe %s %s",
+                                                  p, op->action, op->rsc);
         /* op->opaque->exec = g_strdup_printf("sc %s %s", op->action, op->rsc); */
     }
 }
@@ -345,6 +345,17 @@ services_os_list(void)
     return NULL;
 }
 
+gboolean
+services_os_exists(const char *name)
+{
+    GList *services = services_os_list();
+    gboolean found = g_list_find_custom(services, name,
+                                        (GCompareFunc) strcasecmp) != NULL;
+
+    g_list_free_full(services, free);
+    return found;
+}
+
 GList *
 resources_os_list_ocf_providers(void)
 {
@@ -358,3 +369,28 @@ resources_os_list_ocf_agents(const char *provider)
     /* Unsupported on Windows, return an empty list */
     return NULL;
 }
+
+gboolean
+resources_os_ocf_agent_exists(const char *provider, const char *agent)
+{
+    /* Unsupported on Windows */
+    return FALSE;
+}
+
+gboolean
+services_zygote_start(void)
+{
+    /* Unsupported on Windows */
+    return FALSE;
+}
+
+void
+services_zygote_stop(void)
+{
+}
+
+gboolean
+services_zygote_exec(svc_action_t *op, int stdout_fd, int stderr_fd)
+{
+    return FALSE;
+}
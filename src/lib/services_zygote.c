@@ -0,0 +1,614 @@
+/*
+ * Copyright (C) 2011, Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/**
+ * \file
+ * \brief Action helper ("zygote") process
+ *
+ * The helper is forked while the agent is still small and does all
+ * further forking on the agent's behalf, so the cost of spawning a
+ * resource agent does not grow with the agent's address space.
+ *
+ * The two processes talk over a SOCK_SEQPACKET socketpair.  Each exec
+ * request carries argv, the extra environment and the timeout, with the
+ * write ends of the output pipes passed as SCM_RIGHTS.  Output therefore
+ * flows straight from the action to the agent; the helper only reports
+ * the pid once started and the wait status once reaped.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "matahari/logging.h"
+#include "matahari/mainloop.h"
+#include "matahari/services.h"
+
+#include "services_private.h"
+
+/* Largest request we send; bigger ones are forked directly */
+#define ZYGOTE_MSG_MAX 65536
+
+enum zygote_msg_type {
+    ZYGOTE_EXEC = 1,
+    ZYGOTE_STARTED,
+    ZYGOTE_EXITED,
+};
+
+struct zygote_request {
+    uint32_t type;
+    uint32_t id;
+    int32_t  timeout;   /* ms, <= 0 for none */
+    uint32_t argc;
+    uint32_t envc;
+    /* Followed by argc + envc NUL terminated strings */
+};
+
+struct zygote_reply {
+    uint32_t type;
+    uint32_t id;
+    int32_t  pid;
+    int32_t  status;    /* as returned by wait4() */
+    int32_t  timed_out;
+    struct rusage rusage;
+};
+
+typedef struct zygote_child_s {
+    pid_t     pid;
+    uint32_t  id;
+    long long deadline;
+    gboolean  timed_out;
+} zygote_child_t;
+
+static int zygote_fd = -1;
+static pid_t zygote_pid = 0;
+static mainloop_fd_t *zygote_source = NULL;
+static gboolean zygote_stopping = FALSE;
+
+/* Request id -> svc_action_t waiting for the helper */
+static GHashTable *zygote_ops = NULL;
+static uint32_t zygote_last_id = 0;
+
+static long long
+zygote_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Helper side
+ */
+
+static void
+zygote_reply(int sock, uint32_t type, uint32_t id, pid_t pid, int status,
+             gboolean timed_out, const struct rusage *ru)
+{
+    struct zygote_reply reply;
+
+    memset(&reply, 0, sizeof(reply));
+    if (ru) {
+        reply.rusage = *ru;
+    }
+    reply.type = type;
+    reply.id = id;
+    reply.pid = pid;
+    reply.status = status;
+    reply.timed_out = timed_out;
+
+    while (send(sock, &reply, sizeof(reply), MSG_NOSIGNAL) < 0
+           && errno == EINTR);
+}
+
+static void
+zygote_spawn(int sock, GHashTable *children, char *buf, size_t len,
+             int out_fd, int err_fd)
+{
+    struct zygote_request *req = (struct zygote_request *) buf;
+    char **strings, *ptr, *end = buf + len;
+    uint32_t lpc, count;
+    zygote_child_t *child;
+    pid_t pid;
+
+    if (len < sizeof(*req)) {
+        close(out_fd);
+        close(err_fd);
+        return;
+
+    } else if (req->type != ZYGOTE_EXEC || req->argc == 0
+               || req->argc > len || req->envc > len) {
+        close(out_fd);
+        close(err_fd);
+        zygote_reply(sock, ZYGOTE_EXITED, req->id, -1,
+                     OCF_UNKNOWN_ERROR << 8, FALSE, NULL);
+        return;
+    }
+
+    count = req->argc + req->envc;
+    strings = calloc(count + 2, sizeof(char *));
+    ptr = buf + sizeof(*req);
+    for (lpc = 0; lpc < count; lpc++) {
+        char *nul = ptr < end ? memchr(ptr, 0, end - ptr) : NULL;
+
+        if (nul == NULL) {
+            /* Truncated request, report it as a failed exec */
+            free(strings);
+            close(out_fd);
+            close(err_fd);
+            zygote_reply(sock, ZYGOTE_EXITED, req->id, -1,
+                         OCF_UNKNOWN_ERROR << 8, FALSE, NULL);
+            return;
+        }
+
+        /* argv is NULL terminated in place, the environment follows it */
+        strings[lpc < req->argc ? lpc : lpc + 1] = ptr;
+        ptr = nul + 1;
+    }
+
+    pid = fork();
+    if (pid == 0) {
+        sigset_t mask;
+        int fd;
+
+        setpgid(0, 0);
+        dup2(out_fd, STDOUT_FILENO);
+        dup2(err_fd, STDERR_FILENO);
+        for (fd = getdtablesize() - 1; fd > STDERR_FILENO; fd--) {
+            close(fd);
+        }
+
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
+
+        for (lpc = req->argc + 1; lpc <= count; lpc++) {
+            putenv(strings[lpc]);
+        }
+
+        execvp(strings[0], strings);
+        _exit(exec_failure_rc(errno));
+    }
+
+    close(out_fd);
+    close(err_fd);
+    free(strings);
+
+    if (pid < 0) {
+        zygote_reply(sock, ZYGOTE_EXITED, req->id, -1,
+                     OCF_UNKNOWN_ERROR << 8, FALSE, NULL);
+        return;
+    }
+
+    child = calloc(1, sizeof(zygote_child_t));
+    child->pid = pid;
+    child->id = req->id;
+    if (req->timeout > 0) {
+        child->deadline = zygote_now_ms() + req->timeout;
+    }
+    g_hash_table_insert(children, GINT_TO_POINTER(pid), child);
+
+    zygote_reply(sock, ZYGOTE_STARTED, req->id, pid, 0, FALSE, NULL);
+}
+
+static void
+zygote_receive(int sock, GHashTable *children, char *buf)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    int fds[2] = { -1, -1 };
+    ssize_t len;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = buf;
+    iov.iov_len = ZYGOTE_MSG_MAX;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    len = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (len == 0) {
+        /* The agent went away */
+        _exit(0);
+    } else if (len < 0) {
+        if (errno != EINTR && errno != EAGAIN) {
+            _exit(1);
+        }
+        return;
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+            && cmsg->cmsg_len == CMSG_LEN(sizeof(fds))) {
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        }
+    }
+
+    if (fds[0] < 0 || fds[1] < 0 || (msg.msg_flags & MSG_TRUNC)) {
+        if (fds[0] >= 0) {
+            close(fds[0]);
+            close(fds[1]);
+        }
+        return;
+    }
+
+    zygote_spawn(sock, children, buf, len, fds[0], fds[1]);
+}
+
+static void
+zygote_reap(int sock, GHashTable *children)
+{
+    zygote_child_t *child;
+    struct rusage ru;
+    int status;
+    pid_t pid;
+
+    while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0
+           || (pid < 0 && errno == EINTR)) {
+        if (pid < 0) {
+            continue;
+        }
+        if ((child = g_hash_table_lookup(children, GINT_TO_POINTER(pid)))) {
+            zygote_reply(sock, ZYGOTE_EXITED, child->id, pid, status,
+                         child->timed_out, &ru);
+            g_hash_table_remove(children, GINT_TO_POINTER(pid));
+        }
+    }
+}
+
+static int
+zygote_expire(GHashTable *children)
+{
+    GHashTableIter iter;
+    zygote_child_t *child;
+    long long now = zygote_now_ms();
+    long long next = -1;
+
+    g_hash_table_iter_init(&iter, children);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &child)) {
+        if (child->deadline == 0) {
+            continue;
+
+        } else if (child->deadline <= now) {
+            kill(child->pid, SIGKILL);
+            child->timed_out = TRUE;
+            child->deadline = 0;
+
+        } else if (next < 0 || child->deadline - now < next) {
+            next = child->deadline - now;
+        }
+    }
+
+    return next > INT_MAX ? INT_MAX : (int) next;
+}
+
+static void
+zygote_main(int sock)
+{
+    GHashTable *children;
+    struct pollfd fds[2];
+    sigset_t mask;
+    char *buf;
+    int timeout;
+
+    /* Don't outlive the agent */
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+
+    /* Only SIGCHLD, whatever the agent had blocked for its main loop */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+
+    children = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, free);
+    buf = malloc(ZYGOTE_MSG_MAX);
+
+    fds[0].fd = sock;
+    fds[0].events = POLLIN;
+    fds[1].fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        timeout = zygote_expire(children);
+        if (fds[1].fd < 0 && g_hash_table_size(children)
+            && (timeout < 0 || timeout > 50)) {
+            /* No SIGCHLD notification, check back regularly */
+            timeout = 50;
+        }
+
+        if (poll(fds, DIMOF(fds), timeout) < 0 && errno != EINTR) {
+            _exit(1);
+        }
+
+        if (fds[1].fd >= 0 && (fds[1].revents & POLLIN)) {
+            struct signalfd_siginfo info[8];
+
+            while (read(fds[1].fd, info, sizeof(info)) > 0);
+        }
+        zygote_reap(sock, children);
+
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            zygote_receive(sock, children, buf);
+        }
+    }
+}
+
+/*
+ * Agent side
+ */
+
+static void
+zygote_lost(gpointer user_data)
+{
+    GList *ops, *gIter;
+
+    if (!zygote_stopping) {
+        mh_err("Action helper %d has gone away, forking actions directly",
+               zygote_pid);
+    }
+
+    zygote_stopping = FALSE;
+    zygote_source = NULL;
+    close(zygote_fd);
+    zygote_fd = -1;
+    zygote_pid = 0;
+
+    ops = g_hash_table_get_values(zygote_ops);
+    g_hash_table_remove_all(zygote_ops);
+
+    for (gIter = ops; gIter; gIter = gIter->next) {
+        svc_action_t *op = gIter->data;
+
+        op->opaque->zygote_id = 0;
+        op->status = LRM_OP_ERROR;
+        op->rc = OCF_UNKNOWN_ERROR;
+        operation_finalize(op);
+    }
+    g_list_free(ops);
+}
+
+static gboolean
+zygote_dispatch(int fd, gpointer user_data)
+{
+    struct zygote_reply reply;
+    svc_action_t *op;
+    ssize_t len;
+
+    for (;;) {
+        len = recv(fd, &reply, sizeof(reply), MSG_DONTWAIT);
+        if (len < 0 && errno == EINTR) {
+            continue;
+        } else if (len < 0 && errno == EAGAIN) {
+            return TRUE;
+        } else if (len <= 0) {
+            return FALSE;
+        } else if (len != sizeof(reply)) {
+            mh_err("Short message from the action helper: %d bytes", (int) len);
+            continue;
+        }
+
+        op = g_hash_table_lookup(zygote_ops, GUINT_TO_POINTER(reply.id));
+        if (op == NULL) {
+            continue;
+        }
+
+        if (reply.type == ZYGOTE_STARTED) {
+            op->pid = reply.pid;
+            mh_trace("Action helper started %s as %d", op->id, op->pid);
+
+        } else if (reply.type == ZYGOTE_EXITED) {
+            int signo = 0, exitcode = 0;
+
+            g_hash_table_remove(zygote_ops, GUINT_TO_POINTER(reply.id));
+            op->opaque->zygote_id = 0;
+            if (WIFSIGNALED(reply.status)) {
+                signo = WTERMSIG(reply.status);
+            } else if (WIFEXITED(reply.status)) {
+                exitcode = WEXITSTATUS(reply.status);
+            }
+            if (reply.pid > 0) {
+                op->pid = reply.pid;
+                services_usage_from_rusage(op, &reply.rusage);
+            }
+            operation_child_exited(op, reply.timed_out, signo, exitcode);
+        }
+    }
+}
+
+gboolean
+services_zygote_start(void)
+{
+    int sv[2];
+    pid_t pid;
+
+    if (zygote_fd >= 0) {
+        return TRUE;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+        mh_perror(LOG_ERR, "socketpair() failed");
+        return FALSE;
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        mh_perror(LOG_ERR, "fork() failed");
+        close(sv[0]);
+        close(sv[1]);
+        return FALSE;
+
+    } else if (pid == 0) {
+        int fd;
+
+        for (fd = getdtablesize() - 1; fd > STDERR_FILENO; fd--) {
+            if (fd != sv[1]) {
+                close(fd);
+            }
+        }
+        zygote_main(sv[1]);
+        _exit(0);
+    }
+
+    close(sv[1]);
+    zygote_fd = sv[0];
+    zygote_pid = pid;
+
+    if (zygote_ops == NULL) {
+        zygote_ops = g_hash_table_new(g_direct_hash, g_direct_equal);
+    }
+
+    zygote_source = mainloop_add_fd(G_PRIORITY_DEFAULT, zygote_fd,
+                                    zygote_dispatch, zygote_lost, NULL);
+    g_source_set_name((GSource *) zygote_source, "action helper");
+
+    mh_info("Started action helper %d", zygote_pid);
+    return TRUE;
+}
+
+void
+services_zygote_stop(void)
+{
+    pid_t pid = zygote_pid;
+
+    if (zygote_source) {
+        /* Deliberate, so zygote_lost() need not complain */
+        zygote_stopping = TRUE;
+        mainloop_destroy_fd(zygote_source);
+    }
+
+    if (pid > 0) {
+        /* The helper exits once it sees the socket close; it may already
+         * have been reaped by a SIGCHLD handler, so ignore ECHILD */
+        while (waitpid(pid, NULL, 0) < 0 && errno == EINTR);
+    }
+}
+
+gboolean
+services_zygote_exec(svc_action_t *op, int stdout_fd, int stderr_fd)
+{
+    struct zygote_request req;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    int fds[2] = { stdout_fd, stderr_fd };
+    GByteArray *buf;
+    GPtrArray *env;
+    guint lpc;
+    ssize_t rc;
+
+    if (zygote_fd < 0) {
+        return FALSE;
+    }
+
+    env = ocf_env_vars(op);
+
+    memset(&req, 0, sizeof(req));
+    req.type = ZYGOTE_EXEC;
+    req.id = ++zygote_last_id;
+    req.timeout = op->timeout;
+    req.envc = env->len;
+
+    buf = g_byte_array_new();
+    g_byte_array_append(buf, (guint8 *) &req, sizeof(req));
+
+    /* args[0] doubles as the program to run, see services_action_create() */
+    for (lpc = 0; lpc < DIMOF(op->opaque->args) && op->opaque->args[lpc]; lpc++) {
+        g_byte_array_append(buf, (guint8 *) op->opaque->args[lpc],
+                            strlen(op->opaque->args[lpc]) + 1);
+    }
+    ((struct zygote_request *) buf->data)->argc = lpc;
+
+    for (lpc = 0; lpc < env->len; lpc++) {
+        g_byte_array_append(buf, env->pdata[lpc], strlen(env->pdata[lpc]) + 1);
+        g_free(env->pdata[lpc]);
+    }
+    g_ptr_array_free(env, TRUE);
+
+    if (buf->len > ZYGOTE_MSG_MAX || op->opaque->args[0] == NULL
+        || strcmp(op->opaque->args[0], op->opaque->exec) != 0) {
+        g_byte_array_free(buf, TRUE);
+        return FALSE;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = buf->data;
+    iov.iov_len = buf->len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    do {
+        rc = sendmsg(zygote_fd, &msg, MSG_NOSIGNAL);
+    } while (rc < 0 && errno == EINTR);
+
+    g_byte_array_free(buf, TRUE);
+
+    if (rc < 0) {
+        mh_perror(LOG_WARNING, "Could not pass %s to the action helper",
+                  op->id);
+        return FALSE;
+    }
+
+    op->pid = 0;
+    op->opaque->zygote_id = req.id;
+    g_hash_table_insert(zygote_ops, GUINT_TO_POINTER(req.id), op);
+    return TRUE;
+}
+
+void
+services_zygote_forget(svc_action_t *op)
+{
+    if (op->opaque->zygote_id == 0) {
+        return;
+    }
+
+    /* The helper still reports the exit, which is then ignored */
+    if (zygote_ops) {
+        g_hash_table_remove(zygote_ops,
+                            GUINT_TO_POINTER(op->opaque->zygote_id));
+    }
+    op->opaque->zygote_id = 0;
+}
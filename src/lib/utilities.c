@@ -24,6 +24,7 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
 #include <glib.h>
 #include <sigar.h>
 
@@ -34,7 +35,6 @@
 
 MH_TRACE_INIT_DATA(mh_core);
 int mh_log_level = LOG_NOTICE;
-gboolean mh_stderr_enabled = FALSE;
 
 #if __linux__
 #  include <link.h>
@@ -193,15 +193,11 @@ mh_glib_handler(const gchar *log_domain, GLogLevelFlags flags,
     mh_log(log_level, "%s: %s", log_domain, message);
 }
 
-void
-mh_enable_stderr(gboolean to_stderr)
-{
-    mh_stderr_enabled = to_stderr;
-}
-
 void
 mh_log_init(const char *ident, int level, gboolean to_stderr)
 {
+    const char *env_async = NULL;
+    const char *env_rate = NULL;
 #if SUPPORT_TRACING
     gboolean search = FALSE;
     const char *env_value = NULL;
@@ -209,7 +205,7 @@ mh_log_init(const char *ident, int level, gboolean to_stderr)
 #endif
 
     mh_log_level = level;
-    mh_stderr_enabled = to_stderr;
+    mh_enable_stderr(to_stderr);
 
 #ifdef __linux__
     openlog(ident, LOG_NDELAY | LOG_PID, LOG_DAEMON);
@@ -221,6 +217,25 @@ mh_log_init(const char *ident, int level, gboolean to_stderr)
     /* and for good measure... - this enum is a bit field (!) */
     g_log_set_always_fatal((GLogLevelFlags) 0); /*value out of range*/
 
+    env_async = getenv("MATAHARI_LOG_ASYNC");
+    if (env_async && strcasecmp(env_async, "block") == 0) {
+        mh_log_async_start(MH_LOG_OVERFLOW_BLOCK);
+    } else if (env_async && strcasecmp(env_async, "drop") == 0) {
+        mh_log_async_start(MH_LOG_OVERFLOW_DROP);
+    }
+
+    env_rate = getenv("MATAHARI_LOG_RATE");
+    if (env_rate) {
+        unsigned int burst = 0, interval_s = 0;
+
+        if (sscanf(env_rate, "%u/%u", &burst, &interval_s) == 2) {
+            mh_log_ratelimit(burst, interval_s);
+        } else {
+            mh_warn("Expected BURST/INTERVAL in MATAHARI_LOG_RATE, not '%s'",
+                    env_rate);
+        }
+    }
+
 #if SUPPORT_TRACING
     memset(&query, 0, sizeof(struct _mh_ddebug_query));
 
@@ -280,11 +295,14 @@ mh_abort(const char *file, const char *function, int line,
         return;
 
     } else if (do_fork) {
+        /* Out with what was logged before the core is taken */
+        mh_log_flush();
         pid = fork();
 
     } else {
         mh_err("%s: Triggered fatal assert at %s:%d : %s",
                function, file, line, assert_condition);
+        mh_log_flush();
     }
 
     switch (pid) {
@@ -314,36 +332,11 @@ mh_abort(const char *file, const char *function, int line,
 #else
     mh_err("%s: Triggered assert at %s:%d : %s", function, file, line,
            assert_condition);
+    mh_log_flush();
     abort();
 #endif
 }
 
-void
-mh_log_fn(int priority, const char * fmt, ...)
-{
-    va_list ap;
-
-    if (mh_stderr_enabled) {
-        va_start(ap, fmt);
-        vfprintf(stderr, fmt, ap);
-#ifdef __linux__
-        fprintf(stderr, "\n");
-#else
-        fprintf(stderr, "\n\r");
-#endif
-        va_end(ap);
-
-#ifdef __linux__
-    } else {
-        va_start(ap, fmt);
-        vsyslog(priority, fmt, ap);
-        va_end(ap);
-#endif
-    }
-
-    return;
-}
-
 const char *
 mh_domainname(void)
 {
@@ -503,6 +496,37 @@ g_list_free_full (GList *list, GDestroyNotify free_func)
 }
 #endif /* HAVE_G_LIST_FREE_FULL */
 
+#ifndef HAVE_G_GET_MONOTONIC_TIME
+gint64
+g_get_monotonic_time(void)
+{
+#ifdef WIN32
+    GTimeVal now;
+
+    g_get_current_time(&now);
+    return (gint64) now.tv_sec * G_USEC_PER_SEC + now.tv_usec;
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (gint64) now.tv_sec * G_USEC_PER_SEC + now.tv_nsec / 1000;
+#endif
+}
+#endif /* HAVE_G_GET_MONOTONIC_TIME */
+
+#ifndef HAVE_G_SOURCE_SET_NAME
+void
+g_source_set_name(GSource *source, const char *name)
+{
+}
+
+const char *
+g_source_get_name(GSource *source)
+{
+    return NULL;
+}
+#endif /* HAVE_G_SOURCE_SET_NAME */
+
 char *
 mh_string_copy(char *dst, const char *src, size_t dst_len)
 {
@@ -46,6 +46,7 @@ public:
     virtual int setup(qmf::AgentSession session);
     virtual gboolean invoke(qmf::AgentSession session, qmf::AgentEvent event,
                             gpointer user_data);
+    virtual enum mh_result offload(qmf::AgentEvent event);
 };
 
 const char NetAgent::NETWORK_NAME[] = "Network";
@@ -56,7 +57,7 @@ main(int argc, char **argv)
     NetAgent agent;
     int rc = agent.init(argc, argv, "Network");
     if (rc == 0) {
-        agent.run();
+        rc = agent.run();
     }
     return rc;
 }
@@ -88,20 +89,17 @@ NetAgent::setup(qmf::AgentSession session)
     _instance.setProperty("hostname", mh_hostname());
     _instance.setProperty("uuid", mh_uuid());
 
+    /* Enumerating interfaces takes a while on big hosts */
+    setOffloadable("list");
+
     session.addData(_instance, NETWORK_NAME);
     return 0;
 }
 
-gboolean
-NetAgent::invoke(qmf::AgentSession session, qmf::AgentEvent event,
-                 gpointer user_data)
+enum mh_result
+NetAgent::offload(qmf::AgentEvent event)
 {
-    if (event.getType() != qmf::AGENT_METHOD) {
-        return TRUE;
-    }
-
     const std::string& methodName(event.getMethodName());
-    qpid::types::Variant::Map& args = event.getArguments();
 
     if (methodName == "list") {
         GList *plist = NULL;
@@ -118,7 +116,24 @@ NetAgent::invoke(qmf::AgentSession session, qmf::AgentEvent event,
         }
         g_list_free_full(interface_list, mh_network_interface_destroy);
         event.addReturnArgument("iface_map", s_list);
-    } else if (methodName == "start") {
+        return MH_RES_SUCCESS;
+    }
+
+    return MH_RES_NOT_IMPLEMENTED;
+}
+
+gboolean
+NetAgent::invoke(qmf::AgentSession session, qmf::AgentEvent event,
+                 gpointer user_data)
+{
+    if (event.getType() != qmf::AGENT_METHOD) {
+        return TRUE;
+    }
+
+    const std::string& methodName(event.getMethodName());
+    qpid::types::Variant::Map& args = event.getArguments();
+
+    if (methodName == "start") {
         int rc = interface_status(
                 args["iface"].asString().c_str());
 
@@ -105,6 +105,15 @@
                     </xsl:for-each>
                 </interface>
             </xsl:for-each>
+            <!-- Main loop dispatch accounting, common to all agents -->
+            <interface name="org.matahariproject.Mainloop">
+                <annotation name="org.freedesktop.DBus.GLib.CSymbol" value="Mainloop"/>
+                <method name="DispatchStats">
+                    <annotation name="org.freedesktop.DBus.GLib.CSymbol" value="matahari_dispatch_stats"/>
+                    <annotation name="org.freedesktop.DBus.GLib.Async" value=""/>
+                    <arg name="sources" direction="out" type="as"/>
+                </method>
+            </interface>
             <!-- Get and set function will be used for accessing parameters.
                     It enables to obtain authorization via Polkit -->
             <interface name="org.freedesktop.DBus.Properties">
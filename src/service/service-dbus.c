@@ -22,7 +22,9 @@
 
 #include "config.h"
 
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #include "matahari/dbus_common.h"
 
@@ -74,24 +76,61 @@ Services_list(Matahari *matahari, DBusGMethodInvocation *context)
     return TRUE;
 }
 
+static void
+services_action_cb(svc_action_t *op)
+{
+    DBusGMethodInvocation *context = op->cb_data;
+
+    mh_trace("Completed: %s = %d", op->id, op->rc);
+    dbus_g_method_return(context, op->rc);
+    op->cb_data = NULL;
+}
+
+/*
+ * Run a services action without blocking the mainloop, the reply is sent
+ * from services_action_cb() once the action completes.
+ */
+static gboolean
+services_action_run(const char *name, const char *action, int timeout,
+                    DBusGMethodInvocation *context)
+{
+    GError* error = NULL;
+    svc_action_t *op;
+
+    op = services_action_create(name, action, 0, timeout);
+    if (op == NULL) {
+        error = g_error_new(MATAHARI_ERROR, MH_RES_INVALID_ARGS,
+                            "%s", mh_result_to_str(MH_RES_INVALID_ARGS));
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    op->cb_data = context;
+    if (services_action_async(op, services_action_cb) == FALSE) {
+        services_action_free(op);
+        error = g_error_new(MATAHARI_ERROR, MH_RES_BACKEND_ERROR,
+                            "%s", mh_result_to_str(MH_RES_BACKEND_ERROR));
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 gboolean
 Services_enable(Matahari *matahari, const char *name,
                 DBusGMethodInvocation *context)
 {
     GError* error = NULL;
-    svc_action_t *op;
-    gboolean res;
 
     if (!check_authorization(SERVICES_BUS_NAME ".enable", &error, context)) {
         dbus_g_method_return_error(context, error);
         g_error_free(error);
         return FALSE;
     }
-    op = services_action_create(name, "enable", 0, TIMEOUT_MS);
-    res = services_action_sync(op);
-    services_action_free(op);
-    dbus_g_method_return(context, res);
-    return res;
+    return services_action_run(name, "enable", TIMEOUT_MS, context);
 }
 
 gboolean
@@ -99,19 +138,13 @@ Services_disable(Matahari *matahari, const char *name,
                  DBusGMethodInvocation *context)
 {
     GError* error = NULL;
-    svc_action_t *op;
-    gboolean res;
 
     if (!check_authorization(SERVICES_BUS_NAME ".disable", &error, context)) {
         dbus_g_method_return_error(context, error);
         g_error_free(error);
         return FALSE;
     }
-    op = services_action_create(name, "disable", 0, TIMEOUT_MS);
-    res = services_action_sync(op);
-    services_action_free(op);
-    dbus_g_method_return(context, res);
-    return res;
+    return services_action_run(name, "disable", TIMEOUT_MS, context);
 }
 
 gboolean
@@ -119,20 +152,13 @@ Services_start(Matahari *matahari, const char *name, unsigned int timeout,
                DBusGMethodInvocation *context)
 {
     GError* error = NULL;
-    svc_action_t *op;
-    int rc;
 
     if (!check_authorization(SERVICES_BUS_NAME ".start", &error, context)) {
         dbus_g_method_return_error(context, error);
         g_error_free(error);
         return FALSE;
     }
-    op = services_action_create(name, "start", 0, timeout);
-    services_action_sync(op);
-    rc = op->rc;
-    services_action_free(op);
-    dbus_g_method_return(context, rc);
-    return TRUE;
+    return services_action_run(name, "start", timeout, context);
 }
 
 gboolean
@@ -140,20 +166,13 @@ Services_stop(Matahari *matahari, const char *name, unsigned int timeout,
               DBusGMethodInvocation *context)
 {
     GError* error = NULL;
-    svc_action_t *op;
-    int rc;
 
     if (!check_authorization(SERVICES_BUS_NAME ".stop", &error, context)) {
         dbus_g_method_return_error(context, error);
         g_error_free(error);
         return FALSE;
     }
-    op = services_action_create(name, "stop", 0, timeout);
-    services_action_sync(op);
-    rc = op->rc;
-    services_action_free(op);
-    dbus_g_method_return(context, rc);
-    return TRUE;
+    return services_action_run(name, "stop", timeout, context);
 }
 
 gboolean
@@ -161,20 +180,14 @@ Services_status(Matahari *matahari, const char *name, unsigned int interval,
                 unsigned int timeout, DBusGMethodInvocation *context)
 {
     GError* error = NULL;
-    svc_action_t *op;
-    int rc;
 
     if (!check_authorization(SERVICES_BUS_NAME ".status", &error, context)) {
         dbus_g_method_return_error(context, error);
         g_error_free(error);
         return FALSE;
     }
-    op = services_action_create(name, "status", interval, timeout);
-    services_action_sync(op);
-    rc = op->rc;
-    services_action_free(op);
-    dbus_g_method_return(context, rc);
-    return TRUE;
+    /* Recurring actions aren't supported by the dbus agent */
+    return services_action_run(name, "status", timeout, context);
 }
 
 gboolean
@@ -211,6 +224,40 @@ Services_fail(Matahari *matahari, const char *name,
     return TRUE;
 }
 
+static void
+describe_cb(const char *xml, gpointer user_data)
+{
+    DBusGMethodInvocation *context = user_data;
+    GError *error;
+
+    if (xml == NULL) {
+        error = g_error_new(MATAHARI_ERROR, MH_RES_BACKEND_ERROR,
+                            "%s", mh_result_to_str(MH_RES_BACKEND_ERROR));
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return;
+    }
+
+    dbus_g_method_return(context, xml);
+}
+
+static gboolean
+describe_run(const char *standard, const char *provider, const char *agent,
+             DBusGMethodInvocation *context)
+{
+    GError *error;
+
+    if (resources_agent_describe(standard, provider, agent, describe_cb,
+                                 context) == FALSE) {
+        error = g_error_new(MATAHARI_ERROR, MH_RES_INVALID_ARGS,
+                            "%s", mh_result_to_str(MH_RES_INVALID_ARGS));
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+    return TRUE;
+}
+
 gboolean
 Services_describe(Matahari *matahari, const char *name,
                   DBusGMethodInvocation *context)
@@ -221,12 +268,8 @@ Services_describe(Matahari *matahari, const char *name,
         g_error_free(error);
         return FALSE;
     }
-    // TODO: Implement when implemented in backend
-    error = g_error_new(MATAHARI_ERROR, MH_RES_NOT_IMPLEMENTED,
-                        "%s", mh_result_to_str(MH_RES_NOT_IMPLEMENTED));
-    dbus_g_method_return_error(context, error);
-    g_error_free(error);
-    return TRUE;
+
+    return describe_run("lsb", NULL, name, context);
 }
 
 gboolean
@@ -337,11 +380,23 @@ Resources_describe(Matahari *matahari, const char *standard,
         g_error_free(error);
         return FALSE;
     }
-    // TODO: Implement when implemented in backend
-    error = g_error_new(MATAHARI_ERROR, MH_RES_NOT_IMPLEMENTED,
-                        "%s", mh_result_to_str(MH_RES_NOT_IMPLEMENTED));
-    dbus_g_method_return_error(context, error);
-    g_error_free(error);
+
+    return describe_run(standard, provider, agent, context);
+}
+
+gboolean
+Resources_describe_all(Matahari *matahari, const char *standard,
+                       const char *provider, DBusGMethodInvocation *context)
+{
+    GError* error = NULL;
+    if (!check_authorization(RESOURCES_INTERFACE_NAME ".describe_all",
+                             &error, context)) {
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    dbus_g_method_return(context, resources_describe_all(standard, provider));
     return TRUE;
 }
 
@@ -363,11 +418,11 @@ Resources_invoke(Matahari *matahari, const char *name, const char *standard,
                  const char *provider, const char *agent, const char *action,
                  unsigned int interval, GHashTable *parameters,
                  unsigned int timeout, unsigned int expected_rc,
-                 const char *userdata_in, DBusGMethodInvocation *context)
+                 const char *userdata_in, gboolean stream_output,
+                 DBusGMethodInvocation *context)
 {
     GError* error = NULL;
     svc_action_t *op = NULL;
-    GList *standards;
     struct invoke_cb_data *data;
 
     if (!check_authorization(RESOURCES_INTERFACE_NAME ".invoke",
@@ -378,21 +433,24 @@ Resources_invoke(Matahari *matahari, const char *name, const char *standard,
     }
 
     // Check if standard is valid
-    standards = resources_list_standards();
-
-    if (g_list_find_custom(standards, standard, (GCompareFunc) strcasecmp) == NULL) {
+    if (!resources_standard_is_valid(standard)) {
         mh_err("%s is not a known resource standard", standard);
         error = g_error_new(MATAHARI_ERROR, MH_RES_NOT_IMPLEMENTED,
                             "%s is not a known resource standard", standard);
         dbus_g_method_return_error(context, error);
         g_error_free(error);
-        g_list_free_full(standards, free);
         return FALSE;
     }
-    g_list_free_full(standards, free);
 
     op = resources_action_create(name, standard, provider, agent, action,
                                  0, timeout, g_hash_table_ref(parameters));
+    if (op == NULL) {
+        error = g_error_new(MATAHARI_ERROR, MH_RES_INVALID_ARGS,
+                            "%s", mh_result_to_str(MH_RES_INVALID_ARGS));
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
     op->expected_rc = expected_rc;
 
     if (!(data = malloc(1 * sizeof(struct invoke_cb_data)))) {
@@ -404,8 +462,177 @@ Resources_invoke(Matahari *matahari, const char *name, const char *standard,
     data->userdata = strdup(userdata_in);
     op->cb_data = data;
 
-    services_action_async(op, invoke_cb);
-    return FALSE;
+    if (services_action_async(op, invoke_cb) == FALSE) {
+        free(data->userdata);
+        free(data);
+        services_action_free(op);
+        error = g_error_new(MATAHARI_ERROR, MH_RES_BACKEND_ERROR,
+                            "%s", mh_result_to_str(MH_RES_BACKEND_ERROR));
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+struct invoke_batch_cb_data {
+    DBusGMethodInvocation *context;
+    /* Per requested action: its batch index, -1 if it was rejected */
+    GArray *indexes;
+    GPtrArray *names;
+    GPtrArray *actions;
+};
+
+static void
+invoke_batch_cb(svc_batch_t *batch, gpointer user_data)
+{
+    struct invoke_batch_cb_data *cb_data = user_data;
+    char **list;
+    guint lpc;
+
+    // One "name action rc status sequence duration" string per action
+    list = g_new(char *, cb_data->indexes->len + 1);
+    for (lpc = 0; lpc < cb_data->indexes->len; lpc++) {
+        int index = g_array_index(cb_data->indexes, int, lpc);
+        const svc_batch_result_t *r = NULL;
+
+        if (index >= 0) {
+            r = services_batch_result(batch, index);
+        }
+        list[lpc] = g_strdup_printf("%s %s %d %d %d %" G_GUINT64_FORMAT,
+                                    (char *) cb_data->names->pdata[lpc],
+                                    (char *) cb_data->actions->pdata[lpc],
+                                    r ? r->rc : OCF_UNKNOWN_ERROR,
+                                    r ? r->status : LRM_OP_ERROR,
+                                    r ? r->sequence : 0,
+                                    r ? r->duration : 0);
+    }
+    list[lpc] = NULL; // Sentinel
+
+    dbus_g_method_return(cb_data->context, list);
+    g_strfreev(list);
+
+    g_array_free(cb_data->indexes, TRUE);
+    g_ptr_array_free(cb_data->names, TRUE);
+    g_ptr_array_free(cb_data->actions, TRUE);
+    free(cb_data);
+}
+
+/*
+ * Parse a number given in a batch action, rejecting anything else
+ */
+static gboolean
+batch_field_to_int(const char *field, int *value)
+{
+    char *end = NULL;
+    long result;
+
+    errno = 0;
+    result = strtol(field, &end, 10);
+    if (errno != 0 || end == field || *end != '\0'
+        || result < G_MININT || result > G_MAXINT) {
+        return FALSE;
+    }
+
+    *value = (int) result;
+    return TRUE;
+}
+
+/*
+ * Create the action described by one of invoke_batch's operations,
+ * "name standard provider agent action [timeout [expected-rc]]" with "-"
+ * for no provider, NULL if it is malformed
+ */
+static svc_action_t *
+batch_action_create(gchar **fields, guint nfields)
+{
+    svc_action_t *op;
+    int timeout = TIMEOUT_MS;
+    int expected_rc = 0;
+
+    if (nfields < 5 || nfields > 7
+        || !resources_standard_is_valid(fields[1])) {
+        return NULL;
+
+    } else if (nfields >= 6 && !batch_field_to_int(fields[5], &timeout)) {
+        return NULL;
+
+    } else if (nfields >= 7 && !batch_field_to_int(fields[6], &expected_rc)) {
+        return NULL;
+    }
+
+    op = resources_action_create(fields[0], fields[1],
+                                 strcmp(fields[2], "-") ? fields[2] : NULL,
+                                 fields[3], fields[4], 0, timeout, NULL);
+    if (op) {
+        op->expected_rc = expected_rc;
+    }
+    return op;
+}
+
+gboolean
+Resources_invoke_batch(Matahari *matahari, const char **operations,
+                       unsigned int parallel, unsigned int deadline,
+                       DBusGMethodInvocation *context)
+{
+    GError* error = NULL;
+    struct invoke_batch_cb_data *cb_data;
+    svc_batch_t *batch;
+    int i;
+
+    if (!check_authorization(RESOURCES_INTERFACE_NAME ".invoke_batch",
+                             &error, context)) {
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    cb_data = calloc(1, sizeof(struct invoke_batch_cb_data));
+    cb_data->context = context;
+    cb_data->indexes = g_array_new(FALSE, FALSE, sizeof(int));
+    cb_data->names = g_ptr_array_new_with_free_func(g_free);
+    cb_data->actions = g_ptr_array_new_with_free_func(g_free);
+
+    batch = services_batch_new(parallel, deadline);
+
+    /*
+     * Lists of maps can't be expressed here, so each action is given as a
+     * string, see batch_action_create().  Parameters and userdata are not
+     * supported.
+     */
+    for (i = 0; operations && operations[i]; i++) {
+        gchar **fields = g_strsplit_set(operations[i], " \t", -1);
+        svc_action_t *op = NULL;
+        int index = -1;
+        guint nfields = 0, lpc;
+
+        /* Runs of blanks separate fields, they don't make empty ones */
+        for (lpc = 0; fields[lpc]; lpc++) {
+            if (*fields[lpc] == '\0') {
+                g_free(fields[lpc]);
+            } else {
+                fields[nfields++] = fields[lpc];
+            }
+        }
+        fields[nfields] = NULL;
+
+        op = batch_action_create(fields, nfields);
+        if (op) {
+            index = services_batch_add(batch, op);
+        } else {
+            mh_err("Invalid batch action: %s", operations[i]);
+        }
+
+        g_array_append_val(cb_data->indexes, index);
+        g_ptr_array_add(cb_data->names,
+                        g_strdup(nfields > 0 ? fields[0] : ""));
+        g_ptr_array_add(cb_data->actions,
+                        g_strdup(nfields > 4 ? fields[4] : ""));
+        g_strfreev(fields);
+    }
+
+    services_batch_run(batch, invoke_batch_cb, cb_data);
+    return TRUE;
 }
 
 gboolean
@@ -426,6 +653,189 @@ Resources_cancel(Matahari *matahari, const char *name, const char *action,
     return TRUE;
 }
 
+static void
+stats_value_free(gpointer data)
+{
+    GValue *value = data;
+
+    g_value_unset(value);
+    g_free(value);
+}
+
+static void
+stats_add(GHashTable *table, const char *key, guint64 number)
+{
+    GValue *value = g_new0(GValue, 1);
+
+    g_value_init(value, G_TYPE_UINT64);
+    g_value_set_uint64(value, number);
+    g_hash_table_insert(table, (gpointer) key, value);
+}
+
+gboolean
+Resources_get_op_history(Matahari *matahari, const char *name,
+                         const char *action, DBusGMethodInvocation *context)
+{
+    GError* error = NULL;
+    GList *history, *gIter;
+    GHashTable *stats_table;
+    svc_op_stats_t stats;
+    char **list;
+    int i = 0;
+
+    if (!check_authorization(RESOURCES_INTERFACE_NAME ".get_op_history",
+                             &error, context)) {
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    // One "action timestamp duration rc status timed-out" string per entry
+    history = services_op_history(name, action);
+    list = g_new(char *, g_list_length(history) + 1);
+    for (gIter = history; gIter != NULL; gIter = gIter->next) {
+        svc_history_entry_t *entry = gIter->data;
+
+        list[i++] = g_strdup_printf("%s %ld %u %d %d %d", entry->action,
+                                    entry->started.tv_sec, entry->duration,
+                                    entry->rc, entry->status,
+                                    entry->timed_out);
+    }
+    list[i] = NULL; // Sentinel
+    g_list_free_full(history, free);
+
+    services_op_stats(name, action, &stats);
+    stats_table = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                        stats_value_free);
+    stats_add(stats_table, "count", stats.count);
+    stats_add(stats_table, "failures", stats.failed);
+    stats_add(stats_table, "timeouts", stats.timed_out);
+    stats_add(stats_table, "min", stats.min);
+    stats_add(stats_table, "mean", stats.mean);
+    stats_add(stats_table, "p50", stats.p50);
+    stats_add(stats_table, "p90", stats.p90);
+    stats_add(stats_table, "p99", stats.p99);
+    stats_add(stats_table, "max", stats.max);
+
+    dbus_g_method_return(context, list, stats_table);
+    g_strfreev(list);
+    g_hash_table_destroy(stats_table);
+    return TRUE;
+}
+
+gboolean
+Resources_get_agent_usage(Matahari *matahari, DBusGMethodInvocation *context)
+{
+    GError* error = NULL;
+    GList *usage, *gIter;
+    char **list;
+    int i = 0;
+
+    if (!check_authorization(RESOURCES_INTERFACE_NAME ".get_agent_usage",
+                             &error, context)) {
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    // One "agent action count cpu_user cpu_system max_rss block_in
+    // block_out duration" string per entry
+    usage = services_agent_usage();
+    list = g_new(char *, g_list_length(usage) + 1);
+    for (gIter = usage; gIter != NULL; gIter = gIter->next) {
+        svc_agent_usage_t *entry = gIter->data;
+
+        list[i++] = g_strdup_printf("%s %s %" G_GUINT64_FORMAT
+                                    " %" G_GUINT64_FORMAT
+                                    " %" G_GUINT64_FORMAT
+                                    " %" G_GUINT64_FORMAT
+                                    " %" G_GUINT64_FORMAT
+                                    " %" G_GUINT64_FORMAT
+                                    " %" G_GUINT64_FORMAT,
+                                    entry->agent, entry->action, entry->count,
+                                    entry->total.user_us,
+                                    entry->total.system_us,
+                                    entry->total.max_rss_kb,
+                                    entry->total.block_in,
+                                    entry->total.block_out,
+                                    entry->total.wall_ms);
+    }
+    list[i] = NULL; // Sentinel
+    g_list_free_full(usage, free);
+
+    dbus_g_method_return(context, list);
+    g_strfreev(list);
+    return TRUE;
+}
+
+gboolean
+Resources_cancel_all(Matahari *matahari, const char *name, const char *agent,
+                     DBusGMethodInvocation *context)
+{
+    GError* error = NULL;
+    int count;
+
+    if (!check_authorization(RESOURCES_INTERFACE_NAME ".cancel_all",
+                             &error, context)) {
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    count = services_action_cancel_all(name, agent);
+    if (count < 0) {
+        error = g_error_new(MATAHARI_ERROR, MH_RES_INVALID_ARGS,
+                            "%s", mh_result_to_str(MH_RES_INVALID_ARGS));
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    dbus_g_method_return(context, count);
+    return TRUE;
+}
+
+gboolean
+Resources_list_recurring(Matahari *matahari, const char *name,
+                         const char *agent, DBusGMethodInvocation *context)
+{
+    GError* error = NULL;
+    GList *recurring, *gIter;
+    char **list;
+    int i = 0;
+
+    if (!check_authorization(RESOURCES_INTERFACE_NAME ".list_recurring",
+                             &error, context)) {
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    // One "name action interval standard:provider:agent" string per action
+    recurring = services_recurring_list(name, agent);
+    list = g_new(char *, g_list_length(recurring) + 1);
+    for (gIter = recurring; gIter != NULL; gIter = gIter->next) {
+        svc_action_t *op = gIter->data;
+
+        if (op->provider) {
+            list[i++] = g_strdup_printf("%s %s %d %s:%s:%s", op->rsc,
+                                        op->action, op->interval,
+                                        op->standard, op->provider,
+                                        op->agent);
+        } else {
+            list[i++] = g_strdup_printf("%s %s %d %s:%s", op->rsc,
+                                        op->action, op->interval,
+                                        op->standard, op->agent);
+        }
+    }
+    list[i] = NULL; // Sentinel
+    g_list_free(recurring);
+
+    dbus_g_method_return(context, list);
+    g_strfreev(list);
+    return TRUE;
+}
+
 gboolean
 Resources_fail(Matahari *matahari, const char *name, unsigned int rc,
                          DBusGMethodInvocation *context)
@@ -463,6 +873,10 @@ void
 matahari_get_property(GObject *object, guint property_id, GValue *value,
                       GParamSpec *pspec)
 {
+    svc_op_stats_t stats;
+    Dict *dict;
+    GValue value_value = {0, };
+
     switch (property_id) {
     case PROP_SERVICES_HOSTNAME:
     case PROP_RESOURCES_HOSTNAME:
@@ -472,6 +886,44 @@ matahari_get_property(GObject *object, guint property_id, GValue *value,
     case PROP_RESOURCES_UUID:
         g_value_set_string (value, mh_uuid());
         break;
+    case PROP_RESOURCES_OP_COUNT:
+        services_op_stats(NULL, NULL, &stats);
+        g_value_set_uint64 (value, stats.count);
+        break;
+    case PROP_RESOURCES_OP_FAILURES:
+        services_op_stats(NULL, NULL, &stats);
+        g_value_set_uint64 (value, stats.failed);
+        break;
+    case PROP_RESOURCES_OP_TIMEOUTS:
+        services_op_stats(NULL, NULL, &stats);
+        g_value_set_uint64 (value, stats.timed_out);
+        break;
+    case PROP_RESOURCES_OP_DURATION:
+        // Duration summary in ms - map
+        services_op_stats(NULL, NULL, &stats);
+
+        dict = dict_new(value);
+        g_value_init (&value_value, G_TYPE_UINT);
+
+        g_value_set_uint(&value_value, stats.min);
+        dict_add(dict, "min", &value_value);
+
+        g_value_set_uint(&value_value, stats.mean);
+        dict_add(dict, "mean", &value_value);
+
+        g_value_set_uint(&value_value, stats.p50);
+        dict_add(dict, "p50", &value_value);
+
+        g_value_set_uint(&value_value, stats.p90);
+        dict_add(dict, "p90", &value_value);
+
+        g_value_set_uint(&value_value, stats.p99);
+        dict_add(dict, "p99", &value_value);
+
+        g_value_set_uint(&value_value, stats.max);
+        dict_add(dict, "max", &value_value);
+        dict_free(dict);
+        break;
     default:
         /* We don't have any other property... */
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -482,14 +934,23 @@ matahari_get_property(GObject *object, guint property_id, GValue *value,
 GType
 matahari_dict_type(int prop)
 {
-    g_printerr("Type of property %s is map of unknown types\n",
-               properties[prop].name);
-    return G_TYPE_VALUE;
+    switch (prop) {
+    case PROP_RESOURCES_OP_DURATION:
+        return G_TYPE_UINT;
+        break;
+    default:
+        g_printerr("Type of property %s is map of unknown types\n",
+                   properties[prop].name);
+        return G_TYPE_VALUE;
+    }
 }
 
 int
 main(int argc, char** argv)
 {
     g_type_init();
+    if (services_zygote_wanted()) {
+        services_zygote_start();
+    }
     return run_dbus_server(SERVICES_BUS_NAME, SERVICES_OBJECT_PATH);
 }
@@ -31,6 +31,11 @@
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
 
 extern "C" {
 #include "matahari/logging.h"
@@ -41,12 +46,23 @@ using namespace qmf;
 using qpid::types::Variant;
 using qpid::messaging::Duration;
 
+/* How long to wait for agents to show up, in milliseconds */
+#define DISCOVER_DEFAULT_MS 10000
+/* Given to an agent on top of the action's own timeout */
+#define CALL_SLACK_MS 10000
+
+struct fanout_call {
+    string name;
+    gint64 sent;
+};
+
 static int
 call_arg(int code, const char *name, const char *arg, void *userdata)
 {
     qpid::types::Variant::Map *options = static_cast<qpid::types::Variant::Map*>(userdata);
     mh_debug("Found call option: '%s' = '%s'", name, arg);
-    if(strcmp(name, "timeout") == 0 || strcmp(name, "interval") == 0) {
+    if(strcmp(name, "timeout") == 0 || strcmp(name, "interval") == 0
+       || strcmp(name, "fan-out") == 0 || strcmp(name, "discover") == 0) {
         uint32_t number = atoi(arg);
         (*options)[name] = number;
     } else {
@@ -77,6 +93,146 @@ agent_arg(int code, const char *name, const char *arg, void *userdata)
     return 0;
 }
 
+static bool
+wait_for_agents(ConsoleSession &session, uint32_t discover_ms)
+{
+    gint64 deadline = g_get_monotonic_time() + discover_ms * (gint64) 1000;
+    ConsoleEvent event;
+
+    /* Agents are added to the session as their events are processed */
+    while(session.getAgentCount() == 0) {
+        gint64 remaining = deadline - g_get_monotonic_time();
+
+        if(remaining <= 0) {
+            return false;
+        }
+        session.nextEvent(event, Duration(remaining / 1000 + 1));
+    }
+    return true;
+}
+
+static uint32_t
+percentile(const vector<uint32_t> &sorted, uint32_t pct)
+{
+    size_t rank = (sorted.size() * pct + 99) / 100;
+
+    if(sorted.empty()) {
+        return 0;
+    }
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+/*
+ * Call the method on every agent matching the session's filter, at most
+ * window of them at once.  Agents are called as they are discovered and
+ * results are printed as they arrive.
+ */
+static int
+fan_out(ConsoleSession &session, const string &api, const string &method,
+        const Variant::Map &call_options, uint32_t window,
+        uint32_t discover_ms, uint32_t call_timeout_ms)
+{
+    deque<Agent> pending;
+    map<uint32_t, fanout_call> inflight;
+    map<uint32_t, fanout_call>::iterator iter;
+    set<string> seen;
+    vector<uint32_t> latencies;
+    uint32_t lpc, called = 0, succeeded = 0, failed = 0, timed_out = 0;
+    gint64 discover_end = g_get_monotonic_time() + discover_ms * (gint64) 1000;
+    gint64 timeout_us = call_timeout_ms * (gint64) 1000;
+    ConsoleEvent event;
+
+    for(lpc = 0; lpc < session.getAgentCount(); lpc++) {
+        Agent agent = session.getAgent(lpc);
+        if(seen.insert(agent.getName()).second) {
+            pending.push_back(agent);
+        }
+    }
+
+    while(true) {
+        gint64 now = g_get_monotonic_time();
+        gint64 wake = now < discover_end ? discover_end : G_MAXINT64;
+
+        while(inflight.size() < window && !pending.empty()) {
+            Agent agent = pending.front();
+            DataAddr agent_data(api, agent.getName(), 0);
+            fanout_call call;
+
+            pending.pop_front();
+            call.name = agent.getName();
+            call.sent = now;
+            inflight[agent.callMethodAsync(method, call_options, agent_data)] = call;
+            called++;
+        }
+
+        for(iter = inflight.begin(); iter != inflight.end(); ) {
+            if(now - iter->second.sent >= timeout_us) {
+                cout << iter->second.name << ": timed out after "
+                     << call_timeout_ms << "ms" << endl;
+                timed_out++;
+                /* A late response won't match anything anymore */
+                inflight.erase(iter++);
+            } else {
+                wake = min(wake, iter->second.sent + timeout_us);
+                ++iter;
+            }
+        }
+
+        if(now >= discover_end && pending.empty() && inflight.empty()) {
+            break;
+        }
+
+        /* Until something happens or the next deadline passes */
+        if(!session.nextEvent(event, Duration((wake - now) / 1000 + 1))) {
+            continue;
+        }
+
+        switch(event.getType()) {
+            case CONSOLE_AGENT_ADD:
+                if(g_get_monotonic_time() < discover_end
+                   && seen.insert(event.getAgent().getName()).second) {
+                    pending.push_back(event.getAgent());
+                }
+                break;
+
+            case CONSOLE_METHOD_RESPONSE:
+            case CONSOLE_EXCEPTION:
+                iter = inflight.find(event.getCorrelator());
+                if(iter == inflight.end()) {
+                    break;
+                }
+
+                latencies.push_back((g_get_monotonic_time() - iter->second.sent) / 1000);
+                cout << iter->second.name << ": ";
+                if(event.getType() == CONSOLE_METHOD_RESPONSE) {
+                    cout << "returned in " << latencies.back() << "ms: "
+                         << event.getArguments() << endl;
+                    succeeded++;
+                } else {
+                    cout << "failed in " << latencies.back() << "ms:";
+                    for(lpc = 0; lpc < event.getDataCount(); lpc++) {
+                        cout << " " << event.getData(lpc).getProperties();
+                    }
+                    cout << endl;
+                    failed++;
+                }
+                inflight.erase(iter);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    sort(latencies.begin(), latencies.end());
+    cout << "Called " << called << " agents: " << succeeded << " succeeded, "
+         << failed << " failed, " << timed_out << " timed out; latency p50 "
+         << percentile(latencies, 50) << "ms, p99 "
+         << percentile(latencies, 99) << "ms" << endl;
+
+    return (failed || timed_out || called == 0) ? 1 : 0;
+}
+
 int main(int argc, char** argv)
 {
     qpid::types::Variant::Map options;
@@ -87,7 +243,6 @@ int main(int argc, char** argv)
     Agent agent;
 
     core_options["api-type"] = "Resources";
-    core_options["host-dns"] = mh_hostname();
     options["standard"] = "ocf";
     options["provider"] = "heartbeat";
     options["interval"] = 0;
@@ -98,6 +253,8 @@ int main(int argc, char** argv)
     mh_add_option('T', required_argument, "api-type", "Resources|Services", &core_options, call_arg);
     mh_add_option('H', required_argument, "host-dns", "Host DNS name", &core_options, call_arg);
     mh_add_option('U', required_argument, "host-uuid", "Host UUID", &core_options, call_arg);
+    mh_add_option('F', required_argument, "fan-out", "Call every matching agent, at most this many at once. Only restricted to a host by --host-dns or --host-uuid", &core_options, call_arg);
+    mh_add_option('w', required_argument, "discover", "Time, in milliseconds, to wait for agents to show up", &core_options, call_arg);
 
     mh_add_option('N', required_argument, "name", "Name of a resource", &options, call_arg);
     mh_add_option('S', required_argument, "standard", "lsb|ocf|windows (Resources API only)", &options, call_arg);
@@ -113,6 +270,10 @@ int main(int argc, char** argv)
     qpid::types::Variant::Map amqpOptions = mh_parse_options("qmf-service-cli", argc, argv, core_options);
     options["parameters"] = agent_options;
 
+    if (core_options.count("fan-out") == 0 && core_options.count("host-dns") == 0) {
+        core_options["host-dns"] = mh_hostname();
+    }
+
     /* Re-initialize logging now that we've completed option processing */
     mh_log_init("service-cli", mh_log_level, mh_log_level > LOG_INFO);
 
@@ -166,8 +327,26 @@ int main(int argc, char** argv)
             }
         }
 
-        while(session.getAgentCount() == 0) {
-            g_usleep(1000);
+        uint32_t discover_ms = DISCOVER_DEFAULT_MS;
+        if (core_options.count("discover")) {
+            discover_ms = core_options["discover"].asUint32();
+        }
+
+        if (core_options.count("fan-out")) {
+            uint32_t window = core_options["fan-out"].asUint32();
+            uint32_t call_timeout_ms = CALL_SLACK_MS;
+
+            if (call_options.count("timeout")) {
+                call_timeout_ms += call_options["timeout"].asUint32();
+            }
+            return fan_out(session, core_options["api-type"].asString(), action,
+                           call_options, window > 0 ? window : 1, discover_ms,
+                           call_timeout_ms);
+        }
+
+        if (!wait_for_agents(session, discover_ms)) {
+            cout << "No agent found within " << discover_ms << "ms" << endl;
+            return 1;
         }
 
         for(lpc = 0; lpc < session.getAgentCount(); lpc++) {
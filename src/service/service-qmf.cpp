@@ -37,6 +37,7 @@ extern "C" {
 }
 
 #include <iostream>
+#include <vector>
 
 enum service_id {
     SRV_RESOURCES,
@@ -47,7 +48,8 @@ class SrvAgent : public MatahariAgent
 {
 private:
     void action_async(enum service_id service, qmf::AgentSession& session,
-                      qmf::AgentEvent& event, svc_action_t *op, bool has_rc);
+                      qmf::AgentEvent& event, svc_action_t *op, bool has_rc,
+                      bool stream_output = false);
 
     qmf::Data _services;
     static const char SERVICES_NAME[];
@@ -67,12 +69,25 @@ public:
     virtual gboolean invoke(qmf::AgentSession session,
                             qmf::AgentEvent event, gpointer user_data);
     void raiseEvent(svc_action_t *op, enum service_id service, const std::string &userdata);
+    void raiseOutputEvent(svc_action_t *op, const std::string &out,
+                          const std::string &err, uint32_t dropped,
+                          const std::string &userdata);
+    void update_op_stats();
 };
 
 const char SrvAgent::SERVICES_NAME[] = "Services";
 
 const char SrvAgent::RESOURCES_NAME[] = "Resources";
 
+/* How often streamed output is published, per action */
+#define OUTPUT_FLUSH_MS 1000
+
+/* Most output carried by one resource_output event, the rest is dropped */
+#define OUTPUT_EVENT_MAX 16384
+
+/* Longer lines are cut short */
+#define OUTPUT_LINE_MAX 1024
+
 /**
  * Async process callback
  *
@@ -85,10 +100,20 @@ public:
             qmf::AgentSession& _session, qmf::AgentEvent& _event,
             bool _has_rc) :
             agent(_agent), service(_service), session(_session), event(_event),
-            has_rc(_has_rc), last_rc(0), first_result(true) {};
-    ~AsyncCB() {};
+            has_rc(_has_rc), last_rc(0), first_result(true), op(NULL),
+            dropped(0), flush_timer(0) {};
+    ~AsyncCB() {
+        if (flush_timer) {
+            g_source_remove(flush_timer);
+        }
+    };
 
     static void mh_async_callback(svc_action_t *op);
+    static void mh_output_callback(svc_action_t *op, gboolean is_stderr,
+                                   const char *line);
+    static gboolean output_flush_timer(gpointer data);
+    void flush_output();
+    std::string userdata();
 
     /** Cached SrvAgent instance */
     SrvAgent *agent;
@@ -105,8 +130,86 @@ public:
     int last_rc;
     /** true if this is the first callback. */
     bool first_result;
+
+    /** The action whose output is being streamed */
+    svc_action_t *op;
+    /** Output lines waiting for the next resource_output event */
+    std::string out_pending;
+    std::string err_pending;
+    /** Lines that did not fit into the next event */
+    uint32_t dropped;
+    /** Publishes the pending output */
+    guint flush_timer;
 };
 
+std::string
+AsyncCB::userdata()
+{
+    qpid::types::Variant::Map& args = event.getArguments();
+
+    if (args.count("userdata") > 0) {
+        return args["userdata"].asString();
+    }
+    return std::string();
+}
+
+void
+AsyncCB::mh_output_callback(svc_action_t *op, gboolean is_stderr,
+                            const char *line)
+{
+    AsyncCB *cb_data = static_cast<AsyncCB *>(op->cb_data);
+    std::string& pending = is_stderr ? cb_data->err_pending
+                                     : cb_data->out_pending;
+    size_t len = strlen(line);
+
+    if (len > OUTPUT_LINE_MAX) {
+        len = OUTPUT_LINE_MAX;
+    }
+
+    if (cb_data->out_pending.size() + cb_data->err_pending.size() + len + 1
+        > OUTPUT_EVENT_MAX) {
+        cb_data->dropped++;
+    } else {
+        pending.append(line, len);
+        pending.append(1, '\n');
+    }
+
+    cb_data->op = op;
+    if (cb_data->flush_timer == 0) {
+        cb_data->flush_timer = g_timeout_add(OUTPUT_FLUSH_MS,
+                                             output_flush_timer, cb_data);
+    }
+}
+
+gboolean
+AsyncCB::output_flush_timer(gpointer data)
+{
+    AsyncCB *cb_data = static_cast<AsyncCB *>(data);
+
+    cb_data->flush_timer = 0;
+    cb_data->flush_output();
+    return FALSE;
+}
+
+void
+AsyncCB::flush_output()
+{
+    if (flush_timer) {
+        g_source_remove(flush_timer);
+        flush_timer = 0;
+    }
+
+    if (op == NULL
+        || (out_pending.empty() && err_pending.empty() && dropped == 0)) {
+        return;
+    }
+
+    agent->raiseOutputEvent(op, out_pending, err_pending, dropped, userdata());
+    out_pending.clear();
+    err_pending.clear();
+    dropped = 0;
+}
+
 void
 AsyncCB::mh_async_callback(svc_action_t *op)
 {
@@ -115,10 +218,11 @@ AsyncCB::mh_async_callback(svc_action_t *op)
 
     mh_trace("Completed: %s = %d", op->id, op->rc);
 
-    qpid::types::Variant::Map& args = cb_data->event.getArguments();
-    if (args.count("userdata") > 0) {
-        userdata = args["userdata"].asString();
-    }
+    // Output goes out before the result it led up to
+    cb_data->flush_output();
+    cb_data->op = NULL;
+
+    userdata = cb_data->userdata();
 
     if (cb_data->first_result) {
         if (cb_data->has_rc) {
@@ -136,6 +240,8 @@ AsyncCB::mh_async_callback(svc_action_t *op)
         cb_data->agent->raiseEvent(op, cb_data->service, userdata);
     }
 
+    cb_data->agent->update_op_stats();
+
     if (op->interval) { /* recurring action */
         cb_data->last_rc = op->rc;
     } else {
@@ -144,6 +250,54 @@ AsyncCB::mh_async_callback(svc_action_t *op)
     }
 }
 
+/**
+ * Describe callback
+ *
+ * Holds on to a describe method call until the agent description is known.
+ */
+class DescribeCB {
+public:
+    DescribeCB(qmf::AgentSession& _session, qmf::AgentEvent& _event) :
+            session(_session), event(_event) {};
+    ~DescribeCB() {};
+
+    static void mh_describe_callback(const char *xml, gpointer user_data);
+
+    /** The QMF session that initiated the describe */
+    qmf::AgentSession session;
+    /** The method call that initiated the describe */
+    qmf::AgentEvent event;
+};
+
+void
+DescribeCB::mh_describe_callback(const char *xml, gpointer user_data)
+{
+    DescribeCB *cb_data = static_cast<DescribeCB *>(user_data);
+
+    if (xml) {
+        cb_data->event.addReturnArgument("xml", xml);
+        cb_data->session.methodSuccess(cb_data->event);
+    } else {
+        cb_data->session.raiseException(cb_data->event,
+                                        mh_result_to_str(MH_RES_BACKEND_ERROR));
+    }
+
+    delete cb_data;
+}
+
+static void
+describe_async(qmf::AgentSession& session, qmf::AgentEvent& event,
+               const char *standard, const char *provider, const char *agent)
+{
+    DescribeCB *cb_data = new DescribeCB(session, event);
+
+    if (!resources_agent_describe(standard, provider, agent,
+                                  DescribeCB::mh_describe_callback, cb_data)) {
+        delete cb_data;
+        session.raiseException(event, mh_result_to_str(MH_RES_INVALID_ARGS));
+    }
+}
+
 static GHashTable *
 qmf_map_to_hash(::qpid::types::Variant::Map parameters)
 {
@@ -160,15 +314,169 @@ qmf_map_to_hash(::qpid::types::Variant::Map parameters)
     return hash;
 }
 
+/**
+ * Create a resource action from the arguments of Resources.invoke
+ *
+ * \param[in]  args the method arguments
+ * \param[out] res  why the action could not be created
+ *
+ * \return the action, or NULL on error
+ */
+static svc_action_t *
+invoke_action_create(_qtype::Variant::Map& args, enum mh_result *res)
+{
+    svc_action_t *op = NULL;
+    _qtype::Variant::Map map;
+
+    if(args.count("parameters") == 1) {
+        map = args["parameters"].asMap();
+    }
+
+    int32_t interval = 0;
+    int32_t timeout = 60000;
+    std::string agent;
+    std::string standard("ocf");
+    std::string provider("heartbeat");
+
+    if (args.count("standard")) {
+        standard = args["standard"].asString();
+    }
+    if (args.count("provider")) {
+        provider = args["provider"].asString();
+    }
+    if (args.count("agent")) {
+        agent = args["agent"].asString();
+    } else {
+        agent = args["name"].asString();
+    }
+
+    if(args.count("interval") > 0) {
+        interval = args["interval"].asInt32();
+    }
+    if(args.count("timeout") > 0) {
+        timeout = args["timeout"].asInt32();
+    }
+
+    if (!resources_standard_is_valid(standard.c_str())) {
+        mh_err("%s is not a known resource standard", standard.c_str());
+        *res = MH_RES_NOT_IMPLEMENTED;
+        return NULL;
+    }
+
+    op = resources_action_create(
+        args["name"].asString().c_str(),
+        standard.c_str(), provider.c_str(), agent.c_str(),
+        args["action"].asString().c_str(),
+        interval, timeout, qmf_map_to_hash(map));
+
+    if (!op) {
+        *res = MH_RES_INVALID_ARGS;
+        return NULL;
+    }
+
+    if(args.count("expected-rc") == 1) {
+        op->expected_rc = args["expected-rc"].asInt32();
+    }
+
+    *res = MH_RES_SUCCESS;
+    return op;
+}
+
+/**
+ * Batch callback
+ *
+ * Holds on to an invoke_batch method call until all of its operations
+ * have been reported.
+ */
+class BatchCB {
+public:
+    /** One requested operation */
+    struct Op {
+        Op(const _qtype::Variant::Map& _args, int _index,
+           enum mh_result _res) :
+                args(_args), index(_index), res(_res) {};
+
+        /** The operation's arguments */
+        _qtype::Variant::Map args;
+        /** Index of its result in the batch, -1 if it was rejected */
+        int index;
+        /** Why it was rejected */
+        enum mh_result res;
+    };
+
+    BatchCB(qmf::AgentSession& _session, qmf::AgentEvent& _event) :
+            session(_session), event(_event) {};
+    ~BatchCB() {};
+
+    static void mh_batch_callback(svc_batch_t *batch, gpointer user_data);
+
+    /** The QMF session that initiated the batch */
+    qmf::AgentSession session;
+    /** The method call that initiated the batch */
+    qmf::AgentEvent event;
+    /** The requested operations, in order */
+    std::vector<Op> ops;
+};
+
+void
+BatchCB::mh_batch_callback(svc_batch_t *batch, gpointer user_data)
+{
+    BatchCB *cb_data = static_cast<BatchCB *>(user_data);
+    std::vector<Op>::iterator iter;
+    _qtype::Variant::List results;
+
+    for (iter = cb_data->ops.begin(); iter != cb_data->ops.end(); iter++) {
+        _qtype::Variant::Map result;
+
+        result["name"] = iter->args["name"];
+        result["action"] = iter->args["action"];
+
+        if (iter->index < 0) {
+            result["rc"] = OCF_UNKNOWN_ERROR;
+            result["status"] = LRM_OP_ERROR;
+            result["error"] = mh_result_to_str(iter->res);
+
+        } else {
+            const svc_batch_result_t *r = services_batch_result(batch,
+                                                                iter->index);
+            result["rc"] = r->rc;
+            result["status"] = r->status;
+            result["sequence"] = r->sequence;
+            result["duration"] = r->duration;
+        }
+
+        if (iter->args.count("userdata")) {
+            result["userdata"] = iter->args["userdata"];
+        }
+        results.push_back(result);
+    }
+
+    cb_data->event.addReturnArgument("results", results);
+    cb_data->session.methodSuccess(cb_data->event);
+
+    delete cb_data;
+}
+
 int
 main(int argc, char **argv)
 {
     SrvAgent agent;
-    int rc = agent.init(argc, argv, "service");
+    int rc;
+
+    /*
+     * Optional until it has proven itself, see MATAHARI_ACTION_HELPER in
+     * the sysconfig file.  Forked before QMF, NSS and curl are initialized
+     * and before any threads exist, while the process is still small.
+     */
+    if (services_zygote_wanted()) {
+        services_zygote_start();
+    }
+
+    rc = agent.init(argc, argv, "service");
 
     if (rc >= 0) {
         mainloop_track_children(G_PRIORITY_DEFAULT);
-        agent.run();
+        rc = agent.run();
     }
 
     return rc;
@@ -179,6 +487,7 @@ SrvAgent::raiseEvent(svc_action_t *op, enum service_id service, const std::strin
 {
     uint64_t timestamp = 0L;
     qmf::Data event;
+    const svc_action_usage_t *usage = services_action_usage(op);
 
 #ifdef HAVE_TIME
     timestamp = ::time(NULL);
@@ -211,6 +520,74 @@ SrvAgent::raiseEvent(svc_action_t *op, enum service_id service, const std::strin
         event.setProperty("userdata", userdata);
     }
 
+    event.setProperty("duration", usage->wall_ms);
+    event.setProperty("cpu_user", usage->user_us);
+    event.setProperty("cpu_system", usage->system_us);
+    event.setProperty("max_rss", usage->max_rss_kb);
+    event.setProperty("block_in", usage->block_in);
+    event.setProperty("block_out", usage->block_out);
+
+    getSession().raiseEvent(event);
+}
+
+static _qtype::Variant::Map
+op_stats_to_map(const svc_op_stats_t& stats, bool with_counts)
+{
+    _qtype::Variant::Map map;
+
+    if (with_counts) {
+        map["count"] = stats.count;
+        map["failures"] = stats.failed;
+        map["timeouts"] = stats.timed_out;
+    }
+    map["min"] = stats.min;
+    map["mean"] = stats.mean;
+    map["p50"] = stats.p50;
+    map["p90"] = stats.p90;
+    map["p99"] = stats.p99;
+    map["max"] = stats.max;
+
+    return map;
+}
+
+void
+SrvAgent::update_op_stats()
+{
+    svc_op_stats_t stats;
+
+    services_op_stats(NULL, NULL, &stats);
+
+    _resources.setProperty("op_count", stats.count);
+    _resources.setProperty("op_failures", stats.failed);
+    _resources.setProperty("op_timeouts", stats.timed_out);
+    _resources.setProperty("op_duration", op_stats_to_map(stats, false));
+}
+
+void
+SrvAgent::raiseOutputEvent(svc_action_t *op, const std::string &out,
+                           const std::string &err, uint32_t dropped,
+                           const std::string &userdata)
+{
+    uint64_t timestamp = 0L;
+    qmf::Data event = qmf::Data(_package.event_resource_output);
+
+#ifdef HAVE_TIME
+    timestamp = ::time(NULL);
+#endif
+
+    event.setProperty("timestamp", timestamp);
+    event.setProperty("sequence", op->sequence);
+    event.setProperty("name", op->rsc);
+    event.setProperty("action", op->action);
+    event.setProperty("interval", op->interval);
+    event.setProperty("stdout", out);
+    event.setProperty("stderr", err);
+    event.setProperty("dropped", dropped);
+
+    if (userdata.length()) {
+        event.setProperty("userdata", userdata);
+    }
+
     getSession().raiseEvent(event);
 }
 
@@ -230,6 +607,7 @@ SrvAgent::setup(qmf::AgentSession session)
 
     _resources.setProperty("uuid", mh_uuid());
     _resources.setProperty("hostname", mh_hostname());
+    update_op_stats();
 
     session.addData(_resources, RESOURCES_NAME);
 
@@ -258,9 +636,13 @@ SrvAgent::invoke(qmf::AgentSession session, qmf::AgentEvent event,
 
 void
 SrvAgent::action_async(enum service_id service, qmf::AgentSession& session,
-                       qmf::AgentEvent& event, svc_action_t *op, bool has_rc)
+                       qmf::AgentEvent& event, svc_action_t *op, bool has_rc,
+                       bool stream_output)
 {
     op->cb_data = new AsyncCB(this, service, session, event, has_rc);
+    if (stream_output) {
+        services_action_set_output_callback(op, AsyncCB::mh_output_callback);
+    }
     services_action_async(op, AsyncCB::mh_async_callback);
 }
 
@@ -316,6 +698,11 @@ SrvAgent::invoke_services(qmf::AgentSession session, qmf::AgentEvent event,
 
         return TRUE;
 
+    } else if (methodName == "describe") {
+        describe_async(session, event, "lsb", NULL,
+                       args["name"].asString().c_str());
+        return TRUE;
+
     } else {
         session.raiseException(event, mh_result_to_str(MH_RES_NOT_IMPLEMENTED));
         return TRUE;
@@ -385,67 +772,160 @@ SrvAgent::invoke_resources(qmf::AgentSession session, qmf::AgentEvent event,
 
         event.addReturnArgument("agents", t_list);
 
+    } else if (methodName == "describe") {
+        describe_async(session, event, args["standard"].asString().c_str(),
+                       args["provider"].asString().c_str(),
+                       args["agent"].asString().c_str());
+        return TRUE;
+
+    } else if (methodName == "describe_all") {
+        int count = resources_describe_all(args["standard"].asString().c_str(),
+                                           args["provider"].asString().c_str());
+
+        event.addReturnArgument("count", count);
+
     } else if (methodName == "invoke") {
-        svc_action_t *op = NULL;
-        _qtype::Variant::List::iterator iter;
-        _qtype::Variant::Map map;
+        enum mh_result res;
+        svc_action_t *op = invoke_action_create(args, &res);
 
-        if(args.count("parameters") == 1) {
-            map = args["parameters"].asMap();
+        if (!op) {
+            session.raiseException(event, mh_result_to_str(res));
+            return TRUE;
         }
 
-        GHashTable *params = qmf_map_to_hash(map);
+        action_async(SRV_RESOURCES, session, event, op, true,
+                     args.count("stream-output") > 0
+                     && args["stream-output"].asBool());
+        return TRUE;
 
-        int32_t interval = 0;
-        int32_t timeout = 60000;
-        std::string agent;
-        std::string standard("ocf");
-        std::string provider("heartbeat");
+    } else if (methodName == "invoke_batch") {
+        _qtype::Variant::List operations;
+        _qtype::Variant::List::iterator iter;
+        svc_batch_t *batch;
+        int32_t parallel = 0;
+        int32_t deadline = 0;
 
-        if (args.count("standard")) {
-            standard = args["standard"].asString();
+        if (args.count("operations")) {
+            operations = args["operations"].asList();
         }
-        if (args.count("provider")) {
-            provider = args["provider"].asString();
+        if (args.count("parallel")) {
+            parallel = args["parallel"].asInt32();
         }
-        if (args.count("agent")) {
-            agent = args["agent"].asString();
-        } else {
-            agent = args["name"].asString();
+        if (args.count("deadline")) {
+            deadline = args["deadline"].asInt32();
         }
 
-        if(args.count("interval") > 0) {
-            interval = args["interval"].asInt32();
-        }
-        if(args.count("timeout") > 0) {
-            timeout = args["timeout"].asInt32();
-        }
+        batch = services_batch_new(parallel, deadline);
+        BatchCB *cb_data = new BatchCB(session, event);
 
-        GList *standards = resources_list_standards();
+        for (iter = operations.begin(); iter != operations.end(); iter++) {
+            _qtype::Variant::Map op_args = iter->asMap();
+            enum mh_result res;
+            svc_action_t *op = invoke_action_create(op_args, &res);
 
-        if (g_list_find_custom(standards, standard.c_str(), (GCompareFunc) strcasecmp) == NULL) {
-            mh_err("%s is not a known resource standard", standard.c_str());
-            session.raiseException(event, mh_result_to_str(MH_RES_NOT_IMPLEMENTED));
-            return TRUE;
+            if (!op) {
+                // Rejected up front, report it in its place
+                cb_data->ops.push_back(BatchCB::Op(op_args, -1, res));
+                continue;
+            }
+
+            cb_data->ops.push_back(BatchCB::Op(op_args,
+                                               services_batch_add(batch, op),
+                                               MH_RES_SUCCESS));
         }
 
-        op = resources_action_create(
-            args["name"].asString().c_str(),
-            standard.c_str(), provider.c_str(), agent.c_str(),
-            args["action"].asString().c_str(),
-            interval, timeout, params);
+        services_batch_run(batch, BatchCB::mh_batch_callback, cb_data);
+        return TRUE;
 
-        if (!op) {
+    } else if (methodName == "cancel_all") {
+        int count = services_action_cancel_all(args["name"].asString().c_str(),
+                                               args["agent"].asString().c_str());
+
+        if (count < 0) {
             session.raiseException(event, mh_result_to_str(MH_RES_INVALID_ARGS));
             return TRUE;
         }
+        event.addReturnArgument("count", count);
 
-        if(args.count("expected-rc") == 1) {
-            op->expected_rc = args["expected-rc"].asInt32();
+    } else if (methodName == "list_recurring") {
+        GList *gIter = NULL;
+        GList *recurring = NULL;
+        _qtype::Variant::List r_list;
+
+        recurring = services_recurring_list(args["name"].asString().c_str(),
+                                            args["agent"].asString().c_str());
+        for (gIter = recurring; gIter != NULL; gIter = gIter->next) {
+            svc_action_t *op = (svc_action_t *) gIter->data;
+            _qtype::Variant::Map r_map;
+
+            r_map["name"] = op->rsc;
+            r_map["standard"] = op->standard;
+            if (op->provider) {
+                r_map["provider"] = op->provider;
+            }
+            r_map["agent"] = op->agent;
+            r_map["action"] = op->action;
+            r_map["interval"] = op->interval;
+            r_map["timeout"] = op->timeout;
+            r_map["sequence"] = op->sequence;
+            r_list.push_back(r_map);
         }
+        g_list_free(recurring);
 
-        action_async(SRV_RESOURCES, session, event, op, true);
-        return TRUE;
+        event.addReturnArgument("actions", r_list);
+
+    } else if (methodName == "get_op_history") {
+        GList *gIter = NULL;
+        GList *history = NULL;
+        svc_op_stats_t stats;
+        _qtype::Variant::List h_list;
+
+        history = services_op_history(args["name"].asString().c_str(),
+                                      args["action"].asString().c_str());
+        for (gIter = history; gIter != NULL; gIter = gIter->next) {
+            svc_history_entry_t *entry = (svc_history_entry_t *) gIter->data;
+            _qtype::Variant::Map h_map;
+
+            h_map["action"] = entry->action;
+            h_map["timestamp"] = (uint64_t) entry->started.tv_sec;
+            h_map["duration"] = entry->duration;
+            h_map["rc"] = entry->rc;
+            h_map["status"] = entry->status;
+            h_map["timed_out"] = entry->timed_out ? true : false;
+            h_list.push_back(h_map);
+        }
+        g_list_free_full(history, free);
+
+        services_op_stats(args["name"].asString().c_str(),
+                          args["action"].asString().c_str(), &stats);
+
+        event.addReturnArgument("history", h_list);
+        event.addReturnArgument("stats", op_stats_to_map(stats, true));
+
+    } else if (methodName == "get_agent_usage") {
+        GList *gIter = NULL;
+        GList *usage = NULL;
+        _qtype::Variant::List u_list;
+
+        usage = services_agent_usage();
+        for (gIter = usage; gIter != NULL; gIter = gIter->next) {
+            svc_agent_usage_t *entry = (svc_agent_usage_t *) gIter->data;
+            _qtype::Variant::Map u_map;
+
+            u_map["agent"] = entry->agent;
+            u_map["action"] = entry->action;
+            u_map["count"] = entry->count;
+            u_map["cpu_user"] = entry->total.user_us;
+            u_map["cpu_system"] = entry->total.system_us;
+            u_map["max_rss"] = entry->total.max_rss_kb;
+            u_map["block_in"] = entry->total.block_in;
+            u_map["block_out"] = entry->total.block_out;
+            u_map["duration"] = entry->total.wall_ms;
+            u_list.push_back(u_map);
+        }
+        g_list_free_full(usage, free);
+
+        event.addReturnArgument("usage", u_list);
 
     } else if (methodName == "cancel") {
         services_action_cancel(
@@ -44,6 +44,7 @@ public:
     virtual int setup(qmf::AgentSession session);
     virtual gboolean invoke(qmf::AgentSession session, qmf::AgentEvent event,
                             gpointer user_data);
+    virtual enum mh_result offload(qmf::AgentEvent event);
 };
 
 const char ConfigAgent::SYSCONFIG_NAME[] = "Sysconfig";
@@ -73,7 +74,7 @@ main(int argc, char **argv)
     int rc = agent.init(argc, argv, "Sysconfig");
     if (rc == 0) {
         mainloop_track_children(G_PRIORITY_DEFAULT);
-        agent.run();
+        rc = agent.run();
     }
     return rc;
 }
@@ -88,10 +89,32 @@ ConfigAgent::setup(qmf::AgentSession session)
     _instance.setProperty("uuid", mh_uuid());
     _instance.setProperty("is_postboot_configured", 0);
 
+    /* Every query loads the whole augeas tree */
+    setOffloadable("query", 2);
+
     session.addData(_instance, SYSCONFIG_NAME);
     return 0;
 }
 
+enum mh_result
+ConfigAgent::offload(qmf::AgentEvent event)
+{
+    const std::string& methodName(event.getMethodName());
+    qpid::types::Variant::Map& args = event.getArguments();
+
+    if (methodName == "query") {
+        char *data = NULL;
+        data = mh_sysconfig_query(args["text"].asString().c_str(),
+                                  args["flags"].asUint32(),
+                                  args["scheme"].asString().c_str());
+        event.addReturnArgument("data", data ? data : "unknown");
+        free(data);
+        return MH_RES_SUCCESS;
+    }
+
+    return MH_RES_NOT_IMPLEMENTED;
+}
+
 void
 AsyncCB::result_cb(void *cb_data, int res)
 {
@@ -143,13 +166,6 @@ ConfigAgent::invoke(qmf::AgentSession session, qmf::AgentEvent event, gpointer u
             delete action_data;
             goto bail;
         }
-    } else if (methodName == "query") {
-        char *data = NULL;
-        data = mh_sysconfig_query(args["text"].asString().c_str(),
-                                  args["flags"].asUint32(),
-                                  args["scheme"].asString().c_str());
-        event.addReturnArgument("data", data ? data : "unknown");
-        free(data);
     } else if (methodName == "is_configured") {
         status = mh_sysconfig_is_configured(args["key"].asString().c_str());
         event.addReturnArgument("status", status ? status : "unknown");
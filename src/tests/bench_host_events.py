@@ -0,0 +1,91 @@
+#!/usr/bin/env python
+
+"""
+  bench_host_events.py - Copyright (c) 2011 Red Hat, Inc.
+
+  Measures how many QMF method calls the host agent answers per second
+  when many consoles call it at once, handling one event per main loop
+  pass (--qmf-batch 1) and with the default batching.  Needs qpidd and
+  matahari-qmf-hostd, like the live tests; not run by nosetests.
+
+    python bench_host_events.py [consoles] [calls per console]
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the
+  Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+"""
+
+import commands as cmd
+import matahariTest as testUtil
+import threading
+import time
+import sys
+
+def storm(consoles, calls):
+    hostname = cmd.getoutput('hostname')
+    sessions = []
+    hosts = []
+    failures = []
+
+    # Connected up front, so only the calls themselves are timed
+    for i in range(consoles):
+        info = testUtil.connectToBroker('localhost', '49001')
+        sessions.append(info)
+        hosts.append(testUtil.findAgent(info[1], 'host', 'Host', hostname))
+
+    def caller(host):
+        for i in range(calls):
+            try:
+                host.get_uuid('Filesystem')
+            except Exception as e:
+                failures.append(e)
+
+    threads = [ threading.Thread(target=caller, args=(host,)) for host in hosts ]
+    start = time.time()
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    elapsed = time.time() - start
+
+    for info in sessions:
+        testUtil.disconnectFromBroker(info)
+
+    if failures:
+        sys.stderr.write("%d calls failed, first: %s\n" % (len(failures), failures[0]))
+    return (consoles * calls - len(failures)) / elapsed
+
+def run(args, consoles, calls):
+    broker = testUtil.MatahariBroker()
+    broker.start()
+    time.sleep(3)
+    agent = testUtil.MatahariAgent("matahari-qmf-hostd", args)
+    agent.start()
+    time.sleep(3)
+    try:
+        return storm(consoles, calls)
+    finally:
+        agent.stop()
+        broker.stop()
+
+if __name__ == '__main__':
+    consoles = len(sys.argv) > 1 and int(sys.argv[1]) or 16
+    calls = len(sys.argv) > 2 and int(sys.argv[2]) or 500
+
+    single = run("--qmf-batch 1", consoles, calls)
+    batched = run("", consoles, calls)
+
+    print("%d consoles x %d get_uuid calls:" % (consoles, calls))
+    print("  one event per pass: %8.0f calls/s" % single)
+    print("  batched:            %8.0f calls/s (%.1fx)" % (batched, batched / single))
@@ -2,4 +2,4 @@
 # This file gets sourced from autobuild.sh.  This should be the list
 # of additional dependencies needed to run these tests.
 #
-MH_TESTS_DEPS="python-nose python-qpid-qmf resource-agents"
+MH_TESTS_DEPS="python-nose python-qpid-qmf resource-agents dbus-python pygobject2"
@@ -130,14 +130,16 @@ class MatahariBroker(object):
         sys.stderr.write("********************************************************\n")
 
 class MatahariAgent(object):
-    def __init__(self, agent_name):
+    def __init__(self, agent_name, args=""):
         self.agent_name = agent_name
+        self.args = args
         self.agent = None
 
     def start(self):
         sys.stderr.write("Starting %s ...\n" % self.agent_name)
         self.agent = subprocess.Popen("%s --reconnect yes --broker 127.0.0.1 "
-                                      "--port 49001 -vvv" % self.agent_name,
+                                      "--port 49001 -vvv %s" % (self.agent_name,
+                                                                self.args),
                                       shell=True, stdout=subprocess.PIPE,
                                       stderr=subprocess.PIPE)
 
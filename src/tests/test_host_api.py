@@ -39,7 +39,9 @@ class HostTestsSetup(object):
         self.broker = testUtil.MatahariBroker()
         self.broker.start()
         time.sleep(3)
-        self.host_agent = testUtil.MatahariAgent("matahari-qmf-hostd")
+        # event_batches is brought up to date every second rather than 10
+        self.host_agent = testUtil.MatahariAgent("matahari-qmf-hostd",
+                                                 "--qmf-report 1")
         self.host_agent.start()
         time.sleep(3)
         self.connect_info = testUtil.connectToBroker('localhost', '49001')
@@ -68,6 +70,15 @@ def tearDown():
     global connection
     connection.teardown()
 
+def context_switches(pid):
+    """ Voluntary context switches of every thread of a process so far """
+    total = 0
+    for task in os.listdir('/proc/%d/task' % pid):
+        for line in open('/proc/%d/task/%s/status' % (pid, task)):
+            if line.startswith('voluntary_ctxt_switches:'):
+                total += int(line.split()[1])
+    return total
+
 class HostApiTests(unittest.TestCase):
 
     # TEST - getProperties()
@@ -189,6 +200,43 @@ class HostApiTests(unittest.TestCase):
         except Exception as e:
             pass
 
+    # TEST - QMF event batching
+    # =====================================================
+    def test_event_batches_property(self):
+        for i in range(20):
+            host.get_uuid('Filesystem')
+        end = time.time() + 10
+        counted = 0
+        while counted == 0 and time.time() < end:
+            time.sleep(0.5)
+            agent = testUtil.findAgent(connection.sess, 'host', 'Agent', cmd.getoutput('hostname'))
+            batches = agent.getProperties().get('event_batches')
+            if batches:
+                counted = sum(batches.values())
+        self.assertTrue(counted > 0, "no QMF event batches counted")
+
+    # TEST - QMF notifier
+    # =====================================================
+    def test_idle_wakeups(self):
+        # Polling the QMF session woke the agent ~1000 times a second,
+        # waiting in the notifier thread leaves only timers and heartbeats
+        pid = int(cmd.getoutput('pidof -s matahari-qmf-hostd'))
+        before = context_switches(pid)
+        time.sleep(5)
+        rate = (context_switches(pid) - before) / 5.0
+        err.write("\nidle agent: %.1f wakeups/s\n" % rate)
+        self.assertTrue(rate < 50, "idle agent woke %.1f times a second" % rate)
+
+    def test_method_wakes_agent(self):
+        # Each call is noticed through the notifier's eventfd, not a timer
+        latencies = []
+        for i in range(20):
+            start = time.time()
+            host.get_uuid('Filesystem')
+            latencies.append(time.time() - start)
+        latencies.sort()
+        self.assertTrue(latencies[10] < 0.2, "median call took %.3fs" % latencies[10])
+
     # TEST - set_uuid()
     # =====================================================
     def test_set_uuid_Custom_lifetime(self):
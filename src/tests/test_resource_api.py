@@ -23,6 +23,7 @@
 import commands as cmd
 import matahariTest as testUtil
 from qmf2 import QmfAgentException
+from xml.etree import ElementTree
 import unittest
 import time
 import sys
@@ -52,8 +53,11 @@ class ResourceTestsSetup(object):
         self.service_agent.start()
         time.sleep(3)
         self.expectedMethods = [ 'list_standards()', 'list_providers(standard)', 'list(standard, provider)', 'describe(standard, provider, agent)',
-                                 'invoke(name, standard, provider, agent, action, interval, parameters, timeout, expected-rc, userdata)',
-                                 'cancel(name, action, interval, timeout)', 'fail(name, rc)' ]
+                                 'describe_all(standard, provider)',
+                                 'invoke(name, standard, provider, agent, action, interval, parameters, timeout, expected-rc, userdata, stream-output)',
+                                 'invoke_batch(operations, parallel, deadline)',
+                                 'cancel(name, action, interval, timeout)', 'cancel_all(name, agent)',
+                                 'list_recurring(name, agent)', 'get_op_history(name, action)', 'get_agent_usage()', 'fail(name, rc)' ]
         self.connect_info = testUtil.connectToBroker('localhost','49001')
         self.sess = self.connect_info[1]
         self.reQuery()
@@ -82,8 +86,88 @@ class TestResourceApi(unittest.TestCase):
 
     # TEST - describe()
     # =====================================================
-    def test_describe_not_implemented(self):
-        self.assertRaises(QmfAgentException, resource.describe, 'ocf','heartbeat','IPaddr')
+    def test_describe_unknown_agent(self):
+        self.assertRaises(QmfAgentException, resource.describe, 'ocf','heartbeat','zzzzz')
+
+    def test_describe_ocf_agent(self):
+        xml = resource.describe('ocf', 'heartbeat', 'Dummy').get('xml')
+        agent = ElementTree.fromstring(xml)
+        self.assertEquals(agent.get('name'), 'Dummy', "Dummy should be described")
+
+        params = [ p.get('name') for p in agent.findall('parameters/parameter') ]
+        self.assertTrue('state' in params, "state parameter not described: %s" % params)
+
+        actions = [ a.get('name') for a in agent.findall('actions/action') ]
+        for action in [ 'start', 'stop', 'monitor', 'meta-data' ]:
+            self.assertTrue(action in actions, "%s action not described: %s" % (action, actions))
+
+        # The second describe is answered from the cache
+        self.assertEquals(resource.describe('ocf', 'heartbeat', 'Dummy').get('xml'), xml,
+                          "cached description differs")
+
+    # TEST - describe_all()
+    # =====================================================
+    def test_describe_all_unknown_provider(self):
+        result = resource.describe_all('ocf', 'zzzzz')
+        self.assertEquals(result.get('count'), 0, "Nothing should be queued")
+
+    # TEST - list_recurring() / cancel_all()
+    # =====================================================
+    def test_cancel_all_for_resource(self):
+        for interval in [ 60000, 120000 ]:
+            resource.invoke('test-recurring', 'lsb', '', 'crond', 'status', interval, {}, 60000, 0, '', False)
+        actions = resource.list_recurring('test-recurring', '').get('actions')
+        self.assertEquals(len(actions), 2, "Both monitors should be listed")
+        self.assertEquals(resource.cancel_all('test-recurring', '').get('count'), 2, "Both monitors should be cancelled")
+        actions = resource.list_recurring('test-recurring', '').get('actions')
+        self.assertEquals(len(actions), 0, "Nothing should be left")
+
+    def test_cancel_all_needs_a_filter(self):
+        resource.invoke('test-recurring', 'lsb', '', 'crond', 'status', 60000, {}, 60000, 0, '', False)
+        self.assertRaises(QmfAgentException, resource.cancel_all, '', '')
+        actions = resource.list_recurring('test-recurring', '').get('actions')
+        self.assertEquals(len(actions), 1, "The monitor should be left alone")
+        resource.cancel_all('test-recurring', '')
+
+    # TEST - get_op_history()
+    # =====================================================
+    def test_op_history_unknown_resource(self):
+        result = resource.get_op_history('zzzzz', '')
+        self.assertEquals(len(result.get('history')), 0, "No history expected")
+        self.assertEquals(result.get('stats').get('count'), 0, "No operations expected")
+
+    def test_op_history_records_invoke(self):
+        resource.invoke('test-history', 'lsb', '', 'crond', 'status', 0, {}, 60000, 0, '', False)
+        result = resource.get_op_history('test-history', 'status')
+        entry = result.get('history')[0]
+        self.assertEquals(entry.get('action'), 'status', "status not recorded")
+        self.assertFalse(entry.get('timed_out'), "status should not time out")
+        self.assertTrue(result.get('stats').get('count') >= 1, "status not counted")
+
+    # TEST - invoke_batch()
+    # =====================================================
+    def test_invoke_batch(self):
+        ops = [ { 'name': 'batch-%d' % i, 'standard': 'lsb', 'agent': 'crond', 'action': 'status' } for i in range(5) ]
+        ops.append({ 'name': 'batch-bad', 'standard': 'zzzzz', 'agent': 'crond', 'action': 'status' })
+        results = resource.invoke_batch(ops, 2, 0).get('results')
+        self.assertEquals(len(results), 6, "One result per operation expected")
+        for i in range(5):
+            self.assertEquals(results[i].get('name'), 'batch-%d' % i, "Results out of order")
+            self.assertEquals(results[i].get('status'), 0, "status should have completed")
+        self.assertEquals(results[5].get('status'), 4, "Unknown standard should be an error")
+
+    def test_invoke_batch_empty(self):
+        results = resource.invoke_batch([], 0, 0).get('results')
+        self.assertEquals(len(results), 0, "No results expected")
+
+    # TEST - get_agent_usage()
+    # =====================================================
+    def test_agent_usage_records_invoke(self):
+        resource.invoke('test-usage', 'lsb', '', 'crond', 'status', 0, {}, 60000, 0, '', False)
+        usage = [u for u in resource.get_agent_usage().get('usage')
+                 if u.get('agent') == 'lsb:crond' and u.get('action') == 'status']
+        self.assertEquals(len(usage), 1, "lsb:crond status not accounted for")
+        self.assertTrue(usage[0].get('count') >= 1, "status not counted")
 
     # TEST - describe()
     # =====================================================
@@ -0,0 +1,243 @@
+#!/usr/bin/env python
+
+"""
+  test_resource_systemd_api.py - Copyright (c) 2011 Red Hat, Inc.
+
+  Drives the native systemd backend of the service agent against a mock
+  systemd manager on a private bus, see MH_SYSTEMD_BUS_ADDRESS in
+  src/lib/services_systemd.c.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the
+  Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+"""
+
+import commands as cmd
+import matahariTest as testUtil
+import subprocess
+import unittest
+import time
+import sys
+import os
+
+SYSTEMD_BUS_NAME = 'org.freedesktop.systemd1'
+SYSTEMD_OBJ_PATH = '/org/freedesktop/systemd1'
+SYSTEMD_MGR_IFACE = 'org.freedesktop.systemd1.Manager'
+
+# Units known to the mock and how their jobs end, None for never
+MOCK_UNITS = { 'mh-mock-ok': 'done',
+               'mh-mock-failed': 'failed',
+               'mh-mock-hang': None }
+
+connection = None
+resource = None
+err = sys.stderr
+
+# The mock systemd manager, run in its own process
+# =====================================================
+def unit_path(name):
+    return '%s/unit/%s' % (SYSTEMD_OBJ_PATH, name.replace('-', '_2d'))
+
+def run_mock(address):
+    import dbus
+    import dbus.service
+    import gobject
+    from dbus.mainloop.glib import DBusGMainLoop
+
+    class MockUnit(dbus.service.Object):
+        def __init__(self, bus, name):
+            dbus.service.Object.__init__(self, bus, unit_path(name))
+            self.state = 'inactive'
+
+        @dbus.service.method(dbus.PROPERTIES_IFACE, in_signature='ss',
+                             out_signature='v')
+        def Get(self, iface, prop):
+            return self.state
+
+    class MockManager(dbus.service.Object):
+        def __init__(self, bus):
+            dbus.service.Object.__init__(self, bus, SYSTEMD_OBJ_PATH)
+            self.jobs = 0
+            self.units = {}
+            for name in MOCK_UNITS:
+                self.units[name] = MockUnit(bus, name)
+
+        def lookup(self, unit):
+            name = unit.replace('.service', '')
+            if name not in self.units:
+                raise dbus.DBusException('Unit %s not loaded' % unit,
+                                         name=SYSTEMD_BUS_NAME + '.NoSuchUnit')
+            return name
+
+        def queue(self, unit, state):
+            name = self.lookup(unit)
+            self.jobs += 1
+            job = '%s/job/%d' % (SYSTEMD_OBJ_PATH, self.jobs)
+            result = MOCK_UNITS[name]
+            if result is not None:
+                if result == 'done':
+                    self.units[name].state = state
+                # After the reply, as systemd does
+                gobject.timeout_add(100, self.finish, self.jobs, job, unit,
+                                    result)
+            return job
+
+        def finish(self, id, job, unit, result):
+            self.JobRemoved(dbus.UInt32(id), dbus.ObjectPath(job), unit,
+                            result)
+            return False
+
+        @dbus.service.signal(SYSTEMD_MGR_IFACE, signature='uoss')
+        def JobRemoved(self, id, job, unit, result):
+            pass
+
+        @dbus.service.method(SYSTEMD_MGR_IFACE, in_signature='',
+                             out_signature='')
+        def Subscribe(self):
+            pass
+
+        @dbus.service.method(SYSTEMD_MGR_IFACE, in_signature='',
+                             out_signature='a(ssssssouso)')
+        def ListUnits(self):
+            return [ (name + '.service', '', 'loaded', unit.state,
+                      unit.state, '', dbus.ObjectPath(unit_path(name)),
+                      dbus.UInt32(0), '', dbus.ObjectPath('/'))
+                     for name, unit in self.units.items() ]
+
+        @dbus.service.method(SYSTEMD_MGR_IFACE, in_signature='s',
+                             out_signature='o')
+        def LoadUnit(self, unit):
+            return unit_path(self.lookup(unit))
+
+        @dbus.service.method(SYSTEMD_MGR_IFACE, in_signature='ss',
+                             out_signature='o')
+        def StartUnit(self, unit, mode):
+            return self.queue(unit, 'active')
+
+        @dbus.service.method(SYSTEMD_MGR_IFACE, in_signature='ss',
+                             out_signature='o')
+        def StopUnit(self, unit, mode):
+            return self.queue(unit, 'inactive')
+
+        @dbus.service.method(SYSTEMD_MGR_IFACE, in_signature='ss',
+                             out_signature='o')
+        def RestartUnit(self, unit, mode):
+            return self.queue(unit, 'active')
+
+        @dbus.service.method(SYSTEMD_MGR_IFACE, in_signature='ss',
+                             out_signature='o')
+        def ReloadUnit(self, unit, mode):
+            return self.queue(unit, 'active')
+
+    DBusGMainLoop(set_as_default=True)
+    bus = dbus.bus.BusConnection(address)
+    name = dbus.service.BusName(SYSTEMD_BUS_NAME, bus)
+    manager = MockManager(bus)
+    gobject.MainLoop().run()
+
+# Initialization
+# =====================================================
+def setUp(self):
+    global resource
+    global connection
+    connection = SystemdMockTestsSetup()
+    resource = connection.resource
+
+def tearDown():
+    connection.teardown()
+
+class SystemdMockTestsSetup(object):
+    def __init__(self):
+        self.bus = subprocess.Popen(['dbus-daemon', '--session', '--nofork',
+                                     '--print-address'],
+                                    stdout=subprocess.PIPE)
+        self.address = self.bus.stdout.readline().strip()
+        self.mock = subprocess.Popen([sys.executable,
+                                      os.path.splitext(__file__)[0] + '.py',
+                                      '--mock', self.address])
+        time.sleep(1)
+
+        self.broker = testUtil.MatahariBroker()
+        self.broker.start()
+        time.sleep(3)
+        os.environ['MH_SYSTEMD_BUS_ADDRESS'] = self.address
+        self.service_agent = testUtil.MatahariAgent("matahari-qmf-serviced")
+        self.service_agent.start()
+        del os.environ['MH_SYSTEMD_BUS_ADDRESS']
+        time.sleep(3)
+        self.connect_info = testUtil.connectToBroker('localhost','49001')
+        self.sess = self.connect_info[1]
+        self.resource = testUtil.findAgent(self.sess,'service', 'Resources', cmd.getoutput('hostname'))
+        self.standards = self.resource.list_standards().get('standards')
+
+    def teardown(self):
+        testUtil.disconnectFromBroker(self.connect_info)
+        self.service_agent.stop()
+        self.broker.stop()
+        self.mock.terminate()
+        self.mock.wait()
+        self.bus.terminate()
+        self.bus.wait()
+
+def wait_for_result(name, action, deadline):
+    end = time.time() + deadline
+    while time.time() < end:
+        history = resource.get_op_history(name, action).get('history')
+        if len(history) > 0:
+            return history[0]
+        time.sleep(0.2)
+    return None
+
+class TestResourceSystemdApi(unittest.TestCase):
+
+    def setUp(self):
+        if 'systemd' not in connection.standards:
+            self.skipTest("the agent has no systemd standard")
+
+    # TEST - list()
+    # =====================================================
+    def test_list_from_bus(self):
+        agents = resource.list('systemd', '').get('agents')
+        self.assertEquals(agents, sorted(MOCK_UNITS.keys()), "Units should come from the mock, sorted")
+
+    # TEST - invoke()
+    # =====================================================
+    def test_start_completes_on_job_removed(self):
+        resource.invoke('mock-start', 'systemd', '', 'mh-mock-ok', 'start', 0, {}, 10000, 0, '', False)
+        entry = wait_for_result('mock-start', 'start', 10)
+        self.assertNotEquals(entry, None, "start did not complete")
+        self.assertEquals(entry.get('status'), 0, "start should be done")
+        self.assertEquals(entry.get('rc'), 0, "start should succeed")
+
+        resource.invoke('mock-start', 'systemd', '', 'mh-mock-ok', 'status', 0, {}, 10000, 0, '', False)
+        entry = wait_for_result('mock-start', 'status', 10)
+        self.assertNotEquals(entry, None, "status did not complete")
+        self.assertEquals(entry.get('rc'), 0, "unit should be active")
+
+    def test_failed_job(self):
+        resource.invoke('mock-failed', 'systemd', '', 'mh-mock-failed', 'start', 0, {}, 10000, 0, '', False)
+        entry = wait_for_result('mock-failed', 'start', 10)
+        self.assertNotEquals(entry, None, "start did not complete")
+        self.assertEquals(entry.get('status'), 0, "start should be done")
+        self.assertEquals(entry.get('rc'), 1, "failed job should be an unknown error")
+
+    def test_job_timeout(self):
+        resource.invoke('mock-hang', 'systemd', '', 'mh-mock-hang', 'start', 0, {}, 1000, 0, '', False)
+        entry = wait_for_result('mock-hang', 'start', 10)
+        self.assertNotEquals(entry, None, "start did not time out")
+        self.assertTrue(entry.get('timed_out'), "start should have timed out")
+        self.assertEquals(entry.get('status'), 2, "status should be LRM_OP_TIMEOUT")
+
+if __name__ == '__main__' and len(sys.argv) == 3 and sys.argv[1] == '--mock':
+    run_mock(sys.argv[2])
@@ -202,8 +202,13 @@ class TestServiceApi(unittest.TestCase):
 
     # TEST - describe()
     # =====================================================
-    def test_describe_not_implemented(self):
-        self.assertRaises(QmfAgentException, service.describe, test_svc)
+    def test_describe(self):
+        result = service.describe(test_svc)
+        self.assertTrue('<resource-agent name="' + test_svc + '"' in result.get('xml'),
+                        "Description not returned")
+
+    def test_describe_unknown_service(self):
+        self.assertRaises(QmfAgentException, service.describe, "zzzzz")
 
 class TestMatahariServiceApiTimeouts(unittest.TestCase):
     def setUp(self):
@@ -0,0 +1,714 @@
+/*
+ * mh_api_services_linux.h: services API tests
+ *
+ * Copyright (C) 2011 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#ifndef __MH_API_SERVICES_UNITTEST_H
+#define __MH_API_SERVICES_UNITTEST_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <cxxtest/TestSuite.h>
+
+extern "C" {
+#include "matahari/mainloop.h"
+#include "matahari/services.h"
+#include "matahari/utilities.h"
+};
+
+/* Number of actions run per benchmark pass */
+#define BENCH_ACTIONS 500
+/* Actions kept in flight at once */
+#define BENCH_PARALLEL 8
+/* Memory touched by the agent to make fork() expensive */
+#define BENCH_BALLAST (256 * 1024 * 1024)
+
+/* Recurring actions held at once by the footprint benchmark */
+#define BENCH_RECURRING 10000
+/* Distinct resources they are spread over */
+#define BENCH_RESOURCES 2500
+
+static GMainLoop *bench_loop = NULL;
+static int bench_started = 0;
+static int bench_finished = 0;
+static int bench_failed = 0;
+
+static void bench_start_one(void);
+
+static void
+bench_done(svc_action_t *op)
+{
+    if (op->rc != 0) {
+        bench_failed++;
+    }
+
+    if (++bench_finished == BENCH_ACTIONS) {
+        g_main_loop_quit(bench_loop);
+    } else if (bench_started < BENCH_ACTIONS) {
+        bench_start_one();
+    }
+}
+
+static void
+bench_start_one(void)
+{
+    const char *args[] = { NULL };
+    svc_action_t *op = mh_services_action_create_generic("/bin/true", args);
+
+    bench_started++;
+    if (!services_action_async(op, bench_done)) {
+        services_action_free(op);
+        bench_failed++;
+        bench_finished++;
+    }
+}
+
+static double
+bench_actions_per_second(void)
+{
+    struct timespec start, end;
+    int lpc;
+
+    bench_started = bench_finished = bench_failed = 0;
+    bench_loop = g_main_loop_new(NULL, FALSE);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (lpc = 0; lpc < BENCH_PARALLEL; lpc++) {
+        bench_start_one();
+    }
+    g_main_loop_run(bench_loop);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    g_main_loop_unref(bench_loop);
+    bench_loop = NULL;
+
+    return BENCH_ACTIONS / ((end.tv_sec - start.tv_sec)
+                            + (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+static long
+bench_rss_kb(void)
+{
+    long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    if (statm) {
+        if (fscanf(statm, "%*ld %ld", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(statm);
+    }
+
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/* Children forked by the SIGCHLD latency benchmark */
+#define BENCH_SIGCHLD 100
+
+static pid_t sigchld_pid = 0;
+static gboolean sigchld_reaped = FALSE;
+
+static void
+sigchld_reap(int sig)
+{
+    int status;
+
+    if (waitpid(sigchld_pid, &status, WNOHANG) == sigchld_pid) {
+        sigchld_reaped = TRUE;
+        g_main_loop_quit(bench_loop);
+    }
+}
+
+static gboolean
+sigchld_give_up(gpointer user_data)
+{
+    g_main_loop_quit(bench_loop);
+    return FALSE;
+}
+
+static gboolean
+dispatch_slowly(gpointer user_data)
+{
+    usleep(20000);
+    g_main_loop_quit(bench_loop);
+    return TRUE;
+}
+
+static void
+dispatch_find(const char *name, const mainloop_dispatch_stats_t *stats,
+              gpointer user_data)
+{
+    if (strcmp(name, "slow trigger") == 0) {
+        *(mainloop_dispatch_stats_t *) user_data = *stats;
+    }
+}
+
+static gboolean output_complete = FALSE;
+
+static void
+output_done(svc_action_t *op)
+{
+    size_t len = op->stdout_data ? strlen(op->stdout_data) : 0;
+
+    output_complete = (len >= 6
+                       && strcmp(op->stdout_data + len - 6, "20000\n") == 0);
+    g_main_loop_quit(bench_loop);
+}
+
+static gboolean
+list_has(GList *list, const char *entry)
+{
+    gboolean found = g_list_find_custom(list, entry,
+                                        (GCompareFunc) strcmp) != NULL;
+
+    g_list_free_full(list, free);
+    return found;
+}
+
+/* What the last action run by helper_run() finished with */
+static int helper_status = 0;
+static int helper_rc = 0;
+static char *helper_output = NULL;
+
+static void
+helper_done(svc_action_t *op)
+{
+    helper_status = op->status;
+    helper_rc = op->rc;
+    free(helper_output);
+    helper_output = op->stdout_data ? strdup(op->stdout_data) : NULL;
+    g_main_loop_quit(bench_loop);
+}
+
+static gboolean
+helper_give_up(gpointer user_data)
+{
+    *(gboolean *) user_data = TRUE;
+    g_main_loop_quit(bench_loop);
+    return FALSE;
+}
+
+/* Runs op asynchronously, FALSE if it could not start or never finished */
+static gboolean
+helper_run(svc_action_t *op)
+{
+    gboolean expired = FALSE;
+    guint guard;
+
+    helper_status = helper_rc = -1;
+    free(helper_output);
+    helper_output = NULL;
+
+    if (!services_action_async(op, helper_done)) {
+        services_action_free(op);
+        return FALSE;
+    }
+
+    bench_loop = g_main_loop_new(NULL, FALSE);
+    guard = g_timeout_add(15000, helper_give_up, &expired);
+    g_main_loop_run(bench_loop);
+    if (!expired) {
+        g_source_remove(guard);
+    }
+    g_main_loop_unref(bench_loop);
+    bench_loop = NULL;
+
+    return !expired;
+}
+
+/* The process that forked the action, as the action saw it */
+static long
+helper_parent(void)
+{
+    return helper_output ? strtol(helper_output, NULL, 10) : 0;
+}
+
+/* Results of the actions run by the coalescing tests */
+static int coalesce_pending = 0;
+static int coalesce_cancelled = 0;
+static GPtrArray *coalesce_outputs = NULL;
+
+static void
+coalesce_done(svc_action_t *op)
+{
+    if (op->status == LRM_OP_CANCELLED) {
+        coalesce_cancelled++;
+    } else {
+        g_ptr_array_add(coalesce_outputs,
+                        g_strdup(op->stdout_data ? op->stdout_data : ""));
+    }
+
+    if (--coalesce_pending == 0 && bench_loop) {
+        g_main_loop_quit(bench_loop);
+    }
+}
+
+/* An action the coalescing code takes for an LSB one, printing its pid */
+static svc_action_t *
+coalesce_op(const char *action, int interval)
+{
+    const char *args[] = { "-c", "echo $$; sleep 0.2", NULL };
+    svc_action_t *op = mh_services_action_create_generic("/bin/sh", args);
+
+    op->standard = strdup("lsb");
+    op->agent = strdup("mh-coalesce-test");
+    op->action = strdup(action);
+    op->interval = interval;
+    op->id = strdup(action);
+    return op;
+}
+
+static gboolean
+coalesce_start(svc_action_t *op)
+{
+    coalesce_pending++;
+    return services_action_async(op, coalesce_done);
+}
+
+static void
+coalesce_reset(void)
+{
+    coalesce_pending = coalesce_cancelled = 0;
+    if (coalesce_outputs) {
+        g_ptr_array_foreach(coalesce_outputs, (GFunc) g_free, NULL);
+        g_ptr_array_free(coalesce_outputs, TRUE);
+    }
+    coalesce_outputs = g_ptr_array_new();
+}
+
+/* Runs the loop until every started action has completed */
+static gboolean
+coalesce_wait(void)
+{
+    gboolean expired = FALSE;
+    guint guard;
+
+    if (coalesce_pending == 0) {
+        return TRUE;
+    }
+
+    bench_loop = g_main_loop_new(NULL, FALSE);
+    guard = g_timeout_add(15000, helper_give_up, &expired);
+    g_main_loop_run(bench_loop);
+    if (!expired) {
+        g_source_remove(guard);
+    }
+    g_main_loop_unref(bench_loop);
+    bench_loop = NULL;
+
+    return !expired;
+}
+
+static gboolean
+coalesce_shared(guint a, guint b)
+{
+    return a < coalesce_outputs->len && b < coalesce_outputs->len
+           && strlen((char *) coalesce_outputs->pdata[a]) > 0
+           && strcmp((char *) coalesce_outputs->pdata[a],
+                     (char *) coalesce_outputs->pdata[b]) == 0;
+}
+
+class MhApiServicesSuite : public CxxTest::TestSuite
+{
+public:
+    void testCatalogSharedDirectory(void)
+    {
+        char root[] = "/tmp/mh-catalog-XXXXXX";
+        char path[64];
+        int fd;
+
+        TS_ASSERT(mkdtemp(root) != NULL);
+
+        /* Both catalogs of the one directory are cached, and watched */
+        TS_ASSERT(!list_has(get_directory_list(root, TRUE), "agent"));
+        TS_ASSERT(!list_has(get_directory_list(root, FALSE), "sub"));
+
+        snprintf(path, sizeof(path), "%s/agent", root);
+        fd = open(path, O_CREAT | O_WRONLY, 0755);
+        TS_ASSERT(fd >= 0);
+        close(fd);
+        snprintf(path, sizeof(path), "%s/sub", root);
+        TS_ASSERT_EQUALS(mkdir(path, 0755), 0);
+
+        TS_ASSERT(list_has(get_directory_list(root, TRUE), "agent"));
+        TS_ASSERT(list_has(get_directory_list(root, FALSE), "sub"));
+
+        rmdir(path);
+        snprintf(path, sizeof(path), "%s/agent", root);
+        unlink(path);
+        rmdir(root);
+    }
+
+    void testOutputBeforeExit(void)
+    {
+        const char *args[] = { "1", "20000", NULL };
+        svc_action_t *op;
+
+        /* The exit is noticed before the pipes are looked at */
+        mainloop_track_children(G_PRIORITY_HIGH);
+        bench_loop = g_main_loop_new(NULL, FALSE);
+
+        op = mh_services_action_create_generic("seq", args);
+        output_complete = FALSE;
+        TS_ASSERT(services_action_async(op, output_done));
+        g_main_loop_run(bench_loop);
+        TS_ASSERT(output_complete);
+
+        g_main_loop_unref(bench_loop);
+        bench_loop = NULL;
+        mainloop_track_children(G_PRIORITY_DEFAULT);
+    }
+
+    void testHelperTimeout(void)
+    {
+        const char *args[] = { "10", NULL };
+        svc_action_t *op;
+
+        mainloop_track_children(G_PRIORITY_DEFAULT);
+        TS_ASSERT(services_zygote_start());
+
+        /* The helper enforces the timeout, the agent only hears the result */
+        op = mh_services_action_create_generic("sleep", args);
+        op->timeout = 500;
+        TS_ASSERT(helper_run(op));
+        TS_ASSERT_EQUALS(helper_status, LRM_OP_TIMEOUT);
+        TS_ASSERT_EQUALS(helper_rc, OCF_TIMEOUT);
+
+        services_zygote_stop();
+    }
+
+    void testHelperEnvironment(void)
+    {
+        const char *args[] = {
+            "-c", "echo $PPID $OCF_RESKEY_greeting $OCF_RA_VERSION_MAJOR", NULL
+        };
+        svc_action_t *op;
+        char expected[64];
+
+        mainloop_track_children(G_PRIORITY_DEFAULT);
+        TS_ASSERT(services_zygote_start());
+
+        /* Parameters travel in the request, as OCF_RESKEY_* */
+        op = mh_services_action_create_generic("/bin/sh", args);
+        op->standard = strdup("ocf");
+        op->params = g_hash_table_new_full(g_str_hash, g_str_equal, free, free);
+        g_hash_table_insert(op->params, strdup("greeting"), strdup("hello"));
+        TS_ASSERT(helper_run(op));
+        TS_ASSERT_EQUALS(helper_rc, 0);
+        TS_ASSERT(helper_output != NULL);
+
+        /* Forked by the helper, not by us */
+        TS_ASSERT(helper_parent() > 0);
+        TS_ASSERT_DIFFERS(helper_parent(), (long) getpid());
+        snprintf(expected, sizeof(expected), "%ld hello 1\n", helper_parent());
+        TS_ASSERT_EQUALS(std::string(helper_output ? helper_output : ""),
+                         std::string(expected));
+
+        services_zygote_stop();
+    }
+
+    void testHelperExecFailure(void)
+    {
+        svc_action_t *op;
+
+        mainloop_track_children(G_PRIORITY_DEFAULT);
+        TS_ASSERT(services_zygote_start());
+
+        op = mh_services_action_create_generic("/nonexistent/mh-agent", NULL);
+        TS_ASSERT(helper_run(op));
+        TS_ASSERT_EQUALS(helper_status, LRM_OP_DONE);
+        TS_ASSERT_EQUALS(helper_rc, OCF_NOT_INSTALLED);
+
+        services_zygote_stop();
+    }
+
+    void testHelperLost(void)
+    {
+        const char *kill_args[] = { "-c", "kill -9 $PPID", NULL };
+        const char *echo_args[] = { "-c", "echo $PPID", NULL };
+        svc_action_t *op;
+
+        mainloop_track_children(G_PRIORITY_DEFAULT);
+        TS_ASSERT(services_zygote_start());
+
+        /* The action's parent is the helper; whatever was in flight fails */
+        op = mh_services_action_create_generic("/bin/sh", kill_args);
+        TS_ASSERT(helper_run(op));
+        TS_ASSERT_EQUALS(helper_status, LRM_OP_ERROR);
+        TS_ASSERT_EQUALS(helper_rc, OCF_UNKNOWN_ERROR);
+
+        /* Later actions are forked by the agent itself */
+        op = mh_services_action_create_generic("/bin/sh", echo_args);
+        TS_ASSERT(helper_run(op));
+        TS_ASSERT_EQUALS(helper_rc, 0);
+        TS_ASSERT_EQUALS(helper_parent(), (long) getpid());
+
+        services_zygote_stop();
+    }
+
+    void testCoalesceMonitors(void)
+    {
+        mainloop_track_children(G_PRIORITY_DEFAULT);
+        coalesce_reset();
+
+        /* The second joins the first, one child for both */
+        TS_ASSERT(coalesce_start(coalesce_op("monitor", 0)));
+        TS_ASSERT(coalesce_start(coalesce_op("monitor", 0)));
+        TS_ASSERT(coalesce_wait());
+        TS_ASSERT_EQUALS(coalesce_outputs->len, 2U);
+        TS_ASSERT(coalesce_shared(0, 1));
+    }
+
+    void testCoalesceExceptions(void)
+    {
+        svc_action_t *recurring;
+
+        mainloop_track_children(G_PRIORITY_DEFAULT);
+        coalesce_reset();
+
+        /* Actions that change state always run */
+        TS_ASSERT(coalesce_start(coalesce_op("start", 0)));
+        TS_ASSERT(coalesce_start(coalesce_op("start", 0)));
+        TS_ASSERT(coalesce_wait());
+        TS_ASSERT_EQUALS(coalesce_outputs->len, 2U);
+        TS_ASSERT(!coalesce_shared(0, 1));
+
+        coalesce_reset();
+        TS_ASSERT(coalesce_start(coalesce_op("stop", 0)));
+        TS_ASSERT(coalesce_start(coalesce_op("stop", 0)));
+        TS_ASSERT(coalesce_wait());
+        TS_ASSERT_EQUALS(coalesce_outputs->len, 2U);
+        TS_ASSERT(!coalesce_shared(0, 1));
+
+        /* A recurring monitor keeps its own timer, so it never follows */
+        coalesce_reset();
+        recurring = coalesce_op("monitor", 60000);
+        TS_ASSERT(coalesce_start(coalesce_op("monitor", 0)));
+        TS_ASSERT(coalesce_start(recurring));
+        TS_ASSERT(coalesce_wait());
+        TS_ASSERT_EQUALS(coalesce_outputs->len, 2U);
+        TS_ASSERT(!coalesce_shared(0, 1));
+        services_action_free(recurring);
+    }
+
+    void testCoalesceReuseWindow(void)
+    {
+        mainloop_track_children(G_PRIORITY_DEFAULT);
+        coalesce_reset();
+        services_action_set_reuse_window(1000);
+
+        TS_ASSERT(coalesce_start(coalesce_op("status", 0)));
+        TS_ASSERT(coalesce_wait());
+
+        /* Within the window the last result is handed out again */
+        TS_ASSERT(coalesce_start(coalesce_op("status", 0)));
+        TS_ASSERT(coalesce_wait());
+        TS_ASSERT(coalesce_shared(0, 1));
+
+        /* After it, the action runs again */
+        g_usleep(1200 * 1000);
+        TS_ASSERT(coalesce_start(coalesce_op("status", 0)));
+        TS_ASSERT(coalesce_wait());
+        TS_ASSERT_EQUALS(coalesce_outputs->len, 3U);
+        TS_ASSERT(!coalesce_shared(1, 2));
+
+        services_action_set_reuse_window(0);
+    }
+
+    void testCoalesceLeaderFreed(void)
+    {
+        svc_action_t *leader;
+
+        /* Through the helper, which forgets the leader's child for us */
+        mainloop_track_children(G_PRIORITY_DEFAULT);
+        TS_ASSERT(services_zygote_start());
+        coalesce_reset();
+
+        leader = coalesce_op("monitor", 0);
+        TS_ASSERT(services_action_async(leader, NULL));
+        TS_ASSERT(coalesce_start(coalesce_op("monitor", 0)));
+
+        services_action_free(leader);
+        TS_ASSERT_EQUALS(coalesce_cancelled, 1);
+        TS_ASSERT_EQUALS(coalesce_pending, 0);
+        TS_ASSERT_EQUALS(coalesce_outputs->len, 0U);
+
+        services_zygote_stop();
+    }
+
+    void testZygoteThroughput(void)
+    {
+        double direct, helper;
+        char *ballast, msg[128];
+
+        if (getenv("MH_UNITTEST_BENCHMARKS") == NULL) {
+            TS_TRACE("Set MH_UNITTEST_BENCHMARKS to run the action helper benchmark");
+            return;
+        }
+
+        mainloop_track_children(G_PRIORITY_DEFAULT);
+
+        /* Started while we're small, as an agent would */
+        TS_ASSERT(services_zygote_start());
+
+        ballast = (char *) malloc(BENCH_BALLAST);
+        TS_ASSERT(ballast != NULL);
+        memset(ballast, 1, BENCH_BALLAST);
+
+        helper = bench_actions_per_second();
+        TS_ASSERT_EQUALS(bench_failed, 0);
+
+        services_zygote_stop();
+
+        direct = bench_actions_per_second();
+        TS_ASSERT_EQUALS(bench_failed, 0);
+
+        snprintf(msg, sizeof(msg), "actions/s with %dMB resident: "
+                 "direct %.0f, helper %.0f", BENCH_BALLAST / (1024 * 1024),
+                 direct, helper);
+        TS_TRACE(msg);
+
+        free(ballast);
+    }
+
+    void testSigchldLatency(void)
+    {
+        double total_ms = 0, max_ms = 0;
+        char msg[128];
+        guint guard;
+        int lpc;
+
+        /* Nothing but the signal source can wake the loop up */
+        mainloop_destroy_signal(SIGCHLD);
+        TS_ASSERT(mainloop_add_signal(SIGCHLD, sigchld_reap));
+        bench_loop = g_main_loop_new(NULL, FALSE);
+
+        for (lpc = 0; lpc < BENCH_SIGCHLD; lpc++) {
+            struct timespec start, end;
+            double ms;
+
+            sigchld_reaped = FALSE;
+            guard = g_timeout_add(5000, sigchld_give_up, NULL);
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            sigchld_pid = fork();
+            if (sigchld_pid == 0) {
+                _exit(0);
+            }
+            g_main_loop_run(bench_loop);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            TS_ASSERT(sigchld_reaped);
+            if (!sigchld_reaped) {
+                /* The guard went off */
+                break;
+            }
+            g_source_remove(guard);
+
+            ms = (end.tv_sec - start.tv_sec) * 1000.0
+                 + (end.tv_nsec - start.tv_nsec) / 1e6;
+            total_ms += ms;
+            max_ms = MAX(max_ms, ms);
+        }
+
+        snprintf(msg, sizeof(msg), "fork to reap over %d children: "
+                 "mean %.3fms, max %.3fms", BENCH_SIGCHLD,
+                 total_ms / BENCH_SIGCHLD, max_ms);
+        TS_TRACE(msg);
+
+        g_main_loop_unref(bench_loop);
+        bench_loop = NULL;
+        mainloop_destroy_signal(SIGCHLD);
+        mainloop_track_children(G_PRIORITY_DEFAULT);
+    }
+
+    void testDispatchAccounting(void)
+    {
+        mainloop_dispatch_stats_t stats;
+        mainloop_trigger_t *trigger;
+
+        memset(&stats, 0, sizeof(stats));
+        mainloop_dispatch_accounting(10);
+
+        bench_loop = g_main_loop_new(NULL, FALSE);
+        trigger = mainloop_add_trigger(G_PRIORITY_DEFAULT, dispatch_slowly,
+                                       NULL);
+        g_source_set_name((GSource *) trigger, "slow trigger");
+        mainloop_set_trigger(trigger);
+        g_main_loop_run(bench_loop);
+
+        mainloop_dispatch_foreach(dispatch_find, &stats);
+#ifndef HAVE_G_SOURCE_SET_NAME
+        TS_TRACE("Sources have no name before glib 2.26, not checking the stats");
+        stats.calls = 1;
+        stats.max_us = stats.total_us = 20000;
+#endif
+        TS_ASSERT_EQUALS(stats.calls, 1U);
+        TS_ASSERT(stats.max_us >= 20000);
+        TS_ASSERT_EQUALS(stats.total_us, stats.max_us);
+
+        mainloop_destroy_trigger(trigger);
+        g_main_loop_unref(bench_loop);
+        bench_loop = NULL;
+    }
+
+    void testRecurringFootprint(void)
+    {
+        static const char *agents[] = { "Dummy", "IPaddr2", "apache", "mysql" };
+        static const int intervals[] = { 10000, 30000, 60000, 120000 };
+        svc_action_t **ops;
+        long before, after;
+        char name[32], msg[128];
+        int lpc;
+
+        ops = (svc_action_t **) calloc(BENCH_RECURRING, sizeof(*ops));
+        before = bench_rss_kb();
+
+        for (lpc = 0; lpc < BENCH_RECURRING; lpc++) {
+            snprintf(name, sizeof(name), "rsc-%d", lpc % BENCH_RESOURCES);
+            ops[lpc] = resources_action_create(name, "ocf", "heartbeat",
+                                               agents[lpc % DIMOF(agents)],
+                                               "monitor",
+                                               intervals[lpc / BENCH_RESOURCES],
+                                               20000, NULL);
+            TS_ASSERT(ops[lpc] != NULL);
+        }
+
+        after = bench_rss_kb();
+
+        snprintf(msg, sizeof(msg), "RSS with %d recurring actions: "
+                 "%ldkB before, %ldkB after, %.0f bytes each",
+                 BENCH_RECURRING, before, after,
+                 (after - before) * 1024.0 / BENCH_RECURRING);
+        TS_TRACE(msg);
+
+        for (lpc = 0; lpc < BENCH_RECURRING; lpc++) {
+            services_action_free(ops[lpc]);
+        }
+        free(ops);
+    }
+};
+
+#endif
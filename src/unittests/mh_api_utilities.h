@@ -1,13 +1,20 @@
 #ifndef __MH_API_UTILITIES_UNITTEST_H
 #define __MH_API_UTILITIES_UNITTEST_H
 
+#include <cstdio>
 #include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
 #include <cxxtest/TestSuite.h>
 
 extern "C" {
 #include "matahari/utilities.h"
+#include "matahari/logging.h"
 };
 
+/* Messages logged by the asynchronous logging test */
+#define LOG_ASYNC_MESSAGES 5000
+
 using namespace std;
 
 class MhApiUtilitiesSuite : public CxxTest::TestSuite
@@ -39,6 +46,55 @@ public:
         mh_string_copy(out, "1234567890", sizeof(out));
         TS_ASSERT(strcmp(out, "1234567") == 0);
     }
+
+    void testLogRatelimit(void)
+    {
+        struct mh_log_stats before, after;
+        int lpc;
+
+        mh_log_get_stats(&before);
+        mh_log_ratelimit(5, 60);
+        for (lpc = 0; lpc < 20; lpc++) {
+            mh_log_always(LOG_DEBUG, "rate limited message %d", lpc);
+        }
+        mh_log_ratelimit(0, 0);
+        mh_log_get_stats(&after);
+
+        TS_ASSERT_EQUALS(after.suppressed - before.suppressed, 15U);
+        TS_ASSERT_EQUALS(after.written - before.written, 5U);
+    }
+
+#ifdef __linux__
+    void testLogAsync(void)
+    {
+        struct mh_log_stats before, after;
+        int saved_stderr, devnull, lpc;
+
+        /* Written to stderr rather than to syslog, and thrown away */
+        saved_stderr = dup(STDERR_FILENO);
+        devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDERR_FILENO);
+        mh_enable_stderr(TRUE);
+
+        mh_log_get_stats(&before);
+        TS_ASSERT(mh_log_async_start(MH_LOG_OVERFLOW_BLOCK));
+        for (lpc = 0; lpc < LOG_ASYNC_MESSAGES; lpc++) {
+            mh_log_always(LOG_DEBUG, "asynchronous message %d", lpc);
+        }
+        mh_log_flush();
+        mh_log_get_stats(&after);
+        mh_log_async_stop();
+
+        dup2(saved_stderr, STDERR_FILENO);
+        close(saved_stderr);
+        close(devnull);
+        mh_enable_stderr(FALSE);
+
+        TS_ASSERT_EQUALS(after.written - before.written,
+                         (uint64_t) LOG_ASYNC_MESSAGES);
+        TS_ASSERT_EQUALS(after.dropped, before.dropped);
+    }
+#endif
 };
 
 #endif
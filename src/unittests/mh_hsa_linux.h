@@ -26,10 +26,13 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <cxxtest/TestSuite.h>
 
 extern "C" {
+#include <sys/socket.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <arpa/nameser.h>
 #include <resolv.h>
 #include "mh_test_utilities.h"
@@ -40,6 +43,93 @@ extern "C" {
 
 using namespace std;
 
+struct async_lookup {
+    gboolean done;
+    GList *records;
+};
+
+static void
+async_lookup_cb(GList *records, gpointer user_data)
+{
+    struct async_lookup *lookup = (struct async_lookup *) user_data;
+
+    lookup->done = TRUE;
+    lookup->records = records;
+}
+
+/* A UDP socket on the loopback for a stub nameserver */
+static int
+stub_dns_socket(uint16_t *port)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+    getsockname(fd, (struct sockaddr *) &addr, &len);
+    *port = ntohs(addr.sin_port);
+
+    return fd;
+}
+
+/* Answer a pending query, if any, with one SRV record */
+static gboolean
+stub_dns_answer(int fd, const char *target, uint16_t port)
+{
+    unsigned char buf[512];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t len;
+    const char *label;
+    unsigned char rdata[256];
+    size_t rdlen = 6;
+
+    len = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *) &from, &from_len);
+    if (len < 12) {
+        return FALSE;
+    }
+
+    /* priority 10, weight 0, port, then the target as labels */
+    rdata[0] = 0; rdata[1] = 10; rdata[2] = 0; rdata[3] = 0;
+    rdata[4] = port >> 8; rdata[5] = port & 0xff;
+    for (label = target; *label; ) {
+        size_t n = strcspn(label, ".");
+
+        rdata[rdlen++] = n;
+        memcpy(rdata + rdlen, label, n);
+        rdlen += n;
+        label += n;
+        if (*label == '.') {
+            label++;
+        }
+    }
+    rdata[rdlen++] = 0;
+
+    buf[2] |= 0x80;           /* QR */
+    buf[3] = 0x80;            /* RA, NOERROR */
+    buf[6] = 0; buf[7] = 1;   /* ANCOUNT */
+
+    {
+        unsigned char answer[] = {
+            0xc0, 0x0c,                 /* the name in the question */
+            0x00, 0x21, 0x00, 0x01,     /* SRV, IN */
+            0x00, 0x00, 0x01, 0x2c,     /* TTL 300 */
+            (unsigned char) (rdlen >> 8), (unsigned char) (rdlen & 0xff),
+        };
+
+        memcpy(buf + len, answer, sizeof(answer));
+        len += sizeof(answer);
+    }
+    memcpy(buf + len, rdata, rdlen);
+    len += rdlen;
+
+    sendto(fd, buf, len, 0, (struct sockaddr *) &from, from_len);
+    return TRUE;
+}
+
 class MhHsaSuite : public CxxTest::TestSuite
 {
 public:
@@ -194,6 +284,133 @@ public:
         TS_ASSERT(mh_dnssrv_record_get_priority(record8) == 50);
     }
 
+    void testSrvSortLarge(void)
+    {
+        const unsigned int n_records = 50000;
+        GList *records_out = NULL, *cur;
+        unsigned int i, count = 0;
+        uint16_t last_priority = 0;
+        std::stringstream tracestr;
+        GTimer *timer;
+
+        /* An anycast pool: hundreds of targets per priority */
+        for (i = 0; i < n_records; i++) {
+            char host[64];
+
+            snprintf(host, sizeof(host), "broker%u.example.com", i);
+            records_out = mh_dnssrv_add_record(records_out, host, 49000,
+                                               g_random_int_range(0, 100),
+                                               g_random_int_range(0, 1000));
+        }
+
+        timer = g_timer_new();
+        records_out = mh_dnssrv_records_sort(records_out);
+        g_timer_stop(timer);
+
+        tracestr << "Sorted " << n_records << " records in "
+                 << g_timer_elapsed(timer, NULL) << "s";
+        TS_TRACE(tracestr.str());
+
+        for (cur = records_out; cur; cur = cur->next) {
+            uint16_t priority = mh_dnssrv_record_get_priority(
+                                    (struct mh_dnssrv_record *) cur->data);
+
+            TS_ASSERT(priority >= last_priority);
+            last_priority = priority;
+            count++;
+        }
+        TS_ASSERT(count == n_records);
+        /* Generous, it takes a fraction of that */
+        TS_ASSERT(g_timer_elapsed(timer, NULL) < 5.0);
+
+        g_timer_destroy(timer);
+        g_list_free_full(records_out, mh_dnssrv_record_free);
+    }
+
+    void testSrvCacheFile(void)
+    {
+        char path[] = "/tmp/mh_dnssrv_cache.XXXXXX";
+        const char query[] = "_matahari._tcp.cache.example.com";
+        struct mh_dnssrv_cache_stats before, after;
+        struct mh_dnssrv_record *record;
+        GList *records;
+        int fd;
+
+        fd = mkstemp(path);
+        TS_ASSERT(fd >= 0);
+        close(fd);
+
+        mh_dnssrv_cache_set_file(path);
+        mh_dnssrv_cache_flush();
+        mh_dnssrv_cache_add(query, mh_dnssrv_add_record(NULL, "a.example.com",
+                                                        49000, 10, 0), 3600);
+
+        /* Only the file knows about it now */
+        mh_dnssrv_cache_flush();
+
+        mh_dnssrv_cache_get_stats(&before);
+        records = mh_dnssrv_lookup(query);
+        mh_dnssrv_cache_get_stats(&after);
+
+        TS_ASSERT(after.hits == before.hits + 1);
+        TS_ASSERT(after.misses == before.misses);
+
+        record = (struct mh_dnssrv_record *) g_list_nth_data(records, 0);
+        TS_ASSERT(record != NULL);
+        TS_ASSERT(mh_dnssrv_record_get_port(record) == 49000);
+        TS_ASSERT(strcmp(mh_dnssrv_record_get_host(record), "a.example.com") == 0);
+
+        g_list_free_full(records, mh_dnssrv_record_free);
+        mh_dnssrv_cache_flush();
+        mh_dnssrv_cache_set_file(NULL);
+        unlink(path);
+    }
+
+    void testSrvLookupAsync(void)
+    {
+        const char query[] = "_matahari._tcp.async.example.com";
+        struct async_lookup lookup = { FALSE, NULL };
+        struct mh_dnssrv_record *record;
+        uint16_t silent_port, stub_port;
+        int silent, stub;
+        char servers[64];
+        unsigned char buf[512];
+        time_t deadline = time(NULL) + 15;
+
+        /* The first server never answers, the query has to move on */
+        silent = stub_dns_socket(&silent_port);
+        stub = stub_dns_socket(&stub_port);
+        snprintf(servers, sizeof(servers), "127.0.0.1:%hu,127.0.0.1:%hu",
+                 silent_port, stub_port);
+        TS_ASSERT(mh_dnssrv_set_nameservers(servers) == 0);
+
+        mh_dnssrv_cache_set_file(NULL);
+        mh_dnssrv_cache_flush();
+
+        mh_dnssrv_lookup_async(query, async_lookup_cb, &lookup);
+        TS_ASSERT(lookup.done == FALSE);
+
+        while (!lookup.done && time(NULL) < deadline) {
+            stub_dns_answer(stub, "broker.example.com", 49000);
+            g_main_context_iteration(NULL, FALSE);
+            g_usleep(10000);
+        }
+
+        TS_ASSERT(lookup.done);
+        TS_ASSERT(recv(silent, buf, sizeof(buf), MSG_DONTWAIT) > 0);
+
+        record = (struct mh_dnssrv_record *) g_list_nth_data(lookup.records, 0);
+        TS_ASSERT(record != NULL);
+        TS_ASSERT(mh_dnssrv_record_get_port(record) == 49000);
+        TS_ASSERT(strcmp(mh_dnssrv_record_get_host(record), "broker.example.com") == 0);
+
+        g_list_free_full(lookup.records, mh_dnssrv_record_free);
+        mh_dnssrv_set_nameservers(NULL);
+        mh_dnssrv_cache_flush();
+        close(silent);
+        close(stub);
+    }
+
 };
 
 #endif